@@ -60,6 +60,16 @@
 #define FA_MODIFIED	0x40	/* File has been modified */
 #define FA_DIRTY	0x80	/* FIL.buf[] needs to be written-back */
 
+/* Does the file object have a private data window? */
+#if !FF_FS_TINY
+#define FILEBUF(fp)	1
+#elif FF_FS_FILEBUFS
+#define FILEBUF(fp)	((fp)->buf != 0)
+#else
+#define FILEBUF(fp)	0
+#endif
+#define FF_FILEBUF	(!FF_FS_TINY || FF_FS_FILEBUFS)	/* FIL.buf exists */
+
 
 /* Additional file attribute bits for internal use */
 #define AM_VOL		0x08	/* Volume label */
@@ -1069,6 +1079,56 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 
+#if FF_FS_TINY && FF_FS_FILEBUFS
+/*-----------------------------------------------------------------------*/
+/* Pooled private data windows of the files (tiny configuration)         */
+/*-----------------------------------------------------------------------*/
+/* Files with partial sector accesses evict each other's data from fs->win
+/  and read it again. A file gets a window from the pool at its first
+/  partial sector access instead, until then and when the pool is empty it
+/  uses fs->win like before. */
+
+static BYTE FileBuf[FF_FS_FILEBUFS][FF_MAX_SS];
+static FIL* FileBufOwner[FF_FS_FILEBUFS];
+
+static void filebuf_put (
+	FIL* fp			/* File object returning its window */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_FILEBUFS; i++) {
+		if (FileBufOwner[i] == fp) FileBufOwner[i] = 0;
+	}
+	fp->buf = 0;
+}
+
+
+static FRESULT filebuf_get (	/* Returns FR_OK or FR_DISK_ERR, fp->buf is 0 if the pool is empty */
+	FIL* fp,		/* File object */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < FF_FS_FILEBUFS && FileBufOwner[i]; i++) ;
+	if (i == FF_FS_FILEBUFS) return FR_OK;
+#if !FF_FS_READONLY
+	if (sync_window(fs) != FR_OK) return FR_DISK_ERR;	/* File data in fs->win goes to the disk */
+#endif
+	if (fs->winsect >= fs->database) fs->winsect = (LBA_t)0 - 1;	/* and must not be found there later */
+	FileBufOwner[i] = fp;
+	fp->buf = FileBuf[i];
+	fp->flag &= (BYTE)~FA_DIRTY;
+	fp->sect = 0;	/* Nothing in the window yet */
+	return FR_OK;
+}
+#endif
+
+
+
 
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
@@ -3375,6 +3435,9 @@ static FRESULT mount_volume (	/* FR_OK(0): successful, !=0: an error occurred */
 
 	fs->fs_type = 0;					/* Clear the filesystem object */
 	fs->pdrv = LD2PD(vol);				/* Volume hosting physical drive */
+#if FF_FS_TINY && FF_FS_FILEBUFS
+	memset(FileBufOwner, 0, sizeof FileBufOwner);	/* Files of the old volume are invalid */
+#endif
 	stat = disk_initialize(fs->pdrv);	/* Initialize the physical drive */
 	if (stat & STA_NOINIT) { 			/* Check if the initialization succeeded */
 		return FR_NOT_READY;			/* Failed to initialize due to no medium or hard error */
@@ -3670,6 +3733,9 @@ FRESULT f_open (
 
 
 	if (!fp) return FR_INVALID_OBJECT;
+#if FF_FS_TINY && FF_FS_FILEBUFS
+	filebuf_put(fp);	/* In case it was not closed */
+#endif
 
 	/* Get logical drive number */
 	mode &= FF_FS_READONLY ? FA_READ : FA_READ | FA_WRITE | FA_CREATE_ALWAYS | FA_CREATE_NEW | FA_OPEN_ALWAYS | FA_OPEN_APPEND;
@@ -3902,25 +3968,39 @@ FRESULT f_read (
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
+#if FF_FILEBUF
+				if (FILEBUF(fp)) {
+					if ((fp->flag & FA_DIRTY) && fp->sect - sect < cc) {
 #if FF_FS_TINY
-				if (fs->wflag && fs->winsect - sect < cc) {
-					if (!rbuff) {
-						iprintf("Oops! Accessing the read buffer in direct transfer mode.\n");
-						FatalError(10);
-					}
-					memcpy(rbuff + ((fs->winsect - sect) * SS(fs)), fs->win, SS(fs));
-				}
-#else
-				if ((fp->flag & FA_DIRTY) && fp->sect - sect < cc) {
-					memcpy(rbuff + ((fp->sect - sect) * SS(fs)), fp->buf, SS(fs));
-				}
+						if (!rbuff) {
+							iprintf("Oops! Accessing the read buffer in direct transfer mode.\n");
+							FatalError(10);
+						}
 #endif
+						memcpy(rbuff + ((fp->sect - sect) * SS(fs)), fp->buf, SS(fs));
+					}
+				} else
+#endif
+				{
+#if FF_FS_TINY
+					if (fs->wflag && fs->winsect - sect < cc) {
+						if (!rbuff) {
+							iprintf("Oops! Accessing the read buffer in direct transfer mode.\n");
+							FatalError(10);
+						}
+						memcpy(rbuff + ((fs->winsect - sect) * SS(fs)), fs->win, SS(fs));
+					}
+#endif
+				}
 #endif
 				rcnt = SS(fs) * cc;				/* Number of bytes transferred */
 				continue;
 			}
-#if !FF_FS_TINY
-			if (fp->sect != sect) {			/* Load data sector if not in cache */
+#if FF_FS_TINY && FF_FS_FILEBUFS
+			if (!fp->buf && filebuf_get(fp, fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Partial sector read needs a window */
+#endif
+#if FF_FILEBUF
+			if (FILEBUF(fp) && fp->sect != sect) {	/* Load data sector if not in cache */
 #if !FF_FS_READONLY
 				if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
 					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
@@ -3934,12 +4014,17 @@ FRESULT f_read (
 		}
 		rcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (rcnt > btr) rcnt = btr;					/* Clip it by btr if needed */
+#if FF_FILEBUF
+		if (FILEBUF(fp)) {
+			memcpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
+		} else
+#endif
+		{
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
-		memcpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
-#else
-		memcpy(rbuff, fp->buf + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
+			if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+			memcpy(rbuff, fs->win + fp->fptr % SS(fs), rcnt);	/* Extract partial sector */
 #endif
+		}
 	}
 
 	LEAVE_FF(fs, FR_OK);
@@ -4003,14 +4088,19 @@ FRESULT f_write (
 				fp->clust = clst;			/* Update current cluster */
 				if (fp->obj.sclust == 0) fp->obj.sclust = clst;	/* Set start cluster if the first write */
 			}
+#if FF_FILEBUF
+			if (FILEBUF(fp)) {
+				if (fp->flag & FA_DIRTY) {		/* Write-back sector cache */
+					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+					fp->flag &= (BYTE)~FA_DIRTY;
+				}
+			} else
+#endif
+			{
 #if FF_FS_TINY
-			if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
-#else
-			if (fp->flag & FA_DIRTY) {		/* Write-back sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
-			}
+				if (fs->winsect == fp->sect && sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Write-back sector cache */
 #endif
+			}
 			sect = clst2sect(fs, fp->clust);	/* Get current sector */
 			if (sect == 0) ABORT(fs, FR_INT_ERR);
 			sect += csect;
@@ -4026,8 +4116,9 @@ FRESULT f_write (
 					memcpy(fs->win, wbuff + ((fs->winsect - sect) * SS(fs)), SS(fs));
 					fs->wflag = 0;
 				}
-#else
-				if (fp->sect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
+#endif
+#if FF_FILEBUF
+				if (FILEBUF(fp) && fp->sect - sect < cc) { /* Refill sector cache if it gets invalidated by the direct write */
 					memcpy(fp->buf, wbuff + ((fp->sect - sect) * SS(fs)), SS(fs));
 					fp->flag &= (BYTE)~FA_DIRTY;
 				}
@@ -4036,30 +4127,43 @@ FRESULT f_write (
 				wcnt = SS(fs) * cc;		/* Number of bytes transferred */
 				continue;
 			}
+#if FF_FS_TINY && FF_FS_FILEBUFS
+			if (!fp->buf && filebuf_get(fp, fs) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Partial sector write needs a window */
+#endif
+#if FF_FILEBUF
+			if (FILEBUF(fp)) {
+				if (fp->sect != sect && 		/* Fill sector cache with file data */
+					fp->fptr < fp->obj.objsize &&
+					disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) {
+						ABORT(fs, FR_DISK_ERR);
+				}
+			} else
+#endif
+			{
 #if FF_FS_TINY
-			if (fp->fptr >= fp->obj.objsize) {	/* Avoid silly cache filling on the growing edge */
-				if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
-				fs->winsect = sect;
-			}
-#else
-			if (fp->sect != sect && 		/* Fill sector cache with file data */
-				fp->fptr < fp->obj.objsize &&
-				disk_read(fs->pdrv, fp->buf, sect, 1) != RES_OK) {
-					ABORT(fs, FR_DISK_ERR);
-			}
+				if (fp->fptr >= fp->obj.objsize) {	/* Avoid silly cache filling on the growing edge */
+					if (sync_window(fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+					fs->winsect = sect;
+				}
 #endif
+			}
 			fp->sect = sect;
 		}
 		wcnt = SS(fs) - (UINT)fp->fptr % SS(fs);	/* Number of bytes remains in the sector */
 		if (wcnt > btw) wcnt = btw;					/* Clip it by btw if needed */
+#if FF_FILEBUF
+		if (FILEBUF(fp)) {
+			memcpy(fp->buf + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
+			fp->flag |= FA_DIRTY;
+		} else
+#endif
+		{
 #if FF_FS_TINY
-		if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
-		memcpy(fs->win + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
-		fs->wflag = 1;
-#else
-		memcpy(fp->buf + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
-		fp->flag |= FA_DIRTY;
+			if (move_window(fs, fp->sect) != FR_OK) ABORT(fs, FR_DISK_ERR);	/* Move sector window */
+			memcpy(fs->win + fp->fptr % SS(fs), wbuff, wcnt);	/* Fit data to the sector */
+			fs->wflag = 1;
 #endif
+		}
 	}
 
 	fp->flag |= FA_MODIFIED;				/* Set file change flag */
@@ -4087,8 +4191,8 @@ FRESULT f_sync (
 	res = validate(&fp->obj, &fs);	/* Check validity of the file object */
 	if (res == FR_OK) {
 		if (fp->flag & FA_MODIFIED) {	/* Is there any change to the file? */
-#if !FF_FS_TINY
-			if (fp->flag & FA_DIRTY) {	/* Write-back cached data if needed */
+#if FF_FILEBUF
+			if (FILEBUF(fp) && (fp->flag & FA_DIRTY)) {	/* Write-back cached data if needed */
 				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) LEAVE_FF(fs, FR_DISK_ERR);
 				fp->flag &= (BYTE)~FA_DIRTY;
 			}
@@ -4175,6 +4279,9 @@ FRESULT f_close (
 #else
 			fp->obj.fs = 0;	/* Invalidate file object */
 #endif
+#if FF_FS_TINY && FF_FS_FILEBUFS
+			if (res == FR_OK) filebuf_put(fp);	/* Return the data window to the pool */
+#endif
 #if FF_FS_REENTRANT
 			unlock_fs(fs, FR_OK);		/* Unlock volume */
 #endif
@@ -4431,14 +4538,19 @@ FRESULT f_lseek (
 				if (dsc == 0) ABORT(fs, FR_INT_ERR);
 				dsc += (DWORD)((ofs - 1) / SS(fs)) & (fs->csize - 1);
 				if (fp->fptr % SS(fs) && dsc != fp->sect) {	/* Refill sector cache if needed */
-#if !FF_FS_TINY
+#if FF_FS_TINY && FF_FS_FILEBUFS
+					if (!fp->buf && filebuf_get(fp, fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+#endif
+#if FF_FILEBUF
+					if (FILEBUF(fp)) {
 #if !FF_FS_READONLY
-					if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
-						if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-						fp->flag &= (BYTE)~FA_DIRTY;
-					}
+						if (fp->flag & FA_DIRTY) {		/* Write-back dirty sector cache */
+							if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+							fp->flag &= (BYTE)~FA_DIRTY;
+						}
 #endif
-					if (disk_read(fs->pdrv, fp->buf, dsc, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Load current sector */
+						if (disk_read(fs->pdrv, fp->buf, dsc, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Load current sector */
+					}
 #endif
 					fp->sect = dsc;
 				}
@@ -4511,14 +4623,19 @@ FRESULT f_lseek (
 			fp->flag |= FA_MODIFIED;
 		}
 		if (fp->fptr % SS(fs) && nsect != fp->sect) {	/* Fill sector cache if needed */
-#if !FF_FS_TINY
+#if FF_FS_TINY && FF_FS_FILEBUFS
+			if (!fp->buf && filebuf_get(fp, fs) != FR_OK) ABORT(fs, FR_DISK_ERR);
+#endif
+#if FF_FILEBUF
+			if (FILEBUF(fp)) {
 #if !FF_FS_READONLY
-			if (fp->flag & FA_DIRTY) {			/* Write-back dirty sector cache */
-				if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
-				fp->flag &= (BYTE)~FA_DIRTY;
-			}
+				if (fp->flag & FA_DIRTY) {			/* Write-back dirty sector cache */
+					if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);
+					fp->flag &= (BYTE)~FA_DIRTY;
+				}
 #endif
-			if (disk_read(fs->pdrv, fp->buf, nsect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+				if (disk_read(fs->pdrv, fp->buf, nsect, 1) != RES_OK) ABORT(fs, FR_DISK_ERR);	/* Fill sector cache */
+			}
 #endif
 			fp->sect = nsect;
 		}
@@ -4873,8 +4990,8 @@ FRESULT f_truncate (
 		}
 		fp->obj.objsize = fp->fptr;	/* Set file size to current read/write point */
 		fp->flag |= FA_MODIFIED;
-#if !FF_FS_TINY
-		if (res == FR_OK && (fp->flag & FA_DIRTY)) {
+#if FF_FILEBUF
+		if (res == FR_OK && FILEBUF(fp) && (fp->flag & FA_DIRTY)) {
 			if (disk_write(fs->pdrv, fp->buf, fp->sect, 1) != RES_OK) {
 				res = FR_DISK_ERR;
 			} else {
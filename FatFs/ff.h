@@ -218,6 +218,8 @@ typedef struct {
 #endif
 #if !FF_FS_TINY
 	BYTE	buf[FF_MAX_SS];	/* File private data read/write window */
+#elif FF_FS_FILEBUFS
+	BYTE*	buf;			/* Pooled private data read/write window (0:fs->win is used) */
 #endif
 } FIL;
 
@@ -18,7 +18,11 @@
 /  and optional writing functions as well. */
 
 
+#ifdef HAVE_MSA
+#define FF_FS_MINIMIZE	0	/* f_truncate() for the MSA images */
+#else
 #define FF_FS_MINIMIZE	1
+#endif
 /* This option defines minimization level to remove some basic API functions.
 /
 /   0: Basic functions are fully enabled.
@@ -41,7 +45,7 @@
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -238,6 +242,15 @@
 /  buffer in the filesystem object (FATFS) is used for the file data transfer. */
 
 
+#ifndef FF_FS_FILEBUFS
+#define FF_FS_FILEBUFS	4
+#endif
+/* Number of private sector windows pooled for the files at the tiny configuration.
+/  A file gets one at its first partial sector access and keeps it until f_close(),
+/  the other files share the window in the filesystem object. (0:Disable)
+/  Not used at the normal configuration, every file has its own window there. */
+
+
 #define FF_FS_EXFAT		1
 /* This option switches support for exFAT filesystem. (0:Disable or 1:Enable)
 /  To enable exFAT, also LFN needs to be enabled. (FF_USE_LFN >= 1)
@@ -0,0 +1,196 @@
+// adz.c
+// ADZ floppy images (gzip compressed ADF) used without unpacking them.
+// There is room for neither the whole disk nor a decoder per drive, so
+// one deflate stream is shared by the drives and the decoded tracks go to
+// a small cache. Decoding can only go forward, a track before the current
+// stream position restarts at the closest dictionary snapshot, taken on
+// the way every ADZ_CHECKPOINT_TRACKS tracks while there are free ones.
+// Written tracks stay pinned in the cache as an overlay over the image
+// and are lost at eject, the compressed file itself is never rewritten.
+
+#include <string.h>
+#include "adz.h"
+#include "inflate.h"
+
+#define CHECKPOINT_SIZE ((uint32_t)ADZ_CHECKPOINT_TRACKS * ADZ_TRACK_SIZE)
+
+// gzip header flags
+#define GZ_FHCRC     0x02
+#define GZ_FEXTRA    0x04
+#define GZ_FNAME     0x08
+#define GZ_FCOMMENT  0x10
+
+// the shared decoder
+#define inf inflate_shared
+
+static struct {
+  adz_t        *owner;
+  unsigned char track;
+  unsigned char dirty;
+  uint32_t      used;
+  unsigned char data[ADZ_TRACK_SIZE];
+} cache[ADZ_CACHE_TRACKS];
+static uint32_t cache_stamp;
+
+static struct {
+  adz_t             *owner;
+  inflate_snapshot_t snap;
+} snapshots[ADZ_SNAPSHOTS];
+
+static unsigned int adz_read(void *ctx, uint32_t pos, uint8_t *buf, unsigned int len) {
+  FIL *file = ((adz_t*)ctx)->file;
+  UINT br;
+
+  if (f_tell(file) != pos && f_lseek(file, pos) != FR_OK) return 0;
+  if (f_read(file, buf, len, &br) != FR_OK) return 0;
+  return br;
+}
+
+// skips a zero terminated string of the header
+static FRESULT skip_string(FIL *file) {
+  unsigned char c;
+  UINT br;
+
+  do {
+    if (f_read(file, &c, 1, &br) != FR_OK || br != 1) return FR_INVALID_OBJECT;
+  } while (c);
+  return FR_OK;
+}
+
+FRESULT adz_open(adz_t *adz, FIL *file) {
+  unsigned char h[10];
+  UINT br;
+
+  adz->file = 0;
+  if (f_lseek(file, 0) != FR_OK || f_read(file, h, 10, &br) != FR_OK || br != 10)
+    return FR_INVALID_OBJECT;
+  // deflate method, no reserved flags
+  if (h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || (h[3] & 0xe0))
+    return FR_INVALID_OBJECT;
+
+  if (h[3] & GZ_FEXTRA) {
+    if (f_read(file, h, 2, &br) != FR_OK || br != 2) return FR_INVALID_OBJECT;
+    if (f_lseek(file, f_tell(file) + (h[0] | (h[1] << 8))) != FR_OK) return FR_INVALID_OBJECT;
+  }
+  if ((h[3] & GZ_FNAME) && skip_string(file) != FR_OK) return FR_INVALID_OBJECT;
+  if ((h[3] & GZ_FCOMMENT) && skip_string(file) != FR_OK) return FR_INVALID_OBJECT;
+  if ((h[3] & GZ_FHCRC) && f_lseek(file, f_tell(file) + 2) != FR_OK) return FR_INVALID_OBJECT;
+  adz->start = f_tell(file);
+
+  // the trailer has the uncompressed size
+  if (adz->start + 8 > f_size(file)) return FR_INVALID_OBJECT;
+  if (f_lseek(file, f_size(file) - 4) != FR_OK || f_read(file, h, 4, &br) != FR_OK || br != 4)
+    return FR_INVALID_OBJECT;
+  adz->size = h[0] | (h[1] << 8) | ((uint32_t)h[2] << 16) | ((uint32_t)h[3] << 24);
+  if (adz->size < ADZ_TRACK_SIZE) return FR_INVALID_OBJECT;
+
+  adz->file = file;
+  return FR_OK;
+}
+
+void adz_close(adz_t *adz) {
+  unsigned int i;
+
+  if (!adz->file) return;
+  for (i = 0; i < ADZ_CACHE_TRACKS; i++)
+    if (cache[i].owner == adz) cache[i].owner = 0;
+  for (i = 0; i < ADZ_SNAPSHOTS; i++)
+    if (snapshots[i].owner == adz) snapshots[i].owner = 0;
+  if (inflate_owned(adz_read, adz)) inflate_release();
+  adz->file = 0;
+}
+
+static void snapshot_save(adz_t *adz) {
+  unsigned int i, free = ADZ_SNAPSHOTS;
+
+  for (i = 0; i < ADZ_SNAPSHOTS; i++) {
+    if (snapshots[i].owner == adz && snapshots[i].snap.s.out == inf.s.out) return;
+    if (!snapshots[i].owner && free == ADZ_SNAPSHOTS) free = i;
+  }
+  if (free == ADZ_SNAPSHOTS) return;
+  snapshots[free].owner = adz;
+  inflate_save(&inf, &snapshots[free].snap);
+}
+
+// positions the stream at or before pos, as close as possible
+static void stream_seek(adz_t *adz, uint32_t pos) {
+  unsigned int i, best = ADZ_SNAPSHOTS;
+  uint32_t out;
+
+  if (!inflate_owned(adz_read, adz) || inf.s.out > pos)
+    inflate_init(&inf, adz_read, adz, adz->start);
+  out = inf.s.out;
+  for (i = 0; i < ADZ_SNAPSHOTS; i++) {
+    if (snapshots[i].owner == adz && snapshots[i].snap.s.out <= pos && snapshots[i].snap.s.out > out) {
+      out = snapshots[i].snap.s.out;
+      best = i;
+    }
+  }
+  if (best != ADZ_SNAPSHOTS) inflate_restore(&inf, &snapshots[best].snap);
+}
+
+static int cache_find(adz_t *adz, unsigned char track) {
+  int i;
+
+  for (i = 0; i < ADZ_CACHE_TRACKS; i++)
+    if (cache[i].owner == adz && cache[i].track == track) return i;
+  return -1;
+}
+
+// a free slot or the least recently used clean one
+static int cache_victim() {
+  int i, victim = -1;
+
+  for (i = 0; i < ADZ_CACHE_TRACKS; i++) {
+    if (!cache[i].owner) return i;
+    if (!cache[i].dirty && (victim < 0 || cache[i].used < cache[victim].used)) victim = i;
+  }
+  return victim;
+}
+
+static int adz_load(adz_t *adz, unsigned char track) {
+  uint32_t pos = (uint32_t)track * ADZ_TRACK_SIZE;
+  uint32_t end = pos + ADZ_TRACK_SIZE;
+  int slot;
+
+  if (!adz->file || end > adz->size) return -1;
+  if ((slot = cache_find(adz, track)) < 0) {
+    stream_seek(adz, pos);
+    while (inf.s.out < end) {
+      uint32_t until = (inf.s.out / CHECKPOINT_SIZE + 1) * CHECKPOINT_SIZE;
+      if (until > end) until = end;
+      if (inflate_run(&inf, until) != INFLATE_OK) {
+        inflate_release();
+        return -1;
+      }
+      if (!(inf.s.out % CHECKPOINT_SIZE)) snapshot_save(adz);
+    }
+    slot = cache_victim();
+    inflate_copy(&inf, pos, cache[slot].data, ADZ_TRACK_SIZE);
+    cache[slot].owner = adz;
+    cache[slot].track = track;
+    cache[slot].dirty = 0;
+  }
+  cache[slot].used = ++cache_stamp;
+  return slot;
+}
+
+unsigned char *adz_read_track(adz_t *adz, unsigned char track) {
+  int slot = adz_load(adz, track);
+
+  return (slot < 0) ? 0 : cache[slot].data;
+}
+
+unsigned char adz_write_sector(adz_t *adz, unsigned char track, unsigned char sector, const unsigned char *data) {
+  int slot, i, dirty = 0;
+
+  if (sector >= ADZ_TRACK_SIZE / 512 || (slot = adz_load(adz, track)) < 0) return ADZ_ERROR_DATA;
+  if (!cache[slot].dirty) {
+    for (i = 0; i < ADZ_CACHE_TRACKS; i++)
+      if (cache[i].owner && cache[i].dirty) dirty++;
+    if (dirty >= ADZ_OVERLAY_TRACKS) return ADZ_ERROR_OVERLAY;
+    cache[slot].dirty = 1;
+  }
+  memcpy(cache[slot].data + sector * 512, data, 512);
+  return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * adz.h
+ * Amiga floppy images in gzip format, decoded a track at a time
+ *
+ */
+
+#ifndef ADZ_H
+#define ADZ_H
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+#define ADZ_TRACK_SIZE  (11*512)
+
+// decoded tracks kept in RAM, shared by all drives. With the decoder and
+// the snapshot they take about 88K of the 380K SRAM of the SiDi
+#ifndef ADZ_CACHE_TRACKS
+#define ADZ_CACHE_TRACKS  3
+#endif
+// tracks written by the Amiga are pinned in the cache until eject,
+// one slot always stays free for reading
+#define ADZ_OVERLAY_TRACKS  (ADZ_CACHE_TRACKS - 1)
+
+// dictionary snapshots, shared by all drives, 35K each
+#ifndef ADZ_SNAPSHOTS
+#define ADZ_SNAPSHOTS  1
+#endif
+// distance of the checkpoints in tracks, the single snapshot is taken
+// in the middle of a DD disk
+#ifndef ADZ_CHECKPOINT_TRACKS
+#define ADZ_CHECKPOINT_TRACKS  80
+#endif
+
+// adz_write_sector() errors
+#define ADZ_ERROR_OVERLAY  31  // too many written tracks
+#define ADZ_ERROR_DATA     32  // the track could not be decoded
+
+typedef struct {
+  FIL     *file;   // 0 if the image is not compressed
+  uint32_t start;  // offset of the deflate stream
+  uint32_t size;   // uncompressed size
+} adz_t;
+
+// checks for a gzip image, returns FR_INVALID_OBJECT if it is not one
+FRESULT adz_open(adz_t *adz, FIL *file);
+// drops the cached tracks, the snapshots and the overlay of the image
+void adz_close(adz_t *adz);
+// returns the data of the track or 0 if the image is broken
+unsigned char *adz_read_track(adz_t *adz, unsigned char track);
+// writes a sector to the overlay, returns 0 or an error code
+unsigned char adz_write_sector(adz_t *adz, unsigned char track, unsigned char sector, const unsigned char *data);
+
+#endif // ADZ_H
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "adz.h"
+#include "inflate.h"
+#include "fat_compat.h"
+
+// Inflates ADZ images from a FAT16 RAM disk with the real FatFs and
+// compares every track with the ADF. Without arguments the ADF images are
+// generated (empty, text, code like and incompressible tracks) and
+// compressed with the gzip tool at several levels, real images can be
+// given as ADZ ADF pairs on the command line. Reports the decode time per
+// track for a sequential pass, for random seeks with the checkpoints and
+// for the same seeks decoded from the start of the image.
+//
+//   ./adztest [game.adz game.adf ...]
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+
+static uint8_t *disk;
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  memcpy(buf, disk + lba * 512, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void format() {
+  uint8_t *b = disk;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(disk + 512, 0xfff8);
+  put16(disk + 514, 0xffff);
+  memcpy(disk + (1 + FAT_SECTORS) * 512, disk + 512, FAT_SECTORS * 512);
+}
+
+// ---------- images ----------
+#define TRACKS    160
+#define ADF_SIZE  (TRACKS * ADZ_TRACK_SIZE)
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static uint8_t *load(const char *name, long *size) {
+  FILE *f = fopen(name, "rb");
+  uint8_t *buf;
+
+  if (!f) return 0;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(*size);
+  if (fread(buf, 1, *size, f) != *size) *size = 0;
+  fclose(f);
+  return buf;
+}
+
+static void put_file(const char *name, const uint8_t *data, long size) {
+  FIL f;
+  UINT bw;
+
+  CHECK(f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK);
+  CHECK(f_write(&f, data, size, &bw) == FR_OK && bw == size);
+  CHECK(f_close(&f) == FR_OK);
+}
+
+// a disk with the kinds of tracks found on real ones
+static void make_adf(uint8_t *adf) {
+  static const char *words[] = { "the ", "Amiga ", "disk ", "load ", "level ", "score ",
+    "player ", "sound ", "graphics ", "copper ", "blitter ", "sprite ", "\n" };
+  unsigned int t, i;
+
+  memset(adf, 0, ADF_SIZE);
+  memcpy(adf, "DOS\0", 4);
+  for (t = 0; t < TRACKS; t++) {
+    uint8_t *p = adf + t * ADZ_TRACK_SIZE;
+    switch (t % 7) {
+      case 0:  // empty
+        break;
+      case 1:
+      case 2:  // text
+        for (i = 0; i < ADZ_TRACK_SIZE; ) {
+          const char *w = words[rand() % 13];
+          while (*w && i < ADZ_TRACK_SIZE) p[i++] = *w++;
+        }
+        break;
+      case 3:
+      case 4:  // code and tables, small values and repeats
+        for (i = 0; i < ADZ_TRACK_SIZE; i++)
+          p[i] = (i > 64 && rand() % 3 == 0) ? p[i - 1 - rand() % 64] : rand() % 24;
+        break;
+      default: // packed data
+        for (i = 0; i < ADZ_TRACK_SIZE; i++) p[i] = rand();
+    }
+  }
+}
+
+static void check_track(adz_t *adz, const uint8_t *adf, unsigned int t) {
+  unsigned char *data = adz_read_track(adz, t);
+
+  if (!data || memcmp(data, adf + t * ADZ_TRACK_SIZE, ADZ_TRACK_SIZE)) {
+    printf("track %u differs\n", t);
+    errors++;
+  }
+}
+
+static void bench(const char *label, const char *name, const uint8_t *adf, unsigned int tracks) {
+  static unsigned int seeks[200];
+  adz_t adz;
+  FIL f;
+  double t0, t, max = 0, seq = 0, rnd = 0, cold = 0;
+  unsigned long size;
+  unsigned int i;
+
+  CHECK(f_open(&f, name, FA_READ) == FR_OK);
+  CHECK(adz_open(&adz, &f) == FR_OK);
+  size = f_size(&f);
+  CHECK(adz.size == tracks * ADZ_TRACK_SIZE);
+
+  // sequential pass, which also takes the snapshots
+  for (i = 0; i < tracks; i++) {
+    t0 = now();
+    check_track(&adz, adf, i);
+    t = now() - t0;
+    seq += t;
+    if (t > max) max = t;
+  }
+
+  // the cache would hide the decoder, seek over more tracks than it holds
+  for (i = 0; i < 200; i++) seeks[i] = rand() % tracks;
+  for (i = 0; i < 200; i++) {
+    t0 = now();
+    check_track(&adz, adf, seeks[i]);
+    rnd += now() - t0;
+  }
+  adz_close(&adz);
+  CHECK(!adz.file);
+
+  // the same seeks without snapshots and stream
+  for (i = 0; i < 200; i++) {
+    CHECK(adz_open(&adz, &f) == FR_OK);
+    t0 = now();
+    check_track(&adz, adf, seeks[i]);
+    cold += now() - t0;
+    adz_close(&adz);
+  }
+  CHECK(f_close(&f) == FR_OK);
+
+  printf("  %-14s %7lu bytes: %6.1f us/track sequential (max %6.1f), seek %7.1f us, from start %7.1f us\n",
+         label, size, seq / tracks, max, rnd / 200, cold / 200);
+}
+
+// two compressed drives used alternately, like a disk copy
+static void test_two_drives(const char *name1, const uint8_t *adf1, const char *name2, const uint8_t *adf2) {
+  adz_t adz[2];
+  FIL f[2];
+  unsigned int i;
+
+  CHECK(f_open(&f[0], name1, FA_READ) == FR_OK && adz_open(&adz[0], &f[0]) == FR_OK);
+  CHECK(f_open(&f[1], name2, FA_READ) == FR_OK && adz_open(&adz[1], &f[1]) == FR_OK);
+  for (i = 0; i < TRACKS; i++) {
+    check_track(&adz[0], adf1, i);
+    check_track(&adz[1], adf2, TRACKS - 1 - i);
+  }
+  adz_close(&adz[0]);
+  adz_close(&adz[1]);
+  f_close(&f[0]);
+  f_close(&f[1]);
+}
+
+static void test_overlay(const char *name, const uint8_t *adf) {
+  static uint8_t copy[ADF_SIZE];
+  uint8_t sector[512];
+  adz_t adz;
+  FIL f;
+  unsigned int i, t;
+
+  memcpy(copy, adf, ADF_SIZE);
+  CHECK(f_open(&f, name, FA_READ) == FR_OK && adz_open(&adz, &f) == FR_OK);
+  for (i = 0; i < ADZ_OVERLAY_TRACKS; i++) {
+    t = 10 + i * 30;
+    memset(sector, i + 1, 512);
+    CHECK(adz_write_sector(&adz, t, 3, sector) == 0);
+    CHECK(adz_write_sector(&adz, t, 10, sector) == 0);
+    memcpy(copy + t * ADZ_TRACK_SIZE + 3 * 512, sector, 512);
+    memcpy(copy + t * ADZ_TRACK_SIZE + 10 * 512, sector, 512);
+  }
+  CHECK(adz_write_sector(&adz, 1, 0, sector) == ADZ_ERROR_OVERLAY);
+  CHECK(adz_write_sector(&adz, 1, 11, sector) == ADZ_ERROR_DATA);
+  CHECK(adz_write_sector(&adz, TRACKS, 0, sector) == ADZ_ERROR_DATA);
+
+  // written tracks survive the cache being cycled through the whole disk
+  for (i = 0; i < 2 * TRACKS; i++) check_track(&adz, copy, rand() % TRACKS);
+  for (i = 0; i < TRACKS; i++) check_track(&adz, copy, i);
+
+  // and are gone after eject
+  adz_close(&adz);
+  CHECK(adz_open(&adz, &f) == FR_OK);
+  for (i = 0; i < TRACKS; i++) check_track(&adz, adf, i);
+  adz_close(&adz);
+  f_close(&f);
+}
+
+static void test_broken(const uint8_t *adz_data, long size, const uint8_t *adf) {
+  static uint8_t buf[ADF_SIZE];
+  adz_t adz;
+  FIL f;
+  unsigned int i, good;
+
+  // an ADF is not an ADZ
+  put_file("PLAIN.ADF", adf, ADF_SIZE);
+  CHECK(f_open(&f, "PLAIN.ADF", FA_READ) == FR_OK);
+  CHECK(adz_open(&adz, &f) == FR_INVALID_OBJECT && !adz.file);
+  CHECK(!adz_read_track(&adz, 0));
+  f_close(&f);
+
+  // truncated, with the size of the whole image in the trailer
+  memcpy(buf, adz_data, size / 2);
+  memcpy(buf + size / 2 - 4, adz_data + size - 4, 4);
+  put_file("HALF.ADZ", buf, size / 2);
+  CHECK(f_open(&f, "HALF.ADZ", FA_READ) == FR_OK && adz_open(&adz, &f) == FR_OK);
+  for (good = 0; adz_read_track(&adz, good); good++) ;
+  CHECK(good > 0 && good < TRACKS - 1);
+  for (i = 0; i < good; i++) check_track(&adz, adf, i);
+  CHECK(!adz_read_track(&adz, TRACKS - 1));
+  adz_close(&adz);
+  f_close(&f);
+
+  // garbage in the middle of the stream fails or decodes to wrong data,
+  // but must not run off
+  memcpy(buf, adz_data, size);
+  for (i = size / 3; i < size / 3 + 64; i++) buf[i] = rand();
+  put_file("BAD.ADZ", buf, size);
+  CHECK(f_open(&f, "BAD.ADZ", FA_READ) == FR_OK && adz_open(&adz, &f) == FR_OK);
+  for (i = 0; i < TRACKS; i++) adz_read_track(&adz, i);
+  adz_close(&adz);
+  f_close(&f);
+}
+
+int main(int argc, char **argv) {
+  static const char *levels[] = { "-1", "-6", "-9" };
+  static char cmd[256];
+  uint8_t *adf[3], *adz_data;
+  long size;
+  int i;
+
+  disk = calloc(DISK_SECTORS, 512);
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+
+  printf("ADZ track decode, %d cached tracks, %d snapshots every %d tracks:\n",
+         ADZ_CACHE_TRACKS, ADZ_SNAPSHOTS, ADZ_CHECKPOINT_TRACKS);
+
+  // generated images, the gzip header has the file name
+  for (i = 0; i < 3; i++) {
+    char name[16];
+    FILE *f;
+
+    adf[i] = malloc(ADF_SIZE);
+    make_adf(adf[i]);
+    f = fopen("/tmp/adztest.adf", "wb");
+    fwrite(adf[i], 1, ADF_SIZE, f);
+    fclose(f);
+    sprintf(cmd, "gzip -f %s /tmp/adztest.adf", levels[i]);
+    CHECK(system(cmd) == 0);
+    adz_data = load("/tmp/adztest.adf.gz", &size);
+    CHECK(adz_data && size > 0);
+    if (!adz_data) break;
+    remove("/tmp/adztest.adf.gz");
+    sprintf(name, "LEVEL%s.ADZ", levels[i]);
+    put_file(name, adz_data, size);
+    bench(name, name, adf[i], TRACKS);
+    if (i == 2) test_broken(adz_data, size, adf[i]);
+    free(adz_data);
+  }
+  test_two_drives("LEVEL-1.ADZ", adf[0], "LEVEL-9.ADZ", adf[2]);
+  test_overlay("LEVEL-6.ADZ", adf[1]);
+
+  // real images
+  for (i = 1; i + 1 < argc; i += 2) {
+    uint8_t *real;
+    long adf_size;
+
+    adz_data = load(argv[i], &size);
+    real = load(argv[i + 1], &adf_size);
+    if (!adz_data || !real) {
+      printf("cannot read %s or %s\n", argv[i], argv[i + 1]);
+      errors++;
+      continue;
+    }
+    put_file("REAL.ADZ", adz_data, size);
+    bench(argv[i], "REAL.ADZ", real, adf_size / ADZ_TRACK_SIZE);
+    free(adz_data);
+    free(real);
+  }
+
+  for (i = 0; i < 3; i++) free(adf[i]);
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
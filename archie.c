@@ -9,6 +9,7 @@
 #include "user_io.h"
 #include "data_io.h"
 #include "debug.h"
+#include "prof.h"
 
 #define CONFIG_FILENAME  "ARCHIE  CFG"
 #define MAX_FLOPPY 2
@@ -51,6 +52,7 @@ enum state { STATE_HRST, STATE_RAK1, STATE_RAK2, STATE_IDLE,
 
 #define QUEUE_LEN 8
 static unsigned char tx_queue[QUEUE_LEN][2];
+static input_trace_t tx_trace[QUEUE_LEN];  // input event completed by the byte
 static unsigned char tx_queue_rptr, tx_queue_wptr;
 #define QUEUE_NEXT(a)  ((a+1)&(QUEUE_LEN-1))
 
@@ -158,6 +160,8 @@ static void archie_kbd_enqueue(unsigned char state, unsigned char byte) {
   archie_debugf("KBD ENQUEUE %x (%x)", byte, state);
   tx_queue[tx_queue_wptr][0] = state;
   tx_queue[tx_queue_wptr][1] = byte;
+  input_trace_clear(&tx_trace[tx_queue_wptr]);
+  if(state == STATE_WAIT4ACK2) input_trace_keep(&tx_trace[tx_queue_wptr]);
   tx_queue_wptr = QUEUE_NEXT(tx_queue_wptr);
 } 
 
@@ -173,9 +177,10 @@ static void archie_kbd_tx(unsigned char state, unsigned char byte) {
 
 static void archie_kbd_send(unsigned char state, unsigned char byte) {
   // don't send if we are waiting for an ack
-  if((kbd_state != STATE_WAIT4ACK1)&&(kbd_state != STATE_WAIT4ACK2)) 
+  if((kbd_state != STATE_WAIT4ACK1)&&(kbd_state != STATE_WAIT4ACK2)) {
     archie_kbd_tx(state, byte);
-  else
+    if(state == STATE_WAIT4ACK2) input_trace_sent();
+  } else
     archie_kbd_enqueue(state, byte);
 }
 
@@ -328,6 +333,7 @@ static void archie_check_queue(void) {
     return;
 
   archie_kbd_tx(tx_queue[tx_queue_rptr][0], tx_queue[tx_queue_rptr][1]); 
+  input_trace_emit(&tx_trace[tx_queue_rptr]);
   tx_queue_rptr = QUEUE_NEXT(tx_queue_rptr);
 }
 
@@ -11,6 +11,9 @@
 #include "user_io.h"
 #include "tos.h"
 #include "debug.h"
+#include "prof.h"
+#include "usbsched.h"
+#include "eth_bridge.h"
 
 static char buffer[32];
 static unsigned char fill = 0;
@@ -88,6 +91,12 @@ void cdc_control_poll(void) {
 	    cdc_puts("R\033[7mS\033[0m232 redirect");
 	    cdc_puts("\033[7mP\033[0marallel redirect");
 	    cdc_puts("\033[7mM\033[0mIDI redirect");
+	    cdc_puts("\033[7mU\033[0mSB poll statistics");
+	    cdc_puts("\033[7mE\033[0mthernet statistics");
+#ifdef PROFILING
+	    cdc_puts("\033[7mT\033[0miming statistics");
+	    cdc_puts("\033[7mZ\033[0mero timing statistics");
+#endif
 	    cdc_puts("");
 	    break;
 	    
@@ -120,6 +129,26 @@ void cdc_control_poll(void) {
 	    cdc_puts("MIDI redirect enabled");
 	    tos_set_cdc_control_redirect(CDC_REDIRECT_MIDI);
 	    break;
+
+	  case 'u':
+	    usb_sched_dump(cdc_puts);
+	    usb_sched_reset_stats();
+	    break;
+
+	  case 'e':
+	    eth_bridge_dump(cdc_puts);
+	    break;
+
+#ifdef PROFILING
+	  case 't':
+	    prof_dump(cdc_puts);
+	    break;
+
+	  case 'z':
+	    cdc_puts("Timing statistics cleared");
+	    prof_reset();
+	    break;
+#endif
 	    
 	  }
 	  break;
@@ -0,0 +1,136 @@
+// conf_str.c
+// Keeps the config string of an 8 bit core in RAM, split into items,
+// so the OSD doesn't have to read it over SPI for every menu line.
+// The config snippet from an ARC file replaces the "DIP" item.
+
+#include <string.h>
+#include "conf_str.h"
+
+#define CONF_STR_NONE     0
+#define CONF_STR_FILLING  1
+#define CONF_STR_VALID    2
+#define CONF_STR_OVERFLOW 3
+
+static char pool[CONF_STR_SIZE];
+static conf_item_t items[CONF_STR_ITEMS_MAX];
+static int pool_ptr;
+static int item_start;
+static int nitems;
+static char state = CONF_STR_NONE;
+static char in_arc;
+static const char *arc;
+
+static uint8_t conf_str_bit(char c) {
+	if((c>='0') && (c<='9')) return c-'0';    // bits 0-9
+	if((c>='A') && (c<='Z')) return c-'A'+10; // bits 10-35
+	if((c>='a') && (c<='z')) return c-'a'+36; // bits 36-61
+	return 0;
+}
+
+static void conf_str_parse_item(conf_item_t *item, int offset) {
+	const char *p = &pool[offset];
+
+	item->offset = offset;
+	item->page = 0;
+	item->bit_lo = item->bit_hi = 0;
+
+	// 'P' followed by a ',' opens a submenu, otherwise it's a prefix
+	if(p[0] == 'P' && p[1] && p[2] != ',') {
+		item->page = conf_str_bit(p[1]);
+		p += 2;
+	}
+
+	item->type = p[0];
+	if(p[0] == 'O' || p[0] == 'T') {
+		item->bit_lo = item->bit_hi = conf_str_bit(p[1]);
+		if(p[0] == 'O' && p[1] && conf_str_bit(p[2]) > item->bit_lo)
+			item->bit_hi = conf_str_bit(p[2]);
+	}
+}
+
+static void conf_str_end_item() {
+	if(pool_ptr >= CONF_STR_SIZE) {
+		state = CONF_STR_OVERFLOW;
+		return;
+	}
+	pool[pool_ptr++] = 0;
+
+	if(!in_arc && !strncmp(&pool[item_start], "DIP", 3)) {
+		// drop the DIP item, continue with the config snippet from the ARC
+		pool_ptr = item_start;
+		if(arc) {
+			const char *c = arc;
+			in_arc = 1;
+			while(*c && conf_str_putc(*c)) c++;
+			in_arc = 0;
+		}
+		return;
+	}
+
+	if(nitems >= CONF_STR_ITEMS_MAX) {
+		state = CONF_STR_OVERFLOW;
+		return;
+	}
+	conf_str_parse_item(&items[nitems++], item_start);
+	item_start = pool_ptr;
+}
+
+void conf_str_reset() {
+	state = CONF_STR_NONE;
+	nitems = 0;
+	pool_ptr = item_start = 0;
+	in_arc = 0;
+	arc = 0;
+}
+
+// start filling the cache
+void conf_str_init(const char *arc_conf) {
+	conf_str_reset();
+	arc = arc_conf;
+	state = CONF_STR_FILLING;
+}
+
+// add a character of the config string, returns 0 if the cache can't take more
+char conf_str_putc(char c) {
+	if(state != CONF_STR_FILLING) return 0;
+
+	if(c == ';') {
+		conf_str_end_item();
+	} else if(pool_ptr >= CONF_STR_SIZE-1) {
+		state = CONF_STR_OVERFLOW;
+	} else {
+		pool[pool_ptr++] = c;
+	}
+	return (state == CONF_STR_FILLING);
+}
+
+// the config string is complete
+void conf_str_done() {
+	if(state != CONF_STR_FILLING) return;
+	// the last item is not terminated by a ';'
+	if(pool_ptr != item_start) conf_str_end_item();
+	if(state == CONF_STR_FILLING) state = CONF_STR_VALID;
+}
+
+// the cache holds the complete config string
+char conf_str_valid() {
+	return (state == CONF_STR_VALID);
+}
+
+int conf_str_items() {
+	return nitems;
+}
+
+// get an item, NULL for non-existing and empty ones
+char *conf_str_get(unsigned char index) {
+	char *p;
+
+	if(state != CONF_STR_VALID || index >= nitems) return 0;
+	p = &pool[items[index].offset];
+	return *p ? p : 0;
+}
+
+const conf_item_t *conf_str_get_item(unsigned char index) {
+	if(state != CONF_STR_VALID || index >= nitems) return 0;
+	return &items[index];
+}
@@ -0,0 +1,39 @@
+/*
+ * conf_str.h
+ * Cached and pre-parsed 8 bit core config string
+ *
+ */
+
+#ifndef CONF_STR_H
+#define CONF_STR_H
+
+#include <stdint.h>
+
+// size of the string pool holding all items of the config string
+// (including the config snippet of an ARC file)
+#ifndef CONF_STR_SIZE
+#define CONF_STR_SIZE 2048
+#endif
+
+#ifndef CONF_STR_ITEMS_MAX
+#define CONF_STR_ITEMS_MAX 128
+#endif
+
+typedef struct {
+	uint16_t offset;  // position of the item in the string pool
+	char type;        // first character of the item (behind a 'P' prefix)
+	uint8_t page;     // page of a 'P' prefixed item, 0 otherwise
+	uint8_t bit_lo;   // status bit range of 'O' and 'T' items
+	uint8_t bit_hi;
+} conf_item_t;
+
+void conf_str_reset();
+void conf_str_init(const char *arc_conf);
+char conf_str_putc(char c);
+void conf_str_done();
+char conf_str_valid();
+int conf_str_items();
+char *conf_str_get(unsigned char index);
+const conf_item_t *conf_str_get_item(unsigned char index);
+
+#endif // CONF_STR_H
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "conf_str.h"
+
+static int errors = 0;
+
+static void fill(const char *str, const char *arc) {
+	conf_str_init(arc);
+	while (*str && conf_str_putc(*str)) str++;
+	conf_str_done();
+}
+
+static void check(unsigned char idx, const char *expected) {
+	const char *p = conf_str_get(idx);
+	if ((!p && expected) || (p && !expected) || (p && strcmp(p, expected))) {
+		printf("item %d: got \"%s\", expected \"%s\"\n", idx, p ? p : "(null)", expected ? expected : "(null)");
+		errors++;
+	}
+}
+
+static void check_item(unsigned char idx, char type, int page, int lo, int hi) {
+	const conf_item_t *item = conf_str_get_item(idx);
+	if (!item || item->type != type || item->page != page || item->bit_lo != lo || item->bit_hi != hi) {
+		printf("item %d: parsed fields mismatch\n", idx);
+		errors++;
+	}
+}
+
+int main() {
+	char big[CONF_STR_SIZE + 64];
+
+	fill("NES;;F1,NES;O12,Scandoubler,Off,On,HQ2x;T0,Reset;P1,Video;P1OA,Blend,Off,On;V,v1.0", 0);
+	if (!conf_str_valid()) { printf("cache not valid\n"); errors++; }
+	check(0, "NES");
+	check(1, 0);
+	check(2, "F1,NES");
+	check(3, "O12,Scandoubler,Off,On,HQ2x");
+	check(7, "V,v1.0");
+	check(8, 0);
+	check_item(3, 'O', 0, 1, 2);
+	check_item(4, 'T', 0, 0, 0);
+	check_item(5, 'P', 0, 0, 0);
+	check_item(6, 'O', 1, 10, 10);
+
+	// ARC config snippet replaces the DIP item
+	fill("ARCADE;;DIP;T0,Reset;V,v2", "O34,Lives,3,5;OH,Cabinet,Up,Cocktail;");
+	check(2, "O34,Lives,3,5");
+	check(3, "OH,Cabinet,Up,Cocktail");
+	check(4, "T0,Reset");
+	check(5, "V,v2");
+	check_item(3, 'O', 0, 17, 17);
+
+	// no ARC snippet
+	fill("ARCADE;;DIP;T0,Reset;", "");
+	check(2, "T0,Reset");
+	check(3, 0);
+
+	// a string which doesn't fit must be reported
+	memset(big, 'O', sizeof(big) - 1);
+	big[sizeof(big) - 1] = 0;
+	fill(big, 0);
+	if (conf_str_valid()) { printf("overflow not detected\n"); errors++; }
+	check(0, 0);
+
+	conf_str_reset();
+	if (conf_str_valid()) { printf("reset failed\n"); errors++; }
+
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
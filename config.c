@@ -10,6 +10,7 @@
 #include "ini_parser.h"
 #include "osd.h"
 #include "fpga.h"
+#include "rom_upload.h"
 #include "fdd.h"
 #include "hdd.h"
 #include "firmware.h"
@@ -25,7 +26,7 @@ static configTYPE tmpconf;
 extern char s[FF_LFN_BUF + 1];
 static char configfilename[13];
 char DebugMode=0;
-static unsigned char *romkey = (sector_buffer + 512);
+static unsigned char *romkey;
 
 extern unsigned char drives;
 extern adfTYPE df[4];
@@ -66,36 +67,6 @@ static const ini_var_t config_ini_vars[] = {
                               "mov r0, r0\n\t" \
                               "mov r0, r0")
 
-static void ClearKickstartMirrorE0(void)
-{
-  spi_osd_cmd32le_cont(OSD_CMD_WR, 0x00e00000);
-  for (int i = 0; i < (0x80000 / 4); i++) {
-    SPI(0x00);
-    SPI(0x00);
-    SPIN(); SPIN(); SPIN(); SPIN();
-    SPI(0x00);
-    SPI(0x00);
-    SPIN(); SPIN(); SPIN(); SPIN();
-  }
-  DisableOsd();
-  SPIN(); SPIN(); SPIN(); SPIN();
-}
-
-static void ClearVectorTable(void)
-{
-  spi_osd_cmd32le_cont(OSD_CMD_WR, 0x00000000);
-  for (int i = 0; i < 256; i++) {
-    SPI(0x00);
-    SPI(0x00);
-    SPIN(); SPIN(); SPIN(); SPIN();
-    SPI(0x00);
-    SPI(0x00);
-    SPIN(); SPIN(); SPIN(); SPIN();
-  }
-  DisableOsd();
-  SPIN(); SPIN(); SPIN(); SPIN();
-}
-
 //// UploadKickstart() ////
 char UploadKickstart(char *name)
 {
@@ -110,10 +81,13 @@ char UploadKickstart(char *name)
   if(FileOpenCompat(&keyfile,"ROM     KEY", FA_READ) == FR_OK) {
     keysize=f_size(&keyfile);
     if(keysize<(SECTOR_BUFFER_SIZE-512)) {
+      // at the end of the sector buffer, the ROM is read in front of it
+      romkey = sector_buffer + ((SECTOR_BUFFER_SIZE - keysize) & ~511);
       f_read(&keyfile, romkey, keysize, &br);
       BootPrint("Loaded Amiga Forever key file");
     } else {
       BootPrint("Amiga Forever keyfile is too large!");
+      keysize=0;
     }
     f_close(&keyfile);
   }
@@ -124,9 +98,9 @@ char UploadKickstart(char *name)
     if (f_size(&romfile) == 0x100000) {
       // 1MB Kickstart ROM
       BootPrint("Uploading 1MB Kickstart ...");
-      SendFileV2(&romfile, NULL, 0, 0xe00000, f_size(&romfile)>>10);
-      SendFileV2(&romfile, NULL, 0, 0xf80000, f_size(&romfile)>>10);
-      ClearVectorTable();
+      rom_upload(&romfile, NULL, 0, 0xe00000, 0, f_size(&romfile)>>10);
+      rom_upload(&romfile, NULL, 0, 0xf80000, 0, f_size(&romfile)>>10);
+      rom_clear(0x000000, 0x400);
       f_close(&romfile);
       return(1);
     } else if(f_size(&romfile) == 0x80000) {
@@ -136,10 +110,8 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x08);
         SendFile(&romfile);
       } else {
-        SendFileV2(&romfile, NULL, 0, 0xf80000, f_size(&romfile)>>9);
-        f_rewind(&romfile);
-        SendFileV2(&romfile, NULL, 0, 0xe00000, f_size(&romfile)>>9);
-        ClearVectorTable();
+        rom_upload(&romfile, NULL, 0, 0xf80000, 0xe00000, f_size(&romfile)>>9);
+        rom_clear(0x000000, 0x400);
       }
       f_close(&romfile);
       return(1);
@@ -150,10 +122,8 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x08);
         SendFileEncrypted(&romfile,romkey,keysize);
       } else {
-        SendFileV2(&romfile, romkey, keysize, 0xf80000, f_size(&romfile)>>9);
-        f_rewind(&romfile);
-        SendFileV2(&romfile, romkey, keysize, 0xe00000, f_size(&romfile)>>9);
-        ClearVectorTable();
+        rom_upload(&romfile, romkey, keysize, 0xf80000, 0xe00000, f_size(&romfile)>>9);
+        rom_clear(0x000000, 0x400);
       }
       f_close(&romfile);
       return(1);
@@ -164,11 +134,9 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x04);
         SendFile(&romfile);
       } else {
-        SendFileV2(&romfile, NULL, 0, 0xf80000, f_size(&romfile)>>9);
-        f_rewind(&romfile);
-        SendFileV2(&romfile, NULL, 0, 0xfc0000, f_size(&romfile)>>9);
-        ClearVectorTable();
-        ClearKickstartMirrorE0();
+        rom_upload(&romfile, NULL, 0, 0xf80000, 0xfc0000, f_size(&romfile)>>9);
+        rom_clear(0x000000, 0x400);
+        rom_clear(0xe00000, 0x80000);
       }
       f_close(&romfile);
       return(1);
@@ -179,11 +147,9 @@ char UploadKickstart(char *name)
         PrepareBootUpload(0xF8, 0x04);
         SendFileEncrypted(&romfile,romkey,keysize);
       } else {
-        SendFileV2(&romfile, romkey, keysize, 0xf80000, f_size(&romfile)>>9);
-        f_rewind(&romfile);
-        SendFileV2(&romfile, romkey, keysize, 0xfc0000, f_size(&romfile)>>9);
-        ClearVectorTable();
-        ClearKickstartMirrorE0();
+        rom_upload(&romfile, romkey, keysize, 0xf80000, 0xfc0000, f_size(&romfile)>>9);
+        rom_clear(0x000000, 0x400);
+        rom_clear(0xe00000, 0x80000);
       }
       f_close(&romfile);
       return(1);
@@ -225,7 +191,7 @@ char UploadActionReplay()
     if (FileOpenCompat(&romfile, "HRTMON  ROM", FA_READ)== FR_OK) {
       int adr, data;
       puts("Uploading HRTmon ROM... ");
-      SendFileV2(&romfile, NULL, 0, 0xa10000, (f_size(&romfile)+511)>>9);
+      rom_upload(&romfile, NULL, 0, 0xa10000, 0, (f_size(&romfile)+511)>>9);
       // HRTmon config
       adr = 0xa10000 + 20;
       spi_osd_cmd32le_cont(OSD_CMD_WR, adr);
@@ -633,6 +599,9 @@ unsigned char SaveConfiguration(char *filename)
 }
 
 void EjectAllFloppies() {
+  // the card is gone, the images can't be synced anymore
+  wb_discard_all();
+
   for(int i=0;i<drives;i++)
     df[i].status = 0;
 
@@ -0,0 +1,10 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stdint.h>
+
+#define CRC32_INIT 0xffffffff
+
+uint32_t crc32_update(uint32_t crc, const void *buf, uint32_t len);
+
+#endif // CRC32_H
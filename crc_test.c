@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "crc32.h"
+
+#define BENCH_SIZE (1024*1024)
+#define BENCH_RUNS 64
+
+uint32_t crc32_update_small(uint32_t crc, const void *buf, uint32_t len);
+
+// bit serial reference, as used by the firmware before
+static uint32_t crc32_bitwise(uint32_t crc, const void *buf, uint32_t len) {
+	const uint8_t *p = buf;
+	while (len--) {
+		crc ^= *p++;
+		for (int j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return crc;
+}
+
+static const struct {
+	const char *str;
+	uint32_t crc;
+} vectors[] = {
+	{ "", 0x00000000 },
+	{ "a", 0xE8B7BE43 },
+	{ "abc", 0x352441C2 },
+	{ "123456789", 0xCBF43926 },
+	{ "The quick brown fox jumps over the lazy dog", 0x414FA339 },
+};
+
+static void bench(const char *name, uint32_t (*fn)(uint32_t, const void *, uint32_t), uint8_t *buf, int runs) {
+	uint32_t crc = CRC32_INIT;
+	clock_t start = clock();
+	for (int i = 0; i < runs; i++)
+		crc = fn(crc, buf, BENCH_SIZE);
+	double s = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%-10s %8.1f MB/s (%08X)\n", name, runs / s, ~crc);
+}
+
+int main() {
+	int errors = 0;
+	uint8_t *buf = malloc(BENCH_SIZE + 8);
+
+	for (int i = 0; i < sizeof(vectors)/sizeof(vectors[0]); i++) {
+		uint32_t len = strlen(vectors[i].str);
+		uint32_t c1 = ~crc32_update(CRC32_INIT, vectors[i].str, len);
+		uint32_t c2 = ~crc32_update_small(CRC32_INIT, vectors[i].str, len);
+		if (c1 != vectors[i].crc || c2 != vectors[i].crc) {
+			printf("\"%s\": %08X/%08X, expected %08X\n", vectors[i].str, c1, c2, vectors[i].crc);
+			errors++;
+		}
+	}
+
+	// random data at all alignments and lengths, also fed in pieces
+	srand(1);
+	for (int i = 0; i < BENCH_SIZE + 8; i++) buf[i] = rand();
+	for (int off = 0; off < 8; off++) {
+		for (int len = 0; len < 300; len++) {
+			uint32_t ref = crc32_bitwise(CRC32_INIT, buf + off, len);
+			uint32_t c = crc32_update(crc32_update(CRC32_INIT, buf + off, len / 3), buf + off + len / 3, len - len / 3);
+			if (c != ref || crc32_update_small(CRC32_INIT, buf + off, len) != ref) {
+				printf("mismatch at offset %d, len %d\n", off, len);
+				errors++;
+			}
+		}
+	}
+
+	bench("bitwise", crc32_bitwise, buf, BENCH_RUNS / 8);
+	bench("table", crc32_update_small, buf, BENCH_RUNS);
+	bench("slice-by-4", crc32_update, buf, BENCH_RUNS);
+
+	free(buf);
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
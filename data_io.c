@@ -7,6 +7,11 @@
 #include "data_io.h"
 #include "debug.h"
 #include "spi.h"
+#include "crc32.h"
+#include "savesync.h"
+#ifdef HAVE_INFLATE
+#include "zip.h"
+#endif
 #ifdef HAVE_QSPI
 #include "qspi.h"
 #endif
@@ -14,7 +19,12 @@
 // core supports direct ROM upload via SS4
 char rom_direct_upload = 0;
 
+// checksum of the last file sent to the core
+static uint32_t tx_crc;
+
 void data_io_set_index(char index) {
+  // a background save ends before the next transfer
+  data_io_rx_finish();
   EnableFpga();
   SPI(DIO_FILE_INDEX);
   SPI(index);
@@ -52,7 +62,7 @@ void data_io_file_tx_done(void) {
 // TRANSMIT FILE TO FPGA //
 ///////////////////////////
 
-void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
+static void data_io_tx_prepare(char index, const char *ext, unsigned char attr, DWORD sclust, FSIZE_t fsize) {
   char e[3];
   iprintf("Preparing transmission for index %d\n", index);
 
@@ -70,19 +80,18 @@ void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
   EnableFpga();
   SPI(DIO_FILE_INFO);
 
-  FSIZE_t fsize = f_size(file);
   spi_n(0, 8);                      // name
   spi8(e[0]);spi8(e[1]);spi8(e[2]); // ext
-  spi8(file->obj.attr);             // attr
+  spi8(attr);                       // attr
   spi8(0);                          // unsigned char       LowerCase;          /* NT VFAT lower case flags */
   spi8(0);                          // unsigned char       CreateHundredth;    /* hundredth of seconds in CTime */
   spi16(0);                         // unsigned short      CreateTime;         /* create time */
   spi16(0);                         // unsigned short      CreateDate;         /* create date */
   spi16(0);                         // unsigned short      AccessDate;         /* access date */
-  spi16le(file->obj.sclust >> 16);  // unsigned short      HighCluster;        /* high bytes of cluster number */
+  spi16le(sclust >> 16);            // unsigned short      HighCluster;        /* high bytes of cluster number */
   spi16(0);                         // unsigned short      ModifyTime;         /* last update time */
   spi16(0);                         // unsigned short      ModifyDate;         /* last update date */
-  spi16le(file->obj.sclust);        // unsigned short      StartCluster;       /* starting cluster of file */
+  spi16le(sclust);                  // unsigned short      StartCluster;       /* starting cluster of file */
   spi32le(fsize);
 
   DisableFpga();
@@ -92,9 +101,39 @@ void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
 
 }
 
+void data_io_file_tx_prepare(FIL *file, char index, const char *ext) {
+  if (file)
+    data_io_tx_prepare(index, ext, file->obj.attr, file->obj.sclust, f_size(file));
+  else
+    data_io_tx_prepare(index, ext, 0, 0, 0);
+}
+
+// send a block to the core
+static void data_io_tx_block(const unsigned char *p, unsigned short len) {
+  unsigned short c;
+
+#ifdef HAVE_QSPI
+  if (user_io_get_core_features() & FEAT_QSPI) {
+    qspi_write_block(p, len);
+  } else {
+#endif
+    EnableFpga();
+    SPI(DIO_FILE_TX_DAT);
+
+//  spi_write(p, len); // DMA -- too fast for some cores
+    for(c = 0; c < len; c++)
+      SPI(*p++);
+
+    DisableFpga();
+#ifdef HAVE_QSPI
+  }
+#endif
+}
+
 static void data_io_file_tx_send(FIL *file) {
   FSIZE_t bytes2send = f_size(file);
   UINT br;
+  uint32_t crc = CRC32_INIT;
 
   /* transmit the entire file using one transfer */
   iprintf("Selected %llu bytes to send\n", bytes2send);
@@ -102,8 +141,7 @@ static void data_io_file_tx_send(FIL *file) {
   while(bytes2send) {
     iprintf(".");
 
-    unsigned short c, chunk = (bytes2send>SECTOR_BUFFER_SIZE)?SECTOR_BUFFER_SIZE:bytes2send;
-    char *p;
+    unsigned short chunk = (bytes2send>SECTOR_BUFFER_SIZE)?SECTOR_BUFFER_SIZE:bytes2send;
 
     if (rom_direct_upload && fat_uses_mmc()) {
       // upload directly from the SD-Card if the core supports that
@@ -112,31 +150,19 @@ static void data_io_file_tx_send(FIL *file) {
       DISKLED_ON
       f_read(file, 0, bytes2send, &br);
       DISKLED_OFF
-      bytes2send = 0;
+      // data doesn't pass the controller, no checksum
+      return;
     } else {
       DISKLED_ON
       f_read(file, sector_buffer, chunk, &br);
       DISKLED_OFF
-
-#ifdef HAVE_QSPI
-      if (user_io_get_core_features() & FEAT_QSPI) {
-        qspi_write_block(sector_buffer, chunk);
-      } else {
-#endif
-        EnableFpga();
-        SPI(DIO_FILE_TX_DAT);
-
-//      spi_write(sector_buffer, chunk); // DMA -- too fast for some cores
-        for(p = sector_buffer, c=0;c < chunk;c++)
-          SPI(*p++);
-
-        DisableFpga();
-#ifdef HAVE_QSPI
-      }
-#endif
+      crc = crc32_update(crc, sector_buffer, chunk);
+      data_io_tx_block(sector_buffer, chunk);
       bytes2send -= chunk;
     }
   }
+  tx_crc = ~crc;
+  iprintf("\nCRC32: %08lX", tx_crc);
 }
 
 
@@ -156,6 +182,63 @@ void data_io_file_tx(FIL *file, char index, const char *ext) {
   data_io_file_tx_done();
 }
 
+// stream data assembled from other sources than a single file, 'size'
+// is reported to the core like a file size
+void data_io_stream_start(char index, const char *ext, uint32_t size) {
+  data_io_tx_prepare(index, ext, 0, 0, size);
+  tx_crc = CRC32_INIT;
+}
+
+void data_io_stream_write(const unsigned char *data, unsigned short len) {
+  tx_crc = crc32_update(tx_crc, data, len);
+  data_io_tx_block(data, len);
+}
+
+void data_io_stream_done(void) {
+  tx_crc = ~tx_crc;
+  iprintf("CRC32: %08lX", tx_crc);
+  data_io_file_tx_done();
+}
+
+#ifdef HAVE_INFLATE
+char data_io_zip_tx(char index, const char *ext) {
+  uint32_t size = zip_entry_size(), pos = 0, offset;
+  uint32_t padded = (size + 511) & 0xfffffe00;
+  FIL *file = zip_entry_stored(&offset);
+
+  iprintf("Selected %lu bytes to send from the archive\n", size);
+
+  // a stored entry starting at a sector boundary can be uploaded directly
+  // from the SD-Card, the whole sectors are read like for a plain file
+  if (file && rom_direct_upload && fat_uses_mmc() && !(offset & 511) && offset + padded <= f_size(file)) {
+    UINT br = 0;
+    data_io_tx_prepare(index, ext, 0, 0, size);
+    DISKLED_ON
+    if (f_lseek(file, offset) == FR_OK) f_read(file, 0, padded, &br);
+    DISKLED_OFF
+    data_io_file_tx_done();
+    return br == padded;
+  }
+
+  // otherwise the data is sent from the sector buffer or the inflate window
+  data_io_stream_start(index, ext, size);
+  while (pos < size) {
+    unsigned int n = SECTOR_BUFFER_SIZE;
+    const unsigned char *p;
+
+    iprintf(".");
+    DISKLED_ON
+    p = zip_entry_data(pos, &n);
+    DISKLED_OFF
+    if (!p) break;
+    data_io_stream_write(p, n);
+    pos += n;
+  }
+  data_io_stream_done();
+  return pos == size && tx_crc == zip_entry_crc();
+}
+#endif
+
 // send 'fill' byte 'len' times
 void data_io_fill_tx(unsigned char fill, unsigned int len, char index) {
   data_io_file_tx_prepare(0, index, 0);
@@ -180,35 +263,55 @@ static void data_io_file_rx_prepare(char index) {
   DisableFpga();
 }
 
-static void data_io_file_rx_receive(FIL *file, unsigned int len) {
-  unsigned int bytes2receive = len;
-  char first = 1;
-  UINT bw;
-  /* receive the entire file using one transfer */
-  iprintf("Selected %lu bytes to receive\n", bytes2receive);
+// the file being received, in the background if active
+static struct {
+  FIL          file;
+  unsigned int left;
+  char         first;
+  char         active;
+} rx;
 
-  while(bytes2receive) {
-    iprintf(".");
+// receives the next piece of the file, only the changed sectors are written
+static void data_io_file_rx_chunk(void) {
+  unsigned int c, chunk = (rx.left>2048)?2048:rx.left;
+  unsigned char *p = savesync_buffer(&chunk);
 
-    unsigned short c, chunk = (bytes2receive>2048)?2048:bytes2receive;
-    char *p;
+  EnableFpga();
+  SPI(DIO_FILE_RX_DAT);
+  if (rx.first) {
+    SPI(0);
+    rx.first=0;
+  }
 
-    EnableFpga();
-    SPI(DIO_FILE_RX_DAT);
-    if (first) {
-      SPI(0);
-      first=0;
-    }
+  for(c=0;c < chunk;c++)
+    *p++ = SPI(0xFF);
 
-    for(p = sector_buffer, c=0;c < chunk;c++)
-      *p++ = SPI(0xFF);
+  DisableFpga();
+  rx.left -= chunk;
+  DISKLED_ON
+  savesync_data(chunk);
+  DISKLED_OFF
+}
 
-    DisableFpga();
-    bytes2receive -= chunk;
-    DISKLED_ON
-    f_write(file, sector_buffer, chunk, &bw);
-    DISKLED_OFF
+static void data_io_file_rx_receive(FIL *file, unsigned int len) {
+  uint32_t written = savesync_stats.written;
+
+  /* receive the entire file using one transfer */
+  iprintf("Selected %lu bytes to receive\n", len);
+
+  rx.left = len;
+  rx.first = 1;
+  DISKLED_ON
+  savesync_start(file, len);
+  DISKLED_OFF
+  while(rx.left) {
+    iprintf(".");
+    data_io_file_rx_chunk();
   }
+  DISKLED_ON
+  savesync_done();
+  DISKLED_OFF
+  iprintf("\n%lu sectors changed", savesync_stats.written - written);
 }
 
 static void data_io_file_rx_done(void) {
@@ -227,6 +330,51 @@ void data_io_file_rx(FIL *file, char index, unsigned int len) {
   data_io_file_rx_done();
 }
 
+// a save of an existing file which runs a piece per data_io_poll(), the
+// main loop keeps serving the core in between. It is a normal task, never
+// run from the yield points: a piece uses the sector buffer and writes the
+// card in the middle of whatever yielded
+char data_io_file_rx_background(const char *name, char index, unsigned int len) {
+  data_io_rx_finish();
+  if (f_open(&rx.file, name, FA_READ | FA_WRITE) != FR_OK) return 0;
+  data_io_file_rx_prepare(index);
+  iprintf("Saving %lu bytes to %s in the background\n", len, name);
+  rx.left = len;
+  rx.first = 1;
+  savesync_start(&rx.file, len);
+  rx.active = 1;
+  return 1;
+}
+
+void data_io_poll(void) {
+  if (!rx.active) return;
+  if (rx.left) {
+    data_io_file_rx_chunk();
+    // other tasks use the sector buffer until the next piece
+    DISKLED_ON
+    savesync_flush();
+    DISKLED_OFF
+  }
+  if (!rx.left) {
+    rx.active = 0;
+    savesync_done();
+    f_close(&rx.file);
+    data_io_file_rx_done();
+  }
+}
+
+void data_io_rx_finish(void) {
+  while (rx.active) data_io_poll();
+}
+
+void data_io_rx_abort(void) {
+  if (!rx.active) return;
+  rx.active = 0;
+  // the file has parts of the save, hashes of other parts
+  savesync_forget();
+  f_close(&rx.file);
+}
+
 ////////////////
 // ROM UPLOAD //
 ////////////////
@@ -23,6 +23,17 @@ void data_io_file_tx_done();
 void data_io_fill_tx(unsigned char, unsigned int, char);
 void data_io_file_tx(FIL*, char, const char*);
 void data_io_file_rx(FIL*, char, unsigned int);
+char data_io_file_rx_background(const char *name, char index, unsigned int len);
+void data_io_rx_finish(void);
+void data_io_rx_abort(void);
+void data_io_poll(void);
+void data_io_stream_start(char index, const char *ext, uint32_t size);
+void data_io_stream_write(const unsigned char *data, unsigned short len);
+void data_io_stream_done(void);
+#ifdef HAVE_INFLATE
+// sends the entry of a ZIP archive opened with zip_entry_open(), 0 if it is broken
+char data_io_zip_tx(char index, const char *ext);
+#endif
 
 // called when a rom entry is found in the mist.ini
 void data_io_rom_upload(char *s, char mode);
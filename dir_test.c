@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "fat_compat.h"
+#include "utils.h"
+
+// Browses directories of a FAT16 RAM disk with the file selector scan of
+// fat_compat.c: every scroll and page step is compared with the sorted
+// list of the whole directory, for 8 and 16 OSD lines. A directory of
+// very long names overflows the name arena, its entries have to open
+// still. The RAM of the entry tables is compared with FILINFO tables.
+
+extern dir_entry_t   DirEntries[MAXDIRENTRIES];
+extern unsigned char sort_table[MAXDIRENTRIES];
+extern unsigned char nDirEntries;
+extern unsigned char iSelectedEntry;
+extern uint32_t      iPreviousDirectory;
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+
+static uint8_t *disk;
+static char osd_lines = 8;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+char OsdLines() {
+  return osd_lines;
+}
+
+void sched_yield(uint8_t busy) {
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  memcpy(buf, disk + lba * 512, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void format() {
+  uint8_t *b = disk;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(disk + 512, 0xfff8);
+  put16(disk + 514, 0xffff);
+  memcpy(disk + (1 + FAT_SECTORS) * 512, disk + 512, FAT_SECTORS * 512);
+}
+
+// ---------- directory content ----------
+static DWORD put_file(const char *name, unsigned int len) {
+  static uint8_t data[32768];
+  DWORD clust;
+  UINT bw;
+  FIL f;
+
+  CHECK(f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK);
+  memset(data, 0, len);
+  CHECK(f_write(&f, data, len, &bw) == FR_OK && bw == len);
+  clust = f.obj.sclust;
+  f_close(&f);
+  return clust;
+}
+
+// changes the attributes of the root directory entry starting at clust
+static void patch_root(DWORD clust, BYTE attr) {
+  uint8_t *e;
+
+  for (e = disk + ROOT_SECTOR * 512; e < disk + DATA_SECTOR * 512; e += 32) {
+    if (!e[0] || e[0] == 0xe5 || e[11] == ATTR_LFN) continue;
+    if ((e[26] | (e[27] << 8)) != clust) continue;
+    e[11] = attr;
+    if (attr & AM_DIR) put32(e + 28, 0);
+    return;
+  }
+  CHECK(0);
+}
+
+// a directory made of a file, f_mkdir() is not in the firmware's FatFs
+static void put_dir(const char *name) {
+  DWORD clust = put_file(name, 32768);
+  uint8_t *d = disk + (DATA_SECTOR + (clust - 2) * SPC) * 512;
+
+  memcpy(d, ".          ", 11);
+  d[11] = AM_DIR;
+  put16(d + 26, clust);
+  memcpy(d + 32, "..         ", 11);
+  d[32 + 11] = AM_DIR;
+  patch_root(clust, AM_DIR);
+}
+
+static const char *words[] = {
+  "Legend", "of", "the", "Mystic", "Sword", "Space", "Invaders", "Deluxe",
+  "Adventure", "Island", "Championship", "Edition", "Turbo", "Racing", "II",
+  "Return", "Dragon", "Quest", "Castle", "Knights"
+};
+
+// names from 8.3 ones to a bit more than 100 characters, some differ only
+// behind the 60th
+static void make_names(char names[][160], int n) {
+  int i, w;
+
+  for (i = 0; i < n; i++) {
+    char *p = names[i];
+    switch (i % 6) {
+    case 0:
+      sprintf(p, "GAME%02d.ROM", i);
+      break;
+    case 1:
+      sprintf(p, "game%02d.rom", i);
+      break;
+    case 2:
+      sprintf(p, "Mixed Case %d.Rom", i);
+      break;
+    case 3:
+      p[0] = 0;
+      for (w = 0; w < 3 + i % 11; w++) {
+        strcat(p, words[(i * 7 + w * 3) % 20]);
+        strcat(p, " ");
+      }
+      sprintf(p + strlen(p), "(%d).rom", i);
+      break;
+    default:
+      sprintf(p, "The Long Running Series Collection Volume Number One Part %03d %s.rom",
+              (i / 6) * 6, (i % 6 == 4) ? "(Europe)" : "(USA)");
+      break;
+    }
+  }
+}
+
+// ---------- the reference ----------
+static char ref_names[128][FF_LFN_BUF + 1];
+static BYTE ref_attr[128];
+static int  ref_count;
+
+static int compare(int a, int b) {
+  if ((ref_attr[b] & AM_DIR) && !(ref_attr[a] & AM_DIR)) return 1;
+  if ((ref_attr[a] & AM_DIR) && !(ref_attr[b] & AM_DIR)) return -1;
+  if (!strcmp(ref_names[b], "..")) return 1;
+  if (!strcmp(ref_names[a], "..")) return -1;
+  return _strnicmp(ref_names[a], ref_names[b], FF_LFN_BUF + 1);
+}
+
+// all the entries the selector shows, sorted
+static void reference(const char *ext) {
+  FILINFO fno;
+  DIR d;
+  int i, j;
+
+  ref_count = 0;
+  if (fs.cdir) {
+    strcpy(ref_names[0], "..");
+    ref_attr[0] = AM_DIR;
+    ref_count = 1;
+  }
+  CHECK(f_opendir(&d, ".") == FR_OK);
+  while (f_readdir(&d, &fno) == FR_OK && fno.fname[0]) {
+    const char *e = GetExtension(fno.fname);
+    if (fno.fattrib & AM_HID) continue;
+    if (!strcmp(fno.fname, ".") || !strcmp(fno.fname, "..")) continue;
+    if (!(fno.fattrib & AM_DIR) && strcmp(ext, "*") && (!e || strcasecmp(e, ext))) continue;
+    strcpy(ref_names[ref_count], fno.fname);
+    ref_attr[ref_count++] = fno.fattrib;
+  }
+  f_closedir(&d);
+
+  for (i = 1; i < ref_count; i++) {
+    for (j = i; j > 0 && compare(j, j - 1) < 0; j--) {
+      char name[FF_LFN_BUF + 1];
+      BYTE a = ref_attr[j];
+      strcpy(name, ref_names[j]);
+      strcpy(ref_names[j], ref_names[j - 1]);
+      ref_attr[j] = ref_attr[j - 1];
+      strcpy(ref_names[j - 1], name);
+      ref_attr[j - 1] = a;
+    }
+  }
+}
+
+// ---------- browsing ----------
+static int top, sel, shown;
+
+static int window_ok() {
+  int i;
+
+  if (nDirEntries != shown || iSelectedEntry != sel) return 0;
+  for (i = 0; i < shown; i++) {
+    dir_entry_t *e = &DirEntries[sort_table[i]];
+    if (strcmp(e->fname, ref_names[top + i])) return 0;
+    if ((e->fattrib & AM_DIR) != (ref_attr[top + i] & AM_DIR)) return 0;
+  }
+  return 1;
+}
+
+// what the selector has to show after mode
+static void step(int mode) {
+  int max = osd_lines, n;
+
+  switch (mode) {
+  case SCAN_INIT:
+    top = sel = 0;
+    shown = (ref_count < max) ? ref_count : max;
+    break;
+  case SCAN_NEXT:
+    if (sel + 1 < shown) sel++;
+    else if (shown == max && top + max < ref_count) top++;
+    break;
+  case SCAN_PREV:
+    if (sel) sel--;
+    else if (top) top--;
+    break;
+  case SCAN_NEXT_PAGE:
+    if (sel + 1 < shown) sel = shown - 1;
+    else if (shown == max) {
+      n = ref_count - top - max;
+      top += (n < max) ? n : max;
+    }
+    break;
+  case SCAN_PREV_PAGE:
+    if (sel) sel = 0;
+    else top -= (top < max) ? top : max;
+    break;
+  }
+}
+
+static void browse(const char *label, char *ext, unsigned char options) {
+  int i, bad = 0, steps = 0;
+
+  reference(ext);
+  ScanDirectory(SCAN_INIT, ext, options);
+  step(SCAN_INIT);
+  CHECK(window_ok());
+
+  // down and up a line at a time, then by pages
+  for (i = 0; i < ref_count + 2; i++, steps++) {
+    ScanDirectory(SCAN_NEXT, ext, options);
+    step(SCAN_NEXT);
+    if (!window_ok()) bad++;
+  }
+  CHECK(top + sel == ref_count - 1);
+  for (i = 0; i < ref_count + 2; i++, steps++) {
+    ScanDirectory(SCAN_PREV, ext, options);
+    step(SCAN_PREV);
+    if (!window_ok()) bad++;
+  }
+  CHECK(top == 0 && sel == 0);
+  for (i = 0; i < ref_count / osd_lines + 2; i++, steps++) {
+    ScanDirectory(SCAN_NEXT_PAGE, ext, options);
+    step(SCAN_NEXT_PAGE);
+    if (!window_ok()) bad++;
+  }
+  for (i = 0; i < ref_count / osd_lines + 2; i++, steps++) {
+    ScanDirectory(SCAN_PREV_PAGE, ext, options);
+    step(SCAN_PREV_PAGE);
+    if (!window_ok()) bad++;
+  }
+  CHECK(top == 0 && sel == 0);
+  CHECK(!bad);
+  printf("  %-20s %2d lines: %3d entries, %3d steps, %s\n", label, osd_lines, ref_count, steps,
+         bad ? "order differs" : "same order");
+}
+
+// the first file starting with a letter
+static void find_letter(char *ext, unsigned char options, char c) {
+  int i;
+
+  reference(ext);
+  ScanDirectory(SCAN_INIT, ext, options);
+  for (i = 0; i < ref_count; i++)
+    if (!(ref_attr[i] & AM_DIR) && tolower(ref_names[i][0]) >= tolower(c)) break;
+  CHECK(i < ref_count && tolower(ref_names[i][0]) == tolower(c));
+  CHECK(ScanDirectory(c, ext, options | FIND_FILE) == 1);
+  top = i;
+  sel = 0;
+  shown = (ref_count - i < osd_lines) ? ref_count - i : osd_lines;
+  CHECK(window_ok());
+}
+
+// every shown entry opens, with its long name or the short one
+static void open_all(char *ext, unsigned char options) {
+  int i, pages = 0, arena = 0;
+  FIL f;
+
+  reference(ext);
+  ScanDirectory(SCAN_INIT, ext, options);
+  do {
+    for (i = 0; i < nDirEntries; i++) {
+      dir_entry_t *e = &DirEntries[sort_table[i]];
+      if (e->fattrib & AM_DIR) continue;
+      CHECK(f_open(&f, e->fname, FA_READ) == FR_OK);
+      f_close(&f);
+      if (e->fname != e->sfn) arena++;
+    }
+    iSelectedEntry = nDirEntries - 1;
+    ScanDirectory(SCAN_NEXT_PAGE, ext, options);
+  } while (++pages <= ref_count / osd_lines);
+  CHECK(arena);
+  printf("  %-20s %2d lines: %3d entries, %3d shown with the long name\n", "names > arena", osd_lines,
+         ref_count, arena);
+}
+
+int main(int argc, char **argv) {
+  static char names[96][160];
+  char long_name[FF_LFN_BUF + 1];
+  int i;
+
+  disk = calloc(DISK_SECTORS, 512);
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+
+  make_names(names, 96);
+  for (i = 0; i < 80; i++) put_file(names[i], 100 + i);
+  for (i = 0; i < 6; i++) {
+    char n[64];
+    sprintf(n, "%s %d.TXT", words[i], i);
+    put_file(n, 10);
+  }
+  patch_root(put_file("HIDDEN.ROM", 10), AM_HID);
+  put_dir("SUB");
+  put_dir("Another Directory With A Long Name");
+  put_dir("AARDVARK");
+  put_dir("LONG");
+  CHECK(FindDrive());
+
+  ChangeDirectoryName("SUB");
+  for (i = 80; i < 96; i++) put_file(names[i], 10);
+  ChangeDirectoryName("..");
+  ChangeDirectoryName("LONG");
+  // 40 names of 200 characters don't fit into the arena together
+  for (i = 0; i < 40; i++) {
+    memset(long_name, 'A' + i % 26, 200);
+    sprintf(long_name + 200, "%02d.rom", i);
+    put_file(long_name, 10);
+  }
+  ChangeDirectoryName("..");
+
+  printf("Directory browsing:\n");
+  for (osd_lines = 8; osd_lines <= MAXDIRENTRIES; osd_lines += 8) {
+    browse("root, ROM and dirs", "ROM", SCAN_DIR);
+    browse("root, all files", "*", 0);
+    find_letter("ROM", SCAN_DIR, 'M');
+    find_letter("ROM", SCAN_DIR, 'T');
+
+    ChangeDirectoryName("SUB");
+    browse("subdirectory", "ROM", SCAN_DIR);
+    // back in the parent the directory left is at the top
+    ChangeDirectoryName("..");
+    CHECK(ScanDirectory(SCAN_INIT_FIRST, "ROM", SCAN_DIR) == 1);
+    ScanDirectory(SCAN_INIT_NEXT, "ROM", SCAN_DIR);
+    CHECK(!strcmp(DirEntries[sort_table[0]].fname, "SUB"));
+    CHECK(DirEntries[sort_table[1]].fname[0]);
+
+    ChangeDirectoryName("LONG");
+    open_all("ROM", SCAN_DIR);
+    ChangeDirectoryName("..");
+  }
+
+  printf("Entry tables: %lu bytes with FILINFO, %lu bytes compact (%lu + %d name arena), %lu saved\n",
+         (unsigned long)(2 * MAXDIRENTRIES * sizeof(FILINFO)),
+         (unsigned long)(2 * MAXDIRENTRIES * sizeof(dir_entry_t) + DIR_NAMES_SIZE),
+         (unsigned long)(2 * MAXDIRENTRIES * sizeof(dir_entry_t)), DIR_NAMES_SIZE,
+         (unsigned long)(2 * MAXDIRENTRIES * (sizeof(FILINFO) - sizeof(dir_entry_t)) - DIR_NAMES_SIZE));
+
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
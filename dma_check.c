@@ -0,0 +1,119 @@
+// dma_check.c
+// dma_map() and dma_unmap() of the host tests, where mock drivers stand in
+// for the DMA. A mapped buffer belongs to the DMA until it is unmapped: the
+// pages completely inside it are made read only if the DMA reads it and
+// inaccessible if the DMA writes it, so the CPU touching it too early traps.
+// The access is counted, the page opened and the test goes on. The parts of
+// a buffer on pages shared with other data are not checked.
+
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "dma_check.h"
+
+#define MAX_MAPPED 8
+
+unsigned long dma_violations;
+
+static struct {
+  const void *buf;
+  uint32_t    len;
+  dma_dir_t   dir;
+  uintptr_t   start, end;   // the protected pages
+  uintptr_t   fault;        // first CPU access
+} mapped[MAX_MAPPED];
+
+static uintptr_t page_size;
+static struct sigaction old_action;
+
+static void protect(int i, int prot) {
+  if (mapped[i].end > mapped[i].start)
+    mprotect((void*)mapped[i].start, mapped[i].end - mapped[i].start, prot);
+}
+
+static void fault_handler(int sig, siginfo_t *info, void *ctx) {
+  uintptr_t addr = (uintptr_t)info->si_addr;
+  int i;
+
+  for (i = 0; i < MAX_MAPPED; i++) {
+    if (mapped[i].buf && addr >= mapped[i].start && addr < mapped[i].end) {
+      if (!mapped[i].fault) mapped[i].fault = addr;
+      dma_violations++;
+      mprotect((void*)(addr & ~(page_size - 1)), page_size, PROT_READ | PROT_WRITE);
+      return;
+    }
+  }
+  // a real crash, it happens again with the old handler
+  sigaction(SIGSEGV, &old_action, 0);
+}
+
+static void install(void) {
+  struct sigaction sa;
+
+  if (page_size) return;
+  page_size = sysconf(_SC_PAGESIZE);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = fault_handler;
+  sa.sa_flags = SA_SIGINFO;
+  sigaction(SIGSEGV, &sa, &old_action);
+}
+
+static int find(const void *p) {
+  int i;
+
+  for (i = 0; i < MAX_MAPPED; i++)
+    if (mapped[i].buf && (uintptr_t)p >= (uintptr_t)mapped[i].buf &&
+        (uintptr_t)p < (uintptr_t)mapped[i].buf + mapped[i].len)
+      return i;
+  return -1;
+}
+
+void dma_map(const void *buf, uint32_t len, dma_dir_t dir) {
+  int i;
+
+  install();
+  if (find(buf) >= 0 || find((const uint8_t*)buf + len - 1) >= 0) {
+    printf("DMA: %p+%u is mapped twice\n", buf, len);
+    dma_violations++;
+    return;
+  }
+  for (i = 0; i < MAX_MAPPED && mapped[i].buf; i++);
+  if (i == MAX_MAPPED) {
+    printf("DMA: too many mapped buffers\n");
+    dma_violations++;
+    return;
+  }
+  mapped[i].buf = buf;
+  mapped[i].len = len;
+  mapped[i].dir = dir;
+  mapped[i].start = ((uintptr_t)buf + page_size - 1) & ~(page_size - 1);
+  mapped[i].end = ((uintptr_t)buf + len) & ~(page_size - 1);
+  mapped[i].fault = 0;
+  protect(i, (dir == DMA_TO_DEVICE) ? PROT_READ : PROT_NONE);
+}
+
+void dma_unmap(const void *buf, uint32_t len, dma_dir_t dir) {
+  int i = find(buf);
+
+  if (i < 0 || mapped[i].buf != buf || mapped[i].len != len || mapped[i].dir != dir) {
+    printf("DMA: %p+%u is not mapped like this\n", buf, len);
+    dma_violations++;
+    return;
+  }
+  protect(i, PROT_READ | PROT_WRITE);
+  if (mapped[i].fault)
+    printf("DMA: CPU access at offset %lu of %p+%u while the DMA owns it\n",
+           (unsigned long)(mapped[i].fault - (uintptr_t)buf), buf, len);
+  mapped[i].buf = 0;
+}
+
+void dma_device_write(void *dst, const void *src, uint32_t len) {
+  int i = find(dst);
+
+  if (i >= 0) protect(i, PROT_READ | PROT_WRITE);
+  memcpy(dst, src, len);
+  if (i >= 0) protect(i, (mapped[i].dir == DMA_TO_DEVICE) ? PROT_READ : PROT_NONE);
+}
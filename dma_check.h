@@ -0,0 +1,20 @@
+/*
+ * dma_check.h
+ * Ownership checks of DMA buffers for the host tests
+ *
+ */
+
+#ifndef DMA_CHECK_H
+#define DMA_CHECK_H
+
+#include <stdint.h>
+#include "hw/ATSAMV71/cache.h"
+
+// CPU accesses to buffers owned by the DMA, and unbalanced dma_map() /
+// dma_unmap() calls
+extern unsigned long dma_violations;
+
+// the mock DMA stores received data in a mapped buffer
+void dma_device_write(void *dst, const void *src, uint32_t len);
+
+#endif // DMA_CHECK_H
@@ -0,0 +1,166 @@
+// eth_bridge.c
+// Moves ethernet frames between the core and the network device. Frames
+// are queued in both directions, so a slow side doesn't stall the other
+// one, and several frames are moved per poll.
+
+#include <stdio.h>
+#include <string.h>
+#include "eth_bridge.h"
+#ifdef ETH_BRIDGE_TEST
+uint32_t user_io_eth_get_status(void);
+void user_io_eth_send_rx_frame(uint8_t *, uint16_t);
+void user_io_eth_receive_tx_frame(uint8_t *, uint16_t);
+#define eth_debug(...)
+#define siprintf sprintf
+#else
+#include "user_io.h"
+#include "debug.h"
+#endif
+
+// FPGA status word
+#define ETH_STATUS_CMD(s)   ((s) >> 24)
+#define ETH_STATUS_LEN(s)   ((s) & 0xffff)
+#define ETH_STATUS_PRX      0x20000    // core rx buffer is busy
+#define ETH_CMD_TX_FRAME    0xa5       // core has a frame to send
+
+typedef struct {
+	uint16_t len;
+	uint8_t data[ETH_BRIDGE_FRAMELEN];
+} eth_frame_t;
+
+typedef struct {
+	uint8_t head;    // next slot to be filled
+	uint8_t tail;    // oldest filled slot
+	uint8_t count;
+} eth_queue_t;
+
+static eth_frame_t tx_frames[ETH_TX_FRAMES] __attribute__ ((aligned(4)));
+static eth_frame_t rx_frames[ETH_RX_FRAMES] __attribute__ ((aligned(4)));
+static eth_queue_t tx_queue, rx_queue;
+static eth_bridge_stats_t stats;
+static uint32_t old_status;
+// the waiting frame of each side has been counted as an overrun
+static char tx_overrun, rx_overrun;
+
+#define QUEUE_NEXT(i, n) (((i) + 1 == (n)) ? 0 : (i) + 1)
+
+void eth_bridge_init() {
+	memset(&tx_queue, 0, sizeof(tx_queue));
+	memset(&rx_queue, 0, sizeof(rx_queue));
+	memset(&stats, 0, sizeof(stats));
+	old_status = 0;
+	tx_overrun = rx_overrun = 0;
+}
+
+// exchange frames with the core
+void eth_bridge_poll() {
+	uint8_t burst;
+
+	for (burst = 0; burst < ETH_BRIDGE_BURST; burst++) {
+		char moved = 0, changed = 0;
+		uint32_t status = user_io_eth_get_status();
+
+		if(status != old_status) {
+			changed = 1;
+			eth_debug("fpga status changed to cmd %x, eq=%d, prx=%d, ptx=%d, len=%d",
+			  status >> 24, (status & 0x40000)?1:0, (status & 0x20000)?1:0,
+			  (status & 0x10000)?1:0, status & 0xffff);
+			old_status = status;
+		}
+
+		// core -> tx queue
+		if(ETH_STATUS_CMD(status) == ETH_CMD_TX_FRAME) {
+			uint16_t len = ETH_STATUS_LEN(status);
+
+			if(len > ETH_BRIDGE_FRAMELEN) {
+				// left in the core, count it only once
+				if(changed) stats.tx_drops++;
+			} else if(tx_queue.count < ETH_TX_FRAMES) {
+				eth_frame_t *f = &tx_frames[tx_queue.head];
+				user_io_eth_receive_tx_frame(f->data, len);
+				f->len = len;
+				tx_queue.head = QUEUE_NEXT(tx_queue.head, ETH_TX_FRAMES);
+				tx_queue.count++;
+				stats.tx_frames++;
+				tx_overrun = 0;
+				moved = 1;
+			} else if(!tx_overrun) {
+				// the frame waits in the core, count it only once
+				stats.tx_overruns++;
+				tx_overrun = 1;
+			}
+		}
+
+		// rx queue -> core
+		if(rx_queue.count) {
+			if(!(status & ETH_STATUS_PRX)) {
+				eth_frame_t *f = &rx_frames[rx_queue.tail];
+				user_io_eth_send_rx_frame(f->data, f->len);
+				rx_queue.tail = QUEUE_NEXT(rx_queue.tail, ETH_RX_FRAMES);
+				rx_queue.count--;
+				stats.rx_frames++;
+				rx_overrun = 0;
+				moved = 1;
+			} else if(!rx_overrun) {
+				stats.rx_overruns++;
+				rx_overrun = 1;
+			}
+		}
+
+		if(!moved) break;
+	}
+}
+
+// oldest frame from the core, returns its length or 0 if there's none
+uint16_t eth_bridge_tx_get(uint8_t **data) {
+	if(!tx_queue.count) return 0;
+	*data = tx_frames[tx_queue.tail].data;
+	return tx_frames[tx_queue.tail].len;
+}
+
+// the frame returned by eth_bridge_tx_get() has been sent
+void eth_bridge_tx_done() {
+	if(!tx_queue.count) return;
+	tx_queue.tail = QUEUE_NEXT(tx_queue.tail, ETH_TX_FRAMES);
+	tx_queue.count--;
+}
+
+// buffer for the next received frame, NULL if the queue is full
+uint8_t *eth_bridge_rx_get_buffer() {
+	if(rx_queue.count == ETH_RX_FRAMES) return 0;
+	return rx_frames[rx_queue.head].data;
+}
+
+// a frame has been stored in the buffer from eth_bridge_rx_get_buffer()
+void eth_bridge_rx_put(uint16_t len) {
+	if(rx_queue.count == ETH_RX_FRAMES) return;
+	// the core expects at least a minimum sized ethernet frame
+	if(len < 64) {
+		memset(rx_frames[rx_queue.head].data + len, 0, 64 - len);
+		len = 64;
+	}
+	rx_frames[rx_queue.head].len = len;
+	rx_queue.head = QUEUE_NEXT(rx_queue.head, ETH_RX_FRAMES);
+	rx_queue.count++;
+}
+
+// the network device had to discard frames
+void eth_bridge_rx_drop(uint32_t frames) {
+	stats.rx_drops += frames;
+}
+
+const eth_bridge_stats_t *eth_bridge_get_stats() {
+	return &stats;
+}
+
+void eth_bridge_dump(void (*out)(char *line)) {
+	char line[48];
+
+	out("       frames    drops overruns");
+	siprintf(line, "tx %10lu %8lu %8lu", (unsigned long)stats.tx_frames,
+	         (unsigned long)stats.tx_drops, (unsigned long)stats.tx_overruns);
+	out(line);
+	siprintf(line, "rx %10lu %8lu %8lu", (unsigned long)stats.rx_frames,
+	         (unsigned long)stats.rx_drops, (unsigned long)stats.rx_overruns);
+	out(line);
+}
@@ -0,0 +1,53 @@
+/*
+ * eth_bridge.h
+ * Frame queues between the ethernet interface of the core and the
+ * network device (GMAC or USB ASIX adapter)
+ *
+ */
+
+#ifndef ETH_BRIDGE_H
+#define ETH_BRIDGE_H
+
+#include <stdint.h>
+
+#define ETH_BRIDGE_FRAMELEN 1536
+
+// frames read from the core, waiting for the network device
+#ifndef ETH_TX_FRAMES
+#define ETH_TX_FRAMES 4
+#endif
+
+// frames received from the network, waiting for the core
+#ifndef ETH_RX_FRAMES
+#define ETH_RX_FRAMES 4
+#endif
+
+// max. number of frames moved from/to the core in one poll
+#define ETH_BRIDGE_BURST 4
+
+typedef struct {
+	uint32_t tx_frames;    // frames read from the core
+	uint32_t rx_frames;    // frames written to the core
+	uint32_t tx_drops;     // oversized frames from the core
+	uint32_t rx_drops;     // network frames lost by the device: malformed, or
+	                       // no room left while the rx queue was full
+	uint32_t tx_overruns;  // frames of the core which found the tx queue full
+	uint32_t rx_overruns;  // frames which found the core rx buffer busy
+} eth_bridge_stats_t;
+
+void eth_bridge_init();
+void eth_bridge_poll();
+
+// network side of the tx queue
+uint16_t eth_bridge_tx_get(uint8_t **data);
+void eth_bridge_tx_done();
+
+// network side of the rx queue
+uint8_t *eth_bridge_rx_get_buffer();
+void eth_bridge_rx_put(uint16_t len);
+void eth_bridge_rx_drop(uint32_t frames);
+
+const eth_bridge_stats_t *eth_bridge_get_stats();
+void eth_bridge_dump(void (*out)(char *line));
+
+#endif // ETH_BRIDGE_H
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "eth_bridge.h"
+
+// Loopback through the bridge: the mocked core sends frames, the network
+// side returns them and the core checks what it receives.
+
+#define FRAMES        100000
+#define CORE_RX_DELAY 2       // status reads until the core consumed a rx frame
+
+static uint8_t core_tx[ETH_BRIDGE_FRAMELEN];
+static uint16_t core_tx_len;
+static uint32_t core_tx_seq, core_rx_seq;
+static int core_rx_busy;
+static uint32_t status_reads, spi_bytes, errors;
+static uint16_t oversized;    // length of a frame too big for the bridge
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+static void make_frame(uint32_t seq, uint8_t *d, uint16_t *len) {
+	*len = 64 + (seq * 97) % (ETH_BRIDGE_FRAMELEN - 64);
+	for (int i = 0; i < *len; i++) d[i] = seq + i;
+}
+
+// ---------- mocked FPGA ethernet interface ----------
+uint32_t user_io_eth_get_status(void) {
+	uint32_t s = 0;
+
+	status_reads++;
+	spi_bytes += 5;
+	if (core_rx_busy) core_rx_busy--;
+	if (oversized) {
+		s = 0xa5000000 | oversized;
+	} else if (core_tx_seq < FRAMES) {
+		if (!core_tx_len) make_frame(core_tx_seq, core_tx, &core_tx_len);
+		s = 0xa5000000 | core_tx_len;
+	}
+	if (core_rx_busy) s |= 0x20000;
+	return s;
+}
+
+void user_io_eth_receive_tx_frame(uint8_t *d, uint16_t len) {
+	spi_bytes += len + 1;
+	memcpy(d, core_tx, len);
+	core_tx_len = 0;
+	core_tx_seq++;
+}
+
+void user_io_eth_send_rx_frame(uint8_t *s, uint16_t len) {
+	uint8_t ref[ETH_BRIDGE_FRAMELEN];
+	uint16_t ref_len;
+
+	spi_bytes += len + 2;
+	if (core_rx_busy) {
+		printf("frame %u written while core rx buffer busy\n", core_rx_seq);
+		errors++;
+	}
+	make_frame(core_rx_seq, ref, &ref_len);
+	if (len != ref_len || memcmp(s, ref, len)) {
+		printf("frame %u corrupted\n", core_rx_seq);
+		errors++;
+	}
+	core_rx_seq++;
+	core_rx_busy = CORE_RX_DELAY;
+}
+
+// every waiting frame is counted once, however often it is polled
+static void test_counters() {
+	const eth_bridge_stats_t *stats = eth_bridge_get_stats();
+	uint8_t *frame;
+	int i;
+
+	eth_bridge_init();
+	oversized = ETH_BRIDGE_FRAMELEN + 1;
+	for (i = 0; i < 10; i++) eth_bridge_poll();
+	CHECK(stats->tx_drops == 1);
+	CHECK(stats->tx_frames == 0);
+	oversized = 0;
+
+	// the network side doesn't take frames, the tx queue fills up
+	eth_bridge_init();
+	core_tx_seq = 0;
+	core_tx_len = 0;
+	for (i = 0; i < 10; i++) eth_bridge_poll();
+	CHECK(stats->tx_frames == ETH_TX_FRAMES);
+	CHECK(stats->tx_overruns == 1);
+	// one frame sent, the next one waits again
+	eth_bridge_tx_get(&frame);
+	eth_bridge_tx_done();
+	for (i = 0; i < 10; i++) eth_bridge_poll();
+	CHECK(stats->tx_frames == ETH_TX_FRAMES + 1);
+	CHECK(stats->tx_overruns == 2);
+
+	// the core rx buffer stays busy
+	core_rx_busy = 100;
+	eth_bridge_rx_put(64);
+	for (i = 0; i < 10; i++) eth_bridge_poll();
+	CHECK(stats->rx_frames == 0);
+	CHECK(stats->rx_overruns == 1);
+
+	eth_bridge_rx_drop(1);
+	eth_bridge_rx_drop(3);
+	CHECK(stats->rx_drops == 4);
+}
+
+int main() {
+	uint32_t polls = 0;
+	clock_t start = clock();
+	const eth_bridge_stats_t *stats;
+
+	eth_bridge_init();
+	while (core_rx_seq < FRAMES && polls < FRAMES * 10) {
+		uint8_t *frame, *buf;
+		uint16_t len;
+
+		eth_bridge_poll();
+		// network loopback
+		while ((len = eth_bridge_tx_get(&frame)) && (buf = eth_bridge_rx_get_buffer())) {
+			memcpy(buf, frame, len);
+			eth_bridge_rx_put(len);
+			eth_bridge_tx_done();
+		}
+		polls++;
+	}
+
+	double s = (double)(clock() - start) / CLOCKS_PER_SEC;
+	stats = eth_bridge_get_stats();
+	printf("%u frames in %u polls (%.2f frames/poll), %u status reads\n",
+	       core_rx_seq, polls, (double)core_rx_seq / polls, status_reads);
+	printf("%.0f frames/s host, %.1f SPI bytes/frame\n", core_rx_seq / s, (double)spi_bytes / core_rx_seq);
+	printf("tx %u rx %u tx_drops %u rx_drops %u tx_overruns %u rx_overruns %u\n",
+	       stats->tx_frames, stats->rx_frames, stats->tx_drops, stats->rx_drops,
+	       stats->tx_overruns, stats->rx_overruns);
+	CHECK(core_rx_seq == FRAMES);
+	CHECK(stats->tx_frames == FRAMES && stats->rx_frames == FRAMES);
+	CHECK(stats->tx_drops == 0 && stats->rx_drops == 0);
+	// at most once per frame
+	CHECK(stats->tx_overruns <= FRAMES && stats->rx_overruns <= FRAMES);
+
+	test_counters();
+	printf("%s\n", errors ? "FAILED" : "PASSED");
+	return errors ? 1 : 0;
+}
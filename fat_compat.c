@@ -8,11 +8,15 @@
 #include "osd.h"
 #include "attrs.h"
 #include "utils.h"
+#include "sched.h"
+#ifdef HAVE_INFLATE
+#include "zip.h"
+#endif
 
 #include "FatFs/ff.h"
 #include "FatFs/diskio.h"
 
-unsigned char sector_buffer[SECTOR_BUFFER_SIZE]; // sector buffer for one CDDA sector (or 4 SD sector)
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE] __attribute__ ((aligned(32))); // sector buffer for one CDDA sector (or 4 SD sector)
 struct PartitionEntry partitions[4];             // lbastart and sectors will be byteswapped as necessary
 int partitioncount;
 
@@ -132,6 +136,23 @@ void ChangeDirectoryName(unsigned char *name) {
 	uint32_t      iPreviousDirectoryTmp = fs.cdir;
 
 	iprintf("ChangeDirectoryName: %s -> %s = ", cwd, name);
+#ifdef HAVE_INFLATE
+	// a ZIP archive is entered like a directory and left to the one holding it
+	if (zip_is_open()) {
+		DWORD archive = zip_cluster();
+		zip_close();
+		if (!strcmp(name, "..")) {
+			iPreviousDirectory = archive;
+			iprintf("%s\n", cwd);
+			return;
+		}
+	}
+	const char *ext = GetExtension(name);
+	if (name[0] != '/' && ext && !strncasecmp(ext, "ZIP", 3) && zip_open(name) == FR_OK) {
+		iprintf("%s/%s\n", cwd, name);
+		return;
+	}
+#endif
 	if(name[0] == '/') {
 		// Absolute path
 		strcpy(sector_buffer, name);
@@ -162,6 +183,14 @@ void ChangeDirectoryName(unsigned char *name) {
 	iprintf("%s\n", cwd);
 }
 
+char InArchive(void) {
+#ifdef HAVE_INFLATE
+	return zip_is_open();
+#else
+	return 0;
+#endif
+}
+
 // Simplified function which doesn't use any library routines
 // Requires an initialized cltbl
 #pragma section_code_init
@@ -215,7 +244,13 @@ RAMFUNC FRESULT FileReadNextBlock (
 	if (sect == 0) return(FR_INT_ERR);
 	sect += csect;
 	MMC_Read(sect, buff);
+	// with a private window fp->sect is the sector held there, not this one
+#if FF_FS_TINY && FF_FS_FILEBUFS
+	if (!fp->buf)
+#endif
+#if FF_FS_TINY
 	fp->sect = sect;
+#endif
 	fp->fptr += 512;
 	return (FR_OK);
 }
@@ -252,20 +287,91 @@ FRESULT FileWriteBlock(FIL *file, unsigned char *pBuffer) {
 }
 
 
-FILINFO       DirEntries[MAXDIRENTRIES];
+dir_entry_t   DirEntries[MAXDIRENTRIES];
 unsigned char sort_table[MAXDIRENTRIES];
 unsigned char nDirEntries = 0;          // entries in DirEntry table
 unsigned char iSelectedEntry = 0;       // selected entry index
 unsigned char maxDirEntries = 0;
 
-static FILINFO       t_DirEntries[MAXDIRENTRIES];
+static dir_entry_t   t_DirEntries[MAXDIRENTRIES];
 static unsigned char t_sort_table[MAXDIRENTRIES];
 
+// the names longer than a short name of both tables
+static char          names[DIR_NAMES_SIZE];
+static unsigned int  names_used;
+
 static DIR           dir;
 static FILINFO       fil;
+static dir_entry_t   cur;                  // the entry in fil, with its name there
 static unsigned char nNewEntries = 0;      // indicates if a new entry has been found (used in scroll mode)
 
-FAST static int CompareDirEntries(FILINFO *pDirEntry1, FILINFO *pDirEntry2)
+static void ClearDirEntries(dir_entry_t *entries) {
+	for (int i = 0; i < MAXDIRENTRIES; i++) {
+		entries[i].sfn[0] = 0;
+		entries[i].fname = entries[i].sfn;
+	}
+}
+
+// moves the names of the table entries to the start of the arena, the
+// ones of replaced entries are dropped
+static void CompactNames(void) {
+	dir_entry_t *e, *next;
+	char *last = 0, *dst = names;
+	unsigned int len;
+
+	while (1) {
+		// the names are moved down in the order they are in the arena
+		next = 0;
+		for (int i = 0; i < 2 * MAXDIRENTRIES; i++) {
+			e = (i < MAXDIRENTRIES) ? &DirEntries[i] : &t_DirEntries[i - MAXDIRENTRIES];
+			if (e->fname < names || e->fname >= names + DIR_NAMES_SIZE || e->fname <= last) continue;
+			if (!next || e->fname < next->fname) next = e;
+		}
+		if (!next) break;
+		last = next->fname;
+		len = strlen(next->fname) + 1;
+		memmove(dst, next->fname, len);
+		next->fname = dst;
+		dst += len;
+	}
+	names_used = dst - names;
+}
+
+static char *AllocName(unsigned int len) {
+	if (names_used + len > DIR_NAMES_SIZE) CompactNames();
+	if (names_used + len > DIR_NAMES_SIZE) return 0;
+	names_used += len;
+	return names + names_used - len;
+}
+
+// a name which fits is kept in the entry, a long one goes to the arena. If
+// that is full the short name is used, it still opens the file
+FAST static void CopyDirEntry(dir_entry_t *dst, const dir_entry_t *src)
+{
+	unsigned int len = strlen(src->fname) + 1;
+	char *name;
+
+	dst->fsize = src->fsize;
+	dst->fclust = src->fclust;
+	dst->fattrib = src->fattrib;
+	dst->fname = dst->sfn; // the old name is dropped
+	if (len <= sizeof(dst->sfn)) {
+		strcpy(dst->sfn, src->fname);
+		return;
+	}
+	strcpy(dst->sfn, src->sfn);
+	if ((name = AllocName(len))) {
+		// src->fname may have been moved by the compaction
+		memcpy(name, src->fname, len);
+		dst->fname = name;
+	} else if (!dst->sfn[0]) {
+		// no short name (exFAT, archives), only shown cut off
+		strncpy(dst->sfn, src->fname, FF_SFN_BUF);
+		dst->sfn[FF_SFN_BUF] = 0;
+	}
+}
+
+FAST static int CompareDirEntries(const dir_entry_t *pDirEntry1, const dir_entry_t *pDirEntry2)
 {
 	int rc;
 
@@ -341,6 +447,7 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 	char initial = 1;
 	int i;
 	unsigned char x;
+	unsigned int scanned = 0;
 
 	maxDirEntries = OsdLines();
 
@@ -350,6 +457,13 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 		iSelectedEntry = 0;
 		for (i = 0; i < maxDirEntries; i++)
 			sort_table[i] = i;
+		ClearDirEntries(DirEntries);
+		names_used = 0;
+#ifdef HAVE_INFLATE
+		// only the selectors which can load from an archive stay inside
+		if (zip_is_open() && !(options & SCAN_ZIP)) zip_close();
+		if (!zip_is_open())
+#endif
 		if (f_opendir(&dir, ".") != FR_OK) return 0;
 	}
 	else
@@ -401,20 +515,46 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 	//enable caching in the sector buffer while traversing the directory,
 	//because FatFs is inefficiently using single sector reads
 	disk_cache_set(true, fs.database);
+#ifdef HAVE_INFLATE
+	unsigned int zip_index = 0;
+	if (!zip_is_open())
+#endif
 	f_rewinddir(&dir);
 	nNewEntries = 0;
+	ClearDirEntries(t_DirEntries);
 	while (1) {
-		if (initial && fs.cdir && options & (SCAN_DIR | SCAN_SYSDIR)) {
+		// keep servicing the storage and input requests in large directories.
+		// The tasks read and write the card and use the sector buffer, so the
+		// cache is off while they run and starts empty again afterwards
+		if (!(++scanned & 15)) {
+			disk_cache_set(false, 0);
+			sched_yield(0);
+			disk_cache_set(true, fs.database);
+		}
+		if (initial && (fs.cdir || InArchive()) && options & (SCAN_DIR | SCAN_SYSDIR)) {
 			fil.fattrib = AM_DIR;
 			strcpy(fil.fname, "..");
 			fil.altname[0] = 0;
 			initial = 0;
+#ifdef HAVE_INFLATE
+		} else if (zip_is_open()) {
+			zip_readdir(zip_index++, &fil);
+#endif
 		} else {
 			if (f_readdir(&dir, &fil) != FR_OK) break;
 		}
 		if (fil.fname[0] == 0) break;
+#ifdef HAVE_INFLATE
+		if (options & SCAN_ZIP && !zip_is_open() && !(fil.fattrib & AM_DIR) && CompareExt(fil.fname, "ZIP"))
+			fil.fattrib |= AM_DIR;
+#endif
 
 		is_file = ~fil.fattrib & AM_DIR;
+		cur.fsize = fil.fsize;
+		cur.fclust = fil.fclust;
+		cur.fattrib = fil.fattrib;
+		strcpy(cur.sfn, fil.altname);
+		cur.fname = fil.fname;
 
 		if (!(fil.fattrib & AM_HID) &&
 		   ((extension[0] == '*')
@@ -425,11 +565,11 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 			if (mode == SCAN_INIT) { // initial directory scan (first 8 entries)
 				if (nDirEntries < maxDirEntries) {
 					//iprintf("fname=%s, altname=%s\n", fil.fname, fil.altname);
-					DirEntries[nDirEntries] = fil;
+					CopyDirEntry(&DirEntries[nDirEntries], &cur);
 					nDirEntries++;
-				} else if (CompareDirEntries(&fil, &DirEntries[sort_table[maxDirEntries-1]]) < 0) {// compare new entry with the l
+				} else if (CompareDirEntries(&cur, &DirEntries[sort_table[maxDirEntries-1]]) < 0) {// compare new entry with the l
 					// replace the last entry with the new one if appropriate
-					DirEntries[sort_table[maxDirEntries-1]] = fil;
+					CopyDirEntry(&DirEntries[sort_table[maxDirEntries-1]], &cur);
 				}
 				for (i = nDirEntries - 1; i > 0; i--) {// one pass bubble-sorting (table is already sorted, only the new item must be placed in order)
 					if (CompareDirEntries(&DirEntries[sort_table[i]], &DirEntries[sort_table[i-1]])<0) // compare items
@@ -450,19 +590,19 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 					nDirEntries = 1;
 					iSelectedEntry = 0;
 
-					DirEntries[0] = fil; // add the entry at the top of the buffer
+					CopyDirEntry(&DirEntries[0], &cur); // add the entry at the top of the buffer
 					rc = 1; // indicate to the caller that the directory entry has been found
 					break;
 				}
 			} else if (mode == SCAN_INIT_NEXT) {
 				// scan the directory table and return next maxDirEntries-1 alphabetically sorted entries (first entry is in the buffer)
-				if (CompareDirEntries(&fil, &DirEntries[sort_table[0]]) > 0) {// compare new entry with the first one
+				if (CompareDirEntries(&cur, &DirEntries[sort_table[0]]) > 0) {// compare new entry with the first one
 					if (nDirEntries < maxDirEntries) {// initial directory scan (first 8 entries)
-						DirEntries[nDirEntries] = fil; // add new entry at first empty slot in storage buffer
+						CopyDirEntry(&DirEntries[nDirEntries], &cur); // add new entry at first empty slot in storage buffer
 						nDirEntries++;
 					} else {
-						if (CompareDirEntries(&fil, &DirEntries[sort_table[maxDirEntries-1]]) < 0) {// compare new entry with the last already found
-							DirEntries[sort_table[maxDirEntries-1]] = fil; // replace the last entry with the new one if appropriate
+						if (CompareDirEntries(&cur, &DirEntries[sort_table[maxDirEntries-1]]) < 0) {// compare new entry with the last already found
+							CopyDirEntry(&DirEntries[sort_table[maxDirEntries-1]], &cur); // replace the last entry with the new one if appropriate
 						}
 					}
 
@@ -477,9 +617,9 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 				}
 			} else if (mode == SCAN_NEXT) {
 				if (nNewEntries == 0) {// no entry higher than the last one has been found yet
-					if (CompareDirEntries(&fil, &DirEntries[sort_table[maxDirEntries-1]]) > 0) { // found entry higher than the
+					if (CompareDirEntries(&cur, &DirEntries[sort_table[maxDirEntries-1]]) > 0) { // found entry higher than the
 						nNewEntries++;
-						DirEntries[sort_table[0]] = fil;
+						CopyDirEntry(&DirEntries[sort_table[0]], &cur);
 						// scroll entries' indices
 						x = sort_table[0];
 						for (i = 0; i < maxDirEntries-1; i++)
@@ -488,17 +628,17 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 					}
 				} else {// higher entry already found but we need to check the remaining ones if any of them is lower then the already found one
 					// check if the found entry is lower than the last one and higher than the last but one, if so then replace the last one with it
-					if (CompareDirEntries(&fil, &DirEntries[sort_table[maxDirEntries-1]]) < 0)
-						if (CompareDirEntries(&fil, &DirEntries[sort_table[maxDirEntries-2]]) > 0) {
-							DirEntries[sort_table[maxDirEntries-1]] = fil;
+					if (CompareDirEntries(&cur, &DirEntries[sort_table[maxDirEntries-1]]) < 0)
+						if (CompareDirEntries(&cur, &DirEntries[sort_table[maxDirEntries-2]]) > 0) {
+							CopyDirEntry(&DirEntries[sort_table[maxDirEntries-1]], &cur);
 						}
 				}
 			} else if (mode == SCAN_PREV) {
 				if (nNewEntries == 0) {// no entry lower than the first one has been found yet
-					if (CompareDirEntries(&fil, &DirEntries[sort_table[0]]) < 0) {// found entry lower than the first one
+					if (CompareDirEntries(&cur, &DirEntries[sort_table[0]]) < 0) {// found entry lower than the first one
 						nNewEntries++;
 						if (nDirEntries < maxDirEntries) nDirEntries++;
-						DirEntries[sort_table[maxDirEntries-1]] = fil;
+						CopyDirEntry(&DirEntries[sort_table[maxDirEntries-1]], &cur);
 						// scroll entries' indices
 						x = sort_table[maxDirEntries-1];
 						for (i = maxDirEntries - 1; i > 0; i--)
@@ -507,34 +647,34 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 					}
 				} else {// lower entry already found but we need to check the remaining ones if any of them is higher then the already found one
 					// check if the found entry is higher than the first one and lower than the second one, if so then replace the first one with it
-					if (CompareDirEntries(&fil, &DirEntries[sort_table[0]]) > 0)
-						if (CompareDirEntries(&fil, &DirEntries[sort_table[1]]) < 0) {
-							DirEntries[sort_table[0]] = fil;
+					if (CompareDirEntries(&cur, &DirEntries[sort_table[0]]) > 0)
+						if (CompareDirEntries(&cur, &DirEntries[sort_table[1]]) < 0) {
+							CopyDirEntry(&DirEntries[sort_table[0]], &cur);
 						}
 				}
 			} else if (mode == SCAN_NEXT_PAGE) {
-				if (CompareDirEntries(&fil, &DirEntries[sort_table[maxDirEntries-1]]) > 0) { // compare with the last visible en
+				if (CompareDirEntries(&cur, &DirEntries[sort_table[maxDirEntries-1]]) > 0) { // compare with the last visible en
 					if (nNewEntries < maxDirEntries) {// initial directory scan (first 8 entries)
 						//iprintf("fname=%s, altname=%s\n", fil.fname, fil.altname);
-						t_DirEntries[nNewEntries] = fil;
+						CopyDirEntry(&t_DirEntries[nNewEntries], &cur);
 						t_sort_table[nNewEntries] = nNewEntries; // init sorting table
 						nNewEntries++;
 						SortTempTable(-1);
-					} else if (CompareDirEntries(&fil, &t_DirEntries[t_sort_table[maxDirEntries-1]]) < 0) {// compare new entr
-						t_DirEntries[t_sort_table[maxDirEntries-1]] = fil;
+					} else if (CompareDirEntries(&cur, &t_DirEntries[t_sort_table[maxDirEntries-1]]) < 0) {// compare new entr
+						CopyDirEntry(&t_DirEntries[t_sort_table[maxDirEntries-1]], &cur);
 						SortTempTable(-1);
 					}
 				}
 			} else if (mode == SCAN_PREV_PAGE) {
-				if (CompareDirEntries(&fil, &DirEntries[sort_table[0]]) < 0) { // compare with the last visible en
+				if (CompareDirEntries(&cur, &DirEntries[sort_table[0]]) < 0) { // compare with the last visible en
 					if (nNewEntries < maxDirEntries) {// initial directory scan (first 8 entries)
 						//iprintf("fname=%s, altname=%s\n", fil.fname, fil.altname);
-						t_DirEntries[nNewEntries] = fil;
+						CopyDirEntry(&t_DirEntries[nNewEntries], &cur);
 						t_sort_table[nNewEntries] = nNewEntries; // init sorting table
 						nNewEntries++;
 						SortTempTable(1);
-					} else if (CompareDirEntries(&fil, &t_DirEntries[t_sort_table[maxDirEntries-1]]) > 0) {// compare new entry
-						t_DirEntries[t_sort_table[maxDirEntries-1]] = fil;
+					} else if (CompareDirEntries(&cur, &t_DirEntries[t_sort_table[maxDirEntries-1]]) > 0) {// compare new entry
+						CopyDirEntry(&t_DirEntries[t_sort_table[maxDirEntries-1]], &cur);
 						SortTempTable(1);
 					}
 				}
@@ -544,16 +684,16 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 				else if (find_dir)
 					x = tolower(fil.fname[0]) >= tolower(mode) || is_file;
 				else
-					x = (CompareDirEntries(&fil, &DirEntries[sort_table[iSelectedEntry]]) > 0); // compare with the last visible entry
+					x = (CompareDirEntries(&cur, &DirEntries[sort_table[iSelectedEntry]]) > 0); // compare with the last visible entry
 
 				if (x) {
 					if (nNewEntries < maxDirEntries) {// initial directory scan (first 8 entries)
-						t_DirEntries[nNewEntries] = fil;
+						CopyDirEntry(&t_DirEntries[nNewEntries], &cur);
 						t_sort_table[nNewEntries] = nNewEntries; // init sorting table
 						nNewEntries++;
 						SortTempTable(-1);
-					} else if (CompareDirEntries(&fil, &t_DirEntries[t_sort_table[maxDirEntries-1]]) < 0) { // compare new entry with the last already found
-						t_DirEntries[t_sort_table[maxDirEntries-1]] = fil;
+					} else if (CompareDirEntries(&cur, &t_DirEntries[t_sort_table[maxDirEntries-1]]) < 0) { // compare new entry with the last already found
+						CopyDirEntry(&t_DirEntries[t_sort_table[maxDirEntries-1]], &cur);
 						SortTempTable(-1);
 					}
 				}
@@ -572,7 +712,7 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 			}
 			// copy temporary buffer to display
 			for (i = 0; i < nNewEntries; i++) {
-				DirEntries[sort_table[i+j]] = t_DirEntries[t_sort_table[i]];
+				CopyDirEntry(&DirEntries[sort_table[i+j]], &t_DirEntries[t_sort_table[i]]);
 			}
 		} else if (mode == SCAN_PREV_PAGE) { // note: temporary buffer entries are in reverse order
 			unsigned char j = nNewEntries - 1;
@@ -583,7 +723,7 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 			}
 			// copy temporary buffer to display
 			for (i = 0; i < nNewEntries; i++) {
-				DirEntries[sort_table[j-i]] = t_DirEntries[t_sort_table[i]];
+				CopyDirEntry(&DirEntries[sort_table[j-i]], &t_DirEntries[t_sort_table[i]]);
 			}
 			nDirEntries += nNewEntries;
 			if (nDirEntries > maxDirEntries)
@@ -599,7 +739,7 @@ char ScanDirectory(unsigned long mode, char *extension, unsigned char options) {
 				}
 				if (x) { // first entry is what we were searching for
 					for (i = 0; i < nNewEntries; i++) {
-						DirEntries[sort_table[i]] = t_DirEntries[t_sort_table[i]];
+						CopyDirEntry(&DirEntries[sort_table[i]], &t_DirEntries[t_sort_table[i]]);
 					}
 					nDirEntries = nNewEntries;
 					iSelectedEntry = 0;
@@ -7,6 +7,12 @@
 
 #define MAXDIRENTRIES 16
 
+// long names of the file selector entries, shared by the displayed and the
+// scanned ones
+#ifndef DIR_NAMES_SIZE
+#define DIR_NAMES_SIZE 3072
+#endif
+
 struct PartitionEntry
 {
 	unsigned char geometry[8];		// ignored
@@ -96,6 +102,18 @@ extern unsigned char fat32;
 #define FIND_DIR     4 // find first directory beginning with given character
 #define FIND_FILE    8 // find first file entry beginning with given character
 #define SCAN_SYSDIR 16 // include subdirectories with system attribute
+#define SCAN_ZIP    32 // list ZIP archives as subdirectories (HAVE_INFLATE)
+
+// an entry of the file selector. A name up to 8.3 length is kept in sfn,
+// a longer one in the name arena with the short name in sfn
+typedef struct
+{
+	FSIZE_t fsize;
+	DWORD   fclust;
+	char   *fname;               // sfn or the arena
+	BYTE    fattrib;
+	char    sfn[FF_SFN_BUF + 1];
+} dir_entry_t;
 
 extern FATFS fs;
 
@@ -117,6 +135,8 @@ RAMFUNC FRESULT FileReadNextBlock (FIL *file, void *pBuffer) RAMFUNC;
 const char *GetExtension(const char *fileName);
 char ScanDirectory(unsigned long mode, char *extension, unsigned char options);
 void ChangeDirectoryName(unsigned char *name);
+// the file selector is inside a ZIP archive
+char InArchive(void);
 
 void fat_switch_to_usb(void);
 char *fs_type_to_string(void);
@@ -10,7 +10,7 @@
 #define FAT_IMG "test-arcade.img"
 #define TESTDIR "/"
 
-extern FILINFO  DirEntries[MAXDIRENTRIES];
+extern dir_entry_t DirEntries[MAXDIRENTRIES];
 extern unsigned char sort_table[MAXDIRENTRIES];
 extern unsigned char nDirEntries;
 extern unsigned char iSelectedEntry;
@@ -46,6 +46,9 @@ void FatalError(const char *msg, int errno) {
 	exit(1);
 }
 
+void sched_yield(unsigned char busy) {
+}
+
 unsigned char MMC_CheckCard() {
 	return 1;
 }
@@ -24,6 +24,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 // 2010-01-09   - support for variable number of tracks
 
 #include <stdio.h>
+#include <string.h>
 
 #include "errors.h"
 #include "hardware.h"
@@ -171,6 +172,7 @@ void ReadTrack(adfTYPE *drive)
     unsigned char track;
     unsigned short dsksync;
     unsigned short dsklen;
+    unsigned char *data = 0;
     //unsigned short n;
     fdd_debugf("Read track %d\r", drive->track);
 
@@ -181,17 +183,31 @@ void ReadTrack(adfTYPE *drive)
         drive->track = drive->tracks - 1;
     }
 
+#ifdef HAVE_INFLATE
+    // compressed images are read from the decoded track
+    if (drive->adz.file && !(data = adz_read_track(&drive->adz, drive->track)))
+    {
+        fdd_debugf("ADZ decode error, track %d\r", drive->track);
+        EjectFloppy(drive);
+        UpdateDriveStatus();
+        ErrorMessage("    ADZ decode error!", drive->track);
+        return;
+    }
+#endif
+
     if (drive->track != drive->track_prev)
     { // track step or track 0, start at beginning of track
         drive->track_prev = drive->track;
         sector = 0;
         drive->sector_offset = sector;
-        f_lseek(&drive->file, drive->track * SECTOR_COUNT * 512);
+        if (!data)
+            f_lseek(&drive->file, drive->track * SECTOR_COUNT * 512);
     }
     else
     { // same track, start at next sector in track
         sector = drive->sector_offset;
-        f_lseek(&drive->file, (drive->track * SECTOR_COUNT + sector) * 512);
+        if (!data)
+            f_lseek(&drive->file, (drive->track * SECTOR_COUNT + sector) * 512);
     }
     fdd_debugf("sector: %d\r", sector);
 
@@ -209,7 +225,10 @@ void ReadTrack(adfTYPE *drive)
 
     while (1)
     {
-        FileReadBlock(&drive->file, sector_buffer);
+        if (data)
+            memcpy(sector_buffer, data + sector * 512, 512);
+        else
+            FileReadBlock(&drive->file, sector_buffer);
 
         EnableFpgaMinimig();
 
@@ -270,7 +289,8 @@ void ReadTrack(adfTYPE *drive)
         else // go to the start of current track
         {
             sector = 0;
-            f_lseek(&drive->file, (drive->track * SECTOR_COUNT) * 512);
+            if (!data)
+                f_lseek(&drive->file, (drive->track * SECTOR_COUNT) * 512);
         }
 
         // remember current sector and cluster
@@ -607,23 +627,33 @@ void WriteTrack(adfTYPE *drive)
         {
             if (Track == drive->track)
             {
-                res = f_lseek(&drive->file, (drive->track * SECTOR_COUNT + Sector) * 512);
-                fpos = f_tell(&drive->file);
-                if (res || (fpos != (drive->track * SECTOR_COUNT + Sector) * 512)) {
-                    Error = res;
+#ifdef HAVE_INFLATE
+                if (drive->adz.file)
+                { // written sectors go to the overlay
+                    if (GetData())
+                        Error = (drive->status & DSK_WRITABLE) ? adz_write_sector(&drive->adz, Track, Sector, sector_buffer) : 30;
                 }
-                else if (GetData())
+                else
+#endif
                 {
-                    if (drive->status & DSK_WRITABLE)
-                    {
-                        fdd_debugf("Write sector: %d\r", Sector);
-                        res = FileWriteBlock(&drive->file, sector_buffer);
-                        if (res) Error = res;
+                    res = f_lseek(&drive->file, (drive->track * SECTOR_COUNT + Sector) * 512);
+                    fpos = f_tell(&drive->file);
+                    if (res || (fpos != (drive->track * SECTOR_COUNT + Sector) * 512)) {
+                        Error = res;
                     }
-                    else
+                    else if (GetData())
                     {
-                        Error = 30;
-                        fdd_debugf("Write attempt to protected disk!\r");
+                        if (drive->status & DSK_WRITABLE)
+                        {
+                            fdd_debugf("Write sector: %d\r", Sector);
+                            res = FileWriteBlock(&drive->file, sector_buffer);
+                            if (res) Error = res;
+                        }
+                        else
+                        {
+                            Error = 30;
+                            fdd_debugf("Write attempt to protected disk!\r");
+                        }
                     }
                 }
             }
@@ -636,7 +666,10 @@ void WriteTrack(adfTYPE *drive)
             ErrorMessage("  WriteTrack", Error);
         }
     }
-    f_sync(&drive->file);
+#ifdef HAVE_INFLATE
+    if (!drive->adz.file)
+#endif
+    wb_written(&drive->wb, &drive->file);
 }
 
 void UpdateDriveStatus(void)
@@ -670,3 +703,12 @@ void HandleFDD(unsigned char c1, unsigned char c2)
     }
 }
 
+
+void EjectFloppy(adfTYPE *drive)
+{
+    wb_sync(&drive->wb, &drive->file);
+#ifdef HAVE_INFLATE
+    adz_close(&drive->adz);
+#endif
+    drive->status = 0;
+}
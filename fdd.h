@@ -2,6 +2,10 @@
 #define FDD_H
 
 #include "FatFs/ff.h"
+#include "writeback.h"
+#ifdef HAVE_INFLATE
+#include "adz.h"
+#endif
 
 // floppy disk interface defs
 #define CMD_RDTRK 0x01
@@ -22,6 +26,10 @@ typedef struct
     unsigned char track; /*current track*/
     unsigned char track_prev; /*previous track*/
     char          name[22]; /*floppy name*/
+    wb_state_t    wb; /*unsynced writes to the image*/
+#ifdef HAVE_INFLATE
+    adz_t         adz; /*gzip compressed image*/
+#endif
 } adfTYPE;
 
 void SectorGapToFpga(void);
@@ -34,6 +42,7 @@ unsigned char GetData(void);
 void WriteTrack(adfTYPE *drive);
 void UpdateDriveStatus(void);
 void HandleFDD(unsigned char c1, unsigned char c2);
+void EjectFloppy(adfTYPE *drive);
 
 #endif
 
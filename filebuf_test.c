@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fat_compat.h"
+
+// Replays interleaved partial sector accesses of several open images on
+// a FAT16 RAM disk with the real FatFs in the tiny configuration and
+// counts the disk reads and writes. The baseline is the shared fs.win,
+// which is what every file gets once the pool of private windows is
+// used up: FF_FS_FILEBUFS hog files take all of them first. The file
+// contents are checked against a copy in memory after every trace.
+
+#if !FF_FS_TINY || !FF_FS_FILEBUFS
+#error The test needs the tiny configuration with pooled windows
+#endif
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+
+static uint8_t *disk;
+static unsigned int reads, writes;
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  reads += n;
+  memcpy(buf, disk + lba * 512, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  writes += n;
+  memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void format() {
+  uint8_t *b = disk;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(disk + 512, 0xfff8);
+  put16(disk + 514, 0xffff);
+  memcpy(disk + (1 + FAT_SECTORS) * 512, disk + 512, FAT_SECTORS * 512);
+}
+
+// ---------- images ----------
+#define IMAGES    6
+#define IMG_SIZE  (2 << 20)
+
+static FIL img[IMAGES], hog[FF_FS_FILEBUFS];
+static uint8_t *ref[IMAGES];
+static const char *names[IMAGES] = { "A.D64", "B.D64", "DATA.BIN", "AUDIO.BIN", "A.IMG", "B.IMG" };
+
+static void create_images() {
+  uint8_t buf[4096];
+  unsigned int i, j;
+  UINT bw;
+  FIL f;
+
+  for (i = 0; i < IMAGES; i++) {
+    ref[i] = malloc(IMG_SIZE);
+    for (j = 0; j < IMG_SIZE; j++) ref[i][j] = rand();
+    CHECK(f_open(&f, names[i], FA_WRITE | FA_CREATE_ALWAYS) == FR_OK);
+    for (j = 0; j < IMG_SIZE; j += sizeof(buf)) {
+      memcpy(buf, ref[i] + j, sizeof(buf));
+      CHECK(f_write(&f, buf, sizeof(buf), &bw) == FR_OK && bw == sizeof(buf));
+    }
+    CHECK(f_close(&f) == FR_OK);
+  }
+  for (i = 0; i < FF_FS_FILEBUFS; i++) {
+    char name[8] = "HOG0";
+    name[3] = '0' + i;
+    CHECK(f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK);
+    CHECK(f_write(&f, buf, 1000, &bw) == FR_OK);
+    CHECK(f_close(&f) == FR_OK);
+  }
+}
+
+// all pool windows go to the hog files
+static void hog_pool() {
+  uint8_t b;
+  UINT br;
+  int i;
+
+  for (i = 0; i < FF_FS_FILEBUFS; i++) {
+    char name[8] = "HOG0";
+    name[3] = '0' + i;
+    CHECK(f_open(&hog[i], name, FA_READ) == FR_OK);
+    CHECK(f_read(&hog[i], &b, 1, &br) == FR_OK && hog[i].buf);
+  }
+}
+
+static void free_pool() {
+  int i;
+
+  for (i = 0; i < FF_FS_FILEBUFS; i++) {
+    CHECK(f_close(&hog[i]) == FR_OK && !hog[i].buf);
+  }
+}
+
+static void img_read(int i, FSIZE_t ofs, UINT len) {
+  static uint8_t buf[4096];
+  UINT br;
+
+  CHECK(f_lseek(&img[i], ofs) == FR_OK);
+  CHECK(f_read(&img[i], buf, len, &br) == FR_OK && br == len);
+  if (memcmp(buf, ref[i] + ofs, len)) {
+    printf("%s: %u bytes at %lu differ\n", names[i], len, (unsigned long)ofs);
+    errors++;
+  }
+}
+
+static void img_write(int i, FSIZE_t ofs, UINT len) {
+  static uint8_t buf[4096];
+  UINT bw, j;
+
+  for (j = 0; j < len; j++) buf[j] = rand();
+  memcpy(ref[i] + ofs, buf, len);
+  CHECK(f_lseek(&img[i], ofs) == FR_OK);
+  CHECK(f_write(&img[i], buf, len, &bw) == FR_OK && bw == len);
+}
+
+// ---------- traces ----------
+typedef void (*trace_t)(void);
+
+// two 8 bit cores' floppy drives, 256 byte sectors, loading files
+static void trace_d64() {
+  unsigned int i;
+  FSIZE_t pos[2] = { 0, 0 };
+
+  for (i = 0; i < 20000; i++) {
+    int d = i & 1;
+    img_read(d, pos[d], 256);
+    pos[d] = (pos[d] + 256) % IMG_SIZE;
+  }
+}
+
+// user data of a CD data track, interleaved with CDDA of another track
+static void trace_cd() {
+  unsigned int i, lba = 0, audio = 0;
+
+  for (i = 0; i < 4000; i++) {
+    img_read(2, (FSIZE_t)lba * 2352 + 16, 2048);
+    lba = (lba + 1) % (IMG_SIZE / 2352);
+    if (i & 1) {
+      img_read(3, (FSIZE_t)audio * 2352, 2352);
+      audio = (audio + 1) % (IMG_SIZE / 2352);
+    }
+  }
+}
+
+// two floppies with 256 byte sectors copying from one to the other
+static void trace_copy() {
+  unsigned int i;
+  FSIZE_t src = 0, dst = 0;
+
+  for (i = 0; i < 20000; i++) {
+    img_read(4, src, 256);
+    img_write(5, dst, 256);
+    src = (src + 256) % IMG_SIZE;
+    // the target is written in a different order
+    dst = (dst + 7 * 256) % IMG_SIZE;
+  }
+}
+
+static void verify(int i) {
+  static uint8_t buf[IMG_SIZE];
+  UINT br;
+  FIL f;
+
+  CHECK(f_open(&f, names[i], FA_READ) == FR_OK);
+  CHECK(f_read(&f, buf, IMG_SIZE, &br) == FR_OK && br == IMG_SIZE);
+  CHECK(!memcmp(buf, ref[i], IMG_SIZE));
+  CHECK(f_close(&f) == FR_OK);
+}
+
+static void run(const char *name, trace_t trace, int first, int n) {
+  unsigned int r[2], w[2];
+  int pooled, i;
+
+  for (pooled = 0; pooled < 2; pooled++) {
+    if (!pooled) hog_pool();
+    for (i = first; i < first + n; i++)
+      CHECK(f_open(&img[i], names[i], FA_READ | FA_WRITE) == FR_OK);
+    srand(42);
+    reads = writes = 0;
+    trace();
+    for (i = first; i < first + n; i++) {
+      CHECK((img[i].buf != 0) == pooled);
+      CHECK(f_close(&img[i]) == FR_OK && !img[i].buf);
+    }
+    r[pooled] = reads;
+    w[pooled] = writes;
+    if (!pooled) free_pool();
+    for (i = first; i < first + n; i++) verify(i);
+  }
+  printf("  %-30s: %6u reads, %6u writes shared, %6u reads, %6u writes pooled\n",
+         name, r[0], w[0], r[1], w[1]);
+  CHECK(r[1] < r[0]);
+  CHECK(w[1] <= w[0]);
+}
+
+// more open files than windows
+static void test_exhausted() {
+  int i, n;
+
+  for (i = 0; i < IMAGES; i++)
+    CHECK(f_open(&img[i], names[i], FA_READ | FA_WRITE) == FR_OK);
+  srand(7);
+  for (i = 0; i < 30000; i++) {
+    int d = rand() % IMAGES;
+    FSIZE_t ofs = rand() % (IMG_SIZE - 1024);
+    if (rand() & 1) img_read(d, ofs, 1 + rand() % 1000);
+    else img_write(d, ofs, 1 + rand() % 1000);
+  }
+  for (i = 0, n = 0; i < IMAGES; i++) if (img[i].buf) n++;
+  CHECK(n == FF_FS_FILEBUFS);
+  // a window returned by f_close() goes to the next file
+  for (i = 0; !img[i].buf; i++) ;
+  for (n = 0; img[n].buf; n++) ;
+  CHECK(f_close(&img[i]) == FR_OK);
+  img_read(n, 100, 10);
+  CHECK(img[n].buf);
+  for (n = 0; n < IMAGES; n++) if (n != i) CHECK(f_close(&img[n]) == FR_OK);
+  for (i = 0; i < IMAGES; i++) verify(i);
+
+  // reopened without f_close(), the window is not lost
+  CHECK(f_open(&img[0], names[0], FA_READ) == FR_OK);
+  img_read(0, 100, 10);
+  CHECK(f_open(&img[0], names[0], FA_READ) == FR_OK && !img[0].buf);
+  hog_pool();
+  free_pool();
+  CHECK(f_close(&img[0]) == FR_OK);
+}
+
+int main() {
+  disk = calloc(DISK_SECTORS, 512);
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+  create_images();
+
+  printf("Interleaved partial sector accesses, %d pooled windows:\n", FF_FS_FILEBUFS);
+  run("two 8 bit drives", trace_d64, 0, 2);
+  run("CD data and CDDA", trace_cd, 2, 2);
+  run("floppy copy", trace_copy, 4, 2);
+  test_exhausted();
+
+  // a new mount empties the pool
+  CHECK(f_open(&img[0], names[0], FA_READ) == FR_OK);
+  img_read(0, 100, 10);
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+  hog_pool();
+  free_pool();
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
@@ -25,36 +25,34 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "barriers.h"
 #include "fat_compat.h"
 #include "firmware.h"
+#include "osd.h"
+#include "user_io.h"
+#include "writeback.h"
 
 #ifndef FW_ID
 #define FW_ID "MNMGUPG"
 #endif
 
-static DWORD clmt[99];
-
-unsigned long CalculateCRC32(unsigned long crc, unsigned char *pBuffer, unsigned long nSize) {
-   int i, j;
-   unsigned long byte, mask;
-
-   while (nSize--) {
-      byte = *pBuffer++;            // Get next byte.
-      crc = crc ^ byte;
-      for (j = 7; j >= 0; j--) {    // Do eight times.
-         mask = -(crc & 1);
-         crc = (crc >> 1) ^ (0xEDB88320 & mask);
-      }
-   }
-   return crc;
-}
+// progress bar on the OSD while flashing
+#define FW_PROGRESS_START 32
+#define FW_PROGRESS_WIDTH 192
 
+static DWORD clmt[99];
+static FIL fw_file;
+static upg_state_t upg;
+static unsigned char progress_cmd[5];
+static unsigned char progress_cmd_len;
+static unsigned short progress_filled;
+
+// reads the upgrade file once: ROM CRC, chunk checksums and comparison
+// of the chunks with the flash for WriteFirmware()
 unsigned char CheckFirmware(char *name)
 {
     UPGRADE *pUpgrade = (UPGRADE*)sector_buffer;
-    unsigned long crc;
-    unsigned long size;
-    unsigned long rom_size;
-    unsigned long rom_crc;
-    unsigned long read_size;
+    unsigned char err;
+    unsigned long len;
+    unsigned short i;
+    UINT br;
     FIL file;
 
     Error = ERROR_FILE_NOT_FOUND;
@@ -66,53 +64,31 @@ unsigned char CheckFirmware(char *name)
 
         if (f_size(&file) >= sizeof(UPGRADE))
         {
-          clmt[0] = 99;
-          file.cltbl = clmt;
-          if (f_lseek(&file, CREATE_LINKMAP) == FR_OK) {
-            FileReadNextBlock(&file, sector_buffer);
-            crc = ~CalculateCRC32(-1, sector_buffer, sizeof(UPGRADE) - 4);
+            f_read(&file, sector_buffer, sizeof(UPGRADE), &br);
             iprintf("Upgrade ROM size      : %lu\r", pUpgrade->rom.size);
             iprintf("Upgrade header CRC    : %08lX\r", pUpgrade->crc);
-            iprintf("Calculated header CRC : %08lX\r", crc);
-            if (pUpgrade->crc == crc)
+            err = upg_check_header(&upg, pUpgrade, FW_ID, f_size(&file), SECTOR_BUFFER_SIZE, FLASH_PAGESIZE);
+            if (err == UPG_OK)
             {
-                if (strncmp((const char*)pUpgrade->id, FW_ID, 7) == 0 && pUpgrade->id[7] == 0)
+                for (i = 0; i < upg.chunks; i++)
                 {
-                    if (pUpgrade->rom.size == f_size(&file) - sizeof(UPGRADE))
-                    {
-                        rom_size = pUpgrade->rom.size;
-                        rom_crc = pUpgrade->rom.crc;
-
-                        crc = -1; // initial CRC32 value
-                        size = rom_size;
-                        while (size)
-                        {
-                            if (size > 512)
-                               read_size = 512;
-                            else
-                               read_size = size;
-
-                            FileReadNextBlock(&file, sector_buffer);
-                            crc = CalculateCRC32(crc, sector_buffer, read_size);
-                            size -= read_size;
-                        }
-                        iprintf("Calculated ROM CRC    : %08lX\r", ~crc);
-                        iprintf("ROM CRC from header   : %08lX\r", rom_crc);
-                        if (~crc == rom_crc)
-                        { // upgrade file CRC is OK so go back to the beginning of the file
-                            f_close(&file);
-                            Error = ERROR_NONE;
-                            return 1;
-                        }
-                        else iprintf("ROM CRC mismatch! from header: %08lX, calculated: %08lX\r", rom_crc, ~crc);
-                    }
-                    else iprintf("ROM size mismatch! from header: %lu, from file: %llu\r", pUpgrade->rom.size, f_size(&file)-sizeof(UPGRADE));
+                    len = upg_chunk_len(&upg, i);
+                    if (f_read(&file, sector_buffer, len, &br) != FR_OK || br != len)
+                        break;
+                    upg_verify_chunk(&upg, sector_buffer, (const unsigned char*)FLASH_BASE + i * SECTOR_BUFFER_SIZE);
                 }
-                else iprintf("Invalid upgrade file header!\r");
+                iprintf("Calculated ROM CRC    : %08lX\r", ~upg.crc);
+                iprintf("ROM CRC from header   : %08lX\r", upg.rom_crc);
+                err = upg_verify_done(&upg);
+            }
+            if (err == UPG_OK)
+            {
+                iprintf("Changed blocks        : %u of %u\r", upg.changed, upg.chunks);
+                f_close(&file);
+                Error = ERROR_NONE;
+                return 1;
             }
-            else iprintf("Header CRC mismatch! from header: %08lX, calculated: %08lX\r", pUpgrade->crc, crc);
-          }
-          else iprintf("Error creating linkmap\r");
+            iprintf("%s!\r", upg_error_str(err));
         }
         else iprintf("Upgrade file size too small: %llu\r", f_size(&file));
         f_close(&file);
@@ -123,102 +99,148 @@ unsigned char CheckFirmware(char *name)
 
 char *GetFirmwareVersion(char *name) {
   static char v[16];
-  FIL file;
+  FIL file;
 
   if ((f_open(&file, name, FA_READ) != FR_OK) || (f_size(&file) < sizeof(UPGRADE)))
     return NULL;
 
   FileReadBlock(&file, sector_buffer);
-  strncpy(v, ((UPGRADE*)sector_buffer)->version, 16);
+  strncpy(v, (char*)((UPGRADE*)sector_buffer)->version, 16);
   v[15] = 0;
-  f_close(&file);
+  f_close(&file);
 
   return v;
 }
 
-// enable some nasty hacks to prevent gcc calling memset/memcpy during flash as these
-// are library functions placed in flash and thus must not be called while flash is being
+// the OSD command is prepared before flashing, osd.c runs from flash
+static void ProgressInit(void)
+{
+    unsigned char line = OsdLines() - 2;
+
+    if (!minimig_v2()) {
+        progress_cmd[0] = MM1_OSDCMDWRITE | line;
+        progress_cmd_len = 1;
+    } else {
+        progress_cmd[0] = OSD_CMD_OSD_WR;
+        progress_cmd[1] = 0;
+        progress_cmd[2] = 0;
+        progress_cmd[3] = 0;
+        progress_cmd[4] = line;
+        progress_cmd_len = 5;
+    }
+    progress_filled = 0;
+}
+
+// gcc must not be given a chance to call memset/memcpy below as these are library
+// functions placed in flash and thus must not be called while flash is being
 // overwritten
-#define GCC_OPTIMZES_TOO_MUCH
 
 #pragma section_code_init
+static RAMFUNC void Progress(uint16_t chunk, uint16_t chunks)
+{
+    unsigned short i;
+    unsigned char c;
+
+    // no division, it's a library function
+    while (progress_filled < FW_PROGRESS_WIDTH && (progress_filled + 1) * chunks <= chunk * FW_PROGRESS_WIDTH)
+        progress_filled++;
+
+    EnableOsd();
+    for (i = 0; i < progress_cmd_len; i++)
+        SPI(progress_cmd[i]);
+    for (i = 0; i < OSDLINELEN; i++) {
+        c = 0;
+        if (i == FW_PROGRESS_START - 1 || i == FW_PROGRESS_START + FW_PROGRESS_WIDTH)
+            c = 0x7e;
+        else if (i >= FW_PROGRESS_START && i < FW_PROGRESS_START + FW_PROGRESS_WIDTH)
+            c = (i - FW_PROGRESS_START < progress_filled) ? 0x7e : 0x42;
+        SPI(c);
+    }
+    DisableOsd();
+}
+
+// FileReadNextBlock() looks up the cluster of a position only on cluster
+// boundaries, so reading a chunk starts at the boundary before it
+static RAMFUNC uint8_t ReadChunk(uint16_t chunk, uint8_t *buf)
+{
+    unsigned long pos = sizeof(UPGRADE) + chunk * SECTOR_BUFFER_SIZE;
+    unsigned long n = (upg_chunk_len(&upg, chunk) + 511) >> 9;
+
+    fw_file.fptr = pos & ~(((unsigned long)fs.csize << 9) - 1);
+    while (fw_file.fptr < pos)
+        if (FileReadNextBlock(&fw_file, buf) != FR_OK) return 0;
+
+    while (n--) {
+        if (FileReadNextBlock(&fw_file, buf) != FR_OK) return 0;
+        buf += 512;
+    }
+    return 1;
+}
+
+// programming time: 13.2 ms per disk sector (512B)
+static RAMFUNC uint8_t ProgramPage(uint32_t page, const uint32_t *pSrc)
+{
+    uint32_t *pDst = (uint32_t*)(page * FLASH_PAGESIZE);
+    unsigned long i = FLASH_PAGESIZE / 4;
+
+    if (page & 8) DISKLED_ON
+    else DISKLED_OFF;
+
+    while (i--) {
+        *pDst++ = *pSrc++;
+        dmb();
+    }
+
+    WriteFlash(page);
+    return 1;
+}
+
+// not const: upg_program() reads it while the flash is rewritten, it must
+// be in RAM like the functions it points to
+static upg_target_t fw_target = {
+    .buffer = sector_buffer,
+    .read = ReadChunk,
+    .program = ProgramPage,
+    .progress = Progress
+};
+
 RAMFUNC void WriteFirmware(char *name)
 {
-    unsigned long read_size;
-    unsigned long i;
-    unsigned long k;
-    unsigned long page;
-    unsigned long *pSrc;
-    unsigned long *pDst;
-    FSIZE_t size;
-    FIL file;
+    // CheckFirmware() must have passed
+    if (upg_verify_done(&upg) != UPG_OK) return;
 
+    // unsynced image writes go to the card now, the writeback and FatFs
+    // code is in the flash which is about to be replaced
+    wb_flush_all();
 
     // Since the file may have changed in the meantime, it needs to be
     // opened again...
-    if (f_open(&file, name, FA_READ) != FR_OK) return;
+    if (f_open(&fw_file, name, FA_READ) != FR_OK) return;
     clmt[0] = 99;
-    file.cltbl = clmt;
-    if ((f_lseek(&file, CREATE_LINKMAP) != FR_OK) ||
-        (f_lseek(&file, sizeof(UPGRADE)) != FR_OK) ||
-        (f_tell(&file) != sizeof(UPGRADE))) {
-        f_close(&file);
+    fw_file.cltbl = clmt;
+    if ((f_size(&fw_file) != sizeof(UPGRADE) + upg.size) ||
+        (f_lseek(&fw_file, CREATE_LINKMAP) != FR_OK)) {
+        f_close(&fw_file);
         return;
     }
-    size = f_size(&file) - sizeof(UPGRADE);
+    ProgressInit();
+
     // All interrupts have to be disabled.
     arch_irq_disable();
 //    asm volatile ("mrs r12, CPSR; orr r12, r12, #0xC0; msr CPSR_c, r12"
 //        : /* No outputs */
 //        : /* No inputs */
 //        : "r12", "cc");
-
-
-    // Hack to foul FatFs to not handle a final partial sector (to avoid a memcpy)
-    file.obj.objsize = (file.obj.objsize + 511) & 0xfffffe00;
-    page = 0;
-    pDst = 0;
 
     UnlockFlash();
 
-    while (size)
-    {
-        if (size > 512)
-            read_size = 512;
-        else
-            read_size = size;
-
-        // On _any_ error the upgrade will fail :-(
-        // then the firmware needs to be upgraded by another way!
-        FileReadNextBlock(&file, sector_buffer);
-
-#ifndef GCC_OPTIMZES_TOO_MUCH  // the latest gcc 4.8.0 calls memset for this
-        // it doesn't hurt to not do this at all
-
-        // fill the rest of buffer
-        for (i = read_size; i < 512; i++)
-            sector_buffer[i] = 0xFF;
-#endif
-
-        // programming time: 13.2 ms per disk sector (512B)
-        pSrc = (unsigned long*)sector_buffer;
-        k = 512/FLASH_PAGESIZE;
-        while (k--)
-        {
-            if(size & 2048) DISKLED_ON
-            else DISKLED_OFF;
-
-            i = FLASH_PAGESIZE / 4;
-            while (i--) {
-                *pDst++ = *pSrc++;
-                dmb();
-            }
-
-            WriteFlash(page);
-            page++;
-        }
-
-        size -= read_size;
+    // On a read error before the first page is programmed, the old
+    // firmware is still intact. Afterwards chunks are read until they
+    // match the verified data.
+    if (upg_program(&upg, &fw_target) < 0) {
+        arch_irq_enable();
+        f_close(&fw_file);
+        return;
     }
 
     DISKLED_OFF;
@@ -226,4 +248,3 @@ RAMFUNC void WriteFirmware(char *name)
     for(;;);
 }
 #pragma section_no_code_init
-
@@ -28,6 +28,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "errors.h"
 #include "hardware.h"
 #include "fdd.h"
+#include "writeback.h"
 #include "user_io.h"
 #include "config.h"
 #include "boot.h"
@@ -36,6 +37,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "tos.h"
 #include "mist_cfg.h"
 #include "settings.h"
+#include "crc32.h"
+#include "sched.h"
 #include "usb/joymapping.h"
 
 #ifndef DEFAULT_CORE_NAME
@@ -256,6 +259,7 @@ unsigned char ConfigureFpga(const char *name)
 {
     unsigned long i;
     unsigned char *ptr;
+    uint32_t crc = CRC32_INIT;
     FIL file;
     UINT br;
 
@@ -320,10 +324,14 @@ unsigned char ConfigureFpga(const char *name)
             if ((i & (SECTOR_BUFFER_SIZE*4-1)) == 0)
                 iprintf("*");
 
+            // the core isn't running, but the USB storage can be served
+            sched_yield(SCHED_CORE);
+
             if (f_read(&file, sector_buffer, SECTOR_BUFFER_SIZE, &br) != FR_OK) {
                 f_close(&file);
                 return ERROR_READ_BITSTREAM_FAILED;
             }
+            crc = crc32_update(crc, sector_buffer, br);
 
             ptr = sector_buffer;
         }
@@ -351,7 +359,7 @@ unsigned char ConfigureFpga(const char *name)
     f_close(&file);
 
     iprintf("]\r");
-    iprintf("FPGA bitstream loaded\r");
+    iprintf("FPGA bitstream loaded, CRC32: %08lX\r", ~crc);
     DISKLED_OFF;
 
     // check if DONE is high
@@ -502,100 +510,6 @@ void SendFileEncrypted(FIL *file,unsigned char *key,int keysize)
     iprintf("]\r");
 }
 
-char kick1xfoundstr[] = "Kickstart v1.x found\n";
-const char applymemdetectionpatchstr[] = "Applying Kickstart 1.x memory detection patch\n";
-
-const char *kickfoundstr = NULL, *applypatchstr = NULL;
-
-void PatchKick1xMemoryDetection() {
-  int applypatch = 0;
-
-  if (!strncmp(sector_buffer + 0x18, "exec 33.192 (8 Oct 1986)", 24)) {
-    kick1xfoundstr[13] = '2';
-    kickfoundstr = kick1xfoundstr;
-    goto applypatch;
-  }
-  if (!strncmp(sector_buffer + 0x18, "exec 34.2 (28 Oct 1987)", 23)) {
-    kick1xfoundstr[13] = '3';
-    kickfoundstr = kick1xfoundstr;
-    goto applypatch;
-  }
-
-  goto out;
-
-applypatch:
-  if ((sector_buffer[0x154] == 0x66) && (sector_buffer[0x155] == 0x78)) {
-    applypatchstr = applymemdetectionpatchstr;
-    sector_buffer[0x154] = 0x60;
-  }
-
-out:
-  return;
-}
-
-// SendFileV2 (for minimig_v2)
-void SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int size)
-{
-  UINT br;
-  int i,j;
-  unsigned int keyidx=0;
-
-  iprintf("File size: %dkB\r", size>>1);
-  iprintf("[");
-  if (keysize) {
-    // read header
-    f_read(file, sector_buffer, 0xb, &br);
-  }
-  for (i=0; i<size; i++) {
-    if (!(i&31)) iprintf("*");
-    FileReadBlock(file, sector_buffer);
-    if (keysize) {
-      // decrypt ROM
-      for (j=0; j<512; j++) {
-        sector_buffer[j] ^= key[keyidx++];
-        if(keyidx >= keysize) keyidx -= keysize;
-      }
-    }
-
-    // patch kickstart 1.x to force memory detection every time the AMIGA is reset
-    if (minimig_cfg.kick1x_memory_detection_patch && (i == 0 || i == 512)) {
-      kickfoundstr = NULL;
-      applypatchstr = NULL;
-      PatchKick1xMemoryDetection();
-    }
-
-    EnableOsd();
-    unsigned int adr = address + i*512;
-    SPI(OSD_CMD_WR);
-    SPIN(); SPIN(); SPIN(); SPIN();
-    SPI(adr&0xff); adr = adr>>8;
-    SPI(adr&0xff); adr = adr>>8;
-    SPIN(); SPIN(); SPIN(); SPIN();
-    SPI(adr&0xff); adr = adr>>8;
-    SPI(adr&0xff); adr = adr>>8;
-    SPIN(); SPIN(); SPIN(); SPIN();
-    for (j=0; j<512; j=j+4) {
-      SPI(sector_buffer[j+0]);
-      SPI(sector_buffer[j+1]);
-      SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
-      SPI(sector_buffer[j+2]);
-      SPI(sector_buffer[j+3]);
-      SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
-    }
-    DisableOsd();
-  }
-  iprintf("]\r");
-
-  if (kickfoundstr) {
-    iprintf(kickfoundstr);
-  }
-  if (applypatchstr) {
-    iprintf(applypatchstr);
-  }
-}
-
-
-
 // draw on screen
 char BootDraw(char *data, unsigned short len, unsigned short offset)
 {
@@ -918,6 +832,9 @@ unsigned char fpga_init(const char *name) {
   int loaded_from_usb = USB_LOAD_VAR;
   unsigned char ct;
 
+  // the open disk images belong to the old core
+  wb_flush_all();
+
   // load the global MISTCFG.INI here
   // loading between the FPGA init and detect_core_type breaks with some SD-Cards. Reason unknown.
   virtual_joystick_remap_init(false);
@@ -955,6 +872,7 @@ unsigned char fpga_init(const char *name) {
      (user_io_core_type() == CORE_TYPE_MINIMIG2)) {
 
     puts("Running minimig setup");
+    wb_set_policy(minimig_cfg.writeback_policy, minimig_cfg.writeback_delay);
     
     if(minimig_v2()) {
       user_io_8bit_set_status(minimig_cfg.clock_freq << 1, 0xffffffff);
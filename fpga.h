@@ -7,7 +7,6 @@ unsigned char fpga_init(const char *name);
 unsigned char ConfigureFpga(const char*);
 void SendFile(FIL *file);
 void SendFileEncrypted(FIL *file,unsigned char *key,int keysize);
-void SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int size);
 char BootDraw(char *data, unsigned short len, unsigned short offset);
 char BootPrint(const char *text);
 char PrepareBootUpload(unsigned char base, unsigned char size);
@@ -42,6 +42,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "user_io.h"
 #endif
 #include "debug.h"
+#include "prof.h"
 
 hardfileTYPE  *hardfile[HARDFILES];
 
@@ -281,11 +282,8 @@ static unsigned long chs2lba(unsigned short cylinder, unsigned char head, unsign
 // HardFileSeek()
 static unsigned char HardFileSeek(hdfTYPE *pHDF, unsigned long lba)
 {
-  FSIZE_t seek_pos = (FSIZE_t) lba << 9;
-  FRESULT res;
-  res = f_lseek(&pHDF->idxfile->file, seek_pos);
-  if (res != FR_OK || f_tell(&pHDF->idxfile->file) != seek_pos) {
-    hdd_debugf("Seek error: %llu, %llu", seek_pos, f_tell(&pHDF->idxfile->file));
+  if (IDXSeek(pHDF->idxfile, lba) != FR_OK) {
+    hdd_debugf("Seek error: %lu", lba);
     return 0;
   }
   return 1;
@@ -445,6 +443,7 @@ static void PKT_Read(unsigned char unit, unsigned int lba, unsigned int len, uns
 {
   UINT br;
   unsigned char *pBuffer;
+  PROF_START(prof);
   if (!toc.valid) {
     cdrom_setsense(SENSEKEY_NOT_READY, 0x3a, 0);
     cdrom_send_error(unit);
@@ -483,6 +482,7 @@ static void PKT_Read(unsigned char unit, unsigned int lba, unsigned int len, uns
     lba++;
     WritePacket(unit, sector_buffer, blocksize, bytelimit, !len);
   }
+  PROF_END(PROF_PKT_READ, prof);
 }
 
 static void PKT_Read12(unsigned char *cmd, unsigned char unit, unsigned short bytelimit)
@@ -1236,6 +1236,7 @@ static inline void ATA_ReadSectors(unsigned char* tfr, unsigned short sector, un
   long lba;
   int i;
   int block_count, blocks;
+  PROF_START(prof);
 
   lba=chs2lba(cylinder, head, sector, unit, lbamode);
   hdd_debugf("IDE%d: read %s, %d.%d.%d:%d, %d", unit, (lbamode ? "LBA" : "CHS"), cylinder, head, sector, lba, sector_count);
@@ -1298,7 +1299,7 @@ static inline void ATA_ReadSectors(unsigned char* tfr, unsigned short sector, un
           {
             HardFileSeek(&hdf[unit], lba + hdf[unit].offset);
             // read sector into buffer
-            FileReadBlock(&hdf[unit].idxfile->file, sector_buffer);
+            IDXReadBlocks(hdf[unit].idxfile, sector_buffer, 1);
 
             // adjust checksum by the difference between old and new flag value
             struct RigidDiskBlock *rdb = (struct RigidDiskBlock *)sector_buffer;
@@ -1325,12 +1326,12 @@ static inline void ATA_ReadSectors(unsigned char* tfr, unsigned short sector, un
           HardFileSeek(&hdf[unit], lba + hdf[unit].offset);
 #ifndef SD_NO_DIRECT_MODE
           if (fat_uses_mmc() && !verify) {
-            FileReadBlockEx(&hdf[unit].idxfile->file, 0, blk); // NULL enables direct transfer to the FPGA
+            IDXReadBlocks(hdf[unit].idxfile, 0, blk); // NULL enables direct transfer to the FPGA
           } else {
 #endif
             blocks = blk;
             while (blocks) {
-              FileReadBlockEx(&hdf[unit].idxfile->file, sector_buffer, MIN(blocks, SECTOR_BUFFER_SIZE/512));
+              IDXReadBlocks(hdf[unit].idxfile, sector_buffer, MIN(blocks, SECTOR_BUFFER_SIZE/512));
               if (!verify) {
 #ifdef HAVE_QSPI
                 if(minimig_v2()) {
@@ -1406,6 +1407,7 @@ static inline void ATA_ReadSectors(unsigned char* tfr, unsigned short sector, un
   } else {
     WriteStatus(IDE_STATUS_END);
   }
+  PROF_END(PROF_ATA_READ, prof);
 }
 
 
@@ -1416,6 +1418,7 @@ static inline void ATA_WriteSectors(unsigned char* tfr, unsigned short sector, u
   unsigned short block_count, block_size, sectors;
   unsigned char *buf;
   long lba=chs2lba(cylinder, head, sector, unit, lbamode);
+  PROF_START(prof);
 
   // write sectors
   WriteStatus(IDE_STATUS_REQ); // pio out (class 2) command type
@@ -1431,8 +1434,6 @@ static inline void ATA_WriteSectors(unsigned char* tfr, unsigned short sector, u
     if (multiple && block_count > hdf[unit].sectors_per_block)
         block_count = hdf[unit].sectors_per_block;
 
-    UINT bw;
-
     while(block_count)
     {
       block_size = (block_count > SECTOR_BUFFER_SIZE/512) ? (SECTOR_BUFFER_SIZE/512) : block_count;
@@ -1456,7 +1457,7 @@ static inline void ATA_WriteSectors(unsigned char* tfr, unsigned short sector, u
         case HDF_FILE:
           if (f_size(&hdf[unit].idxfile->file) && (lba>-1)) {
             // Don't attempt to write to fake RDB
-            f_write(&hdf[unit].idxfile->file, sector_buffer, 512*block_size, &bw);
+            IDXWriteBlocks(hdf[unit].idxfile, sector_buffer, block_size);
           }
           lba+=block_size;
           break;
@@ -1491,8 +1492,8 @@ static inline void ATA_WriteSectors(unsigned char* tfr, unsigned short sector, u
       block_count-=block_size;
     }
 
-    if (hdf[unit].type & HDF_FILE)
-      f_sync(&hdf[unit].idxfile->file);
+    if ((hdf[unit].type & HDF_TYPEMASK) == HDF_FILE)
+      wb_written(&hdf[unit].wb, &hdf[unit].idxfile->file);
 
     if (lbamode) {
       sector = lba & 0xff;
@@ -1507,6 +1508,7 @@ static inline void ATA_WriteSectors(unsigned char* tfr, unsigned short sector, u
     else
         WriteStatus(IDE_STATUS_END | IDE_STATUS_IRQ);
   }
+  PROF_END(PROF_ATA_WRITE, prof);
 }
 
 
@@ -1723,6 +1725,8 @@ static void GetHardfileGeometry(hdfTYPE *pHDF, bool amiga)
 // OpenHardfile()
 unsigned char OpenHardfile(unsigned char unit, bool amiga)
 {
+  if (hdf[unit].idxfile)
+    wb_sync(&hdf[unit].wb, &hdf[unit].idxfile->file);
   hdf[unit].idxfile = &sd_image[unit];
 
   switch(hardfile[unit]->enabled) {
@@ -6,6 +6,7 @@
 
 #include <stdbool.h>
 #include "idxfile.h"
+#include "writeback.h"
 
 // defines
 #define CMD_IDECMD  0x04
@@ -89,6 +90,7 @@ typedef struct
   unsigned short  sectors_per_block;
   unsigned short  partition; // partition no.
   long            offset; // if a partition, the lba offset of the partition.  Can be negative if we've synthesized an RDB.
+  wb_state_t      wb; // unsynced writes to the hard file
 } hdfTYPE;
 
 // variables
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "hidparser.h"
+
+// Decodes random reports of common report descriptors with the compiled
+// extraction and with the former bit collecting code and compares them
+
+#define REPORTS     4096
+#define BENCH_RUNS  2000
+
+int iprintf(const char *fmt, ...) { return 0; }
+
+// generic USB gamepad (0079:0006)
+static uint8_t desc_generic_pad[] = {
+	0x05,0x01,0x09,0x04,0xA1,0x01,0xA1,0x02,0x75,0x08,0x95,0x05,0x15,0x00,0x26,0xFF,
+	0x00,0x35,0x00,0x46,0xFF,0x00,0x09,0x30,0x09,0x31,0x09,0x32,0x09,0x32,0x09,0x35,
+	0x81,0x02,0x75,0x04,0x95,0x01,0x25,0x07,0x46,0x3B,0x01,0x65,0x14,0x09,0x39,0x81,
+	0x42,0x65,0x00,0x75,0x01,0x95,0x0C,0x25,0x01,0x45,0x01,0x05,0x09,0x19,0x01,0x29,
+	0x0C,0x81,0x02,0x06,0x00,0xFF,0x75,0x01,0x95,0x08,0x25,0x01,0x45,0x01,0x09,0x01,
+	0x81,0x02,0xC0,0xA1,0x02,0x75,0x08,0x95,0x07,0x46,0xFF,0x00,0x26,0xFF,0x00,0x09,
+	0x02,0x91,0x02,0xC0,0xC0
+};
+
+// gamepad in DirectInput mode, 16 buttons
+static uint8_t desc_dinput_pad[] = {
+	0x05,0x01,0x09,0x04,0xA1,0x01,0xA1,0x02,0x15,0x00,0x26,0xFF,0x00,0x35,0x00,0x46,
+	0xFF,0x00,0x75,0x08,0x95,0x04,0x09,0x30,0x09,0x31,0x09,0x32,0x09,0x35,0x81,0x02,
+	0x25,0x07,0x46,0x3B,0x01,0x75,0x04,0x95,0x01,0x65,0x14,0x09,0x39,0x81,0x42,0x65,
+	0x00,0x75,0x01,0x95,0x0C,0x05,0x09,0x19,0x01,0x29,0x0C,0x25,0x01,0x45,0x01,0x81,
+	0x02,0x06,0x00,0xFF,0x75,0x01,0x95,0x10,0x25,0x01,0x45,0x01,0x09,0x01,0x81,0x02,
+	0xC0,0xA1,0x02,0x26,0xFF,0x00,0x46,0xFF,0x00,0x75,0x08,0x95,0x07,0x09,0x02,0x91,
+	0x02,0xC0,0xC0
+};
+
+// flight stick with 10 bit axes, hat and twist
+static uint8_t desc_flightstick[] = {
+	0x05,0x01,0x09,0x04,0xA1,0x01,0xA1,0x02,0x75,0x0A,0x95,0x02,0x15,0x00,0x26,0xFF,
+	0x03,0x35,0x00,0x46,0xFF,0x03,0x09,0x30,0x09,0x31,0x81,0x02,0x75,0x04,0x95,0x01,
+	0x25,0x07,0x46,0x3B,0x01,0x65,0x14,0x09,0x39,0x81,0x42,0x65,0x00,0x75,0x08,0x95,
+	0x01,0x26,0xFF,0x00,0x46,0xFF,0x00,0x09,0x35,0x81,0x02,0x75,0x01,0x95,0x0C,0x25,
+	0x01,0x45,0x01,0x05,0x09,0x19,0x01,0x29,0x0C,0x81,0x02,0x75,0x02,0x95,0x01,0x81,
+	0x01,0xC0,0xC0
+};
+
+// controller with report id and signed 16 bit axes
+static uint8_t desc_signed16[] = {
+	0x05,0x01,0x09,0x05,0xA1,0x01,0x85,0x01,0x09,0x01,0xA1,0x00,0x09,0x30,0x09,0x31,
+	0x09,0x33,0x09,0x34,0x16,0x00,0x80,0x26,0xFF,0x7F,0x75,0x10,0x95,0x04,0x81,0x02,
+	0xC0,0x09,0x39,0x15,0x00,0x25,0x07,0x35,0x00,0x46,0x3B,0x01,0x65,0x14,0x75,0x04,
+	0x95,0x01,0x81,0x42,0x75,0x04,0x95,0x01,0x81,0x03,0x05,0x09,0x19,0x01,0x29,0x0A,
+	0x15,0x00,0x25,0x01,0x75,0x01,0x95,0x0A,0x81,0x02,0x75,0x06,0x95,0x01,0x81,0x03,
+	0xC0
+};
+
+// wheel mouse with report protocol
+static uint8_t desc_mouse[] = {
+	0x05,0x01,0x09,0x02,0xA1,0x01,0x09,0x01,0xA1,0x00,0x05,0x09,0x19,0x01,0x29,0x03,
+	0x15,0x00,0x25,0x01,0x95,0x03,0x75,0x01,0x81,0x02,0x95,0x01,0x75,0x05,0x81,0x03,
+	0x05,0x01,0x09,0x30,0x09,0x31,0x09,0x38,0x15,0x81,0x25,0x7F,0x75,0x08,0x95,0x03,
+	0x81,0x06,0xC0,0xC0
+};
+
+// mouse with 12 bit signed axes
+static uint8_t desc_mouse12[] = {
+	0x05,0x01,0x09,0x02,0xA1,0x01,0x09,0x01,0xA1,0x00,0x05,0x09,0x19,0x01,0x29,0x05,
+	0x15,0x00,0x25,0x01,0x95,0x05,0x75,0x01,0x81,0x02,0x95,0x01,0x75,0x03,0x81,0x03,
+	0x05,0x01,0x09,0x30,0x09,0x31,0x16,0x01,0xF8,0x26,0xFF,0x07,0x75,0x0C,0x95,0x02,
+	0x81,0x06,0x09,0x38,0x15,0x81,0x25,0x7F,0x75,0x08,0x95,0x01,0x81,0x06,0xC0,0xC0
+};
+
+static const struct {
+	const char *name;
+	uint8_t *desc;
+	uint16_t size;
+	char remap;    // move some buttons like a HID_BUTTON_REMAP in mist.ini
+} corpus[] = {
+	{ "generic pad",       desc_generic_pad, sizeof(desc_generic_pad), 0 },
+	{ "generic pad remap", desc_generic_pad, sizeof(desc_generic_pad), 1 },
+	{ "dinput pad",        desc_dinput_pad,  sizeof(desc_dinput_pad),  0 },
+	{ "flight stick",      desc_flightstick, sizeof(desc_flightstick), 0 },
+	{ "signed 16 bit",     desc_signed16,    sizeof(desc_signed16),    0 },
+	{ "wheel mouse",       desc_mouse,       sizeof(desc_mouse),       0 },
+	{ "12 bit mouse",      desc_mouse12,     sizeof(desc_mouse12),     0 },
+};
+
+// the former bit collecting code from hid.c
+static uint16_t collect_bits(uint8_t *p, uint16_t offset, uint8_t size, bool is_signed) {
+	uint8_t mask = 0xff << (offset&7);
+	uint8_t byte = offset/8;
+	uint8_t bits = size;
+	uint8_t shift = offset&7;
+
+	uint16_t rval = (p[byte++] & mask) >> shift;
+	mask = 0xff;
+	shift = 8-shift;
+	bits -= shift;
+
+	if(shift > size) {
+		rval &= (1<<size)-1;
+	} else {
+		while(bits) {
+			mask = (bits<8)?(0xff>>(8-bits)):0xff;
+			rval += (p[byte++] & mask) << shift;
+			shift += 8;
+			bits -= (bits>8)?8:bits;
+		}
+	}
+
+	if(is_signed) {
+		uint16_t sign_bit = 1<<(size-1);
+		if(rval & sign_bit) {
+			while(sign_bit) {
+				rval |= sign_bit;
+				sign_bit <<= 1;
+			}
+		}
+	}
+
+	return rval;
+}
+
+typedef struct {
+	uint16_t axis[MAX_AXES];
+	uint16_t hat;
+	uint16_t buttons;
+} decoded_t;
+
+static void decode_old(hid_report_t *conf, uint8_t *p, decoded_t *d) {
+	uint8_t i;
+	for(i=0;i<MAX_AXES;i++) {
+		bool is_signed = conf->joystick_mouse.axis[i].logical.min > conf->joystick_mouse.axis[i].logical.max;
+		d->axis[i] = collect_bits(p, conf->joystick_mouse.axis[i].offset, conf->joystick_mouse.axis[i].size, is_signed);
+	}
+	d->hat = conf->joystick_mouse.hat.size ? collect_bits(p, conf->joystick_mouse.hat.offset, conf->joystick_mouse.hat.size, 0) : 0;
+	d->buttons = 0;
+	for(i=0;i<MAX_BUTTONS;i++)
+		if(p[conf->joystick_mouse.button[i].byte_offset] & conf->joystick_mouse.button[i].bitmask)
+			d->buttons |= (1<<i);
+}
+
+static void decode_new(hid_report_t *conf, uint8_t *p, decoded_t *d) {
+	uint8_t i;
+	for(i=0;i<MAX_AXES;i++)
+		d->axis[i] = hid_report_field(&conf->prog.axis[i], p);
+	d->hat = hid_report_field(&conf->prog.hat, p);
+	d->buttons = hid_report_buttons(conf, p);
+}
+
+int main() {
+	static uint8_t reports[REPORTS][64];
+	int errors = 0;
+	uint32_t i, c, r;
+	clock_t start;
+	double t_old, t_new;
+	decoded_t d1, d2;
+	volatile uint16_t sink;
+
+	srand(1);
+	for(i=0; i<REPORTS; i++)
+		for(r=0; r<64; r++) reports[i][r] = rand();
+
+	for(c=0; c<sizeof(corpus)/sizeof(corpus[0]); c++) {
+		hid_report_t conf;
+
+		if(!parse_report_descriptor(corpus[c].desc, corpus[c].size, &conf)) {
+			printf("%s: descriptor not accepted\n", corpus[c].name);
+			errors++;
+			continue;
+		}
+		if(corpus[c].remap) {
+			// like the 5200daptor hack and HID_BUTTON_REMAP entries
+			conf.joystick_mouse.button[2].byte_offset = 4;
+			conf.joystick_mouse.button[2].bitmask = 0x40;
+			conf.joystick_mouse.button[7].byte_offset = 0;
+			conf.joystick_mouse.button[7].bitmask = 0x80 >> 3;
+			hid_report_compile(&conf);
+		}
+
+		uint8_t off = conf.report_id ? 1 : 0;
+		for(i=0; i<REPORTS; i++) {
+			decode_old(&conf, reports[i]+off, &d1);
+			decode_new(&conf, reports[i]+off, &d2);
+			if(memcmp(&d1, &d2, sizeof(decoded_t))) {
+				printf("%s: report %d decoded differently\n", corpus[c].name, i);
+				errors++;
+				break;
+			}
+		}
+
+		start = clock();
+		for(r=0; r<BENCH_RUNS; r++)
+			for(i=0; i<REPORTS; i++) {
+				decode_old(&conf, reports[i]+off, &d1);
+				sink = d1.axis[0] + d1.buttons;
+			}
+		t_old = (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / BENCH_RUNS / REPORTS;
+
+		start = clock();
+		for(r=0; r<BENCH_RUNS; r++)
+			for(i=0; i<REPORTS; i++) {
+				decode_new(&conf, reports[i]+off, &d2);
+				sink = d2.axis[0] + d2.buttons;
+			}
+		t_new = (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / BENCH_RUNS / REPORTS;
+
+		printf("%-18s %2d bytes, %d button runs: %5.1f -> %5.1f ns/report\n", corpus[c].name,
+		       conf.report_size, conf.prog.button_runs, t_old, t_new);
+	}
+
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
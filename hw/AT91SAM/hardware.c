@@ -295,6 +295,20 @@ RAMFUNC unsigned long CheckTimer(unsigned long time)
     return(time > (1UL << 31));
 }
 
+// PIT ticks (MCLK/16), extended to 32 bits, as the 12 bit period counter
+// wraps after 4096ms. Needs to be called at least every 4 seconds.
+RAMFUNC unsigned long GetTimestamp(void)
+{
+    static unsigned long base, last;
+    unsigned long piir = *AT91C_PITC_PIIR;
+    unsigned long ticks = (piir >> 20) * (MCLK / 16 / 1000) + (piir & AT91C_PITC_CPIV);
+
+    if (ticks < last)
+        base += 4096 * (MCLK / 16 / 1000);
+    last = ticks;
+    return base + ticks;
+}
+
 void WaitTimer(unsigned long time)
 {
     time = GetTimer(time);
@@ -8,6 +8,7 @@
 #define MCLK 48000000
 #define FWS 1 // Flash wait states
 #define FLASH_PAGESIZE 256
+#define FLASH_BASE 0x00100000
 
 #define DISKLED       AT91C_PIO_PA29
 #define DISKLED_ON    *AT91C_PIOA_CODR = DISKLED;
@@ -113,6 +114,10 @@ unsigned long GetTimer(unsigned long offset);
 unsigned long CheckTimer(unsigned long t);
 void WaitTimer(unsigned long time);
 
+// free running timestamp for profiling, PIT based
+#define TIMESTAMP_TICKS_PER_US (MCLK / 16 / 1000000)
+unsigned long GetTimestamp(void);
+
 void USART_Poll(void);
 
 void inline MCUReset() {*AT91C_RSTC_RCR = 0xA5 << 24 | AT91C_RSTC_PERRST | AT91C_RSTC_PROCRST | AT91C_RSTC_EXTRST;}
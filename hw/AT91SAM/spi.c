@@ -47,13 +47,13 @@ void DisableFpga()
     *AT91C_SPI_MR = AT91C_SPI_MSTR | AT91C_SPI_MODFDIS  | (0x01 << 16); // NPCS1
 }
 
-void EnableOsd()
+RAMFUNC void EnableOsd()
 {
     *AT91C_SPI_CR = AT91C_SPI_SPIEN;
     *AT91C_SPI_MR = AT91C_SPI_MSTR | AT91C_SPI_MODFDIS  | (0x07 << 16); // NPCS3
 }
 
-void DisableOsd()
+RAMFUNC void DisableOsd()
 {
     *AT91C_SPI_CR = AT91C_SPI_SPIEN | AT91C_SPI_LASTXFER;
     spi_wait4xfer_end();
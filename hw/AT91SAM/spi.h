@@ -20,8 +20,8 @@ void spi_set_speed(unsigned char speed);
 #define EnableFpgaMinimig EnableFpga
 void EnableFpga(void);
 void DisableFpga(void);
-void EnableOsd(void);
-void DisableOsd(void);
+RAMFUNC void EnableOsd(void);
+RAMFUNC void DisableOsd(void);
 void EnableDMode();
 void DisableDMode();
 RAMFUNC void EnableCard();
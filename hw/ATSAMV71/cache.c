@@ -0,0 +1,78 @@
+/*
+This file is part of MiST-firmware
+
+MiST-firmware is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+MiST-firmware is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "hardware.h"
+#include "cache.h"
+#include "attrs.h"
+
+// sram_nc in flash.ld
+#define NOCACHE_ADDR 0x2045F000
+
+void cache_init(void)
+{
+    ARM_MPU_Disable();
+    // DMA descriptors, normal memory without caching
+    ARM_MPU_SetRegionEx(0, NOCACHE_ADDR, ARM_MPU_RASR_EX(1, ARM_MPU_AP_FULL,
+                        ARM_MPU_ACCESS_NORMAL(ARM_MPU_CACHEP_NOCACHE, ARM_MPU_CACHEP_NOCACHE, 1),
+                        0, ARM_MPU_REGION_SIZE_4KB));
+    // the QSPI memory window is the FPGA, not memory. The default map would
+    // make it cacheable external RAM and the byte writes would be merged
+    ARM_MPU_SetRegionEx(1, QSPIMEM0_ADDR, ARM_MPU_RASR_EX(1, ARM_MPU_AP_FULL,
+                        ARM_MPU_ACCESS_DEVICE(1), 0, ARM_MPU_REGION_SIZE_512MB));
+    // the rest keeps the default memory map
+    ARM_MPU_Enable(MPU_CTRL_PRIVDEFENA_Msk);
+
+    SCB_EnableDCache();
+}
+
+// The maintenance runs from RAM, the SD card is read with it while the
+// flash is programmed
+
+RAMFUNC void cache_clean_region(const void *addr, uint32_t size)
+{
+    SCB_CleanDCache_by_Addr((uint32_t*)addr, size);
+}
+
+RAMFUNC void cache_invalidate_region(void *addr, uint32_t size)
+{
+    uint32_t start = (uint32_t)addr, end = start + size;
+
+    if (!size) return;
+    // lines shared with other data are written back first
+    if (start & (L1_CACHE_BYTES - 1))
+        SCB_CleanInvalidateDCache_by_Addr((uint32_t*)start, 1);
+    if (end & (L1_CACHE_BYTES - 1))
+        SCB_CleanInvalidateDCache_by_Addr((uint32_t*)(end - 1), 1);
+    SCB_InvalidateDCache_by_Addr(addr, size);
+}
+
+// Before a receive the lines are dropped, so no dirty line is evicted
+// over the new data. The core may fetch lines speculatively during the
+// transfer, they are dropped again at the end.
+RAMFUNC void dma_map(const void *buf, uint32_t len, dma_dir_t dir)
+{
+    if (dir == DMA_TO_DEVICE)
+        cache_clean_region(buf, len);
+    else
+        cache_invalidate_region((void*)buf, len);
+}
+
+RAMFUNC void dma_unmap(const void *buf, uint32_t len, dma_dir_t dir)
+{
+    if (dir == DMA_FROM_DEVICE)
+        cache_invalidate_region((void*)buf, len);
+}
@@ -0,0 +1,55 @@
+/*
+This file is part of MiST-firmware
+
+MiST-firmware is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+MiST-firmware is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+// Data cache maintenance for the DMA masters (XDMAC, USBHS, GMAC). They
+// don't see the cache of the core, so a buffer is handed over to the DMA
+// with dma_map() and taken back with dma_unmap() when the transfer is done.
+// Between the two calls the CPU must not touch it. Buffers received by DMA
+// must start and end on a cache line, or the lines shared with other data
+// could be written back over the received data; the drivers bounce such
+// transfers through an aligned buffer of their own.
+
+#ifndef L1_CACHE_BYTES
+#define L1_CACHE_BYTES 32
+#endif
+
+// for uninitialized buffers only, the sections are not loaded
+#define CACHE_ALIGNED __attribute__((aligned(L1_CACHE_BYTES), section(".region_cache_aligned")))
+#define NOT_CACHED    __attribute__((section(".region_nocache")))
+
+// size of a buffer rounded up to whole cache lines
+#define CACHE_ALIGN_SIZE(s)  (((s) + L1_CACHE_BYTES - 1) & ~(L1_CACHE_BYTES - 1))
+#define CACHE_IS_ALIGNED(p, s) (!((((uintptr_t)(p)) | (s)) & (L1_CACHE_BYTES - 1)))
+
+typedef enum {
+  DMA_TO_DEVICE,    // the DMA reads the buffer
+  DMA_FROM_DEVICE   // the DMA writes the buffer
+} dma_dir_t;
+
+void cache_init(void);
+void cache_clean_region(const void *addr, uint32_t size);
+void cache_invalidate_region(void *addr, uint32_t size);
+
+void dma_map(const void *buf, uint32_t len, dma_dir_t dir);
+void dma_unmap(const void *buf, uint32_t len, dma_dir_t dir);
+
+#endif // CACHE_H
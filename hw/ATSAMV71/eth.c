@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include "eth.h"
 #include "hardware.h"
+#include "cache.h"
 #include "debug.h"
 
 #include "network/gmac.h"
@@ -9,8 +10,7 @@
 #include "network/gmii.h"
 
 #include "user_io.h"
-
-extern unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+#include "eth_bridge.h"
 
 static struct _phy phy;
 static struct _phy_desc phy_desc;
@@ -19,18 +19,17 @@ static uint8_t mac[] = {0x02, 0x00, 0x01, 0x02, 0x03, 0x04};
 
 #define RX_BUFFERS 20
 #define TX_BUFFERS 5
-static uint8_t rx_buffer[ETH_RX_UNITSIZE*RX_BUFFERS] __attribute__ ((aligned));
-static uint8_t tx_buffer[ETH_TX_UNITSIZE*TX_BUFFERS] __attribute__ ((aligned));
-static struct _eth_desc rx_desc[RX_BUFFERS] __attribute__ ((aligned));
-static struct _eth_desc tx_desc[TX_BUFFERS] __attribute__ ((aligned));
+static uint8_t rx_buffer[ETH_RX_UNITSIZE*RX_BUFFERS] CACHE_ALIGNED;
+static uint8_t tx_buffer[ETH_TX_UNITSIZE*TX_BUFFERS] CACHE_ALIGNED;
+// the descriptors are shared with the GMAC word by word
+static struct _eth_desc rx_desc[RX_BUFFERS] __attribute__ ((aligned)) NOT_CACHED;
+static struct _eth_desc tx_desc[TX_BUFFERS] __attribute__ ((aligned)) NOT_CACHED;
 
 static char link = 0;
 static char link_changed = 0;
 
 static unsigned long timerMAC;
 
-#define MAX_FRAMELEN 1536
-static uint32_t old_status;
 
 static void PIOAIrqHandler()
 {
@@ -69,6 +68,7 @@ int eth_init()
 	PIOA->PIO_FELLSR = PHY_INT; // detect falling edge
 	PIOA->PIO_IER = PHY_INT;
 	timerMAC = 0;
+	eth_bridge_init();
 	ethd_start(&ethd);
 	return 0;
 }
@@ -103,36 +103,32 @@ int eth_poll()
 
 	if (!link) return 0;
 
-	uint32_t status = user_io_eth_get_status();
-
-	if(status != old_status) {
-		eth_debug("fpga status changed to cmd %x, eq=%d, prx=%d, ptx=%d, len=%d",
-		  status >> 24, (status & 0x40000)?1:0, (status & 0x20000)?1:0,
-		  (status & 0x10000)?1:0, status & 0xffff);
-		old_status = status;
+	uint8_t *frame;
+	uint16_t len;
+	uint32_t recv_size;
+
+	// GMAC -> rx queue
+	while ((frame = eth_bridge_rx_get_buffer())) {
+		recv_size = 0;
+		if (ethd_poll(&ethd, 0, frame, ETH_BRIDGE_FRAMELEN, &recv_size) != ETH_OK || !recv_size)
+			break;
+		//iprintf("received packet: %d bytes\n", recv_size);
+		//hexdump(frame, recv_size, 0);
+		eth_bridge_rx_put(recv_size);
 	}
 
-	if((status >> 24) == 0xa5) {
-		uint16_t len = status & 0xffff;
-
-		if(len <= MAX_FRAMELEN) {
-			user_io_eth_receive_tx_frame(sector_buffer, len);
-			//iprintf("sending packet: %d bytes\n", len);
-			//hexdump(sector_buffer, len, 0);
-			ethd_send(&ethd, 0, sector_buffer, len, 0);
-		}
-	}
+	// frames the GMAC had no buffer for while the rx queue was full
+	eth_bridge_rx_drop((GMAC0->GMAC_RRE & GMAC_RRE_RXRER_Msk) + (GMAC0->GMAC_ROE & GMAC_ROE_RXOVR_Msk));
 
-	if(!(status & 0x20000)) {
+	eth_bridge_poll();
 
-		uint32_t recv_size = 0;
-		if (ethd_poll(&ethd, 0, sector_buffer, SECTOR_BUFFER_SIZE, &recv_size) == ETH_OK) {
-			if (recv_size) {
-				user_io_eth_send_rx_frame(sector_buffer, recv_size);
-				//iprintf("received packet: %d bytes\n", recv_size);
-				//hexdump(sector_buffer, recv_size, 0);
-			}
-		}
+	// tx queue -> GMAC
+	while ((len = eth_bridge_tx_get(&frame))) {
+		//iprintf("sending packet: %d bytes\n", len);
+		//hexdump(frame, len, 0);
+		if (ethd_send(&ethd, 0, frame, len, 0) == ETH_TX_BUSY)
+			break; // no free tx descriptor, try again in the next poll
+		eth_bridge_tx_done();
 	}
 	return 0;
 }
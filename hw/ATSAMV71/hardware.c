@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "mist_cfg.h"
 #include "user_io.h"
 #include "xmodem.h"
+#include "cache.h"
 
 volatile unsigned long timer_ticks = 0;
 
@@ -36,7 +37,7 @@ RAMFUNC void _default_systick_handler()
 void __init_hardware()
 {
     SCB_EnableICache();
-    //SCB_EnableDCache();
+    cache_init();
 
     SUPC->SUPC_MR = SUPC_MR_BODRSTEN_NOT_ENABLE | SUPC_MR_BODDIS_DISABLE | SUPC_MR_ONREG_ONREG_USED | SUPC_MR_OSCBYPASS_NO_EFFECT | SUPC_MR_KEY_PASSWD;
     WDT->WDT_MR = WDT_MR_WDDIS; // disable watchdog
@@ -274,6 +275,12 @@ void Timer_Init(void) {
     // 1ms systick interrupt
     SysTick->LOAD = PLLCLK/1000;
     SysTick->CTRL = 0x7; // ENABLE/TICKINT/PROC CLKSOURCE
+
+    // cycle counter for GetTimestamp()
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 }
 
 RAMFUNC unsigned long GetTimer(unsigned long offset)
@@ -554,4 +561,7 @@ void RAMFUNC WriteFlash(unsigned long page) {
 
     EEFC->EEFC_FCR = EEFC_FCR_FCMD_WP | EEFC_FCR_FARG(page) | EEFC_FCR_FKEY_PASSWD; // write page
     while (!(EEFC->EEFC_FSR & EEFC_FSR_FRDY));  // wait for ready
+    // drop the stale lines of the page, it is read at FLASH_BASE and through the boot alias at 0
+    SCB_InvalidateDCache_by_Addr((void*)(FLASH_BASE + page * FLASH_PAGESIZE), FLASH_PAGESIZE);
+    SCB_InvalidateDCache_by_Addr((void*)(page * FLASH_PAGESIZE), FLASH_PAGESIZE);
 }
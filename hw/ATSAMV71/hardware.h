@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define PLLCLK 288000000
 #define FWS 6
 #define FLASH_PAGESIZE 512
+#define FLASH_BASE 0x00400000
 
 #define DMA_CH_MMC           0
 #define DMA_CH_SPI_TRANS     1
@@ -157,6 +158,10 @@ unsigned long GetTimer(unsigned long offset);
 unsigned long CheckTimer(unsigned long t);
 void WaitTimer(unsigned long time);
 
+// free running timestamp for profiling, DWT cycle counter
+#define TIMESTAMP_TICKS_PER_US (PLLCLK / 1000000)
+static inline unsigned long GetTimestamp() { return DWT->CYCCNT; }
+
 void USART_Poll();
 
 void MCUReset();
@@ -20,6 +20,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdint.h>
 
 #include "mmc.h"
+#include "cache.h"
 
 // SD CMD6 argument structure
 // CMD6 arg[ 3: 0] function group 1, access mode
@@ -55,6 +56,8 @@ static uint8_t  SCR[8];
 static uint8_t  CSD[16];
 static uint8_t  CID[16];
 static uint8_t  switch_status[512/8];
+// blocks for buffers which don't start and end on a cache line
+static uint8_t  bounce_buffer[512] CACHE_ALIGNED;
 
 // internal functions
 static unsigned char MMC_WaitReady() RAMFUNC;
@@ -290,11 +293,13 @@ RAMFUNC static unsigned char MMC_ReadBlocks(unsigned char *buffer, unsigned long
     XDMAC0->XDMAC_CH[DMA_CH_MMC].XDMAC_CDA = (uint32_t)buffer;
     XDMAC0->XDMAC_CH[DMA_CH_MMC].XDMAC_CUBC = XDMAC_CUBC_UBLEN(blocks*512/4);
     XDMAC0->XDMAC_CH[DMA_CH_MMC].XDMAC_CIS; // read interrupt reg to clear any flags prior to enabling channel
+    dma_map(buffer, blocks*512, DMA_FROM_DEVICE);
     XDMAC0->XDMAC_GE = XDMAC_GE_EN0;        // start DMA
     XDMAC0->XDMAC_CH[DMA_CH_MMC].XDMAC_CIS; // clear any flags
 
     unsigned char retval = MMC_WaitTransferEnd();
     XDMAC0->XDMAC_GD = XDMAC_GD_DI0;
+    dma_unmap(buffer, blocks*512, DMA_FROM_DEVICE);
 /*
     for (int i=0; i<blocks; i++) {
       hexdump(buffer, 512, 0);
@@ -306,12 +311,39 @@ RAMFUNC static unsigned char MMC_ReadBlocks(unsigned char *buffer, unsigned long
     return(retval);
 }
 
+// memcpy() is in the flash, which can't be read while it is programmed.
+// The byte stores don't need an aligned destination.
+RAMFUNC static void MMC_CopyBlock(unsigned char *dst, const uint32_t *src)
+{
+    for (int i = 0; i < 512 / 4; i++, dst += 4) {
+        uint32_t w = src[i];
+        dst[0] = w;
+        dst[1] = w >> 8;
+        dst[2] = w >> 16;
+        dst[3] = w >> 24;
+    }
+}
+
+// the DMA writes whole cache lines only, others are read block by block
+RAMFUNC static unsigned char MMC_ReadAligned(unsigned char *buffer, unsigned long lba, unsigned long blocks)
+{
+    if (CACHE_IS_ALIGNED(buffer, 0))
+        return MMC_ReadBlocks(buffer, lba, blocks);
+
+    for (; blocks; blocks--, lba++, buffer += 512) {
+        if (!MMC_ReadBlocks(bounce_buffer, lba, 1)) return 0;
+        MMC_CopyBlock(buffer, (const uint32_t*)bounce_buffer);
+        if (blocks > 1 && !MMC_WaitReady()) return 0;
+    }
+    return 1;
+}
+
 // Read single 512-byte block
 RAMFUNC unsigned char MMC_Read(unsigned long lba, unsigned char *pReadBuffer)
 {
     //iprintf("MMC_Read lba=%lu\n", lba);
     if (!MMC_WaitReady()) return 0;
-    return MMC_ReadBlocks(pReadBuffer, lba, 1);
+    return MMC_ReadAligned(pReadBuffer, lba, 1);
 }
 
 // read multiple 512-byte blocks
@@ -319,7 +351,7 @@ RAMFUNC unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *pReadBu
 {
     //iprintf("MMC_ReadMultiple lba=%lu, nBlockCount=%d\n", lba, nBlockCount);
     if (!MMC_WaitReady()) return 0;
-    return MMC_ReadBlocks(pReadBuffer, lba, nBlockCount);
+    return MMC_ReadAligned(pReadBuffer, lba, nBlockCount);
 }
 
 static unsigned char MMC_WriteBlocks(unsigned long lba, const unsigned char *pWriteBuffer, unsigned long blocks)
@@ -346,6 +378,7 @@ static unsigned char MMC_WriteBlocks(unsigned long lba, const unsigned char *pWr
         return(0);
     }
 
+    dma_map(pWriteBuffer, blocks*512, DMA_TO_DEVICE);
     XDMAC0->XDMAC_CH[DMA_CH_MMC].XDMAC_CSA = (uint32_t)pWriteBuffer;
     XDMAC0->XDMAC_CH[DMA_CH_MMC].XDMAC_CDA = (uint32_t)&(HSMCI0->HSMCI_FIFO[0]);
     XDMAC0->XDMAC_CH[DMA_CH_MMC].XDMAC_CUBC = XDMAC_CUBC_UBLEN(blocks*512/4);
@@ -354,6 +387,7 @@ static unsigned char MMC_WriteBlocks(unsigned long lba, const unsigned char *pWr
 
     unsigned char retval = MMC_WaitTransferEnd();
     XDMAC0->XDMAC_GD = XDMAC_GD_DI0;
+    dma_unmap(pWriteBuffer, blocks*512, DMA_TO_DEVICE);
     if (blocks > 1) MMC_Command(CMD12, 0, HSMCI_CMDR_RSPTYP_R1B | HSMCI_CMDR_MAXLAT);
 
     return(retval);
@@ -39,6 +39,7 @@
 #include "ring.h"
 #include "network/gmacd.h"
 #include "irq/nvic.h"
+#include "cache.h"
 
 #include <string.h>
 #include <assert.h>
@@ -52,8 +53,6 @@
 #define GMAC_INT_TX_ERR_BITS (GMAC_IER_TUR | GMAC_IER_RLEX | GMAC_IER_TFC)
 #define GMAC_INT_TX_BITS     (GMAC_INT_TX_ERR_BITS | GMAC_IER_TCOMP)
 
-#define NOT_CACHED
-#define CACHE_ALIGNED
 /*---------------------------------------------------------------------------
  *         Types
  *---------------------------------------------------------------------------*/
@@ -17,6 +17,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "qspi.h"
 #include "hardware.h"
+#include "cache.h"
 
 static uint8_t* dst;
 
@@ -59,11 +60,13 @@ void qspi_write_block(const uint8_t *data, uint32_t len) {
   XDMAC0->XDMAC_CH[DMA_CH_QSPI_TRANS].XDMAC_CUBC = XDMAC_CUBC_UBLEN(len);
   XDMAC0->XDMAC_CH[DMA_CH_QSPI_TRANS].XDMAC_CIS; //read interrupt reg to clear any flags prior to enabling channel
   XDMAC0->XDMAC_CH[DMA_CH_QSPI_TRANS].XDMAC_CIE = XDMAC_CIE_BIE;
+  dma_map(data, len, DMA_TO_DEVICE);
   // Start the transmitter
   XDMAC0->XDMAC_GE = XDMAC_GE_EN3;
 
   // Wait for end of transfer
   while (!(XDMAC0->XDMAC_CH[DMA_CH_QSPI_TRANS].XDMAC_CIS & XDMAC_CIS_BIS));
+  dma_unmap(data, len, DMA_TO_DEVICE);
   dst += len;
 }
 
@@ -15,8 +15,11 @@ You should have received a copy of the GNU General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include "spi.h"
 #include "hardware.h"
+#include "cache.h"
+#include "utils.h"
 
 void spi_init()
 {
@@ -37,7 +40,7 @@ void spi_init()
     SPI0->SPI_CSR[3] = SPI_CSR_CPOL | SPI_CSR_SCBR(SPI_SDC_CLK_VALUE) | SPI_CSR_DLYBCT(0) | SPI_CSR_CSAAT | SPI_CSR_DLYBS(10); // SS2
 }
 
-void spi_wait4xfer_end()
+RAMFUNC void spi_wait4xfer_end()
 {
     while (!(SPI0->SPI_SR & SPI_SR_TXEMPTY));
 }
@@ -62,13 +65,13 @@ void DisableFpga()
     SPI0->SPI_CR = SPI_CR_SPIDIS;
 }
 
-void EnableOsd()
+RAMFUNC void EnableOsd()
 {
     SPI0->SPI_MR = SPI_MR_MSTR | SPI_MR_MODFDIS | SPI_MR_PCS(0x0E); // NPCS0
     SPI0->SPI_CR = SPI_CR_SPIEN;
 }
 
-void DisableOsd()
+RAMFUNC void DisableOsd()
 {
     spi_wait4xfer_end();
     SPI0->SPI_CR = SPI_CR_SPIDIS;
@@ -120,7 +123,7 @@ void spi_block(unsigned short num)
 }
 
 
-void spi_transfer(const char *srcAddr, char *dstAddr, uint16_t len)
+static void spi_dma(const char *srcAddr, char *dstAddr, uint16_t len)
 {
     static uint32_t dummy __attribute__ ((aligned)) = 0xdeadbeaf;
 
@@ -160,11 +163,39 @@ void spi_transfer(const char *srcAddr, char *dstAddr, uint16_t len)
     XDMAC0->XDMAC_CH[DMA_CH_SPI_REC].XDMAC_CIS; //read interrupt reg to clear any flags prior to enabling channel
     XDMAC0->XDMAC_CH[DMA_CH_SPI_REC].XDMAC_CIE = XDMAC_CIE_BIE;
 
+    if (srcAddr) dma_map(srcAddr, len, DMA_TO_DEVICE);
+    if (dstAddr) dma_map(dstAddr, len, DMA_FROM_DEVICE);
+
     // Start the transmitter-receiver
     XDMAC0->XDMAC_GE = XDMAC_GE_EN1 | XDMAC_GE_EN2;
 
     // Wait for end of transfer
     while (!(XDMAC0->XDMAC_CH[DMA_CH_SPI_TRANS].XDMAC_CIS & XDMAC_CIS_BIS));
+    if (dstAddr) {
+        // the last byte is stored after it was sent
+        while (!(XDMAC0->XDMAC_CH[DMA_CH_SPI_REC].XDMAC_CIS & XDMAC_CIS_BIS));
+        dma_unmap(dstAddr, len, DMA_FROM_DEVICE);
+    }
+    if (srcAddr) dma_unmap(srcAddr, len, DMA_TO_DEVICE);
+}
+
+void spi_transfer(const char *srcAddr, char *dstAddr, uint16_t len)
+{
+    // received in pieces if the buffer shares cache lines with other data
+    static char bounce[512] CACHE_ALIGNED;
+
+    if (!dstAddr || CACHE_IS_ALIGNED(dstAddr, len)) {
+        spi_dma(srcAddr, dstAddr, len);
+        return;
+    }
+    while (len) {
+        uint16_t chunk = MIN(len, sizeof(bounce));
+        spi_dma(srcAddr, bounce, chunk);
+        memcpy(dstAddr, bounce, chunk);
+        if (srcAddr) srcAddr += chunk;
+        dstAddr += chunk;
+        len -= chunk;
+    }
 }
 
 void spi_read(char *addr, uint16_t len)
@@ -28,7 +28,7 @@ void spi_init(void);
 void spi_slow();
 void spi_fast();
 void spi_fast_mmc();
-void spi_wait4xfer_end();
+RAMFUNC void spi_wait4xfer_end();
 unsigned char spi_get_speed();
 void spi_set_speed(unsigned char speed);
 
@@ -36,8 +36,8 @@ void spi_set_speed(unsigned char speed);
 void EnableFpga(void);
 void EnableFpgaMinimig(void);
 void DisableFpga(void);
-void EnableOsd(void);
-void DisableOsd(void);
+RAMFUNC void EnableOsd(void);
+RAMFUNC void DisableOsd(void);
 void EnableDMode();
 void DisableDMode();
 void EnableCard();
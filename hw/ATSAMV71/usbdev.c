@@ -22,6 +22,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "arch/barriers.h"
 #include "usb/usb.h"
 #include "usbdev.h"
+#include "cache.h"
 #include "utils.h"
 #include "debug.h"
 
@@ -239,20 +240,33 @@ void usb_dump_regs() {
 // Maximum transfer size on USB DMA
 #define EPT_VIRTUAL_SIZE  0x8000
 
-static void usb_dma_transfer(uint8_t ep, uint8_t* data, uint32_t size)
+static void usb_dma_start(uint8_t ep, uint8_t* data, uint32_t size, uint32_t control)
 {
 	UsbhsDevDma* devdma = &USBHS->USBHS_DEVDMA[ep-1];
 	devdma->USBHS_DEVDMAADDRESS = (uint32_t) data;
 	devdma->USBHS_DEVDMASTATUS = devdma->USBHS_DEVDMASTATUS; // clear pending bits
 	devdma->USBHS_DEVDMACONTROL = 0;
-	devdma->USBHS_DEVDMACONTROL = USBHS_DEVDMACONTROL_BURST_LCK | USBHS_DEVDMACONTROL_CHANN_ENB | USBHS_DEVDMACONTROL_BUFF_LENGTH(size);
-	while (devdma->USBHS_DEVDMASTATUS & USBHS_DEVDMASTATUS_CHANN_ACT);
+	devdma->USBHS_DEVDMACONTROL = control | USBHS_DEVDMACONTROL_BURST_LCK | USBHS_DEVDMACONTROL_CHANN_ENB | USBHS_DEVDMACONTROL_BUFF_LENGTH(size);
+}
+
+// the channel is disabled by the hardware when the whole buffer is transferred
+static uint8_t usb_dma_busy(uint8_t ep)
+{
+	return !!(USBHS->USBHS_DEVDMA[ep-1].USBHS_DEVDMASTATUS & USBHS_DEVDMASTATUS_CHANN_ENB);
+}
+
+static void usb_dma_transfer(uint8_t ep, uint8_t* data, uint32_t size)
+{
+	usb_dma_start(ep, data, size, 0);
+	while (USBHS->USBHS_DEVDMA[ep-1].USBHS_DEVDMASTATUS & USBHS_DEVDMASTATUS_CHANN_ACT);
 }
 
 static void usb_write_fifo_buffer(uint8_t ep, uint8_t* data, uint32_t size)
 {
 	if (ep) { // EP0 doesn't have DMA
+		dma_map(data, size, DMA_TO_DEVICE);
 		usb_dma_transfer(ep, data, size);
+		dma_unmap(data, size, DMA_TO_DEVICE);
 	} else {
 		volatile uint8_t *fifo = ((volatile uint8_t*)USBHS_RAM_ADDR) + EPT_VIRTUAL_SIZE * ep;
 		dsb(); isb();
@@ -264,8 +278,20 @@ static void usb_write_fifo_buffer(uint8_t ep, uint8_t* data, uint32_t size)
 
 static void usb_read_fifo_buffer(uint8_t ep, uint8_t* data, uint32_t size)
 {
+	// for buffers sharing cache lines with other data, one bank at most
+	static uint8_t bounce[BULK_OUT_SIZE] CACHE_ALIGNED;
+
 	if (ep) { // EP0 doesn't have DMA
-		usb_dma_transfer(ep, data, size);
+		if (CACHE_IS_ALIGNED(data, size)) {
+			dma_map(data, size, DMA_FROM_DEVICE);
+			usb_dma_transfer(ep, data, size);
+			dma_unmap(data, size, DMA_FROM_DEVICE);
+		} else {
+			dma_map(bounce, sizeof(bounce), DMA_FROM_DEVICE);
+			usb_dma_transfer(ep, bounce, size);
+			dma_unmap(bounce, sizeof(bounce), DMA_FROM_DEVICE);
+			memcpy(data, bounce, size);
+		}
 	} else {
 		volatile uint8_t *fifo = ((volatile uint8_t*)USBHS_RAM_ADDR) + EPT_VIRTUAL_SIZE * ep;
 		dmb();
@@ -318,11 +344,12 @@ static void usb_irq_handler(void) {
 		USBHS->USBHS_DEVEPTIER[3] = USBHS_DEVEPTIER_TXINES;
 
 		// setup endpoint 4 for IN requests
-		USBHS->USBHS_DEVEPTCFG[4] = USBHS_DEVEPTCFG_ALLOC | USBHS_DEVEPTCFG_EPBK_1_BANK |
+		// (two banks, so the host can read one while the DMA fills the other)
+		USBHS->USBHS_DEVEPTCFG[4] = USBHS_DEVEPTCFG_ALLOC | USBHS_DEVEPTCFG_EPBK_2_BANK |
 		                            BULK_SIZE_CONF | USBHS_DEVEPTCFG_EPDIR_IN | USBHS_DEVEPTCFG_EPTYPE_BLK | USBHS_DEVEPTCFG_AUTOSW;
 
 		// setup endpoint 5 for OUT requests
-		USBHS->USBHS_DEVEPTCFG[5] = USBHS_DEVEPTCFG_ALLOC | USBHS_DEVEPTCFG_EPBK_1_BANK |
+		USBHS->USBHS_DEVEPTCFG[5] = USBHS_DEVEPTCFG_ALLOC | USBHS_DEVEPTCFG_EPBK_2_BANK |
 		                            BULK_SIZE_CONF | USBHS_DEVEPTCFG_EPDIR_OUT | USBHS_DEVEPTCFG_EPTYPE_BLK | USBHS_DEVEPTCFG_AUTOSW;
 
 		USBHS->USBHS_DEVEPT = USBHS_DEVEPT_EPEN0 | USBHS_DEVEPT_EPEN1 | USBHS_DEVEPT_EPEN2 | USBHS_DEVEPT_EPEN3 | USBHS_DEVEPT_EPEN4 | USBHS_DEVEPT_EPEN5;
@@ -638,4 +665,54 @@ uint16_t usb_storage_write(const char *pData, uint16_t length) {
 	return usb_write(4, pData, length);
 }
 
+// the buffers owned by the DMA of the mass storage endpoints
+static struct {
+	const char *buf;
+	uint32_t len;
+} storage_dma[2];
+
+static void usb_storage_unmap(uint8_t i) {
+	if (!storage_dma[i].buf) return;
+	dma_unmap(storage_dma[i].buf, storage_dma[i].len, i ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+	storage_dma[i].buf = 0;
+}
+
+// Start sending a buffer on the mass storage IN endpoint. The DMA fills the
+// endpoint banks packet by packet, and sends a short packet at the end.
+uint8_t usb_storage_write_start(const char *pData, uint32_t length) {
+	if (!usb_is_configured()) return 0;
+	storage_dma[0].buf = pData;
+	storage_dma[0].len = length;
+	dma_map(pData, length, DMA_TO_DEVICE);
+	usb_dma_start(4, (uint8_t*)pData, length, USBHS_DEVDMACONTROL_END_B_EN);
+	return 1;
+}
+
+// Start receiving a buffer on the mass storage OUT endpoint. A short packet
+// from the host ends the transfer early. The buffer must start and end on a
+// cache line.
+uint8_t usb_storage_read_start(char *pData, uint32_t length) {
+	if (!usb_is_configured()) return 0;
+	storage_dma[1].buf = pData;
+	storage_dma[1].len = length;
+	dma_map(pData, length, DMA_FROM_DEVICE);
+	usb_dma_start(5, (uint8_t*)pData, length, USBHS_DEVDMACONTROL_END_TR_EN);
+	return 1;
+}
+
+// the buffer of a finished transfer belongs to the CPU again
+uint8_t usb_storage_busy(void) {
+	uint8_t busy = 0;
+	if (usb_dma_busy(4)) busy = 1; else usb_storage_unmap(0);
+	if (usb_dma_busy(5)) busy = 1; else usb_storage_unmap(1);
+	return busy;
+}
+
+void usb_storage_abort(void) {
+	USBHS->USBHS_DEVDMA[4-1].USBHS_DEVDMACONTROL = 0;
+	USBHS->USBHS_DEVDMA[5-1].USBHS_DEVDMACONTROL = 0;
+	usb_storage_unmap(0);
+	usb_storage_unmap(1);
+}
+
 void usb_dev_reconnect(void) {}
\ No newline at end of file
@@ -51,4 +51,14 @@ uint8_t  usb_storage_is_configured(void);
 uint16_t usb_storage_write(const char *pData, uint16_t length);
 uint16_t usb_storage_read(char *pData, uint16_t length);
 
+// mass storage data transfers running in the background on the USB DMA,
+// so the card can be accessed at the same time
+#define USB_STORAGE_ASYNC
+#define USB_STORAGE_BUFFER_SIZE 16384
+
+uint8_t  usb_storage_write_start(const char *pData, uint32_t length);
+uint8_t  usb_storage_read_start(char *pData, uint32_t length);
+uint8_t  usb_storage_busy(void);
+void     usb_storage_abort(void);
+
 #endif // USBDEV_H
@@ -1,15 +1,33 @@
 #include <stdio.h>
+#include <string.h>
 #include "idxfile.h"
 #include "hardware.h"
+#include "FatFs/diskio.h"
+#ifdef IDXFILE_TEST
+#undef DISKLED_ON
+#undef DISKLED_OFF
+#define DISKLED_ON
+#define DISKLED_OFF
+#define GetRTTC() 0
+int iprintf(const char *fmt, ...);
+#endif
+
+// FA_MODIFIED of ff.c, makes f_sync() update the directory entry after
+// writes which bypassed FatFs
+#define IDX_FA_MODIFIED 0x40
+// FA_DIRTY of ff.c, the file buffer needs to be written back
+#define IDX_FA_DIRTY    0x80
 
 IDXFile sd_image[SD_IMAGES];
 
 void IDXIndex(IDXFile *pIDXF) {
     // builds index to speed up hard file seek
     FIL *file = &pIDXF->file;
+    FATFS *fs = file->obj.fs;
     unsigned long  time = GetRTTC();
     FRESULT res;
 
+    pIDXF->base = 0;
     pIDXF->clmt[0] = SZ_TBL;
     file->cltbl = pIDXF->clmt;
     DISKLED_ON
@@ -21,17 +39,112 @@ void IDXIndex(IDXFile *pIDXF) {
     } else {
       time = GetRTTC() - time;
       iprintf("File indexed in %lu ms, index size = %d\n", time, pIDXF->clmt[0]);
+      // a single fragment, sectors are accessed without FatFs
+      if (pIDXF->clmt[0] == 4 && f_size(file)) {
+        pIDXF->base = fs->database + (LBA_t)fs->csize * (pIDXF->clmt[2] - 2);
+        pIDXF->lba = 0;
+        iprintf("File is contiguous at sector %lu\n", (unsigned long)pIDXF->base);
+      }
     }
 }
 
 unsigned char IDXOpen(IDXFile *file, const char *name, char mode) {
+  file->base = 0;
   return f_open(&(file->file), name, mode);
 }
 
 void IDXClose(IDXFile *file) {
+  file->base = 0;
   f_close(&(file->file));
 }
 
 unsigned char IDXSeek(IDXFile *file, unsigned long lba) {
-  return f_lseek(&(file->file), (FSIZE_t) lba << 9);
+  FSIZE_t pos = (FSIZE_t) lba << 9;
+  FRESULT res;
+
+  if (file->base) {
+    if (pos > f_size(&file->file)) return FR_INVALID_PARAMETER;
+    file->lba = lba;
+    return FR_OK;
+  }
+  res = f_lseek(&(file->file), pos);
+  if (res == FR_OK && f_tell(&file->file) != pos) res = FR_INVALID_PARAMETER;
+  return res;
+}
+
+// the direct access stops at the end of the file like f_read() does
+static unsigned int IDXClip(IDXFile *file, unsigned int count) {
+  LBA_t size = f_size(&file->file) >> 9;
+
+  if (file->lba >= size) return 0;
+  return (count > size - file->lba) ? size - file->lba : count;
+}
+
+unsigned char IDXReadBlocks(IDXFile *file, unsigned char *pBuffer, unsigned int count) {
+  UINT br;
+
+  if (file->base) {
+    count = IDXClip(file, count);
+    if (!count) return FR_OK;
+    if (disk_read(file->file.obj.fs->pdrv, pBuffer, file->base + file->lba, count) != RES_OK) return FR_DISK_ERR;
+    file->lba += count;
+    return FR_OK;
+  }
+  return f_read(&(file->file), pBuffer, count<<9, &br);
+}
+
+// FatFs may hold a sector of the file in its buffers. It is refreshed
+// with the written data like f_write() does, a pending write back would
+// overwrite the new data and a later access through FatFs would see the
+// old one
+static void IDXUpdateCached(IDXFile *file, const unsigned char *pBuffer, LBA_t sect, unsigned int count) {
+  FIL *fp = &file->file;
+  FATFS *fs = fp->obj.fs;
+
+#if !FF_FS_TINY || FF_FS_FILEBUFS
+  BYTE *buf = fp->buf;  // none from the pool yet on the tiny build
+
+  if (buf && fp->sect >= sect && fp->sect - sect < count) {
+    memcpy(buf, pBuffer + ((fp->sect - sect) << 9), 512);
+    fp->flag &= ~IDX_FA_DIRTY;
+  }
+#endif
+  if (fs->winsect >= sect && fs->winsect - sect < count) {
+    memcpy(fs->win, pBuffer + ((fs->winsect - sect) << 9), 512);
+    fs->wflag = 0;
+  }
+}
+
+unsigned char IDXWriteBlocks(IDXFile *file, const unsigned char *pBuffer, unsigned int count) {
+  UINT bw;
+  FRESULT res;
+
+  if (file->base) {
+    unsigned int n;
+
+    if (!(file->file.flag & FA_WRITE)) return FR_DENIED;
+    n = IDXClip(file, count);
+    if (n) {
+      IDXUpdateCached(file, pBuffer, file->base + file->lba, n);
+      if (disk_write(file->file.obj.fs->pdrv, pBuffer, file->base + file->lba, n) != RES_OK) return FR_DISK_ERR;
+      file->lba += n;
+      file->file.flag |= IDX_FA_MODIFIED;
+      pBuffer += n << 9;
+      count -= n;
+    }
+    if (!count) return FR_OK;
+
+    // Beyond the end FatFs grows the file. In the fast seek mode it only
+    // uses the rest of the last cluster, so the file stays contiguous. It
+    // is synced, FatFs keeps no data the direct access doesn't see
+    res = f_lseek(&file->file, (FSIZE_t)file->lba << 9);
+    if (res == FR_OK) res = f_write(&file->file, pBuffer, count << 9, &bw);
+    if (res == FR_OK) res = f_sync(&file->file);
+    file->lba = f_tell(&file->file) >> 9;
+    if (res == FR_OK && bw != count << 9) res = FR_DENIED;  // no room to grow
+    return res;
+  }
+  res = f_write(&(file->file), pBuffer, count<<9, &bw);
+  if (res == FR_OK && bw != count << 9) res = FR_DENIED;
+  return res;
 }
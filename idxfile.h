@@ -29,6 +29,8 @@ typedef struct
 {
 	char valid;
 	FIL file;
+	LBA_t base;  // first sector of a contiguous file on the medium, 0 if fragmented
+	LBA_t lba;   // current sector in the file for the direct access
 	DWORD clmt[SZ_TBL];
 } IDXFile;
 
@@ -42,19 +44,20 @@ typedef struct
 
 extern IDXFile sd_image[SD_IMAGES];
 
+unsigned char IDXOpen(IDXFile *file, const char *name, char mode);
+void IDXClose(IDXFile *file);
+unsigned char IDXSeek(IDXFile *file, unsigned long lba);
+void IDXIndex(IDXFile *pIDXF);
+// a NULL buffer transfers directly to the FPGA (MMC only)
+unsigned char IDXReadBlocks(IDXFile *file, unsigned char *pBuffer, unsigned int count);
+unsigned char IDXWriteBlocks(IDXFile *file, const unsigned char *pBuffer, unsigned int count);
+
 static inline unsigned char IDXRead(IDXFile *file, unsigned char *pBuffer, uint8_t blksz) {
-  UINT br;
-  return f_read(&(file->file), pBuffer, 512<<blksz, &br);
+  return IDXReadBlocks(file, pBuffer, 1<<blksz);
 }
 
 static inline unsigned char IDXWrite(IDXFile *file, unsigned char *pBuffer, uint8_t blksz) {
-  UINT bw;
-  return f_write(&(file->file), pBuffer, 512<<blksz, &bw);
+  return IDXWriteBlocks(file, pBuffer, 1<<blksz);
 }
 
-unsigned char IDXOpen(IDXFile *file, const char *name, char mode);
-void IDXClose(IDXFile *file);
-unsigned char IDXSeek(IDXFile *file, unsigned long lba);
-void IDXIndex(IDXFile *pIDXF);
-
 #endif
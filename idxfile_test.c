@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "idxfile.h"
+
+// Runs the IDXFile accesses of the IDE, ACSI and 8 bit block drives on a
+// FAT16 RAM disk with the real FatFs. Contiguous images must be detected
+// by IDXIndex() and give the same data through the direct sector access
+// as through FatFs, fragmented ones stay with FatFs. The benchmark
+// compares the CPU time per request of both paths, the card transfer
+// itself is not counted.
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+#define IMG_SIZE      (8 << 20)
+#define IMG_CLUSTERS  (IMG_SIZE / (SPC * 512))
+#define FRAGMENTS     16
+
+static uint8_t *disk;
+static unsigned int reads, writes;
+static unsigned long fpga_lba, fpga_count;
+static int copy = 1;  // 0: count only, to measure the CPU time outside of the card
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+// a NULL buffer is the direct transfer to the FPGA
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  reads++;
+  if (!buf) {
+    fpga_lba = lba;
+    fpga_count = n;
+  } else if (copy) {
+    memcpy(buf, disk + lba * 512, n * 512);
+  }
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  writes++;
+  if (copy) memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static uint32_t cluster_lba(uint16_t clust) {
+  return DATA_SECTOR + (clust - 2) * SPC;
+}
+
+// clusters of the fragmented image: FRAGMENTS runs with a gap in between
+static uint16_t frag_cluster(uint32_t i) {
+  uint32_t run = IMG_CLUSTERS / FRAGMENTS;
+  return 2 + IMG_CLUSTERS + (i / run) * (run + 2) + i % run;
+}
+
+static void dir_entry(int n, const char *name, uint16_t first) {
+  uint8_t *e = disk + ROOT_SECTOR * 512 + n * 32;
+
+  memcpy(e, name, 11);
+  e[11] = 0x20;
+  put16(e + 26, first);
+  put32(e + 28, IMG_SIZE);
+}
+
+static void format() {
+  uint8_t *b = disk, *fat = disk + 512;
+  uint32_t i;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(fat, 0xfff8);
+  put16(fat + 2, 0xffff);
+
+  dir_entry(0, "CONTIG  HDF", 2);
+  for (i = 0; i < IMG_CLUSTERS; i++)
+    put16(fat + (2 + i) * 2, (i == IMG_CLUSTERS - 1) ? 0xffff : 3 + i);
+  dir_entry(1, "FRAG    HDF", frag_cluster(0));
+  for (i = 0; i < IMG_CLUSTERS; i++)
+    put16(fat + frag_cluster(i) * 2, (i == IMG_CLUSTERS - 1) ? 0xffff : frag_cluster(i + 1));
+  memcpy(disk + (1 + FAT_SECTORS) * 512, fat, FAT_SECTORS * 512);
+
+  // every sector of the images holds its number
+  for (i = DATA_SECTOR; i < DISK_SECTORS; i++) {
+    put32(disk + i * 512, i);
+    memset(disk + i * 512 + 4, i, 508);
+  }
+}
+
+// ---------- checks ----------
+static IDXFile contig, frag;
+static uint8_t buf[16 * 512], ref[16 * 512];
+
+static void open_images(BYTE mode) {
+  CHECK(IDXOpen(&contig, "CONTIG.HDF", mode) == FR_OK);
+  CHECK(IDXOpen(&frag, "FRAG.HDF", mode) == FR_OK);
+  IDXIndex(&contig);
+  IDXIndex(&frag);
+}
+
+static void test_detection() {
+  open_images(FA_READ | FA_WRITE);
+  CHECK(contig.base == cluster_lba(2));
+  CHECK(frag.base == 0 && frag.file.cltbl);
+  CHECK(frag.clmt[0] == 2 * FRAGMENTS + 2);
+  IDXClose(&contig);
+  CHECK(contig.base == 0);
+  IDXClose(&frag);
+}
+
+static void test_access() {
+  unsigned long i, lba, count;
+  LBA_t base;
+  UINT n;
+
+  open_images(FA_READ | FA_WRITE);
+  base = contig.base;
+  srand(1);
+  for (i = 0; i < 2000; i++) {
+    lba = rand() % (IMG_SIZE / 512);
+    count = 1 + rand() % 16;
+
+    // direct and FatFs
+    contig.base = base;
+    CHECK(IDXSeek(&contig, lba) == FR_OK);
+    memset(buf, 0, sizeof(buf));
+    CHECK(IDXReadBlocks(&contig, buf, count) == FR_OK);
+    contig.base = 0;
+    CHECK(IDXSeek(&contig, lba) == FR_OK);
+    memset(ref, 0, sizeof(ref));
+    CHECK(IDXReadBlocks(&contig, ref, count) == FR_OK);
+    if (memcmp(buf, ref, sizeof(buf))) {
+      printf("lba %lu, %lu sectors differ\n", lba, count);
+      errors++;
+      break;
+    }
+  }
+  contig.base = base;
+  CHECK(((uint32_t*)buf)[0] == base + lba);
+
+  // the end of the file
+  CHECK(IDXSeek(&contig, IMG_SIZE / 512 - 2) == FR_OK);
+  reads = 0;
+  CHECK(IDXReadBlocks(&contig, buf, 16) == FR_OK && reads == 1);
+  CHECK(contig.lba == IMG_SIZE / 512);
+  CHECK(IDXReadBlocks(&contig, buf, 1) == FR_OK && reads == 1);
+  CHECK(IDXSeek(&contig, IMG_SIZE / 512 + 1) != FR_OK);
+
+  // direct transfer to the FPGA
+  CHECK(IDXSeek(&contig, 1000) == FR_OK);
+  CHECK(IDXReadBlocks(&contig, 0, 8) == FR_OK);
+  CHECK(fpga_lba == base + 1000 && fpga_count == 8);
+
+  // writes through the direct path are seen by FatFs, the directory
+  // entry is updated by f_sync()
+  memset(buf, 0xa5, sizeof(buf));
+  CHECK(IDXSeek(&contig, 777) == FR_OK);
+  CHECK(IDXWriteBlocks(&contig, buf, 3) == FR_OK);
+  contig.base = 0;
+  CHECK(IDXSeek(&contig, 776) == FR_OK);
+  CHECK(IDXReadBlocks(&contig, ref, 5) == FR_OK);
+  CHECK(!memcmp(ref + 512, buf, 3 * 512));
+  CHECK(((uint32_t*)ref)[0] == base + 776 && ((uint32_t*)(ref + 4 * 512))[0] == base + 780);
+  contig.base = base;
+  CHECK(f_sync(&contig.file) == FR_OK);
+  CHECK(disk[ROOT_SECTOR * 512 + 24] || disk[ROOT_SECTOR * 512 + 25]);  // modification date
+
+  // FatFs doesn't keep an old copy of a sector written directly, neither
+  // a clean nor a dirty one
+  memset(buf, 0x5a, 512);
+  CHECK(f_lseek(&contig.file, 500 * 512) == FR_OK);
+  CHECK(f_read(&contig.file, ref, 4, &n) == FR_OK && n == 4);
+  CHECK(IDXSeek(&contig, 500) == FR_OK);
+  CHECK(IDXWriteBlocks(&contig, buf, 1) == FR_OK);
+  CHECK(f_read(&contig.file, ref, 4, &n) == FR_OK && n == 4);
+  CHECK(!memcmp(ref, buf, 4));
+  CHECK(f_lseek(&contig.file, 501 * 512) == FR_OK);
+  CHECK(f_write(&contig.file, "old", 4, &n) == FR_OK && n == 4);
+  CHECK(IDXSeek(&contig, 501) == FR_OK);
+  CHECK(IDXWriteBlocks(&contig, buf, 1) == FR_OK);
+  CHECK(f_sync(&contig.file) == FR_OK);
+  CHECK(!memcmp(disk + (base + 501) * 512, buf, 512));
+
+  // the image has no room to grow, a write beyond the end fails after
+  // the sectors inside the file
+  CHECK(IDXSeek(&contig, IMG_SIZE / 512 - 1) == FR_OK);
+  CHECK(IDXWriteBlocks(&contig, buf, 2) != FR_OK);
+  CHECK(contig.lba == IMG_SIZE / 512 && f_size(&contig.file) == IMG_SIZE);
+  CHECK(!memcmp(disk + (base + IMG_SIZE / 512 - 1) * 512, buf, 512));
+
+  // fragmented images work as before
+  CHECK(IDXSeek(&frag, 5 * IMG_SIZE / 512 / FRAGMENTS - 3) == FR_OK);
+  CHECK(IDXReadBlocks(&frag, buf, 6) == FR_OK);
+  CHECK(((uint32_t*)buf)[0] == cluster_lba(frag_cluster(5 * IMG_CLUSTERS / FRAGMENTS - 1)) + SPC - 3);
+  CHECK(((uint32_t*)(buf + 3 * 512))[0] == cluster_lba(frag_cluster(5 * IMG_CLUSTERS / FRAGMENTS)));
+  IDXClose(&contig);
+  IDXClose(&frag);
+
+  // read only images can't be written through the direct path
+  open_images(FA_READ);
+  CHECK(contig.base);
+  writes = 0;
+  CHECK(IDXSeek(&contig, 10) == FR_OK);
+  CHECK(IDXWriteBlocks(&contig, buf, 1) != FR_OK && writes == 0);
+  IDXClose(&contig);
+  IDXClose(&frag);
+}
+
+// ---------- benchmark ----------
+#define REQUESTS 1000000
+
+static double run(IDXFile *f, int write, unsigned char *b, unsigned int count) {
+  clock_t t = clock();
+  unsigned long i, lba = 0;
+
+  for (i = 0; i < REQUESTS; i++) {
+    lba = (lba + 7919) % (IMG_SIZE / 512 - count);
+    IDXSeek(f, lba);
+    if (write) IDXWriteBlocks(f, b, count);
+    else IDXReadBlocks(f, b, count);
+  }
+  return (double)(clock() - t) * 1e9 / CLOCKS_PER_SEC / REQUESTS;
+}
+
+static void bench(const char *name, int write, unsigned char *b, unsigned int count) {
+  LBA_t base = contig.base;
+  double direct, fatfs, fragmented;
+
+  direct = run(&contig, write, b, count);
+  contig.base = 0;
+  fatfs = run(&contig, write, b, count);
+  contig.base = base;
+  fragmented = run(&frag, write, b, count);
+  printf("  %-28s: %7.1f ns FatFs, %7.1f ns direct (%4.1fx), %7.1f ns FatFs fragmented\n",
+         name, fatfs, direct, fatfs / direct, fragmented);
+  CHECK(direct < fatfs);
+}
+
+static void benchmark() {
+  open_images(FA_READ | FA_WRITE);
+  copy = 0;
+  printf("CPU time per request, without the card transfer:\n");
+  bench("8 bit, read 1 sector", 0, buf, 1);
+  bench("8 bit, write 1 sector", 1, buf, 1);
+  bench("ACSI, read 16 sectors", 0, buf, 16);
+  bench("IDE, 16 sectors to the FPGA", 0, 0, 16);
+  copy = 1;
+  IDXClose(&contig);
+  IDXClose(&frag);
+}
+
+int main() {
+  disk = calloc(DISK_SECTORS, 512);
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+
+  test_detection();
+  test_access();
+  benchmark();
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
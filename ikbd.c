@@ -33,6 +33,7 @@
 #include "debug.h"
 #include "hardware.h"
 #include "utils.h"
+#include "prof.h"
 
 #define IKBD_AUTO_MS   20
 
@@ -52,6 +53,8 @@
 /* ------------------- transmit queue ------------------- */
 #define QUEUE_LEN 16    // power of 2!
 static unsigned short tx_queue[QUEUE_LEN];
+static input_trace_t tx_trace[QUEUE_LEN];  // input event completed by the byte
+static input_trace_t key_trace;
 static unsigned char wptr = 0, rptr = 0;
 static unsigned long ikbd_timer = 0;
 
@@ -64,6 +67,7 @@ static struct {
   struct {
     unsigned char state;    // current state
     unsigned char prev;     // last reported state
+    input_trace_t trace;    // usb report of the state change
   } joy[2];
 
   // ----- mouse state -------
@@ -71,6 +75,7 @@ static struct {
     // current state
     unsigned char but, but_prev;
     short x, y;
+    input_trace_t trace;
 
     struct {
       // absolute mouse state
@@ -123,6 +128,17 @@ static void enqueue(unsigned short b) {
     return;
 
   tx_queue[wptr] = b;
+  input_trace_clear(&tx_trace[wptr]);
+  wptr = (wptr+1)&(QUEUE_LEN-1);
+}
+
+// last byte of an event, the trace is passed on to the byte
+static void enqueue_traced(unsigned short b, input_trace_t *trace) {
+  if(((wptr + 1)&(QUEUE_LEN-1)) == rptr)
+    return;
+
+  tx_queue[wptr] = b;
+  input_trace_move(&tx_trace[wptr], trace);
   wptr = (wptr+1)&(QUEUE_LEN-1);
 }
 
@@ -424,9 +440,10 @@ void ikbd_poll(void) {
 	  if(state != ikbd.joy[i].prev) {
 	    //	    iprintf("JOY%d: %x\n", i, state);
 	    enqueue(0xfe + i);
-	    enqueue(state);
+	    enqueue_traced(state, &ikbd.joy[i].trace);
 	    ikbd.joy[i].prev = state;
-	  }
+	  } else
+	    input_trace_clear(&ikbd.joy[i].trace);
 	}
       }
 
@@ -497,7 +514,7 @@ void ikbd_poll(void) {
 	    //	    iprintf("RMOUSE: %x %x %x\n", b, x&0xff, y&0xff);
 	    enqueue(0xf8|b);
 	    enqueue(x & 0xff);
-	    enqueue(y & 0xff);
+	    enqueue_traced(y & 0xff, &ikbd.mouse.trace);
 	    
 	    ikbd.mouse.x -= x;
 	    ikbd.mouse.y -= y;
@@ -569,6 +586,7 @@ void ikbd_poll(void) {
   spi_uio_cmd_cont(UIO_IKBD_OUT);
   spi8(tx_queue[rptr]);
   DisableIO();
+  input_trace_emit(&tx_trace[rptr]);
   
   ikbd.tx_cnt++;
   
@@ -578,13 +596,16 @@ void ikbd_poll(void) {
 // called from external parts to report joystick states
 void ikbd_joystick(unsigned char joystick, unsigned char map) {
   ikbd.joy[joystick].state = joystick_map2ikbd(map);
+  if(ikbd.state & IKBD_STATE_JOYSTICK_EVENT_REPORTING)
+    input_trace_keep(&ikbd.joy[joystick].trace);
 }
 
 void ikbd_keyboard(unsigned char code) {
 #ifdef IKBD_DEBUG
   ikbd_debugf("send keycode %x%s", code&0x7f, (code&0x80)?" BREAK":"");
 #endif
-  enqueue(code);
+  input_trace_keep(&key_trace);
+  enqueue_traced(code, &key_trace);
 }
 
 void ikbd_mouse(unsigned char b, char x, char y) {
@@ -597,6 +618,8 @@ void ikbd_mouse(unsigned char b, char x, char y) {
   ikbd.mouse.but = ((b&1)?2:0)|((b&2)?1:0);
   ikbd.mouse.x += x;
   ikbd.mouse.y += y;
+  if(!(ikbd.state & (IKBD_STATE_MOUSE_DISABLED | IKBD_STATE_MOUSE_ABSOLUTE | IKBD_STATE_MOUSE_KEYCODE)))
+    input_trace_keep(&ikbd.mouse.trace);
 
   // save button state for absolute mouse reports
 
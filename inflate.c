@@ -0,0 +1,329 @@
+// inflate.c
+// Deflate decoder for compressed disk images and archives. It decodes into
+// its 32k window and stops at a requested output position, so a caller can
+// take the output in pieces (a track, a transfer block) and continue later.
+// The compressed data is pulled through a read callback by source position,
+// which makes the whole decoder state a plain copy: the checkpoints of a
+// seekable image are the state and the window saved with inflate_save().
+// Huffman codes up to INFLATE_FAST bits long are decoded with a lookup
+// table, the longer ones bit by bit from the canonical code.
+
+#include <string.h>
+#include "inflate.h"
+
+#define WMASK (INFLATE_WINDOW - 1)
+
+inflate_t inflate_shared;
+
+enum { INF_HEADER, INF_STORED, INF_CODES, INF_DONE, INF_BAD };
+
+static const uint16_t len_base[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t len_extra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const uint8_t cl_order[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// makes at least n (<= 24) bits available, zero bytes are added past the
+// end of the source and flagged, a stream using them is truncated
+static void need(inflate_t *inf, unsigned int n) {
+  inflate_state_t *s = &inf->s;
+
+  while (s->bitcnt < n) {
+    uint32_t b = 0;
+    if (!inf->avail) {
+      inf->avail = inf->read(inf->ctx, s->in_pos, inf->inbuf, INFLATE_INBUF);
+      inf->next = inf->inbuf;
+    }
+    if (inf->avail) {
+      b = *inf->next++;
+      inf->avail--;
+      s->in_pos++;
+    } else {
+      s->pad++;
+    }
+    s->bitbuf |= b << s->bitcnt;
+    s->bitcnt += 8;
+  }
+}
+
+static uint32_t bits(inflate_t *inf, unsigned int n) {
+  inflate_state_t *s = &inf->s;
+  uint32_t v;
+
+  need(inf, n);
+  v = s->bitbuf & ((1UL << n) - 1);
+  s->bitbuf >>= n;
+  s->bitcnt -= n;
+  return v;
+}
+
+// the padding was consumed
+static uint8_t overrun(inflate_t *inf) {
+  return inf->s.bitcnt < 8 * inf->s.pad;
+}
+
+static uint8_t build(inflate_huff_t *h, const uint8_t *length, unsigned int n) {
+  uint16_t offs[16];
+  unsigned int sym, len, left;
+
+  memset(h->count, 0, sizeof(h->count));
+  memset(h->fast, 0, sizeof(h->fast));
+  for (sym = 0; sym < n; sym++) h->count[length[sym]]++;
+  if (h->count[0] == n) return 0;  // no codes, only valid if never used
+
+  // over-subscribed sets are invalid, incomplete ones are allowed
+  left = 1;
+  for (len = 1; len < 16; len++) {
+    left <<= 1;
+    if (left < h->count[len]) return 1;
+    left -= h->count[len];
+  }
+
+  offs[1] = 0;
+  for (len = 1; len < 15; len++) offs[len + 1] = offs[len] + h->count[len];
+  for (sym = 0; sym < n; sym++)
+    if (length[sym]) h->symbol[offs[length[sym]]++] = sym;
+
+  // codes are sent msb first, the table index is the bit reversed code
+  {
+    unsigned int code = 0, index = 0, i;
+    for (len = 1; len <= INFLATE_FAST; len++) {
+      for (i = 0; i < h->count[len]; i++, code++, index++) {
+        unsigned int rev = 0, c = code, j;
+        for (j = 0; j < len; j++, c >>= 1) rev = (rev << 1) | (c & 1);
+        for (; rev < (1 << INFLATE_FAST); rev += 1 << len)
+          h->fast[rev] = (h->symbol[index] << 4) | len;
+      }
+      code <<= 1;
+    }
+  }
+  return 0;
+}
+
+// returns the symbol or -1 for an invalid code
+static int decode(inflate_t *inf, const inflate_huff_t *h) {
+  inflate_state_t *s = &inf->s;
+  unsigned int e, len, code, first, index, count;
+  uint32_t b;
+
+  need(inf, 15);
+  b = s->bitbuf;
+  e = h->fast[b & ((1 << INFLATE_FAST) - 1)];
+  if (e) {
+    s->bitbuf >>= e & 15;
+    s->bitcnt -= e & 15;
+    return e >> 4;
+  }
+  code = first = index = 0;
+  for (len = 1; len < 16; len++) {
+    code |= b & 1;
+    b >>= 1;
+    count = h->count[len];
+    if (code - first < count) {
+      s->bitbuf >>= len;
+      s->bitcnt -= len;
+      return h->symbol[index + (code - first)];
+    }
+    index += count;
+    first = (first + count) << 1;
+    code <<= 1;
+  }
+  return -1;
+}
+
+static uint8_t fixed(inflate_t *inf) {
+  uint8_t length[288];
+  unsigned int i;
+
+  for (i = 0; i < 144; i++) length[i] = 8;
+  for (; i < 256; i++) length[i] = 9;
+  for (; i < 280; i++) length[i] = 7;
+  for (; i < 288; i++) length[i] = 8;
+  build(&inf->s.lencode, length, 288);
+  for (i = 0; i < 30; i++) length[i] = 5;
+  build(&inf->s.distcode, length, 30);
+  return 0;
+}
+
+static uint8_t dynamic(inflate_t *inf) {
+  uint8_t length[286 + 30];
+  unsigned int nlen, ndist, ncode, i;
+  int sym;
+
+  nlen = bits(inf, 5) + 257;
+  ndist = bits(inf, 5) + 1;
+  ncode = bits(inf, 4) + 4;
+  if (nlen > 286 || ndist > 30) return 1;
+
+  memset(length, 0, 19);
+  for (i = 0; i < ncode; i++) length[cl_order[i]] = bits(inf, 3);
+  // the code length code goes to the literal/length table for now
+  if (build(&inf->s.lencode, length, 19)) return 1;
+
+  for (i = 0; i < nlen + ndist; ) {
+    unsigned int rep;
+    uint8_t val = 0;
+
+    if ((sym = decode(inf, &inf->s.lencode)) < 0) return 1;
+    if (sym < 16) {
+      length[i++] = sym;
+      continue;
+    }
+    if (sym == 16) {
+      if (!i) return 1;
+      val = length[i - 1];
+      rep = 3 + bits(inf, 2);
+    } else if (sym == 17) {
+      rep = 3 + bits(inf, 3);
+    } else {
+      rep = 11 + bits(inf, 7);
+    }
+    if (i + rep > nlen + ndist) return 1;
+    while (rep--) length[i++] = val;
+  }
+  if (!length[256]) return 1;  // no end of block code
+  if (build(&inf->s.lencode, length, nlen)) return 1;
+  if (build(&inf->s.distcode, length + nlen, ndist)) return 1;
+  return overrun(inf);
+}
+
+static void copy_match(inflate_t *inf, uint32_t until) {
+  inflate_state_t *s = &inf->s;
+
+  while (s->len && s->out < until) {
+    inf->window[s->out & WMASK] = inf->window[(s->out - s->dist) & WMASK];
+    s->out++;
+    s->len--;
+  }
+}
+
+static uint8_t codes(inflate_t *inf, uint32_t until) {
+  inflate_state_t *s = &inf->s;
+  int sym;
+
+  copy_match(inf, until);
+  while (s->out < until) {
+    if ((sym = decode(inf, &s->lencode)) < 0) return 1;
+    if (sym < 256) {
+      inf->window[s->out++ & WMASK] = sym;
+    } else if (sym == 256) {
+      s->mode = INF_HEADER;
+      break;
+    } else {
+      sym -= 257;
+      if (sym >= 29) return 1;
+      s->len = len_base[sym] + bits(inf, len_extra[sym]);
+      if ((sym = decode(inf, &s->distcode)) < 0 || sym >= 30) return 1;
+      s->dist = dist_base[sym] + bits(inf, dist_extra[sym]);
+      if (s->dist > s->out) return 1;
+      copy_match(inf, until);
+    }
+    if (overrun(inf)) return 1;
+  }
+  return 0;
+}
+
+static uint8_t stored(inflate_t *inf, uint32_t until) {
+  inflate_state_t *s = &inf->s;
+
+  while (s->len && s->out < until) {
+    // whole bytes left in the bit buffer come first
+    inf->window[s->out++ & WMASK] = bits(inf, 8);
+    s->len--;
+    if (overrun(inf)) return 1;
+  }
+  if (!s->len) s->mode = INF_HEADER;
+  return 0;
+}
+
+void inflate_init(inflate_t *inf, inflate_read_t read, void *ctx, uint32_t pos) {
+  memset(&inf->s, 0, sizeof(inf->s));
+  inf->s.mode = INF_HEADER;
+  inf->s.in_pos = pos;
+  inf->read = read;
+  inf->ctx = ctx;
+  inf->avail = 0;
+}
+
+uint8_t inflate_run(inflate_t *inf, uint32_t until) {
+  inflate_state_t *s = &inf->s;
+  uint8_t err = 0;
+
+  while (s->out < until && !err) {
+    switch (s->mode) {
+      case INF_HEADER:
+        if (s->final) {
+          s->mode = INF_DONE;
+          break;
+        }
+        s->final = bits(inf, 1);
+        switch (bits(inf, 2)) {
+          case 0:
+            bits(inf, s->bitcnt & 7);
+            s->len = bits(inf, 16);
+            if ((s->len ^ 0xffff) != bits(inf, 16)) err = 1;
+            s->mode = INF_STORED;
+            break;
+          case 1:
+            err = fixed(inf);
+            s->mode = INF_CODES;
+            break;
+          case 2:
+            err = dynamic(inf);
+            s->mode = INF_CODES;
+            break;
+          default:
+            err = 1;
+        }
+        if (overrun(inf)) err = 1;
+        break;
+      case INF_STORED:
+        err = stored(inf, until);
+        break;
+      case INF_CODES:
+        err = codes(inf, until);
+        break;
+      case INF_DONE:
+        return INFLATE_END;
+      default:
+        return INFLATE_ERROR;
+    }
+  }
+  if (err) {
+    s->mode = INF_BAD;
+    return INFLATE_ERROR;
+  }
+  return INFLATE_OK;
+}
+
+void inflate_copy(inflate_t *inf, uint32_t pos, uint8_t *dst, unsigned int len) {
+  while (len) {
+    unsigned int ofs = pos & WMASK;
+    unsigned int n = INFLATE_WINDOW - ofs;
+    if (n > len) n = len;
+    memcpy(dst, inf->window + ofs, n);
+    dst += n;
+    pos += n;
+    len -= n;
+  }
+}
+
+void inflate_save(inflate_t *inf, inflate_snapshot_t *snap) {
+  memcpy(&snap->s, &inf->s, sizeof(inf->s));
+  memcpy(snap->window, inf->window, INFLATE_WINDOW);
+}
+
+void inflate_restore(inflate_t *inf, const inflate_snapshot_t *snap) {
+  memcpy(&inf->s, &snap->s, sizeof(inf->s));
+  memcpy(inf->window, snap->window, INFLATE_WINDOW);
+  inf->avail = 0;
+}
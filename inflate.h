@@ -0,0 +1,80 @@
+/*
+ * inflate.h
+ * Resumable deflate (RFC 1951) decoder with a 32k output window
+ *
+ */
+
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <inttypes.h>
+
+#define INFLATE_WINDOW  32768
+#define INFLATE_INBUF   512
+#define INFLATE_FAST    9     // bits resolved by a single table lookup
+
+// inflate_run() results
+#define INFLATE_OK     0  // the requested output position was reached
+#define INFLATE_END    1  // end of the deflate stream
+#define INFLATE_ERROR  2  // invalid or truncated stream
+
+// reads up to len compressed bytes at the absolute source position pos,
+// returns the number of bytes read, 0 at the end of the source
+typedef unsigned int (*inflate_read_t)(void *ctx, uint32_t pos, uint8_t *buf, unsigned int len);
+
+typedef struct {
+  uint16_t count[16];        // codes of each length
+  uint16_t symbol[288];      // symbols ordered by code
+  uint16_t fast[1 << INFLATE_FAST]; // (symbol << 4) | length, 0 for longer codes
+} inflate_huff_t;
+
+// everything a checkpoint needs besides the window
+typedef struct {
+  uint8_t  mode;
+  uint8_t  final;            // the current block is the last one
+  uint8_t  bitcnt;
+  uint8_t  pad;              // zero bytes added past the end of the source
+  uint32_t bitbuf;
+  uint32_t in_pos;           // source position of the next unread byte
+  uint32_t out;              // bytes produced so far
+  uint16_t len;              // pending match or stored bytes
+  uint16_t dist;
+  inflate_huff_t lencode;
+  inflate_huff_t distcode;
+} inflate_state_t;
+
+typedef struct {
+  inflate_state_t s;
+  inflate_read_t  read;
+  void           *ctx;
+  const uint8_t  *next;
+  unsigned int    avail;
+  uint8_t         inbuf[INFLATE_INBUF];
+  uint8_t         window[INFLATE_WINDOW];
+} inflate_t;
+
+// a point of the stream to restart decoding from
+typedef struct {
+  inflate_state_t s;
+  uint8_t         window[INFLATE_WINDOW];
+} inflate_snapshot_t;
+
+// The decoder of adz.c and zip.c. Only one stream is decoded at a time, a
+// user recognizes its own by the read function and context given to
+// inflate_init() and starts again if another one took the decoder.
+extern inflate_t inflate_shared;
+#define inflate_owned(r, c)  (inflate_shared.read == (r) && inflate_shared.ctx == (c))
+// the stream is broken or gone, the next user starts again
+#define inflate_release()    (inflate_shared.read = 0)
+
+// start decoding a raw deflate stream found at source position pos
+void inflate_init(inflate_t *inf, inflate_read_t read, void *ctx, uint32_t pos);
+// decode until inf->s.out reaches until
+uint8_t inflate_run(inflate_t *inf, uint32_t until);
+// copy len bytes of output starting at pos, which must still be in the window
+void inflate_copy(inflate_t *inf, uint32_t pos, uint8_t *dst, unsigned int len);
+
+void inflate_save(inflate_t *inf, inflate_snapshot_t *snap);
+void inflate_restore(inflate_t *inf, const inflate_snapshot_t *snap);
+
+#endif // INFLATE_H
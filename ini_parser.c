@@ -51,34 +51,58 @@
 
 //// globals ////
 #ifdef INI_PARSER_TEST
+#define INI_READ_SIZE           4096
+typedef unsigned int UINT;
+typedef long FSIZE_t;
 FILE* ini_fp = NULL;
-char  sector_buffer[INI_BUF_SIZE] = {0};
+char  sector_buffer[INI_READ_SIZE] = {0};
 int   ini_size=0;
 #else
+#define INI_READ_SIZE           SECTOR_BUFFER_SIZE
 FIL   ini_file;
 #endif
 
 static int ini_pt = 0;
+static int ini_len = 0;      // valid bytes in the read buffer
+static FSIZE_t ini_buf_pos;  // file offset of the read buffer
 
-//// ini_getch() ////
-static char ini_getch()
+//// ini_fill() ////
+static int ini_fill()
 {
   UINT br;
-  if (!(ini_pt&0x1ff)) {
-    // reload buffer
-    #ifdef INI_PARSER_TEST
-    fread(sector_buffer, sizeof(char), INI_BUF_SIZE, ini_fp);
-    #else
-    f_read(&ini_file, sector_buffer, 512, &br);
-    #endif
-  }
 
   #ifdef INI_PARSER_TEST
-  if (ini_pt >= ini_size) return 0;
+  ini_buf_pos = ftell(ini_fp);
+  br = fread(sector_buffer, sizeof(char), INI_READ_SIZE, ini_fp);
   #else
-  if (ini_pt >= f_size(&ini_file)) return 0;
+  ini_buf_pos = f_tell(&ini_file);
+  if (f_read(&ini_file, sector_buffer, INI_READ_SIZE, &br) != FR_OK) br = 0;
   #endif
-  else return sector_buffer[(ini_pt++)&0x1ff];
+  ini_pt = 0;
+  ini_len = br;
+  return br;
+}
+
+//// ini_reload() ////
+// restore the read buffer after a custom handler used sector_buffer
+void ini_reload()
+{
+  UINT br;
+
+  #ifdef INI_PARSER_TEST
+  fseek(ini_fp, ini_buf_pos, SEEK_SET);
+  fread(sector_buffer, sizeof(char), ini_len, ini_fp);
+  #else
+  f_lseek(&ini_file, ini_buf_pos);
+  f_read(&ini_file, sector_buffer, ini_len, &br);
+  #endif
+}
+
+//// ini_getch() ////
+static char ini_getch()
+{
+  if (ini_pt >= ini_len && !ini_fill()) return 0;
+  return sector_buffer[ini_pt++];
 }
 
 
@@ -121,7 +145,11 @@ static int ini_getline(char* line)
   int i=0;
 
   while(1) {
-    c = ini_getch();
+    if (ini_pt >= ini_len && !ini_fill()) {
+      c = 0;
+      break;
+    }
+    c = sector_buffer[ini_pt++];
     if ((!c) || CHAR_IS_LINEEND(c)) break;
     else if (CHAR_IS_QUOTE(c) && !ignore) literal ^= 1;
     else if (CHAR_IS_COMMENT(c) && !ignore && !literal) ignore++;
@@ -188,30 +216,84 @@ static int ini_get_section(const ini_cfg_t* cfg, char* buf, const char* alter_se
 }
 
 
+//// ini_hash() ////
+#define INI_HASH_STEP(h, c)     (((h) << 5) + (h) + (c))
+
+static uint16_t ini_hash(const char* name)
+{
+  uint16_t h = 0;
+  while (*name) h = INI_HASH_STEP(h, *name++);
+  return h;
+}
+
+
+//// ini_index ////
+// hash buckets of the var names, chained through next[]. They are built
+// for a var table when it is parsed first and kept until another table is
+// parsed. Larger tables than INI_INDEX_VARS are searched linearly.
+#define INI_HASH_BUCKETS        32
+#define INI_INDEX_VARS          128
+#define INI_INDEX_END           0xff
+
+static struct {
+  const ini_var_t* vars;
+  uint8_t head[INI_HASH_BUCKETS];
+  uint8_t next[INI_INDEX_VARS];
+} ini_index;
+
+
+//// ini_index_vars() ////
+static void ini_index_vars(const ini_cfg_t* cfg)
+{
+  int j;
+
+  if (ini_index.vars == cfg->vars) return;
+  ini_index.vars = 0;
+  if (cfg->nvars > INI_INDEX_VARS) return;
+  memset(ini_index.head, INI_INDEX_END, sizeof(ini_index.head));
+  // inserted backwards, so a chain is in table order like the linear search
+  for (j=cfg->nvars-1; j>=0; j--) {
+    uint16_t b = ini_hash(cfg->vars[j].name) & (INI_HASH_BUCKETS-1);
+    ini_index.next[j] = ini_index.head[b];
+    ini_index.head[b] = j;
+  }
+  ini_index.vars = cfg->vars;
+}
+
+
 //// ini_get_var() ////
 static void* ini_get_var(const ini_cfg_t* cfg, int cur_section, char* buf, int tag)
 {
   int i=0, j=0;
   int var_id = -1;
+  uint16_t h = 0;
 
-  // find var
+  // find var, convert it to uppercase and hash it
   while(1) {
     if (buf[i] == '=') {
       buf[i] = '\0';
       break;
     } else if (buf[i] == '\0') return (void*)0;
+    buf[i] = CHAR_TO_UPPERCASE(buf[i]);
+    h = INI_HASH_STEP(h, buf[i]);
     i++;
   }
 
-  // convert to uppercase
-  for (j=0; j<=i; j++) {
-    if (!buf[j]) break;
-    else buf[j] = CHAR_TO_UPPERCASE(buf[j]);
-  }
-
   // parse var
-  for (j=0; j<cfg->nvars; j++) {
-    if ((!strcmp(buf, cfg->vars[j].name)) && (cfg->vars[j].section_id == cur_section)) var_id = j;
+  if (ini_index.vars == cfg->vars) {
+    for (j=ini_index.head[h & (INI_HASH_BUCKETS-1)]; j!=INI_INDEX_END; j=ini_index.next[j]) {
+      if ((cfg->vars[j].section_id == cur_section) && (!strcmp(buf, cfg->vars[j].name))) {
+        var_id = j;
+        break;
+      }
+    }
+  } else {
+    for (j=0; j<cfg->nvars; j++) {
+      if ((cfg->vars[j].section_id == cur_section) && (!strcmp(buf, cfg->vars[j].name))) {
+        var_id = j;
+        break;
+      }
+    }
   }
 
   // get data
@@ -313,7 +395,8 @@ void ini_parse(const ini_cfg_t* cfg, const char *alter_section, int tag)
   ini_parser_debugf("Opened file %s with size %llu bytes.", cfg->filename, f_size(&ini_file));
   #endif
 
-  ini_pt = 0;
+  ini_pt = ini_len = 0;
+  ini_index_vars(cfg);
 
   // parse ini
   while (1) {
@@ -325,7 +408,7 @@ void ini_parse(const ini_cfg_t* cfg, const char *alter_section, int tag)
       if (line[0] == INI_SECTION_START) {
         // if first char in line is INI_SECTION_START, get section
         section = ini_get_section(cfg, line, alter_section);
-      } else {
+      } else if (section != INI_SECTION_INVALID_ID) {
         // otherwise this is a variable, get it
         ini_get_var(cfg, section, line, tag);
       }
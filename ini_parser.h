@@ -49,6 +49,7 @@ typedef struct {
 //// functions ////
 void ini_parse(const ini_cfg_t* cfg, const char *alter_section, int tag);
 void ini_save(const ini_cfg_t* cfg, int tag);
+void ini_reload();
 
 #endif // __INI_PARSER_H__
 
@@ -1,9 +1,14 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "mist_cfg.h"
 
+#define BENCH_INI "bench.ini"
+#define BENCH_SECTIONS 300
+
 void siprintf(char *str, const char *format, ...) {
     va_list arg;
     va_start(arg, format);
@@ -11,10 +16,65 @@ void siprintf(char *str, const char *format, ...) {
     va_end(arg);
 }
 
-int main() {
+// a large mist.ini with many per-core sections and joystick remaps
+static void bench_create() {
+    FILE *fp = fopen(BENCH_INI, "w");
+    fprintf(fp, "[mist]\n");
+    fprintf(fp, "scandoubler_disable=1          ; set to 1 to run supported cores in 15khz\n");
+    fprintf(fp, "mouse_speed=50\n");
+    fprintf(fp, "joystick_dead_range=8\n");
+    for (int j=0; j<16; j++)
+        fprintf(fp, "joystick_remap=%04x,%04x,1,2,4,8,10,20,40,80,100,200,1000,2000\n", 0x0583+j, 0x2060+j);
+    for (int i=0; i<BENCH_SECTIONS; i++) {
+        fprintf(fp, "\n[CORE%d]\n", i);
+        fprintf(fp, "; remaps for core %d\n", i);
+        fprintf(fp, "mouse_speed=%d\n", 10 + (i % 190));
+        fprintf(fp, "joy_key_map=1000,29 ;L2 to ESC\n");
+        fprintf(fp, "joy_key_map=2000,3A ;R2 to F1\n");
+        for (int j=0; j<4; j++)
+            fprintf(fp, "joystick_remap=%04x,%04x,0,0,4,8,80,20,40,10,2,0,480,880,C0\n", 0x0583+j, 0x2060+j);
+    }
+    fprintf(fp, "\n[MINIMIG_CONFIG]\nconf_default=\"68020 AGA\"\n");
+    fprintf(fp, "\n[ATARIST_CONFIG]\nconf_2=\"STe 2.06\"\n");
+    fclose(fp);
+}
+
+static int bench(int runs) {
+    ini_cfg_t cfg = mist_ini_cfg;
+    clock_t start;
+    double ms;
+
+    cfg.filename = BENCH_INI;
+    bench_create();
+
+    // silence the parser debug output
+    freopen("/dev/null", "w", stderr);
+
+    start = clock();
+    for (int i=0; i<runs; i++) {
+        memset(&mist_cfg, 0, sizeof(mist_cfg));
+        ini_parse(&cfg, "CORE150", 0);
+    }
+    ms = (double)(clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+    printf("%d parses: %.3f ms/parse\n", runs, ms / runs);
+    if (mist_cfg.mouse_speed != 10 + 150 || mist_cfg.joystick_dead_range != 8 ||
+        strcmp(minimig_cfg.conf_name[0], "68020 AGA") || strcmp(atarist_cfg.conf_name[2], "STe 2.06")) {
+        printf("FAILED: unexpected values\n");
+        return 1;
+    }
+    printf("PASSED\n");
+    remove(BENCH_INI);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc > 1 && !strcmp(argv[1], "bench"))
+        return bench(argc > 2 ? atoi(argv[2]) : 1000);
 
     memset(&mist_cfg, 0, sizeof(mist_cfg));
-    ini_parse(&mist_ini_cfg, "DEFENDER");
+    ini_parse(&mist_ini_cfg, "DEFENDER", 0);
     for (int i=0; i<5; i++) {
         printf("minimig cfg[%d] = %s\n", i, minimig_cfg.conf_name[i]);
     }
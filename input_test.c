@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ikbd.h"
+#include "prof.h"
+
+// Replays USB keyboard, mouse and joystick reports into the Atari ST ikbd
+// emulation on a virtual clock. The SPI layer is mocked and logs the
+// bytes sent to the core, the latencies recorded by the input tracing
+// are compared with the ones seen on the SPI log.
+
+#define UIO_IKBD_OUT  0x02
+#define SIM_TIME      10000000   // us
+#define LOOP_TIME     150        // us per main loop pass
+#define KEYS_MAX      256
+
+static unsigned long now;        // us
+static unsigned char spi_cmd;
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+unsigned long GetTimestamp(void) { return now; }
+unsigned long GetTimer(unsigned long offset) { return now/1000 + offset; }
+unsigned long CheckTimer(unsigned long t) { return (t - now/1000) > (1UL << 31); }
+char GetRTC(unsigned char *d) { return 0; }
+char SetRTC(unsigned char *d) { return 0; }
+unsigned char bcd2bin(unsigned char in) { return 10*(in >> 4) + (in & 0x0f); }
+unsigned char bin2bcd(unsigned char in) { return 16*(in/10) + (in % 10); }
+int iprintf(const char *fmt, ...) { return 0; }
+void ikbd_handle_input(unsigned char cmd);
+
+// pressed keys, to find their codes on the SPI log
+static struct {
+	unsigned char code;
+	unsigned long time;
+	char sent;
+} keys[KEYS_MAX];
+static int nkeys;
+static unsigned long key_max, key_sum;
+static int key_count;
+
+void spi_uio_cmd_cont(unsigned char cmd) { spi_cmd = cmd; now += 2; }
+void DisableIO(void) { }
+unsigned char spi_in() { return 0; }
+
+void spi8(unsigned char b) {
+	int i;
+	now += 1;
+	if(spi_cmd != UIO_IKBD_OUT) return;
+	for(i = 0; i < nkeys; i++) {
+		if(!keys[i].sent && keys[i].code == b) {
+			unsigned long lat = now - keys[i].time;
+			keys[i].sent = 1;
+			if(lat > key_max) key_max = lat;
+			key_sum += lat;
+			key_count++;
+			break;
+		}
+	}
+}
+
+static void out(char *line) {
+	printf("%s\n", line);
+}
+
+// let the emulation run until the given time
+static void run_until(unsigned long t) {
+	while(now < t) {
+		ikbd_poll();
+		now += LOOP_TIME;
+	}
+}
+
+int main() {
+	const prof_probe_t *p;
+	unsigned long next_key, next_mouse, next_joy;
+	unsigned char code = 0x10, joy = 0;
+
+	srand(1);
+	ikbd_init();
+	ikbd_handle_input(0x80);  // reset
+	ikbd_handle_input(0x01);
+	run_until(500000);
+	prof_reset();
+
+	// a directly sent report, e.g. a joystick of an 8 bit core
+	input_trace_begin(PROF_INPUT_JOY);
+	now += 120;
+	input_trace_sent();
+	input_trace_sent();  // only counted once
+	input_trace_end();
+	CHECK(prof_get(PROF_INPUT_JOY)->count == 1);
+	CHECK(prof_get(PROF_INPUT_JOY)->max == 120);
+	prof_reset();
+
+	next_key = now + 10000;
+	next_mouse = now + 1000;
+	next_joy = now + 5000;
+	while(now < SIM_TIME) {
+		// keyboard: a key press or release every 40-160ms
+		if(now >= next_key && nkeys < KEYS_MAX) {
+			keys[nkeys].code = code;
+			keys[nkeys].time = now;
+			nkeys++;
+			input_trace_begin(PROF_INPUT_KBD);
+			ikbd_keyboard(code);
+			input_trace_end();
+			code = (code == 0x3f) ? 0x10 : code + 1;
+			next_key = now + 40000 + rand() % 120000;
+		}
+
+		// mouse: reports every 8ms while it's moved
+		if(now >= next_mouse) {
+			input_trace_begin(PROF_INPUT_MOUSE);
+			ikbd_mouse(0, rand() % 7 - 3, rand() % 7 - 3);
+			input_trace_end();
+			next_mouse = now + 8000;
+		}
+
+		// joystick: a change every 30-300ms
+		if(now >= next_joy) {
+			joy ^= 1 << (rand() % 5);
+			input_trace_begin(PROF_INPUT_JOY);
+			ikbd_joystick(0, joy);
+			input_trace_end();
+			next_joy = now + 30000 + rand() % 270000;
+		}
+
+		ikbd_poll();
+		now += LOOP_TIME;
+	}
+	run_until(now + 100000);
+
+	prof_dump(out);
+
+	// keyboard latencies seen by the tracing and on the SPI log match
+	p = prof_get(PROF_INPUT_KBD);
+	printf("keyboard: %d keys, spi log: %d sent, max %luus, avg %luus\n", nkeys, key_count,
+	       key_max, key_count ? key_sum / key_count : 0);
+	CHECK(key_count == nkeys);
+	CHECK(p->count == key_count);
+	CHECK(p->max + 1 >= key_max && p->max <= key_max);
+	CHECK(p->sum / p->count + 1 >= key_sum / key_count && p->sum / p->count <= key_sum / key_count);
+
+	// mouse and joystick events wait for the 20ms ikbd auto report, the
+	// mouse packets also for the keys queued before them (1 byte per ms)
+	p = prof_get(PROF_INPUT_MOUSE);
+	CHECK(p->count > 0);
+	CHECK(p->max < 100000);
+	p = prof_get(PROF_INPUT_JOY);
+	CHECK(p->count > 0);
+	CHECK(p->max < 25000);
+
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
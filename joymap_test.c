@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "user_io.h"
+#include "mist_cfg.h"
+#include "usb/joymapping.h"
+
+#define BENCH_REPORTS 1000000
+
+// stubs for the firmware functions used by joymapping.c
+mist_cfg_t mist_cfg;
+
+int iprintf(const char *format, ...) {
+	return 0;
+}
+
+void siprintf(char *str, const char *format, ...) {
+	va_list arg;
+	va_start(arg, format);
+	vsprintf(str, format, arg);
+	va_end(arg);
+}
+
+char user_io_osd_is_visible() { return 0; }
+void user_io_mouse(unsigned char idx, unsigned char b, char x, char y, char z) {}
+void user_io_kbd(unsigned char m, unsigned char *k, uint8_t priority, unsigned short vid, unsigned short pid) {}
+
+static const struct {
+	uint16_t vid, pid;
+} pads[] = {
+	{ 0x0F30, 0x1012 }, { 0x081F, 0xE401 }, { 0x0583, 0x2060 }, { 0x0411, 0x00C6 },
+	{ 0x0079, 0x0006 }, { 0x0079, 0x0011 }, { 0x1F4F, 0x0003 }, { 0x04D8, 0xF947 },
+	{ 0x04D8, 0xF421 }, { 0x04D8, 0xF6EC }, { 0x04D8, 0xF672 }, { 0x1345, 0x1030 },
+	{ 0x1235, 0xab11 }, { 0x1235, 0xab21 }, { 0x1002, 0x9000 }, { 0x040b, 0x6533 },
+	{ 0x0738, 0x2217 }, { 0x045E, 0x028E }, { 0x1C59, 0x0026 }, { 0x1234, 0x5678 },
+};
+#define NPADS (sizeof(pads)/sizeof(pads[0]))
+
+static uint16_t ref_default[16] = {
+	JOY_RIGHT, JOY_LEFT, JOY_DOWN, JOY_UP, JOY_A, JOY_B, JOY_SELECT, JOY_START,
+	JOY_X, JOY_Y, JOY_L, JOY_R, JOY_L2, JOY_R2, JOY_L3, JOY_R3
+};
+
+// the former per report mapping (without the ini remaps)
+static uint16_t ref_mapping(uint16_t vid, uint16_t pid, uint16_t joy_input) {
+	
+	uint8_t i;
+	
+	// defines translations between physical buttons and virtual joysticks
+    uint16_t mapping[16];
+	// keep directions by default
+	for(i=0; i<4; i++) 
+	   mapping[i]=ref_default[i]; 
+	// blank the rest
+	for(i=4; i<16; i++) mapping[i]=0;
+
+	uint8_t use_default=1;
+	uint8_t btn_off = 3; // start at three since array is 0 based, so 4 = button 1
+	
+	// mapping for Qanba Q4RAF
+	if( vid==0x0F30 && pid==0x1012) {
+	  mapping[btn_off+1]  = JOY_A;
+	  mapping[btn_off+2]  = JOY_B;
+	  mapping[btn_off+4]  = JOY_A;
+	  mapping[btn_off+3]  = JOY_B;     
+	  mapping[btn_off+5]  = JOY_X; //for jump
+	  mapping[btn_off+6]  = JOY_SELECT;
+	  mapping[btn_off+8]  = JOY_SELECT;
+	  mapping[btn_off+10] = JOY_START;       
+	  use_default=0;
+	}
+	
+	// mapping for no-brand cheap snes clone pad
+	if(vid==0x081F && pid==0xE401) {
+	  mapping[btn_off+2]  = JOY_A;
+	  mapping[btn_off+3]  = JOY_B;
+	  mapping[btn_off+1]  = JOY_B; // allow two ways to hold the controller  
+	  mapping[btn_off+4]  = JOY_UP;
+	  mapping[btn_off+5]  = JOY_L | JOY_L2; // also bind to buttons for flippers
+	  mapping[btn_off+6]  = JOY_R | JOY_R2; 
+	  mapping[btn_off+9]  = JOY_SELECT;
+	  mapping[btn_off+10] = JOY_START;       
+	  use_default=0;
+	}
+	
+	// mapping for iBuffalo SNES pad - BSGP801
+	if(vid==0x0583 && pid==0x2060) {
+	  mapping[btn_off+1] = JOY_A;
+	  mapping[btn_off+2] = JOY_B;
+	  mapping[btn_off+3] = JOY_B;  // allow two ways to hold the controller
+	  mapping[btn_off+4] = JOY_UP; 
+	  mapping[btn_off+5] = JOY_L | JOY_L2; // also bind to buttons for flippers
+	  mapping[btn_off+6] = JOY_R | JOY_R2;                 
+	  mapping[btn_off+7] = JOY_SELECT;
+	  mapping[btn_off+8] = JOY_START;
+	  use_default=0;
+	}
+	
+	//mapping for Buffalo NES pad - BGCFC801
+	if(vid==0x0411 && pid==0x00C6) {
+	  mapping[btn_off+1] = JOY_A;
+	  mapping[btn_off+2] = JOY_B;
+	  mapping[btn_off+3] = JOY_B;  // allow two ways to hold the controller
+	  mapping[btn_off+4] = JOY_UP; 
+	  mapping[btn_off+5] = JOY_L | JOY_L2; // also bind to buttons for flippers
+	  mapping[btn_off+6] = JOY_R | JOY_R2;                     
+	  mapping[btn_off+7] = JOY_SELECT;
+	  mapping[btn_off+8] = JOY_START;
+	  use_default=0;
+	} 
+
+	//mapping for RetroLink N64 and Gamecube pad (same vid/pid)
+	if(vid==VID_RETROLINK && pid==0x0006) {
+	  mapping[btn_off+7] = JOY_A;  // A on N64 pad
+	  mapping[btn_off+9] = JOY_B;  // B on N64 pad
+	  mapping[btn_off+3] = JOY_A;  // A on GC pad
+	  mapping[btn_off+4] = JOY_B;  // B on GC pad
+	  mapping[btn_off+5] = JOY_L | JOY_SELECT;
+	  mapping[btn_off+8] = JOY_L | JOY_SELECT; // Z button on N64 pad
+	  mapping[btn_off+6] = JOY_R | JOY_SELECT;
+	  mapping[btn_off+10] = JOY_START;
+	  use_default=0;
+	}
+	
+	//mapping for ROYDS Stick.EX
+	if(vid==0x1F4F && pid==0x0003) {
+	  mapping[btn_off+3] = JOY_A;  // Circle (usually select in PSx)
+	  mapping[btn_off+1] = JOY_B;  // Cross  (usually cancel in PSx)
+	  mapping[btn_off+2] = JOY_X;  // Triangle
+	  mapping[btn_off+4] = JOY_Y;  // Square
+	  mapping[btn_off+5] = JOY_L;
+	  mapping[btn_off+6] = JOY_R; 
+	  mapping[btn_off+7] = JOY_L2; 
+	  mapping[btn_off+8] = JOY_R2;
+	  mapping[btn_off+9] = JOY_SELECT;
+	  mapping[btn_off+10] = JOY_START;
+	  use_default=0;
+	}
+	
+	//mapping for NEOGEO-daptor
+	if(vid==VID_DAPTOR && pid==0xF421) {
+	  mapping[btn_off+1] = JOY_B;  // red button "A" on pad (inverted order with NES/SNES
+	  mapping[btn_off+2] = JOY_A;  // yellow button "B" on pad (inverted order with NES/SNES
+	  mapping[btn_off+3] = JOY_Y | JOY_L;  // green button, "C" on pad (mapped to Y and L in SNES convention)
+	  mapping[btn_off+4] = JOY_X | JOY_R;  // blue button "D"  
+	  mapping[btn_off+5] = JOY_START;
+	  mapping[btn_off+6] = JOY_SELECT;
+	  use_default=0;
+	}
+	
+	//mapping for 8bitdo SFC30
+	if(vid==0x1235 && (pid==0xab11 || pid==0xab21)) {
+		mapping[btn_off+1] = JOY_A;
+	  mapping[btn_off+2] = JOY_B;
+	  //mapping[btn_off+3] // physical button #3 not used
+		mapping[btn_off+4] = JOY_X;
+		mapping[btn_off+5] = JOY_Y;
+	  //mapping[btn_off+6] // physical button #6 not used
+		mapping[btn_off+7] = JOY_L | JOY_L2; // also bind to buttons for flippers
+	  mapping[btn_off+8] = JOY_R | JOY_R2; // also bind to buttons for flippers
+	  //9 and 10 not used
+		mapping[btn_off+11] = JOY_SELECT;
+		mapping[btn_off+12] = JOY_START;
+		use_default=0;
+	}
+	
+		//mapping for 8bitdo FC30
+	if(vid==0x1002 && pid==0x9000) {
+		mapping[btn_off+1] = JOY_A;
+	  mapping[btn_off+2] = JOY_B;
+	  //mapping[btn_off+3] // physical button #3 not used
+		mapping[btn_off+4] = JOY_X;
+		mapping[btn_off+5] = JOY_Y;
+	  //mapping[btn_off+6] // physical button #6 not used
+		mapping[btn_off+7] = JOY_L | JOY_L2; // also bind to buttons for flippers
+	  mapping[btn_off+8] = JOY_R | JOY_R2; // also bind to buttons for flippers
+		mapping[btn_off+9] = JOY_L | JOY_L2; // also bind to buttons for flippers
+	  mapping[btn_off+10] = JOY_R | JOY_R2; // also bind to buttons for flippers		
+		mapping[btn_off+11] = JOY_SELECT;
+		mapping[btn_off+12] = JOY_START;
+		use_default=0;
+	}
+	
+	// apply default mapping to rest of buttons if requested
+	if (use_default) {
+	  for(i=4; i<16; i++) 
+		if (mapping[i]==0) mapping[i]=ref_default[i];
+	}
+	
+	uint16_t vjoy = 0;
+	for(i=0; i<16; i++) 
+	  if (joy_input & (0x01<<i))  vjoy |= mapping[i];
+  
+  return vjoy;
+}
+
+int main() {
+	static joymapping_table_t table[NPADS];
+	static uint16_t reports[4096];
+	joymapping_t remap;
+	int errors = 0;
+	uint32_t i, p, sum;
+	clock_t start;
+
+	virtual_joystick_remap_init(0);
+	for(p=0; p<NPADS; p++)
+		virtual_joystick_mapping_init(&table[p], pads[p].vid, pads[p].pid);
+
+	// built-in mappings
+	for(p=0; p<NPADS; p++) {
+		for(i=0; i<0x10000; i++) {
+			if(virtual_joystick_mapping(&table[p], i) != ref_mapping(pads[p].vid, pads[p].pid, i)) {
+				printf("%04x/%04x: input %04x mismatch\n", pads[p].vid, pads[p].pid, i);
+				errors++;
+				break;
+			}
+		}
+	}
+
+	// an ini remap replaces the table of the attached device
+	memset(&remap, 0, sizeof(remap));
+	remap.vid = 0x0583;
+	remap.pid = 0x2060;
+	for(i=0; i<16; i++) remap.mapping[i] = 1 << (15-i);
+	virtual_joystick_remap_update(&remap);
+	if(virtual_joystick_mapping(&table[2], 0x0010) != 0x0800 || virtual_joystick_mapping(&table[2], 0x8001) != 0x8001) {
+		printf("remap not applied\n");
+		errors++;
+	}
+	if(virtual_joystick_mapping(&table[0], 0x0010) != ref_mapping(pads[0].vid, pads[0].pid, 0x0010)) {
+		printf("remap applied to the wrong device\n");
+		errors++;
+	}
+	virtual_joystick_remap_init(0);
+
+	// synthetic reports, mostly idle with a few buttons
+	srand(1);
+	for(i=0; i<4096; i++) reports[i] = (rand() & 3) ? 0 : rand() & (rand() | 0xf);
+
+	sum = 0;
+	start = clock();
+	for(i=0; i<BENCH_REPORTS; i++) {
+		p = i % NPADS;
+		sum += ref_mapping(pads[p].vid, pads[p].pid, reports[i & 4095]);
+	}
+	printf("per report:  %6.1f ns/report (%08x)\n", (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / BENCH_REPORTS, sum);
+
+	sum = 0;
+	start = clock();
+	for(i=0; i<BENCH_REPORTS; i++) {
+		p = i % NPADS;
+		sum += virtual_joystick_mapping(&table[p], reports[i & 4095]);
+	}
+	printf("precompiled: %6.1f ns/report (%08x)\n", (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / BENCH_REPORTS, sum);
+
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
@@ -50,6 +50,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "config.h"
 #include "menu.h"
 #include "user_io.h"
+#include "data_io.h"
 #include "arc_file.h"
 #include "font.h"
 #include "tos.h"
@@ -59,6 +60,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "usbdev.h"
 #include "cdc_control.h"
 #include "storage_control.h"
+#include "sched.h"
+#include "writeback.h"
 #include "FatFs/diskio.h"
 #ifdef HAVE_QSPI
 #include "qspi.h"
@@ -113,6 +116,48 @@ void HandleFpga(void) {
 
 extern void inserttestfloppy();
 
+// floppy and hard disk requests of the minimig core
+static void minimig_poll(void) {
+  if((user_io_core_type() == CORE_TYPE_MINIMIG) ||
+     (user_io_core_type() == CORE_TYPE_MINIMIG2))
+    HandleFpga();
+}
+
+// eth_poll() returns a status on the SiDi, tasks return nothing
+static void eth_task(void) {
+  eth_poll();
+}
+
+static void ui_poll(void) {
+  char mmc_ok = fat_medium_present();
+
+  // MIST (atari) core supports the same UI as Minimig
+  if((user_io_core_type() == CORE_TYPE_MIST) ||
+     (user_io_core_type() == CORE_TYPE_MIST2)) {
+    if(!mmc_ok)
+      tos_eject_all();
+
+    HandleUI();
+  }
+
+  if((user_io_core_type() == CORE_TYPE_MINIMIG) ||
+     (user_io_core_type() == CORE_TYPE_MINIMIG2)) {
+    if(!mmc_ok)
+      EjectAllFloppies();
+
+    HandleUI();
+  }
+
+  // 8 bit cores can also have a ui if a valid config string can be read from it
+  if((user_io_core_type() == CORE_TYPE_8BIT) &&
+     user_io_is_8bit_with_config_string())
+    HandleUI();
+
+  // Archie core will get its own treatment one day ...
+  if(user_io_core_type() == CORE_TYPE_ARCHIE)
+    HandleUI();
+}
+
 #ifdef USB_STORAGE
 int GetUSBStorageDevices()
 {
@@ -232,45 +277,19 @@ int main(void)
 
     usb_dev_open();
 
-    while (1) {
-      mmc_ok = fat_medium_present();
-
-      cdc_control_poll();
-      storage_control_poll();
-
-      user_io_poll();
-
-      usb_poll();
+    sched_init();
+    sched_add("storage", storage_control_poll, SCHED_CRITICAL, 0, 0);
+    sched_add("user_io", user_io_poll, SCHED_CRITICAL, SCHED_CORE, 0);
+    sched_add("minimig", minimig_poll, SCHED_CRITICAL, SCHED_CORE, 0);
+    sched_add("usb", usb_poll, SCHED_CRITICAL, SCHED_CORE, 0);
+    sched_add("cdc", cdc_control_poll, SCHED_NORMAL, SCHED_CORE, 0);
+    sched_add("eth", eth_task, SCHED_NORMAL, SCHED_CORE, 0);
+    sched_add("ui", ui_poll, SCHED_NORMAL, SCHED_CORE, 0);
+    sched_add("writeback", wb_poll, SCHED_NORMAL, 0, 100);
+    sched_add("save", data_io_poll, SCHED_NORMAL, SCHED_CORE, 0);
 
-      eth_poll();
-
-      // MIST (atari) core supports the same UI as Minimig
-      if((user_io_core_type() == CORE_TYPE_MIST) ||
-         (user_io_core_type() == CORE_TYPE_MIST2)) {
-         if(!mmc_ok)
-             tos_eject_all();
-
-         HandleUI();
-      }
+    while (1)
+      sched_run();
 
-      // call original minimig handlers if minimig core is found
-      if((user_io_core_type() == CORE_TYPE_MINIMIG) ||
-        (user_io_core_type() == CORE_TYPE_MINIMIG2)) {
-        if(!mmc_ok)
-            EjectAllFloppies();
-
-        HandleFpga();
-        HandleUI();
-      }
-
-      // 8 bit cores can also have a ui if a valid config string can be read from it
-      if((user_io_core_type() == CORE_TYPE_8BIT) && 
-	 user_io_is_8bit_with_config_string())
-	HandleUI();
-
-      // Archie core will get its own treatment one day ...
-      if(user_io_core_type() == CORE_TYPE_ARCHIE)
-	HandleUI();
-    }
     return 0;
 }
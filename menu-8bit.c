@@ -28,9 +28,18 @@
 #include "data_io.h"
 #include "hdd.h"
 #include "fat_compat.h"
+#include "prealloc.h"
 #include "cue_parser.h"
 #include "snes.h"
 #include "zx_col.h"
+#include "mra.h"
+#ifdef HAVE_INFLATE
+#include "zip.h"
+// ROM selectors list ZIP archives as directories
+#define SCAN_ROM_ZIP SCAN_ZIP
+#else
+#define SCAN_ROM_ZIP 0
+#endif
 
 extern char s[FF_LFN_BUF + 1];
 
@@ -125,14 +134,44 @@ static char RomFileSelected(uint8_t idx, const char *SelectedName) {
 	FIL file;
 	char ext_idx = user_io_ext_idx(SelectedName, fs_pFileExt);
 
+#ifdef HAVE_INFLATE
+	if (InArchive()) {
+		// an entry of a ZIP archive, decoded while it is sent
+		if (zip_entry_open(SelectedName) != FR_OK) {
+			ErrorMessage("\n   Error opening archive entry!\n", 0);
+			return 0;
+		}
+		if (romtype == ROM_SNES) ext_idx = snes_romtype(zip_entry_read, 0, zip_entry_size());
+		if (!data_io_zip_tx(ext_idx << 6 | selected_drive_slot, GetExtension(SelectedName))) {
+			ErrorMessage("\n   Error loading from archive!\n", 0);
+			return 0;
+		}
+		CloseMenu();
+		return 0;
+	}
+#endif
 	// this assumes that further file entries only exist if the first one also exists
 	if (f_open(&file, SelectedName, FA_READ) == FR_OK) {
+#ifdef HAVE_XML
+		const char *ext = GetExtension(SelectedName);
+		if (ext && !strncasecmp(ext, "MRA", 3)) {
+			// arcade ROM set, assembled from the files next to the recipe
+			char err = mra_load(&file);
+			f_close(&file);
+			if (err) {
+				ErrorMessage("\n   Error loading MRA file!\n", err);
+				return 0;
+			}
+			CloseMenu();
+			return 0;
+		}
+#endif
 		if (romtype == ROM_ZXCOL || romtype == ROM_ZXCHR) {
-			if (romtype == ROM_ZXCOL && !zx_col_load(&file, sector_buffer)) {
+			if (romtype == ROM_ZXCOL && !zx_col_load(&file, sector_buffer, SECTOR_BUFFER_SIZE)) {
 				ErrorMessage("\n   Error parsing COL file!\n", 0);
 				f_close(&file);
 				return 0;
-			} else if (romtype == ROM_ZXCHR && !zx_chr_load(&file, sector_buffer)) {
+			} else if (romtype == ROM_ZXCHR && !zx_chr_load(&file, sector_buffer, SECTOR_BUFFER_SIZE)) {
 				ErrorMessage("\n   Error parsing CHR file!\n", 0);
 				f_close(&file);
 				return 0;
@@ -231,7 +270,7 @@ static char GetMenuItem_8bit(uint8_t idx, char action, menu_item_t *item) {
 				while(strlen(ext) < 3) strcat(ext, " ");
 				selected_drive_slot = 1;
 				romtype = ROM_NORMAL;
-				SelectFileNG(ext, SCAN_DIR | SCAN_LFN, RomFileSelected, 1);
+				SelectFileNG(ext, SCAN_DIR | SCAN_LFN | SCAN_ROM_ZIP, RomFileSelected, 1);
 			} else if (action == MENU_ACT_GET) {
 				//menumask = 1;
 				strcpy(s, " Load *.");
@@ -289,7 +328,9 @@ static char GetMenuItem_8bit(uint8_t idx, char action, menu_item_t *item) {
 			if (p[1] && p[1] != ',' && p[2] && p[2] != ',' && !strncmp(&p[2], "ZXCHR", 5)) romtype = ROM_ZXCHR; // F3ZXCHR
 			substrcpy(ext, p, 1);
 			while(strlen(ext) < 3) strcat(ext, " ");
-			SelectFileNG(ext, SCAN_DIR | SCAN_LFN, (p[0] == 'F')?RomFileSelected:iscue?CueFileSelected:ImageFileSelected, 1);
+			// the ZX screens are parsed from a file, other ROMs can come from an archive
+			SelectFileNG(ext, SCAN_DIR | SCAN_LFN | ((p[0] == 'F' && romtype != ROM_ZXCOL && romtype != ROM_ZXCHR) ? SCAN_ROM_ZIP : 0),
+			             (p[0] == 'F')?RomFileSelected:iscue?CueFileSelected:ImageFileSelected, 1);
 		} else if (action == MENU_ACT_BKSP) {
 			if (p[0] == 'S' && p[1] && p[2] == 'U') {
 				// umount image
@@ -420,7 +461,11 @@ static char GetMenuItem_8bit(uint8_t idx, char action, menu_item_t *item) {
 
 				if (!user_io_create_config_name(s, "RAM", CONFIG_ROOT)) {
 					menu_debugf("Saving RAM file");
+					// a running background save of it ends first
+					data_io_rx_finish();
 					if (f_open(&file, s, FA_READ | FA_WRITE | FA_OPEN_ALWAYS) == FR_OK) {
+						// a new save file is allocated in one piece, else it grows as written
+						if (!f_size(&file)) FilePreallocate(&file, len, 0);
 						data_io_file_rx(&file, -1, len);
 						f_close(&file);
 						CloseMenu();
@@ -14,6 +14,7 @@
 #include "user_io.h"
 #include "misc_cfg.h"
 #include "cue_parser.h"
+#include "prealloc.h"
 
 // TODO!
 #define SPIN() asm volatile ( "mov r0, r0\n\t" \
@@ -25,6 +26,9 @@ extern adfTYPE df[4];
 static hardfileTYPE t_hardfile[HARDFILES]; // temporary copy of former hardfile configuration
 static unsigned char t_enable_ide[2]; // temporary copy of former IDE configuration
 static unsigned char t_ide_idx;
+static const uint16_t new_hdf_sizes[] = {64, 128, 256, 512, 1024, 2048}; // MB
+static unsigned char new_hdf_size = 2;
+static char new_hdf_msg[96];
 
 extern configTYPE config;
 extern char s[FF_LFN_BUF + 1];
@@ -87,6 +91,10 @@ static void InsertFloppy(adfTYPE *drive, const unsigned char *name)
 	unsigned long tracks;
 	FRESULT res;
 
+	wb_sync(&drive->wb, &drive->file);
+#ifdef HAVE_INFLATE
+	adz_close(&drive->adz);
+#endif
 	if ((res = f_open(&drive->file, name, FA_READ | FA_WRITE)) != FR_OK) {
 		iprintf("Disk open failed (%d), trying read only mode\n", res);
 		readonly = true;
@@ -94,6 +102,11 @@ static void InsertFloppy(adfTYPE *drive, const unsigned char *name)
 		return;
 	}
 	// calculate number of tracks in the ADF image file
+#ifdef HAVE_INFLATE
+	if (adz_open(&drive->adz, &drive->file) == FR_OK)
+		tracks = drive->adz.size / (512*11);
+	else
+#endif
 	tracks = f_size(&drive->file) / (512*11);
 	if (tracks > MAX_TRACKS) {
 		iprintf("UNSUPPORTED ADF SIZE!!! Too many tracks: %lu\r", tracks);
@@ -217,6 +230,39 @@ static char CueISOFileSelected(uint8_t idx, const char *SelectedName) {
 	return 0;
 }
 
+static char NewHardFileCreate(uint8_t idx) {
+	FIL file;
+	FRESULT res;
+	uint16_t mb = new_hdf_sizes[new_hdf_size];
+	char i;
+
+	// HDnnnM.HDF, or HDnnnM1.HDF ... HDnnnM9.HDF if it exists, in the current directory
+	for (i = 0; i < 10; i++) {
+		siprintf(new_hdf_msg, i ? "HD%uM%d.HDF" : "HD%uM.HDF", mb, i);
+		res = FileCreateContiguous(&file, new_hdf_msg, (FSIZE_t)mb << 20,
+		                           minimig_cfg.hdf_zero_fill ? PREALLOC_ZERO : PREALLOC_CLEAR);
+		if (res != FR_EXIST) break;
+	}
+	if (res == FR_OK) {
+		f_close(&file);
+		strcpy(s, new_hdf_msg);
+		siprintf(new_hdf_msg, "\n Created %s\n\n Select it, then prep it\n with HDToolbox and format.", s);
+		DialogBox(new_hdf_msg, MENU_DIALOG_OK, 0);
+	} else if (res == FR_DENIED) {
+		ErrorMessage("\n   Not enough contiguous\n   free space for the\n   new hardfile!\n", res);
+	} else {
+		ErrorMessage("\n   Error creating hardfile!\n", res);
+	}
+	return 0;
+}
+
+static char NewHardFileDialog(uint8_t idx) {
+	if (idx == 0) { // yes
+		DialogBox("\n      Creating hardfile\n\n         Please wait\n", 0, NewHardFileCreate);
+	}
+	return 0;
+}
+
 static char KickstartReload(uint8_t idx) {
 	if (idx == 0) {// yes
 		CloseMenu();
@@ -417,7 +463,8 @@ static char GetMenuItem_Minimig(uint8_t idx, char action, menu_item_t *item) {
 					item->item = s;
 					break;
 				case 8:
-					item->active = 0;
+					siprintf(s, "   New hardfile : %u MB", new_hdf_sizes[new_hdf_size]);
+					item->item = s;
 					break;
 				case 9:
 				case 11: {
@@ -612,10 +659,14 @@ static char GetMenuItem_Minimig(uint8_t idx, char action, menu_item_t *item) {
 				case 2:
 				case 3:
 					if (df[idx].status & DSK_INSERTED) {// eject selected floppy
-						df[idx].status = 0;
+						EjectFloppy(&df[idx]);
 					} else {
 						df[idx].status = 0;
+#ifdef HAVE_INFLATE
+						SelectFileNG("ADFADZ", SCAN_DIR | SCAN_LFN, FloppyFileSelected, 0);
+#else
 						SelectFileNG("ADF", SCAN_DIR | SCAN_LFN, FloppyFileSelected, 0);
+#endif
 					}
 					break;
 				case 4:
@@ -638,6 +689,10 @@ static char GetMenuItem_Minimig(uint8_t idx, char action, menu_item_t *item) {
 				case 7:
 					config.enable_ide[t_ide_idx]=(config.enable_ide[t_ide_idx]==0);
 					break;
+				case 8:
+					siprintf(new_hdf_msg, "\n   Create a new %u MB\n   hardfile?\n", new_hdf_sizes[new_hdf_size]);
+					DialogBox(new_hdf_msg, MENU_DIALOG_YESNO, NewHardFileDialog);
+					break;
 				case 9:
 				case 11: {
 					uint8_t hdf_idx = (t_ide_idx << 1) + (idx == 11);
@@ -864,13 +919,18 @@ static char GetMenuItem_Minimig(uint8_t idx, char action, menu_item_t *item) {
 					ConfigFloppy(config.floppy.drives,config.floppy.speed);
 				}
 				//menustate = MENU_MAIN1;
+			} else if (page_idx == 1) { // size of a new hardfile
+				if(action == MENU_ACT_PLUS && (new_hdf_size < sizeof(new_hdf_sizes)/sizeof(new_hdf_sizes[0]) - 1))
+					new_hdf_size++;
+				else if(action == MENU_ACT_MINUS && (new_hdf_size > 0))
+					new_hdf_size--;
 			} else
 				return 0;
 			break;
 		case MENU_ACT_BKSP:
 			if (page_idx == 0) { // eject all floppies
 				for (int i = 0; i <= drives; i++)
-					df[i].status = 0;
+					EjectFloppy(&df[i]);
 			}
 			break;
 		case MENU_ACT_RIGHT:
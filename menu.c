@@ -95,7 +95,7 @@ extern char s[FF_LFN_BUF + 1];
 
 extern unsigned long storage_size;
 
-extern FILINFO  DirEntries[MAXDIRENTRIES];
+extern dir_entry_t DirEntries[MAXDIRENTRIES];
 extern unsigned char sort_table[MAXDIRENTRIES];
 extern unsigned char nDirEntries;
 extern unsigned char maxDirEntries;
@@ -111,7 +111,7 @@ const char *days[] = { "Sunday", "Monday", "Tuesday", "Wednesday", "Thursday", "
 const char *helptexts[]={
 	0,
 	"                                Welcome to MiST!  Use the cursor keys to navigate the menus.  Use space bar or enter to select an item.  Press Esc or F12 to exit the menus.  Joystick emulation on the numeric keypad can be toggled with the numlock key, while pressing Ctrl-Alt-0 (numeric keypad) toggles autofire mode.",
-	"                                Minimig can emulate an A600 IDE harddisk interface.  The emulation can make use of Minimig-style hardfiles (complete disk images) or UAE-style hardfiles (filesystem images with no partition table).  It is also possible to use either the entire SD card or an individual partition as an emulated harddisk.",
+	"                                Minimig can emulate an A600 IDE harddisk interface.  The emulation can make use of Minimig-style hardfiles (complete disk images) or UAE-style hardfiles (filesystem images with no partition table).  It is also possible to use either the entire SD card or an individual partition as an emulated harddisk.  A new, empty hardfile can be created in the current directory, KP +/- selects its size.",
 	"                                Minimig's processor core can emulate a 68000 or 68020 processor (though the 68020 mode is still experimental.)  If you're running software built for 68000, there's no advantage to using the 68020 mode, since the 68000 emulation runs just as fast.",
 	"                                Minimig can make use of up to 2 megabytes of Chip RAM, up to 1.5 megabytes of Slow RAM (A500 Trapdoor RAM), and up to 8 megabytes (68000/68010) / 24 megabytes (68020) of true Fast RAM.  To use the HRTmon feature you will need a file on the SD card named hrtmon.rom.",
 	"                                Minimig's video features include a blur filter, to simulate the poorer picture quality on older monitors, and also scanline generation to simulate the appearance of a screen with low vertical resolution.",
@@ -1581,7 +1581,7 @@ void HandleUI(void)
 
 			if (c == KEY_BACK)
 			{
-				if (iCurrentDirectory) // if not root directory
+				if (iCurrentDirectory || InArchive()) // if not root directory
 				{
 					ChangeDirectoryName("..");
 					if (ScanDirectory(SCAN_INIT_FIRST, fs_pFileExt, fs_Options))
@@ -1686,7 +1686,7 @@ void HandleUI(void)
 				{
 					if (nDirEntries)
 					{
-						SelectedName = (char*) &DirEntries[sort_table[iSelectedEntry]].fname;
+						SelectedName = DirEntries[sort_table[iSelectedEntry]].fname;
 						strncpy(DiskInfo, DirEntryInfo[iSelectedEntry], sizeof(DiskInfo));
 						parentstate = MENU_NG;
 						menustate = fs_MenuSelect;
@@ -9,6 +9,9 @@
 typedef struct {
   uint8_t kick1x_memory_detection_patch;
   uint8_t clock_freq;
+  uint8_t writeback_policy;
+  uint16_t writeback_delay;
+  uint8_t hdf_zero_fill;
   char conf_name[5][11];
 } minimig_cfg_t;
 
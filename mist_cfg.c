@@ -6,14 +6,13 @@
 #include <string.h>
 #include "ini_parser.h"
 #include "mist_cfg.h"
+#include "writeback.h"
 #include "user_io.h"
 #include "data_io.h"
 #include "usb/usb.h"
 #include "usb/hid.h"
 #include "usb/joymapping.h"
 
-extern FIL ini_file;
-
 // call data_io_rom_upload but reload sector_buffer afterwards since the io
 // operations in data_io_rom_upload may have overwritten the buffer
 // mode = 0: prepare for rom upload, mode = 1: rom upload, mode = 2, end rom upload
@@ -21,8 +20,7 @@ char ini_rom_upload(char *s, char action, int tag) {
   if(action == INI_SAVE) return 0;
 #ifndef INI_PARSER_TEST
   data_io_rom_upload(s, 1);
-  f_lseek(&ini_file, (((f_tell(&ini_file)+511)>>9)-1)<<9);
-  FileReadBlock(&ini_file, sector_buffer);
+  ini_reload();
 #endif
   return 0;
 }
@@ -69,12 +67,16 @@ mist_cfg_t mist_cfg = {
   .ypbpr = 0,
   .keep_video_mode = 0,
   .led_animation = 0,
-  .amiga_mod_keys = 0
+  .amiga_mod_keys = 0,
+  .ram_autosave = 0
 };
 
 minimig_cfg_t minimig_cfg = {
   .kick1x_memory_detection_patch = 0,
   .clock_freq = 0,
+  .writeback_policy = WB_DEFAULT_POLICY,
+  .writeback_delay = WB_DEFAULT_DELAY,
+  .hdf_zero_fill = 0,
   .conf_name = {"Default","1","2","3","4"}
 };
 
@@ -126,9 +128,13 @@ const ini_var_t mist_ini_vars[] = {
   {"ROM", (void*)ini_rom_upload, CUSTOM_HANDLER, 0, 0, 1},
   {"AMIGA_MOD_KEYS", (void*)(&(mist_cfg.amiga_mod_keys)), UINT8, 0, 3, 1},
   {"USB_STORAGE", (void*)(&(mist_cfg.usb_storage)), UINT8, 0, 1, 1},
+  {"RAM_AUTOSAVE", (void*)(&(mist_cfg.ram_autosave)), UINT8, 0, 255, 1},
   // [MINIMIG_CONFIG]
   {"KICK1X_MEMORY_DETECTION_PATCH", (void*)(&(minimig_cfg.kick1x_memory_detection_patch)), UINT8, 0, 1, 2},
   {"CLOCK_FREQ", (void*)(&(minimig_cfg.clock_freq)), UINT8, 0, 2, 2},
+  {"WRITEBACK_POLICY", (void*)(&(minimig_cfg.writeback_policy)), UINT8, 0, 2, 2},
+  {"WRITEBACK_DELAY", (void*)(&(minimig_cfg.writeback_delay)), UINT16, 100, 10000, 2},
+  {"HDF_ZERO_FILL", (void*)(&(minimig_cfg.hdf_zero_fill)), UINT8, 0, 1, 2},
   {"CONF_DEFAULT", (void*)(&(minimig_cfg.conf_name[0])), STRING, 1, 10, 2},
   {"CONF_1", (void*)(&(minimig_cfg.conf_name[1])), STRING, 1, 10, 2},
   {"CONF_2", (void*)(&(minimig_cfg.conf_name[2])), STRING, 1, 10, 2},
@@ -41,6 +41,7 @@ typedef struct {
   uint8_t sdram64;
   uint8_t amiga_mod_keys;
   uint8_t usb_storage;
+  uint8_t ram_autosave;
 } mist_cfg_t;
 
 
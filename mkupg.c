@@ -2,133 +2,82 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "crc32.h"
+#include "upgrade.h"
+
 #ifndef FW_ID
 #define FW_ID "MNMGUPG"
 #endif
 
-typedef struct
-{
-    unsigned int flags;
-    unsigned int base;
-    unsigned int size;
-    unsigned int crc;
-} __attribute__ ((packed)) romTYPE;
-
-typedef struct
-{
-    unsigned char id[8];
-    unsigned char version[16];
-    romTYPE       rom;
-    unsigned int padding[117];
-    unsigned int crc;
-} __attribute__ ((packed)) UPGRADE;
-
-/* polynomial 0xEDB88320 */
-const unsigned int crc32_table[256] =
-{ 
-    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
-    0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
-    0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
-    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
-    0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
-    0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
-    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
-    0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
-    0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
-    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
-    0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
-    0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
-    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
-    0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
-    0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
-    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
-    0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
-    0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
-    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
-    0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
-    0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
-    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
-    0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
-    0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
-    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
-    0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
-    0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
-    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
-    0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
-    0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
-    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
-    0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
-};
-
-// Initial CRC value is -1 (0xFFFFFFFF)
-// Final CRC value is bitwise negation of the last calculated value
-unsigned int CalculateCRC32(unsigned int crc, unsigned char *pBuffer, unsigned int nSize)
-{
-    while (nSize--)
-        crc = crc32_table[(unsigned char)crc ^ *pBuffer++] ^ crc >> 8;
-
-    return crc;  
-}
+// defaults of the simulated flash (AT91SAM7S256)
+#define SIM_PAGESIZE  256
+#define SIM_CHUNKSIZE 4096
 
-int main(int argc, char **argv) {
-  UPGRADE upgrade;
-  
-  printf("mkupg - minimig/mist upgrade file creator\n");
+static upg_state_t upg;
+static unsigned char *sim_rom;        // ROM part of the upgrade file
+static unsigned char *sim_flash;
+static unsigned char *sim_buffer;
+static unsigned int sim_pagesize;
+static unsigned int sim_programmed, sim_limit;
 
-  if(argc != 4) {
-    printf("Usage: mkupg <infile>.bin <outfile>.upg> <6-digit date code>\n");
-    return -1;
-  }
-  if(strlen(argv[3])!=6)
-  {
-    printf("Date code should be a 6-digit code in the form YYMMDD\n");
-    return -1;
+static unsigned char *load(const char *name, int *size) {
+  FILE *f = fopen(name, "rb");
+  unsigned char *data;
+
+  if(!f) {
+    printf("Unable to open %s\n", name);
+    return NULL;
   }
-  
-  FILE *inf, *outf;
-  int size;
-  inf = fopen(argv[1], "rb");
-  if(!inf) {
-    printf("Unable to open %s\n", argv[1]);
-    return -1;
+
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  data = malloc(*size ? *size : 1);
+  if(fread(data, 1, *size, f) != *size) {
+    printf("Read error on %s\n", name);
+    free(data);
+    data = NULL;
   }
+  fclose(f);
+  return data;
+}
 
-  // check file size
-  fseek(inf, 0, SEEK_END);
-  size = ftell(inf);
-  fseek(inf, 0, SEEK_SET);
+static int create(const char *in, const char *out, const char *date) {
+  UPGRADE upgrade;
+  FILE *outf;
+  int size;
 
-  unsigned char *bin = malloc(size);
-  if(fread(bin, 1, size, inf) != size) {
-    printf("Read error on %s\n", argv[1]);
-    free(bin);
-    fclose(inf);
+  if(strlen(date)!=6)
+  {
+    printf("Date code should be a 6-digit code in the form YYMMDD\n");
     return -1;
   }
-  fclose(inf);
 
+  unsigned char *bin = load(in, &size);
+  if(!bin) return -1;
 
   printf("Upgrade header size   : %u\n", (unsigned int)sizeof(UPGRADE));
 
   // create upgrade header
   memset(&upgrade, 0, sizeof(upgrade));
-  strcpy(upgrade.version,"ATH");
-  strncpy(upgrade.version+3,argv[3],6);
-  strcpy(upgrade.id, FW_ID);
-  upgrade.rom.size = size;
-  upgrade.rom.crc = ~CalculateCRC32(-1, bin, size);
+  strcpy((char*)upgrade.version,"ATH");
+  strncpy((char*)upgrade.version+3,date,6);
+  strcpy((char*)upgrade.id, FW_ID);
   upgrade.rom.size = size;
+  upgrade.rom.crc = ~crc32_update(CRC32_INIT, bin, size);
 
   printf("ROM size              : %d\n", size);
   printf("ROM CRC               : %08X\n", upgrade.rom.crc);
 
-  upgrade.crc = ~CalculateCRC32(-1, (unsigned char*)&upgrade, sizeof(UPGRADE) - 4);
+  upgrade.crc = ~crc32_update(CRC32_INIT, (unsigned char*)&upgrade, sizeof(UPGRADE) - 4);
   printf("Header CRC            : %08X\n", upgrade.crc);
   printf("Version string        : %s\n", upgrade.version);
 
-  outf = fopen(argv[2], "wb");
+  outf = fopen(out, "wb");
   if(!outf) {
-    printf("Unable to open %s for writing\n", argv[2]);
+    printf("Unable to open %s for writing\n", out);
+    free(bin);
     return -1;
   }
 
@@ -140,3 +89,161 @@ int main(int argc, char **argv) {
 
   return 0;
 }
+
+// the checks CheckFirmware() does, flash may be NULL
+static int verify(unsigned char *upgfile, int size, unsigned int chunksize, unsigned int pagesize,
+                  unsigned char *flash, int flashsize) {
+  UPGRADE *hdr = (UPGRADE*)upgfile;
+  unsigned char err;
+  unsigned short i;
+
+  if(size < sizeof(UPGRADE)) {
+    printf("Upgrade file size too small: %d\n", size);
+    return -1;
+  }
+
+  err = upg_check_header(&upg, hdr, FW_ID, size, chunksize, pagesize);
+  if(err == UPG_OK) {
+    for(i = 0; i < upg.chunks; i++) {
+      unsigned int pos = i * chunksize;
+      int in_flash = flash && pos + upg_chunk_len(&upg, i) <= flashsize;
+      upg_verify_chunk(&upg, upgfile + sizeof(UPGRADE) + pos, in_flash ? flash + pos : NULL);
+    }
+    err = upg_verify_done(&upg);
+  }
+
+  printf("Version string        : %.16s\n", hdr->version);
+  printf("ROM size              : %u\n", hdr->rom.size);
+  printf("ROM CRC               : %08X\n", hdr->rom.crc);
+  if(err != UPG_OK) {
+    printf("%s!\n", upg_error_str(err));
+    return -1;
+  }
+  printf("Calculated ROM CRC    : %08X\n", ~upg.crc);
+  printf("Blocks                : %u x %u bytes\n", upg.chunks, upg.chunk_size);
+  if(flash) printf("Changed blocks        : %u\n", upg.changed);
+  return 0;
+}
+
+static uint8_t sim_read(uint16_t chunk, uint8_t *buf) {
+  memcpy(buf, sim_rom + chunk * upg.chunk_size, upg_chunk_len(&upg, chunk));
+  return 1;
+}
+
+static uint8_t sim_program(uint32_t page, const uint32_t *data) {
+  if(sim_limit && sim_programmed == sim_limit) return 0;   // power loss
+  memcpy(sim_flash + page * sim_pagesize, data, sim_pagesize);
+  sim_programmed++;
+  return 1;
+}
+
+static void sim_progress(uint16_t chunk, uint16_t chunks) {
+  printf("\rProgress              : %3u%%", chunks ? chunk * 100 / chunks : 100);
+  fflush(stdout);
+}
+
+// flash an upgrade file into an image of the flash, optionally stopping
+// after a number of programmed pages as if the power was lost
+static int simulate(const char *upgname, const char *flashname, unsigned int pagesize,
+                    unsigned int chunksize, unsigned int limit) {
+  upg_target_t target = { NULL, sim_read, sim_program, sim_progress };
+  unsigned char *upgfile, *old;
+  int size, flashsize = 0, oldsize = 0;
+  FILE *f;
+  int ret;
+
+  upgfile = load(upgname, &size);
+  if(!upgfile) return -1;
+
+  if(!pagesize || !chunksize || chunksize % pagesize) {
+    printf("Block size must be a multiple of the page size\n");
+    return -1;
+  }
+
+  // a missing flash image is erased flash
+  f = fopen(flashname, "rb");
+  if(f) {
+    fclose(f);
+    old = load(flashname, &oldsize);
+    if(!old) return -1;
+  } else {
+    old = NULL;
+  }
+
+  flashsize = oldsize;
+  if(size > sizeof(UPGRADE)) {
+    int need = (size - sizeof(UPGRADE) + chunksize - 1) / chunksize * chunksize;
+    if(need > flashsize) flashsize = need;
+  }
+  sim_flash = malloc(flashsize ? flashsize : 1);
+  memset(sim_flash, 0xff, flashsize);
+  if(old) memcpy(sim_flash, old, oldsize);
+  free(old);
+
+  ret = verify(upgfile, size, chunksize, pagesize, sim_flash, oldsize);
+  if(ret == 0) {
+    sim_rom = upgfile + sizeof(UPGRADE);
+    sim_buffer = malloc(chunksize);
+    sim_pagesize = pagesize;
+    sim_programmed = 0;
+    sim_limit = limit;
+    target.buffer = sim_buffer;
+
+    upg_program(&upg, &target);
+    printf("\nProgrammed pages      : %u\n", sim_programmed);
+
+    f = fopen(flashname, "wb");
+    if(!f) {
+      printf("Unable to open %s for writing\n", flashname);
+      ret = -1;
+    } else {
+      fwrite(sim_flash, 1, flashsize, f);
+      fclose(f);
+    }
+
+    if(ret == 0 && memcmp(sim_flash, sim_rom, upg.size)) {
+      printf("Upgrade interrupted, run again to complete it\n");
+      ret = 2;
+    }
+    free(sim_buffer);
+  }
+
+  free(sim_flash);
+  free(upgfile);
+  return ret;
+}
+
+static void usage() {
+  printf("Usage: mkupg <infile>.bin <outfile>.upg <6-digit date code>\n");
+  printf("       mkupg -v <file>.upg\n");
+  printf("       mkupg -s <file>.upg <flash>.bin [<page size> [<block size> [<pages before power loss>]]]\n");
+}
+
+int main(int argc, char **argv) {
+  printf("mkupg - minimig/mist upgrade file creator\n");
+
+  if(argc == 3 && !strcmp(argv[1], "-v")) {
+    unsigned char *upgfile;
+    int size, ret;
+
+    upgfile = load(argv[2], &size);
+    if(!upgfile) return -1;
+    ret = verify(upgfile, size, SIM_CHUNKSIZE, SIM_PAGESIZE, NULL, 0);
+    free(upgfile);
+    return ret;
+  }
+
+  if(argc >= 4 && argc <= 7 && !strcmp(argv[1], "-s")) {
+    return simulate(argv[2], argv[3],
+                    (argc > 4) ? strtoul(argv[4], NULL, 0) : SIM_PAGESIZE,
+                    (argc > 5) ? strtoul(argv[5], NULL, 0) : SIM_CHUNKSIZE,
+                    (argc > 6) ? strtoul(argv[6], NULL, 0) : 0);
+  }
+
+  if(argc != 4) {
+    usage();
+    return -1;
+  }
+
+  return create(argv[1], argv[2], argv[3]);
+}
@@ -0,0 +1,405 @@
+// mra.c
+// Assembles arcade ROMs from MRA recipes while they are uploaded. The
+// recipe lists the parts of each <rom>: ranges of files, inline hex data
+// repeated as fill pattern, and <interleave> groups which merge several
+// files byte by byte into 16 or 32 bit words:
+//
+// <rom index="0">
+//   <part name="prg.bin" offset="0x100" length="0x4000"/>
+//   <interleave output="16">
+//     <part name="gfx_lo.bin" map="01"/>
+//     <part name="gfx_hi.bin" map="10"/>
+//   </interleave>
+//   <part repeat="0x800">FF</part>
+// </rom>
+//
+// The map gives for every byte of an output word, from the rightmost
+// character as byte 0, which byte of the part's input goes there (0 for
+// none). The recipe is parsed twice: the first pass checks it and all part
+// files and sums up the ROM sizes, the second one streams the ROMs to the
+// sink a buffer at a time, so the assembled image never exists on the card.
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "mra.h"
+#include "sxmlc/sxmlc.h"
+#ifdef MRA_TEST
+#include <stdio.h>
+#define mra_debugf(a, ...) printf(a"\n", ## __VA_ARGS__)
+#else
+#include "hardware.h"
+#include "debug.h"
+#include "fat_compat.h"
+#include "data_io.h"
+#define mra_debugf(a, ...) iprintf("\033[1;34mMRA: " a "\033[0m\n", ## __VA_ARGS__)
+#endif
+
+typedef struct {
+  char name[MRA_NAME_LEN];
+  uint32_t offset;
+  uint32_t length;       // 0: up to the end of the file
+  uint32_t repeat;
+  uint8_t map[4];        // input byte + 1 for each byte of the output word
+  uint8_t mapped;
+} mra_part_t;
+
+static struct {
+  const mra_sink_t *sink; // NULL in the first pass
+  uint8_t *in, *out;
+  uint16_t chunk;         // size of in and out
+  uint8_t err;
+  uint8_t rom;            // number of the current <rom>
+  uint8_t index;          // its index attribute
+  uint8_t in_rom, in_part, started;
+  uint32_t size;          // bytes of the current <rom>
+  uint32_t sizes[MRA_MAX_ROMS];
+  uint8_t width;          // output bytes of an <interleave>, 0 outside
+  uint8_t parts;
+  mra_part_t part[MRA_MAX_INTERLEAVE];
+  uint8_t data[MRA_MAX_DATA];
+  uint16_t data_len;
+  uint8_t nibbles;
+} mra;
+
+static FIL mra_file[MRA_MAX_INTERLEAVE];
+
+const char *mra_error_str(uint8_t err) {
+  switch (err) {
+    case MRA_OK:         return "OK";
+    case MRA_ERR_XML:    return "Malformed MRA file";
+    case MRA_ERR_FILE:   return "ROM file missing";
+    case MRA_ERR_RANGE:  return "ROM file too short";
+    case MRA_ERR_RECIPE: return "Unsupported MRA file";
+    case MRA_ERR_NOROM:  return "No ROM in MRA file";
+  }
+  return "Unknown error";
+}
+
+// opens the file of a part at its offset and returns the length of the part
+static uint8_t mra_open(FIL *f, const mra_part_t *p, uint32_t *len) {
+  FSIZE_t size;
+
+  if (f_open(f, p->name, FA_READ) != FR_OK) {
+    mra_debugf("Unable to open %s", p->name);
+    return MRA_ERR_FILE;
+  }
+  size = f_size(f);
+  if (p->offset > size || (p->length && p->length > size - p->offset)) {
+    mra_debugf("%s: range %lx+%lx outside of the file", p->name, p->offset, p->length);
+    f_close(f);
+    return MRA_ERR_RANGE;
+  }
+  if (f_lseek(f, p->offset) != FR_OK) {
+    f_close(f);
+    return MRA_ERR_FILE;
+  }
+  *len = p->length ? p->length : size - p->offset;
+  return MRA_OK;
+}
+
+static uint8_t mra_read(FIL *f, uint8_t *buf, uint16_t len) {
+  UINT br;
+
+  if (f_read(f, buf, len, &br) != FR_OK || br != len)
+    return MRA_ERR_FILE;
+  return MRA_OK;
+}
+
+static void mra_write(const uint8_t *data, uint16_t len) {
+  if (!mra.started) {
+    mra.sink->start(mra.index, mra.sizes[mra.rom]);
+    mra.started = 1;
+  }
+  mra.sink->write(data, len);
+}
+
+static void mra_emit_part(const mra_part_t *p) {
+  uint32_t len, left, r;
+  uint16_t n, fill;
+
+  if (p->name[0]) {
+    if ((mra.err = mra_open(&mra_file[0], p, &len))) return;
+    if ((uint64_t)len * p->repeat > 0xffffffff - mra.size) {
+      mra.err = MRA_ERR_RECIPE;
+    } else {
+      mra.size += len * p->repeat;
+      for (r = 0; mra.sink && r < p->repeat && !mra.err; r++) {
+        if (r && f_lseek(&mra_file[0], p->offset) != FR_OK) mra.err = MRA_ERR_FILE;
+        for (left = len; left && !mra.err; left -= n) {
+          n = (left > mra.chunk) ? mra.chunk : left;
+          if (!(mra.err = mra_read(&mra_file[0], mra.out, n)))
+            mra_write(mra.out, n);
+        }
+      }
+    }
+    f_close(&mra_file[0]);
+  } else if (mra.data_len) {
+    if ((uint64_t)mra.data_len * p->repeat > 0xffffffff - mra.size) {
+      mra.err = MRA_ERR_RECIPE;
+      return;
+    }
+    len = mra.data_len * p->repeat;
+    mra.size += len;
+    if (!mra.sink) return;
+
+    // fill the buffer with whole copies of the pattern
+    for (fill = 0; fill + mra.data_len <= mra.chunk; fill += mra.data_len)
+      memcpy(mra.out + fill, mra.data, mra.data_len);
+    for (left = len; left; left -= n) {
+      n = (left > fill) ? fill : left;
+      mra_write(mra.out, n);
+    }
+  }
+}
+
+static void mra_emit_interleave(void) {
+  uint8_t i, j, w = mra.width, k[MRA_MAX_INTERLEAVE], opened, used = 0, sum = 0;
+  uint32_t len, units = 0xffffffff, left, u, per;
+  uint16_t n;
+  uint8_t *in;
+
+  if (!mra.parts) return;
+
+  for (i = 0; i < mra.parts; i++) {
+    mra_part_t *p = &mra.part[i];
+    // parts without map fill the output bytes in order
+    if (!p->mapped) {
+      if (i >= w) {
+        mra.err = MRA_ERR_RECIPE;
+        return;
+      }
+      p->map[i] = 1;
+    }
+    for (j = 0, k[i] = 0; j < w; j++) {
+      if (!p->map[j]) continue;
+      if (used & (1 << j)) {
+        mra.err = MRA_ERR_RECIPE;
+        return;
+      }
+      used |= 1 << j;
+      if (p->map[j] > k[i]) k[i] = p->map[j];
+    }
+    // a map of zeros takes no bytes from the part
+    if (!k[i]) {
+      mra.err = MRA_ERR_RECIPE;
+      return;
+    }
+    sum += k[i];
+  }
+  if (used != (1 << w) - 1) {
+    mra_debugf("interleave doesn't cover all output bytes");
+    mra.err = MRA_ERR_RECIPE;
+    return;
+  }
+
+  for (opened = 0; opened < mra.parts; opened++) {
+    if ((mra.err = mra_open(&mra_file[opened], &mra.part[opened], &len))) break;
+    if (len / k[opened] < units) units = len / k[opened];
+  }
+
+  if (!mra.err && (uint64_t)units * w > 0xffffffff - mra.size)
+    mra.err = MRA_ERR_RECIPE;
+
+  if (!mra.err) {
+    mra.size += units * w;
+    per = mra.chunk / ((sum > w) ? sum : w);
+    for (left = units; mra.sink && left && !mra.err; left -= n) {
+      n = (left > per) ? per : left;
+      for (i = 0, in = mra.in; i < mra.parts; in += n * k[i], i++) {
+        if ((mra.err = mra_read(&mra_file[i], in, n * k[i]))) break;
+        for (j = 0; j < w; j++) {
+          const uint8_t *s;
+          uint8_t *d;
+
+          if (!mra.part[i].map[j]) continue;
+          s = in + mra.part[i].map[j] - 1;
+          d = mra.out + j;
+          for (u = 0; u < n; u++, s += k[i], d += w)
+            *d = *s;
+        }
+      }
+      if (!mra.err) mra_write(mra.out, n * w);
+    }
+  }
+
+  while (opened--) f_close(&mra_file[opened]);
+}
+
+static uint8_t mra_hex(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 0xff;
+}
+
+static void mra_part_start(const XMLNode *node) {
+  mra_part_t *p;
+  const char *v;
+  int i;
+  uint8_t j, len;
+
+  if (mra.width) {
+    if (mra.parts == MRA_MAX_INTERLEAVE) {
+      mra.err = MRA_ERR_RECIPE;
+      return;
+    }
+    p = &mra.part[mra.parts++];
+  } else {
+    p = &mra.part[0];
+  }
+  memset(p, 0, sizeof(mra_part_t));
+  p->repeat = 1;
+  mra.data_len = 0;
+  mra.nibbles = 0;
+  mra.in_part = 1;
+
+  for (i = 0; i < node->n_attributes; i++) {
+    v = node->attributes[i].value;
+    if (!strcmp(node->attributes[i].name, "name")) {
+      if (strlen(v) >= MRA_NAME_LEN) mra.err = MRA_ERR_RECIPE;
+      else strcpy(p->name, v);
+    } else if (!strcmp(node->attributes[i].name, "offset")) {
+      p->offset = strtoul(v, NULL, 0);
+    } else if (!strcmp(node->attributes[i].name, "length")) {
+      p->length = strtoul(v, NULL, 0);
+    } else if (!strcmp(node->attributes[i].name, "repeat")) {
+      p->repeat = strtoul(v, NULL, 0);
+    } else if (!strcmp(node->attributes[i].name, "map")) {
+      len = strlen(v);
+      if (!mra.width || len != mra.width) {
+        mra.err = MRA_ERR_RECIPE;
+        return;
+      }
+      for (j = 0; j < len; j++) {
+        if (v[j] < '0' || v[j] > '0' + len) {
+          mra.err = MRA_ERR_RECIPE;
+          return;
+        }
+        p->map[len - 1 - j] = v[j] - '0';
+      }
+      p->mapped = 1;
+    }
+  }
+}
+
+static int mra_start_node(const XMLNode *node, SAX_Data *sd) {
+  int i, bits;
+
+  if (!strcmp(node->tag, "rom")) {
+    if (mra.rom == MRA_MAX_ROMS) {
+      mra.err = MRA_ERR_RECIPE;
+    } else {
+      mra.in_rom = 1;
+      mra.index = 0;
+      mra.size = 0;
+      mra.started = 0;
+      for (i = 0; i < node->n_attributes; i++)
+        if (!strcmp(node->attributes[i].name, "index"))
+          mra.index = strtoul(node->attributes[i].value, NULL, 0);
+    }
+  } else if (mra.in_rom && !strcmp(node->tag, "interleave")) {
+    bits = 0;
+    for (i = 0; i < node->n_attributes; i++)
+      if (!strcmp(node->attributes[i].name, "output"))
+        bits = strtoul(node->attributes[i].value, NULL, 0);
+    if (bits != 8 && bits != 16 && bits != 32) {
+      mra_debugf("interleave output %d not supported", bits);
+      mra.err = MRA_ERR_RECIPE;
+    }
+    mra.width = bits / 8;
+    mra.parts = 0;
+  } else if (mra.in_rom && !strcmp(node->tag, "part")) {
+    mra_part_start(node);
+  }
+  return !mra.err;
+}
+
+static int mra_end_node(const XMLNode *node, SAX_Data *sd) {
+  if (!strcmp(node->tag, "rom") && mra.in_rom) {
+    mra.in_rom = 0;
+    if (!mra.sink) mra.sizes[mra.rom] = mra.size;
+    else if (mra.started) mra.sink->done();
+    mra.started = 0;
+    mra.rom++;
+  } else if (mra.in_rom && !strcmp(node->tag, "interleave")) {
+    mra_emit_interleave();
+    mra.width = 0;
+  } else if (mra.in_part && !strcmp(node->tag, "part")) {
+    mra.in_part = 0;
+    if (mra.nibbles & 1) mra.err = MRA_ERR_RECIPE;
+    else if (!mra.width) mra_emit_part(&mra.part[0]);
+    else if (mra.data_len || !mra.part[mra.parts-1].name[0]) mra.err = MRA_ERR_RECIPE;
+  }
+  return !mra.err;
+}
+
+// inline data of a part: hex bytes, optionally separated by spaces
+static int mra_new_text(SXML_CHAR *text, SAX_Data *sd) {
+  uint8_t v;
+
+  if (!mra.in_part) return true;
+  for (; *text && !mra.err; text++) {
+    if (isspace((unsigned char)*text)) continue;
+    v = mra_hex(*text);
+    if (v == 0xff || mra.data_len == MRA_MAX_DATA) {
+      mra.err = MRA_ERR_RECIPE;
+      break;
+    }
+    if (mra.nibbles++ & 1) mra.data[mra.data_len++] |= v;
+    else mra.data[mra.data_len] = v << 4;
+  }
+  return !mra.err;
+}
+
+static const SAX_Callbacks mra_sax = {
+  .start_node = mra_start_node,
+  .end_node   = mra_end_node,
+  .new_text   = mra_new_text
+};
+
+uint8_t mra_assemble(FIL *recipe, uint8_t *buf, uint16_t buf_size, const mra_sink_t *sink) {
+  uint8_t pass, i;
+
+  if (buf_size < MRA_XML_BUF_SIZE + 2 * MRA_MAX_DATA) return MRA_ERR_RECIPE;
+
+  memset(&mra, 0, sizeof(mra));
+  mra.chunk = ((buf_size - MRA_XML_BUF_SIZE) / 2) & ~3;
+  mra.in = buf + MRA_XML_BUF_SIZE;
+  mra.out = mra.in + mra.chunk;
+
+  for (pass = 0; pass < 2; pass++) {
+    mra.sink = pass ? sink : NULL;
+    mra.rom = mra.in_rom = mra.in_part = mra.started = mra.width = 0;
+    if (f_lseek(recipe, 0) != FR_OK) return MRA_ERR_FILE;
+
+    if (!XMLDoc_parse_fd_SAX_buf(recipe, (SXML_CHAR*)buf, MRA_XML_BUF_SIZE, &mra_sax, NULL) && !mra.err)
+      mra.err = MRA_ERR_XML;
+
+    if (mra.err) {
+      if (mra.started) mra.sink->done();
+      mra_debugf("%s", mra_error_str(mra.err));
+      return mra.err;
+    }
+
+    if (!pass) {
+      for (i = 0; i < mra.rom && !mra.sizes[i]; i++);
+      if (i == mra.rom) return MRA_ERR_NOROM;
+      for (i = 0; i < mra.rom; i++)
+        if (mra.sizes[i]) mra_debugf("ROM %d: %lu bytes", i, mra.sizes[i]);
+    }
+  }
+  return MRA_OK;
+}
+
+#ifndef MRA_TEST
+static void mra_tx_start(uint8_t index, uint32_t size) {
+  data_io_stream_start(index, "ROM", size);
+}
+
+static const mra_sink_t mra_data_io = { mra_tx_start, data_io_stream_write, data_io_stream_done };
+
+uint8_t mra_load(FIL *recipe) {
+  return mra_assemble(recipe, sector_buffer, SECTOR_BUFFER_SIZE, &mra_data_io);
+}
+#endif
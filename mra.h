@@ -0,0 +1,48 @@
+/*
+ * mra.h
+ * Arcade ROM assembly from MRA recipes
+ *
+ */
+
+#ifndef MRA_H
+#define MRA_H
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+// max. number of <rom> elements with parts
+#define MRA_MAX_ROMS        4
+// max. number of parts in an <interleave>
+#define MRA_MAX_INTERLEAVE  4
+// max. bytes of inline part data
+#define MRA_MAX_DATA        256
+#define MRA_NAME_LEN        64
+// part of the buffer used to read the recipe
+#define MRA_XML_BUF_SIZE    2048
+
+// mra_assemble() results
+#define MRA_OK              0
+#define MRA_ERR_XML         1  // malformed recipe
+#define MRA_ERR_FILE        2  // part file missing or unreadable
+#define MRA_ERR_RANGE       3  // offset/length outside of the part file
+#define MRA_ERR_RECIPE      4  // unsupported or invalid part/interleave
+#define MRA_ERR_NOROM       5  // nothing to assemble
+
+// receives the assembled ROMs
+typedef struct {
+  void (*start)(uint8_t index, uint32_t size);
+  void (*write)(const uint8_t *data, uint16_t len);
+  void (*done)(void);
+} mra_sink_t;
+
+// assembles all <rom> elements of the recipe and streams them to the
+// sink, part files are opened relative to the current directory
+uint8_t mra_assemble(FIL *recipe, uint8_t *buf, uint16_t buf_size, const mra_sink_t *sink);
+const char *mra_error_str(uint8_t err);
+
+#ifndef MRA_TEST
+// assemble and upload to the core through data_io
+uint8_t mra_load(FIL *recipe);
+#endif
+
+#endif // MRA_H
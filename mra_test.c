@@ -0,0 +1,294 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mra.h"
+
+// Assembles recipes against generated part files and compares the streamed
+// ROMs with images built directly from the files: plain and partial files,
+// fill patterns, 16 and 32 bit interleaves, byte swapping maps, several
+// <rom> elements. Broken recipes must fail before anything is uploaded.
+// Finally a large recipe is assembled to measure the throughput.
+//
+// usage: mratest [<file>.mra <output>.bin]
+// assembles a recipe with the part files in the current directory
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- FatFs mock, files are kept in memory ----------
+#define MAX_FILES 16
+
+static struct {
+  char name[64];
+  uint8_t *data;
+  uint32_t size;
+} files[MAX_FILES];
+static int nfiles;
+static unsigned int reads, opened;
+
+static void add_file(const char *name, uint8_t *data, uint32_t size) {
+  strcpy(files[nfiles].name, name);
+  files[nfiles].data = data;
+  files[nfiles].size = size;
+  nfiles++;
+}
+
+static uint8_t *make_file(const char *name, uint32_t size, unsigned int seed) {
+  uint8_t *data = malloc(size);
+  srand(seed);
+  for (uint32_t i = 0; i < size; i++) data[i] = rand();
+  add_file(name, data, size);
+  return data;
+}
+
+static void free_files() {
+  while (nfiles) free(files[--nfiles].data);
+}
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode) {
+  FILE *f;
+  int i;
+
+  for (i = 0; i < nfiles && strcmp(files[i].name, path); i++);
+  if (i == nfiles) {
+    // try the host file system
+    if (nfiles == MAX_FILES || !(f = fopen(path, "rb"))) return FR_NO_FILE;
+    fseek(f, 0, SEEK_END);
+    files[i].size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    files[i].data = malloc(files[i].size + 1);
+    if (fread(files[i].data, 1, files[i].size, f) != files[i].size) {
+      fclose(f);
+      free(files[i].data);
+      return FR_DISK_ERR;
+    }
+    fclose(f);
+    strcpy(files[i].name, path);
+    nfiles++;
+  }
+  memset(fp, 0, sizeof(FIL));
+  fp->obj.sclust = i;
+  fp->obj.objsize = files[i].size;
+  opened++;
+  return FR_OK;
+}
+
+FRESULT f_close(FIL *fp) {
+  opened--;
+  return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs) {
+  fp->fptr = (ofs > fp->obj.objsize) ? fp->obj.objsize : ofs;
+  return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+  FSIZE_t left = fp->obj.objsize - fp->fptr;
+
+  reads++;
+  *br = (btr < left) ? btr : left;
+  memcpy(buff, files[fp->obj.sclust].data + fp->fptr, *br);
+  fp->fptr += *br;
+  return FR_OK;
+}
+
+// ---------- sink ----------
+#define MAX_OUT (16 << 20)
+
+static struct {
+  uint8_t index;
+  uint32_t size, len;
+  uint8_t *data;
+} roms[MRA_MAX_ROMS];
+static int nroms, active;
+
+static void sink_start(uint8_t index, uint32_t size) {
+  CHECK(!active && nroms < MRA_MAX_ROMS);
+  roms[nroms].index = index;
+  roms[nroms].size = size;
+  roms[nroms].len = 0;
+  if (!roms[nroms].data) roms[nroms].data = malloc(MAX_OUT);
+  active = 1;
+}
+
+static void sink_write(const uint8_t *data, uint16_t len) {
+  CHECK(active && len);
+  if (roms[nroms].len + len <= MAX_OUT) memcpy(roms[nroms].data + roms[nroms].len, data, len);
+  roms[nroms].len += len;
+}
+
+static void sink_done(void) {
+  CHECK(active);
+  CHECK(roms[nroms].len == roms[nroms].size);
+  active = 0;
+  nroms++;
+}
+
+static const mra_sink_t sink = { sink_start, sink_write, sink_done };
+
+// ---------- recipe ----------
+static uint8_t buffer[8192];  // sector_buffer of the SAMV71
+
+static uint8_t assemble(const char *xml) {
+  FIL recipe;
+  uint8_t err;
+
+  add_file("test.mra", (uint8_t*)strdup(xml), strlen(xml));
+  f_open(&recipe, "test.mra", FA_READ);
+  nroms = active = 0;
+  reads = 0;
+  err = mra_assemble(&recipe, buffer, sizeof(buffer), &sink);
+  f_close(&recipe);
+  CHECK(!active);
+  CHECK(opened == 0);
+  free(files[--nfiles].data);
+  return err;
+}
+
+static void test_assembly() {
+  uint8_t *a = make_file("a.bin", 100000, 1);
+  uint8_t *b = make_file("b.bin", 70001, 2);
+  uint8_t *lo = make_file("lo.bin", 65536, 3);
+  uint8_t *hi = make_file("hi.bin", 65536, 4);
+  uint8_t *w[4];
+  uint8_t *exp = malloc(1 << 20), *p = exp;
+  const uint8_t fill[3] = { 0xff, 0x00, 0xa5 };
+  int i, j;
+
+  w[0] = make_file("w0.bin", 32768, 5);
+  w[1] = make_file("w1.bin", 32768, 6);
+  w[2] = make_file("w2.bin", 32770, 7);  // longer parts are cut
+  w[3] = make_file("w3.bin", 32768, 8);
+
+  uint8_t err = assemble(
+    "<?xml version=\"1.0\"?>\n"
+    "<misterromdescription>\n"
+    "  <name>Test</name>\n"
+    "  <rom index=\"0\" zip=\"test.zip\" md5=\"none\">\n"
+    "    <part name=\"a.bin\"/>\n"
+    "    <part name=\"b.bin\" offset=\"0x100\" length=\"0x2000\"/>\n"
+    "    <!-- fill pattern -->\n"
+    "    <part repeat=\"0x1001\">FF 00 a5</part>\n"
+    "    <interleave output=\"16\">\n"
+    "      <part name=\"lo.bin\" map=\"01\"/>\n"
+    "      <part name=\"hi.bin\" map=\"10\"/>\n"
+    "    </interleave>\n"
+    "    <interleave output=\"32\">\n"
+    "      <part name=\"w0.bin\"/><part name=\"w1.bin\"/><part name=\"w2.bin\"/><part name=\"w3.bin\"/>\n"
+    "    </interleave>\n"
+    "    <interleave output=\"16\"><part name=\"b.bin\" map=\"12\"/></interleave>\n"
+    "    <part name=\"a.bin\" offset=\"10\" length=\"5\" repeat=\"3\"/>\n"
+    "  </rom>\n"
+    "  <rom index=\"1\"><part>\n01 02\n0304</part></rom>\n"
+    "  <rom index=\"2\"></rom>\n"
+    "</misterromdescription>\n");
+
+  memcpy(p, a, 100000); p += 100000;
+  memcpy(p, b + 0x100, 0x2000); p += 0x2000;
+  for (i = 0; i < 0x1001 * 3; i++) *p++ = fill[i % 3];
+  for (i = 0; i < 65536; i++) { *p++ = lo[i]; *p++ = hi[i]; }
+  for (i = 0; i < 32768; i++) for (j = 0; j < 4; j++) *p++ = w[j][i];
+  for (i = 0; i < 70000; i += 2) { *p++ = b[i+1]; *p++ = b[i]; }
+  for (i = 0; i < 3; i++) { memcpy(p, a + 10, 5); p += 5; }
+
+  CHECK(err == MRA_OK);
+  CHECK(nroms == 2);
+  CHECK(roms[0].index == 0 && roms[0].len == p - exp);
+  CHECK(!memcmp(roms[0].data, exp, p - exp));
+  CHECK(roms[1].index == 1 && roms[1].len == 4 && !memcmp(roms[1].data, "\1\2\3\4", 4));
+
+  free(exp);
+}
+
+static void test_errors() {
+  // everything is checked before the upload starts
+  CHECK(assemble("<rom><part name=\"missing.bin\"/></rom>") == MRA_ERR_FILE && nroms == 0);
+  CHECK(assemble("<rom><part name=\"a.bin\"/><part name=\"b.bin\" offset=\"70000\" length=\"2\"/></rom>") == MRA_ERR_RANGE && nroms == 0);
+  CHECK(assemble("<rom><part name=\"a.bin\"/><part>FF 0</part></rom>") == MRA_ERR_RECIPE && nroms == 0);
+  CHECK(assemble("<rom><part>FF XX</part></rom>") == MRA_ERR_RECIPE);
+  CHECK(assemble("<rom><interleave output=\"24\"><part name=\"a.bin\"/></interleave></rom>") == MRA_ERR_RECIPE);
+  CHECK(assemble("<rom><interleave output=\"16\"><part name=\"lo.bin\" map=\"01\"/><part name=\"hi.bin\" map=\"01\"/></interleave></rom>") == MRA_ERR_RECIPE);
+  CHECK(assemble("<rom><interleave output=\"16\"><part name=\"lo.bin\" map=\"01\"/></interleave></rom>") == MRA_ERR_RECIPE);
+  CHECK(assemble("<rom><interleave output=\"16\"><part name=\"lo.bin\"/><part>00</part></interleave></rom>") == MRA_ERR_RECIPE);
+  CHECK(assemble("<rom><interleave output=\"16\"><part name=\"lo.bin\" map=\"12\"/><part name=\"hi.bin\" map=\"00\"/></interleave></rom>") == MRA_ERR_RECIPE);
+  CHECK(assemble("<rom><part name=\"a.bin\"></rom") == MRA_ERR_XML);
+  CHECK(assemble("<misterromdescription><name>x</name><rom index=\"1\"/></misterromdescription>") == MRA_ERR_NOROM);
+}
+
+static void test_throughput() {
+  char xml[1024];
+  clock_t t;
+  double s;
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    sprintf(xml, "big%d.bin", i);
+    make_file(xml, 1 << 20, 10 + i);
+  }
+  make_file("big.bin", 4 << 20, 20);
+
+  t = clock();
+  CHECK(assemble(
+    "<misterromdescription><rom index=\"0\">"
+    "<part name=\"big.bin\"/>"
+    "<interleave output=\"32\"><part name=\"big0.bin\" map=\"0001\"/><part name=\"big1.bin\" map=\"0010\"/>"
+    "<part name=\"big2.bin\" map=\"0100\"/><part name=\"big3.bin\" map=\"1000\"/></interleave>"
+    "<interleave output=\"16\"><part name=\"big0.bin\" map=\"12\"/></interleave>"
+    "<part repeat=\"0x100000\">00 FF</part>"
+    "</rom></misterromdescription>") == MRA_OK);
+  s = (double)(clock() - t) / CLOCKS_PER_SEC;
+
+  CHECK(nroms == 1 && roms[0].len == (11 << 20));
+  printf("assembled %u bytes in %.1f ms (%.0f MB/s), %u f_read calls\n", roms[0].len, s * 1000,
+         s > 0 ? roms[0].len / s / (1 << 20) : 0, reads);
+}
+
+static int assemble_file(const char *name, const char *out) {
+  FIL recipe;
+  FILE *f;
+  uint8_t err;
+  int i;
+
+  if (f_open(&recipe, name, FA_READ) != FR_OK) {
+    printf("Unable to open %s\n", name);
+    return 1;
+  }
+  err = mra_assemble(&recipe, buffer, sizeof(buffer), &sink);
+  f_close(&recipe);
+  if (err) {
+    printf("%s: %s\n", name, mra_error_str(err));
+    return 1;
+  }
+  f = fopen(out, "wb");
+  if (!f) {
+    printf("Unable to open %s for writing\n", out);
+    return 1;
+  }
+  // the ROMs are written one after the other
+  for (i = 0; i < nroms; i++) {
+    printf("ROM index %d: %u bytes\n", roms[i].index, roms[i].len);
+    fwrite(roms[i].data, 1, roms[i].len, f);
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int i;
+
+  if (argc == 3) return assemble_file(argv[1], argv[2]);
+
+  test_assembly();
+  test_errors();
+  free_files();
+  test_throughput();
+  free_files();
+  for (i = 0; i < MRA_MAX_ROMS; i++) free(roms[i].data);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
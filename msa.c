@@ -0,0 +1,297 @@
+// msa.c
+// MSA floppy images for the ST FDC. The tracks of an MSA file are run
+// length encoded and have different sizes, so the file positions of all
+// of them are indexed when the disk is inserted and a track is decoded
+// into the track buffer when one of its sectors is accessed. The buffer
+// is shared by both drives. A written track is encoded again once it is
+// left or MSA_FLUSH_DELAY ms after the last write. The new encoding is
+// padded to the old length if possible, otherwise the rest of the file
+// is moved. The sector buffer is used for the file I/O. A track which
+// cannot be written back stays dirty and is tried again later.
+
+#include <stdio.h>
+#include <string.h>
+#include "msa.h"
+#include "fat_compat.h"
+#include "timer.h"
+#ifdef MSA_TEST
+int iprintf(const char *fmt, ...);
+#endif
+
+#define MSA_ID    0x0e0f
+#define MSA_RUN   0xe5
+
+static struct {
+  msa_t        *owner;
+  unsigned char index;
+  unsigned char dirty;
+  msec_t        written;
+  unsigned char data[MSA_MAX_SPT * 512];
+} track;
+
+static uint16_t get16(const unsigned char *p) {
+  return (p[0] << 8) | p[1];
+}
+
+FRESULT msa_open(msa_t *msa, FIL *file) {
+  unsigned char h[10];
+  unsigned int i, end;
+  uint32_t pos;
+  UINT br;
+
+  msa->file = 0;
+  if (f_lseek(file, 0) != FR_OK || f_read(file, h, 10, &br) != FR_OK || br != 10)
+    return FR_INVALID_OBJECT;
+  end = get16(h + 8);
+  if (get16(h) != MSA_ID || !get16(h + 2) || get16(h + 2) > MSA_MAX_SPT || get16(h + 4) > 1 ||
+      get16(h + 6) > end || end >= MSA_MAX_TRACKS)
+    return FR_INVALID_OBJECT;
+  msa->spt = get16(h + 2);
+  msa->sides = get16(h + 4) + 1;
+  msa->start = get16(h + 6);
+  msa->tracks = (end + 1 - msa->start) * msa->sides;
+
+  // the track lengths form a chain through the file
+  pos = 10;
+  for (i = 0; i < msa->tracks; i++) {
+    uint16_t len;
+    msa->offset[i] = pos;
+    if (f_lseek(file, pos) != FR_OK || f_read(file, h, 2, &br) != FR_OK || br != 2)
+      return FR_INVALID_OBJECT;
+    len = get16(h);
+    if (!len || len > msa->spt * 512) return FR_INVALID_OBJECT;
+    pos += 2 + len;
+  }
+  if (pos > f_size(file)) return FR_INVALID_OBJECT;
+  msa->offset[i] = pos;
+  msa->file = file;
+  return FR_OK;
+}
+
+// ---------- decoding ----------
+static struct {
+  FIL     *file;
+  uint32_t left;
+  unsigned int pos, fill;
+} in;
+
+static int get_byte() {
+  if (in.pos == in.fill) {
+    UINT br;
+    unsigned int n = (in.left > SECTOR_BUFFER_SIZE) ? SECTOR_BUFFER_SIZE : in.left;
+    if (!n || f_read(in.file, sector_buffer, n, &br) != FR_OK || br != n) return -1;
+    in.left -= n;
+    in.pos = 0;
+    in.fill = n;
+  }
+  return sector_buffer[in.pos++];
+}
+
+static FRESULT track_load(msa_t *msa, unsigned char index) {
+  unsigned int raw = msa->spt * 512, len, out = 0;
+  UINT br;
+
+  len = msa->offset[index + 1] - msa->offset[index] - 2;
+  if (f_lseek(msa->file, msa->offset[index] + 2) != FR_OK) return FR_DISK_ERR;
+  if (len == raw)
+    return (f_read(msa->file, track.data, raw, &br) != FR_OK || br != raw) ? FR_DISK_ERR : FR_OK;
+
+  in.file = msa->file;
+  in.left = len;
+  in.pos = in.fill = 0;
+  while (out < raw) {
+    int b = get_byte();
+    if (b < 0) return FR_INT_ERR;
+    if (b == MSA_RUN) {
+      int c = get_byte(), h = get_byte(), l = get_byte();
+      unsigned int n = (h << 8) | l;
+      if (c < 0 || h < 0 || l < 0 || out + n > raw) return FR_INT_ERR;
+      memset(track.data + out, c, n);
+      out += n;
+    } else {
+      track.data[out++] = b;
+    }
+  }
+  return FR_OK;
+}
+
+// ---------- encoding ----------
+static struct {
+  FIL     *file;   // 0 to only count the bytes
+  uint16_t len;
+  unsigned int fill;
+  FRESULT  res;
+} enc;
+
+static void put_byte(unsigned char b) {
+  enc.len++;
+  if (!enc.file) return;
+  sector_buffer[enc.fill++] = b;
+  if (enc.fill == SECTOR_BUFFER_SIZE) {
+    UINT bw;
+    if (f_write(enc.file, sector_buffer, enc.fill, &bw) != FR_OK || bw != enc.fill) enc.res = FR_DISK_ERR;
+    enc.fill = 0;
+  }
+}
+
+static void put_run(unsigned char b, unsigned int n) {
+  put_byte(MSA_RUN);
+  put_byte(b);
+  put_byte(n >> 8);
+  put_byte(n);
+}
+
+// runs of 4 and more bytes and all 0xe5 are encoded as runs. Up to extra
+// bytes are spent on a longer encoding to keep the length of the track:
+// literals in front of a run, short literals as runs, runs split up.
+static uint16_t encode(FIL *file, unsigned int raw, unsigned int extra) {
+  unsigned int i = 0, j, n, m;
+
+  enc.file = file;
+  enc.len = 0;
+  enc.fill = 0;
+  enc.res = FR_OK;
+  while (i < raw) {
+    unsigned char b = track.data[i];
+    for (n = 1; i + n < raw && track.data[i + n] == b; n++) ;
+    i += n;
+    if (b == MSA_RUN) {
+      for (; extra >= 4 && n > 1; n--, extra -= 4) put_run(b, 1);
+      put_run(b, n);
+    } else if (n >= 4) {
+      m = (extra < n - 1) ? extra : n - 1;
+      extra -= m;
+      for (j = 0; j < m; j++) put_byte(b);
+      put_run(b, n - m);
+    } else if (extra >= 4 - n) {
+      extra -= 4 - n;
+      put_run(b, n);
+    } else {
+      while (n--) put_byte(b);
+    }
+  }
+  if (file && enc.fill) {
+    UINT bw;
+    if (f_write(file, sector_buffer, enc.fill, &bw) != FR_OK || bw != enc.fill) enc.res = FR_DISK_ERR;
+  }
+  return enc.len;
+}
+
+// moves the tracks from index on and anything after them by d bytes, a
+// file that got shorter is truncated
+static FRESULT shift(msa_t *msa, unsigned char index, int32_t d) {
+  uint32_t from = msa->offset[index], end = f_size(msa->file);
+  uint32_t left = end - from;
+  unsigned int i;
+  UINT br;
+
+  while (left) {
+    unsigned int n = (left > SECTOR_BUFFER_SIZE) ? SECTOR_BUFFER_SIZE : left;
+    // moving up starts at the end
+    uint32_t pos = (d > 0) ? from + left - n : end - left;
+    if (f_lseek(msa->file, pos) != FR_OK || f_read(msa->file, sector_buffer, n, &br) != FR_OK || br != n)
+      return FR_DISK_ERR;
+    if (f_lseek(msa->file, pos + d) != FR_OK || f_write(msa->file, sector_buffer, n, &br) != FR_OK || br != n)
+      return FR_DISK_ERR;
+    left -= n;
+  }
+  for (i = index; i <= msa->tracks; i++) msa->offset[i] += d;
+  if (d < 0 && (f_lseek(msa->file, end + d) != FR_OK || f_truncate(msa->file) != FR_OK))
+    return FR_DISK_ERR;
+  return FR_OK;
+}
+
+static FRESULT track_flush() {
+  msa_t *msa = track.owner;
+  unsigned int raw, old, len, extra = 0;
+  unsigned char h[2];
+  FRESULT res;
+  UINT bw;
+
+  if (!msa || !track.dirty) return FR_OK;
+  raw = msa->spt * 512;
+  old = msa->offset[track.index + 1] - msa->offset[track.index] - 2;
+
+  // a track as long as the raw data is stored raw
+  len = encode(0, raw, 0);
+  if (len >= raw || old == raw) {
+    len = raw;
+  } else if (len < old && encode(0, raw, old - len) == old) {
+    extra = old - len;
+    len = old;
+  }
+  if (len != old && (res = shift(msa, track.index + 1, (int32_t)len - old)) != FR_OK)
+    return res;
+
+  h[0] = len >> 8;
+  h[1] = len;
+  if (f_lseek(msa->file, msa->offset[track.index]) != FR_OK || f_write(msa->file, h, 2, &bw) != FR_OK || bw != 2)
+    return FR_DISK_ERR;
+  if (len == raw) {
+    if (f_write(msa->file, track.data, raw, &bw) != FR_OK || bw != raw) return FR_DISK_ERR;
+  } else {
+    encode(msa->file, raw, extra);
+    if (enc.res != FR_OK) return enc.res;
+  }
+  if ((res = f_sync(msa->file)) != FR_OK) return res;
+  track.dirty = 0;
+  return FR_OK;
+}
+
+static FRESULT track_write_back() {
+  FRESULT res = track_flush();
+
+  if (res != FR_OK) iprintf("MSA: writing track %d failed (%d)\n", track.index, res);
+  return res;
+}
+
+FRESULT msa_close(msa_t *msa) {
+  FRESULT res = FR_OK;
+
+  if (track.owner == msa) {
+    res = track_write_back();
+    track.owner = 0;
+    track.dirty = 0;
+  }
+  msa->file = 0;
+  return res;
+}
+
+void msa_discard(msa_t *msa) {
+  if (track.owner == msa) {
+    track.owner = 0;
+    track.dirty = 0;
+  }
+  msa->file = 0;
+}
+
+unsigned char *msa_sector(msa_t *msa, uint32_t lba) {
+  uint32_t first = (uint32_t)msa->start * msa->sides;
+  uint32_t ts;
+
+  if (!msa->file) return 0;
+  ts = lba / msa->spt;
+  if (ts < first || ts - first >= msa->tracks) return 0;
+  if (track.owner != msa || track.index != ts - first) {
+    // the dirty track is kept if it cannot be written back
+    if (track_write_back() != FR_OK) return 0;
+    track.owner = 0;
+    if (track_load(msa, ts - first) != FR_OK) return 0;
+    track.owner = msa;
+    track.index = ts - first;
+  }
+  return track.data + (lba % msa->spt) * 512;
+}
+
+void msa_written(msa_t *msa) {
+  if (track.owner != msa) return;
+  track.dirty = 1;
+  track.written = timer_get_msec();
+}
+
+void msa_poll(void) {
+  if (track.dirty && (timer_get_msec() - track.written) >= MSA_FLUSH_DELAY) {
+    // tried again after another delay
+    if (track_write_back() != FR_OK) track.written = timer_get_msec();
+  }
+}
@@ -0,0 +1,45 @@
+/*
+ * msa.h
+ * Atari ST floppy images in MSA format (run length encoded tracks)
+ * The track buffer and the indices take about 7KB of RAM, so only the
+ * boards with HAVE_MSA support them.
+ *
+ */
+
+#ifndef MSA_H
+#define MSA_H
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+#define MSA_MAX_TRACKS  86
+// the track buffer is shared by the drives, 11 covers DD disks
+#ifndef MSA_MAX_SPT
+#define MSA_MAX_SPT     11
+#endif
+// a written track is encoded back after this many ms without writes
+#define MSA_FLUSH_DELAY 1000
+
+typedef struct {
+  FIL          *file;      // 0 if the image is not an MSA
+  unsigned char spt;
+  unsigned char sides;
+  unsigned char start;     // first track in the image
+  unsigned char tracks;    // number of (track, side) entries
+  uint32_t      offset[MSA_MAX_TRACKS * 2 + 1]; // of the track length words, and the end
+} msa_t;
+
+// checks the header and indexes the tracks, FR_INVALID_OBJECT if not an MSA
+FRESULT msa_open(msa_t *msa, FIL *file);
+// writes back a dirty track of the image and forgets it
+FRESULT msa_close(msa_t *msa);
+// forgets the image without writing, the card is gone
+void msa_discard(msa_t *msa);
+// the 512 bytes of a sector in the track buffer, 0 if it cannot be read
+unsigned char *msa_sector(msa_t *msa, uint32_t lba);
+// the sector returned by msa_sector() was modified
+void msa_written(msa_t *msa);
+// writes back the dirty track after MSA_FLUSH_DELAY
+void msa_poll(void);
+
+#endif // MSA_H
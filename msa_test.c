@@ -0,0 +1,502 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "msa.h"
+#include "fat_compat.h"
+#include "timer.h"
+
+// Converts generated ST images (boot sector, FAT, formatted empty
+// sectors, text and packed data) to MSA with a reference encoder, puts
+// them on a FAT16 RAM disk and reads every sector through msa.c with the
+// real FatFs. Written tracks are checked by decoding the whole file again
+// with the reference decoder. The benchmark compares the sector reads of
+// the MSA with the ones of the plain .ST image.
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+
+static uint8_t *disk;
+static unsigned int reads;
+static int write_fail;
+static msec_t msec;
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+msec_t timer_get_msec() {
+  return msec;
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  reads += n;
+  memcpy(buf, disk + lba * 512, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  if (write_fail) return 0;
+  memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void format() {
+  uint8_t *b = disk;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(disk + 512, 0xfff8);
+  put16(disk + 514, 0xffff);
+  memcpy(disk + (1 + FAT_SECTORS) * 512, disk + 512, FAT_SECTORS * 512);
+}
+
+// ---------- reference conversion ----------
+typedef struct {
+  const char *name;
+  int spt, sides, tracks;
+  uint8_t *st;
+  long st_size;
+} image_t;
+
+static void make_st(image_t *img) {
+  unsigned int s, i, n = img->spt * img->sides * img->tracks;
+
+  img->st_size = n * 512;
+  img->st = malloc(img->st_size);
+  for (s = 0; s < n; s++) {
+    uint8_t *p = img->st + s * 512;
+    if (s < 12) {                    // boot sector, FATs, directory
+      memset(p, 0, 512);
+      for (i = 0; i < 40; i++) p[rand() % 512] = rand();
+    } else if (s % 5 == 0 || s > n / 2) { // formatted, never written
+      memset(p, 0xe5, 512);
+    } else if (s % 5 == 1) {         // text
+      for (i = 0; i < 512; i++) p[i] = "the ST disk  \n"[rand() % 14];
+    } else {                         // packed
+      for (i = 0; i < 512; i++) p[i] = rand();
+    }
+  }
+}
+
+static long st_to_msa(const image_t *img, uint8_t *msa) {
+  unsigned int raw = img->spt * 512, t, i, n;
+  long pos = 10;
+
+  msa[0] = 0x0e; msa[1] = 0x0f;
+  msa[2] = 0; msa[3] = img->spt;
+  msa[4] = 0; msa[5] = img->sides - 1;
+  msa[6] = 0; msa[7] = 0;
+  msa[8] = 0; msa[9] = img->tracks - 1;
+  for (t = 0; t < img->tracks * img->sides; t++) {
+    const uint8_t *d = img->st + t * raw;
+    uint8_t *len = msa + pos;
+    long start = pos += 2;
+    for (i = 0; i < raw; i += n) {
+      for (n = 1; i + n < raw && d[i + n] == d[i]; n++) ;
+      if (n >= 4 || d[i] == 0xe5) {
+        msa[pos++] = 0xe5; msa[pos++] = d[i]; msa[pos++] = n >> 8; msa[pos++] = n;
+      } else {
+        memcpy(msa + pos, d + i, n);
+        pos += n;
+      }
+    }
+    if (pos - start >= raw) {
+      memcpy(msa + start, d, raw);
+      pos = start + raw;
+    }
+    len[0] = (pos - start) >> 8;
+    len[1] = pos - start;
+  }
+  return pos;
+}
+
+// the whole file decoded, the header has to match the image
+static int msa_to_st(const image_t *img, const uint8_t *msa, long size, uint8_t *st) {
+  unsigned int raw = img->spt * 512, t;
+  long pos = 10;
+
+  if (msa[3] != img->spt || msa[5] != img->sides - 1 || msa[9] != img->tracks - 1) return 0;
+  for (t = 0; t < img->tracks * img->sides; t++) {
+    unsigned int len = (msa[pos] << 8) | msa[pos + 1], out = 0;
+    long end = (pos += 2) + len;
+    uint8_t *d = st + t * raw;
+    if (end > size) return 0;
+    if (len == raw) {
+      memcpy(d, msa + pos, raw);
+    } else {
+      while (pos < end) {
+        if (msa[pos] == 0xe5) {
+          unsigned int n = (msa[pos + 2] << 8) | msa[pos + 3];
+          if (out + n > raw) return 0;
+          memset(d + out, msa[pos + 1], n);
+          out += n;
+          pos += 4;
+        } else {
+          if (out >= raw) return 0;
+          d[out++] = msa[pos++];
+        }
+      }
+      if (out != raw || pos != end) return 0;
+    }
+    pos = end;
+  }
+  return 1;
+}
+
+static void put_file(const char *name, const uint8_t *data, long size) {
+  FIL f;
+  UINT bw;
+
+  CHECK(f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK);
+  CHECK(f_write(&f, data, size, &bw) == FR_OK && bw == size);
+  CHECK(f_close(&f) == FR_OK);
+}
+
+static long get_file(const char *name, uint8_t *data) {
+  FIL f;
+  UINT br;
+
+  CHECK(f_open(&f, name, FA_READ) == FR_OK);
+  CHECK(f_read(&f, data, f_size(&f), &br) == FR_OK);
+  f_close(&f);
+  return br;
+}
+
+static void check_sector(msa_t *msa, const image_t *img, unsigned int lba) {
+  unsigned char *p = msa_sector(msa, lba);
+
+  if (!p || memcmp(p, img->st + lba * 512, 512)) {
+    printf("%s: sector %u differs\n", img->name, lba);
+    errors++;
+  }
+}
+
+// ---------- tests ----------
+static uint8_t msa_buf[2 << 20], st_buf[2 << 20];
+
+static void test_read(image_t *img) {
+  unsigned int i, n = img->spt * img->sides * img->tracks;
+  long size;
+  msa_t msa;
+  FIL f;
+
+  size = st_to_msa(img, msa_buf);
+  put_file(img->name, msa_buf, size);
+  CHECK(f_open(&f, img->name, FA_READ) == FR_OK);
+  CHECK(msa_open(&msa, &f) == FR_OK);
+  CHECK(msa.spt == img->spt && msa.sides == img->sides && msa.tracks == img->tracks * img->sides);
+  for (i = 0; i < n; i++) check_sector(&msa, img, i);
+  for (i = 0; i < 2000; i++) check_sector(&msa, img, rand() % n);
+  CHECK(!msa_sector(&msa, n));
+  CHECK(msa_close(&msa) == FR_OK && !msa.file);
+  CHECK(!msa_sector(&msa, 0));
+  f_close(&f);
+}
+
+static void test_invalid(image_t *img) {
+  long size = st_to_msa(img, msa_buf);
+  msa_t msa;
+  FIL f;
+
+  // plain image
+  put_file("PLAIN.ST", img->st, img->st_size);
+  CHECK(f_open(&f, "PLAIN.ST", FA_READ) == FR_OK && msa_open(&msa, &f) == FR_INVALID_OBJECT && !msa.file);
+  f_close(&f);
+
+  // truncated
+  put_file("SHORT.MSA", msa_buf, size - 100);
+  CHECK(f_open(&f, "SHORT.MSA", FA_READ) == FR_OK && msa_open(&msa, &f) == FR_INVALID_OBJECT);
+  f_close(&f);
+
+  // track longer than the raw data
+  msa_buf[10] = 0x30;
+  put_file("BAD.MSA", msa_buf, size);
+  CHECK(f_open(&f, "BAD.MSA", FA_READ) == FR_OK && msa_open(&msa, &f) == FR_INVALID_OBJECT);
+  f_close(&f);
+}
+
+// writes n sectors starting at lba through the track buffer
+static void write_sectors(msa_t *msa, image_t *img, unsigned int lba, unsigned int n, int fill) {
+  unsigned int i, j;
+
+  for (i = lba; i < lba + n; i++) {
+    unsigned char *p = msa_sector(msa, i);
+    CHECK(p != 0);
+    if (!p) return;
+    for (j = 0; j < 512; j++) p[j] = (fill < 0) ? rand() : fill;
+    msa_written(msa);
+    memcpy(img->st + i * 512, p, 512);
+  }
+}
+
+static void verify_file(image_t *img) {
+  long size = get_file(img->name, msa_buf);
+
+  memset(st_buf, 0, img->st_size);
+  CHECK(msa_to_st(img, msa_buf, size, st_buf));
+  CHECK(!memcmp(st_buf, img->st, img->st_size));
+}
+
+static void test_write(image_t *img) {
+  unsigned int spt = img->spt, n = spt * img->sides * img->tracks, i, lba;
+  unsigned char *p;
+  long size, old_size;
+  msa_t msa;
+  FIL f;
+
+  size = st_to_msa(img, msa_buf);
+  put_file(img->name, msa_buf, size);
+  CHECK(f_open(&f, img->name, FA_READ | FA_WRITE) == FR_OK && msa_open(&msa, &f) == FR_OK);
+
+  // a few bytes of a text track, the encoding is padded to the old length
+  old_size = size;
+  write_sectors(&msa, img, 2 * spt + 1, 1, 't');
+  check_sector(&msa, img, 0);           // leaving the track writes it back
+  CHECK(f_size(&f) == old_size);
+  CHECK(msa.offset[msa.tracks] == old_size);
+  verify_file(img);
+
+  // packed data over a formatted track grows the file
+  write_sectors(&msa, img, n - 2 * spt, spt, -1);
+  msec += MSA_FLUSH_DELAY - 1;
+  msa_poll();
+  CHECK(msa.offset[msa.tracks] == old_size);
+  msec += 1;
+  msa_poll();
+  CHECK(msa.offset[msa.tracks] > old_size);
+  verify_file(img);
+
+  // formatted again, it stays raw in place
+  old_size = msa.offset[msa.tracks];
+  write_sectors(&msa, img, n - 2 * spt, spt, 0xe5);
+  CHECK(msa_close(&msa) == FR_OK);
+  CHECK(msa_open(&msa, &f) == FR_OK && msa.offset[msa.tracks] == old_size);
+  verify_file(img);
+
+  // a formatted track in the middle, 4 bytes, gets 3 literals in front of
+  // a run, 7 bytes. Formatting it again cannot be padded to 7 bytes, the
+  // rest of the file moves up and back down.
+  lba = (n / 2 / spt + 2) * spt;
+  write_sectors(&msa, img, lba, spt, 't');
+  p = msa_sector(&msa, lba);
+  memcpy(p, "abc", 3);
+  memcpy(img->st + lba * 512, p, 512);
+  msa_written(&msa);
+  CHECK(msa_close(&msa) == FR_OK);
+  CHECK(msa_open(&msa, &f) == FR_OK && msa.offset[msa.tracks] == old_size + 3);
+  verify_file(img);
+  write_sectors(&msa, img, lba, spt, 0xe5);
+  CHECK(msa_close(&msa) == FR_OK);
+  CHECK(f_size(&f) == old_size);
+  CHECK(msa_open(&msa, &f) == FR_OK && msa.offset[msa.tracks] == old_size);
+  verify_file(img);
+
+  // random writes all over the disk
+  for (i = 0; i < 300; i++) {
+    lba = rand() % n;
+    write_sectors(&msa, img, lba, 1 + rand() % 3 > n - lba ? 1 : 1 + rand() % 3,
+                  (rand() & 1) ? -1 : "\0\xe5t"[rand() % 3]);
+  }
+  CHECK(msa_close(&msa) == FR_OK);
+  verify_file(img);
+  CHECK(msa_open(&msa, &f) == FR_OK);
+  for (i = 0; i < n; i++) check_sector(&msa, img, i);
+  msa_close(&msa);
+  f_close(&f);
+}
+
+// both drives share the track buffer
+static void test_two_drives(image_t *a, image_t *b) {
+  unsigned int na = a->spt * a->sides * a->tracks, nb = b->spt * b->sides * b->tracks, i;
+  msa_t msa[2];
+  FIL f[2];
+
+  CHECK(f_open(&f[0], a->name, FA_READ | FA_WRITE) == FR_OK && msa_open(&msa[0], &f[0]) == FR_OK);
+  CHECK(f_open(&f[1], b->name, FA_READ | FA_WRITE) == FR_OK && msa_open(&msa[1], &f[1]) == FR_OK);
+  // disk copy from a to b
+  for (i = 0; i < na && i < nb; i++) {
+    unsigned char *p = msa_sector(&msa[0], i);
+    memcpy(st_buf, p, 512);
+    p = msa_sector(&msa[1], i);
+    memcpy(p, st_buf, 512);
+    msa_written(&msa[1]);
+    memcpy(b->st + i * 512, st_buf, 512);
+  }
+  CHECK(msa_close(&msa[0]) == FR_OK);
+  CHECK(msa_close(&msa[1]) == FR_OK);
+  f_close(&f[0]);
+  f_close(&f[1]);
+  verify_file(a);
+  verify_file(b);
+}
+
+// a track which cannot be written back is kept dirty, one of a removed
+// card is dropped
+static void test_errors(image_t *img) {
+  unsigned int spt = img->spt;
+  long size = get_file(img->name, msa_buf);
+  msa_t msa;
+  FIL f;
+
+  memcpy(st_buf, img->st, img->st_size);
+  CHECK(f_open(&f, img->name, FA_READ | FA_WRITE) == FR_OK && msa_open(&msa, &f) == FR_OK);
+  write_sectors(&msa, img, 0, 1, 'x');
+  write_fail = 1;
+  msec += MSA_FLUSH_DELAY;
+  msa_poll();
+  CHECK(!msa_sector(&msa, 2 * spt));
+  CHECK(msa_sector(&msa, 0) && msa_sector(&msa, 0)[0] == 'x');
+  CHECK(msa_close(&msa) != FR_OK);
+  f_close(&f);
+  write_fail = 0;
+  put_file(img->name, msa_buf, size);
+  memcpy(img->st, st_buf, img->st_size);
+
+  CHECK(f_open(&f, img->name, FA_READ | FA_WRITE) == FR_OK && msa_open(&msa, &f) == FR_OK);
+  write_sectors(&msa, img, 0, 1, 'y');
+  msa_discard(&msa);
+  CHECK(!msa.file && msa_close(&msa) == FR_OK);
+  f_close(&f);
+  memcpy(img->st, st_buf, img->st_size);
+  verify_file(img);
+}
+
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static void bench(image_t *img) {
+  unsigned int n = img->spt * img->sides * img->tracks, i, pass;
+  unsigned int r[2][2];
+  double t[2][2];
+  msa_t msa;
+  FIL f;
+
+  put_file("BENCH.ST", img->st, img->st_size);
+  put_file("BENCH.MSA", msa_buf, st_to_msa(img, msa_buf));
+  CHECK(f_open(&f, "BENCH.MSA", FA_READ) == FR_OK && msa_open(&msa, &f) == FR_OK);
+  for (pass = 0; pass < 2; pass++) {
+    double t0 = now();
+    reads = 0;
+    srand(3);
+    for (i = 0; i < n; i++) {
+      unsigned int lba = pass ? rand() % n : i;
+      CHECK(msa_sector(&msa, lba) != 0);
+    }
+    t[1][pass] = now() - t0;
+    r[1][pass] = reads;
+  }
+  msa_close(&msa);
+  f_close(&f);
+
+  CHECK(f_open(&f, "BENCH.ST", FA_READ) == FR_OK);
+  for (pass = 0; pass < 2; pass++) {
+    double t0 = now();
+    reads = 0;
+    srand(3);
+    for (i = 0; i < n; i++) {
+      unsigned int lba = pass ? rand() % n : i;
+      UINT br;
+      f_lseek(&f, lba * 512);
+      f_read(&f, sector_buffer, 512, &br);
+    }
+    t[0][pass] = now() - t0;
+    r[0][pass] = reads;
+  }
+  f_close(&f);
+
+  printf("  %-10s %5ld bytes ST, %5ld MSA\n", img->name, img->st_size, st_to_msa(img, msa_buf));
+  printf("    sequential: ST %6u reads %6.1f MB/s, MSA %6u reads %6.1f MB/s\n",
+         r[0][0], img->st_size / t[0][0], r[1][0], img->st_size / t[1][0]);
+  printf("    random:     ST %6u reads %6.1f MB/s, MSA %6u reads %6.1f MB/s\n",
+         r[0][1], img->st_size / t[0][1], r[1][1], img->st_size / t[1][1]);
+}
+
+int main() {
+  image_t img[] = {
+    { "DS9.MSA",  9, 2, 80 },
+    { "SS9.MSA",  9, 1, 80 },
+    { "DS10.MSA", 10, 2, 82 },
+    { "DS11.MSA", 11, 2, 83 },
+  };
+  int i;
+
+  disk = calloc(DISK_SECTORS, 512);
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+
+  for (i = 0; i < 4; i++) {
+    make_st(&img[i]);
+    test_read(&img[i]);
+  }
+  test_invalid(&img[0]);
+  for (i = 0; i < 4; i++) test_write(&img[i]);
+  test_two_drives(&img[0], &img[2]);
+  test_errors(&img[1]);
+
+  printf("Sector reads through the MSA track buffer:\n");
+  for (i = 0; i < 4; i += 3) bench(&img[i]);
+
+  for (i = 0; i < 4; i++) free(img[i].st);
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
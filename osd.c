@@ -42,6 +42,7 @@ This is the Minimig OSD (on-screen-display) handler.
 #include "logo.h"
 #include "state.h"
 #include "user_io.h"
+#include "writeback.h"
 
 extern unsigned char charfont[128][8];
 
@@ -446,6 +447,7 @@ void OsdDisable(void)
 
 void OsdReset(unsigned char boot)
 {
+    wb_flush_all();
     if(minimig_v1())
       spi_osd_cmd(MM1_OSDCMDRST | (boot & 0x01));
     else {
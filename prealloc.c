@@ -0,0 +1,60 @@
+// prealloc.c
+// New images and save files allocated in a single run of clusters with
+// f_expand(). Growing a file with f_write() or f_lseek() allocates and
+// links one cluster at a time, fills the holes of a used card first and
+// the resulting fragments defeat the cluster index and the direct sector
+// access of idxfile.c. As the new file is contiguous, the optional zero
+// fill goes to the card in multi sector writes, bypassing FatFs.
+
+#include <string.h>
+#include "prealloc.h"
+#include "fat_compat.h"
+#include "sched.h"
+#include "FatFs/diskio.h"
+
+// sector buffer writes between two yield points while zero filling
+#define PREALLOC_YIELD  64
+
+static FRESULT FileZeroFill(FIL *file, LBA_t sector, LBA_t count) {
+  FATFS *fs = file->obj.fs;
+  unsigned int n, i = 0;
+
+  while (count) {
+    if (!(i++ % PREALLOC_YIELD)) {
+      sched_yield(0);
+      // the tasks run from the yield point may use the sector buffer
+      memset(sector_buffer, 0, SECTOR_BUFFER_SIZE);
+    }
+    n = (count > SECTOR_BUFFER_SIZE / 512) ? SECTOR_BUFFER_SIZE / 512 : count;
+    if (disk_write(fs->pdrv, sector_buffer, sector, n) != RES_OK) return FR_DISK_ERR;
+    sector += n;
+    count -= n;
+  }
+  return FR_OK;
+}
+
+FRESULT FilePreallocate(FIL *file, FSIZE_t size, uint8_t flags) {
+  FATFS *fs = file->obj.fs;
+  LBA_t count;
+  FRESULT res;
+
+  res = f_expand(file, size, 1);
+  if (res != FR_OK || !(flags & (PREALLOC_ZERO | PREALLOC_CLEAR))) return res;
+
+  count = (size + 511) >> 9;
+  if (!(flags & PREALLOC_ZERO) && count > (PREALLOC_CLEAR_SIZE >> 9))
+    count = PREALLOC_CLEAR_SIZE >> 9;
+  return FileZeroFill(file, fs->database + (LBA_t)fs->csize * (file->obj.sclust - 2), count);
+}
+
+FRESULT FileCreateContiguous(FIL *file, const char *name, FSIZE_t size, uint8_t flags) {
+  FRESULT res;
+
+  res = f_open(file, name, FA_READ | FA_WRITE | FA_CREATE_NEW);
+  if (res != FR_OK) return res;
+  res = FilePreallocate(file, size, flags);
+  if (res == FR_OK) res = f_sync(file);
+  // f_unlink() is not available with FF_FS_MINIMIZE, an empty file is left behind
+  if (res != FR_OK) f_close(file);
+  return res;
+}
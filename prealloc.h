@@ -0,0 +1,27 @@
+/*
+ * prealloc.h
+ * Contiguous preallocation of new disk images and save files
+ *
+ */
+
+#ifndef PREALLOC_H
+#define PREALLOC_H
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+// zero fill options
+#define PREALLOC_ZERO   1  // the whole file
+#define PREALLOC_CLEAR  2  // only the first PREALLOC_CLEAR_SIZE bytes
+
+// RDB search area and boot blocks of a hardfile, so stale data of a
+// deleted image is not detected as a partition table
+#define PREALLOC_CLEAR_SIZE  (64 * 512)
+
+// allocate size bytes in one run of clusters for an empty file opened
+// for writing, FR_DENIED if there's no such run
+FRESULT FilePreallocate(FIL *file, FSIZE_t size, uint8_t flags);
+// create a new preallocated file, it's left open on success
+FRESULT FileCreateContiguous(FIL *file, const char *name, FSIZE_t size, uint8_t flags);
+
+#endif // PREALLOC_H
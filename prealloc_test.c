@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "prealloc.h"
+#include "fat_compat.h"
+
+// Creates images on FAT32 and exFAT RAM disks with the real FatFs. The
+// free space at the start of the volumes is fragmented like on a used
+// card. Images grown with f_write() or f_lseek() fill these holes first,
+// preallocated ones must be a single fragment. The benchmark counts the
+// card write commands and sectors and the CPU time of both ways, with
+// and without zero fill.
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk ----------
+#define DISK_SECTORS  131072   // 64MB
+#define IMG_SIZE      (16 << 20)
+#define HOLE          16       // clusters, used and free runs of the fragmented area
+
+static uint8_t *disk;
+static unsigned int write_cmds, sectors_written;
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+void sched_yield(unsigned char busy) {
+  // a task using the sector buffer
+  memset(sector_buffer, 0x55, SECTOR_BUFFER_SIZE);
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  memcpy(buf, disk + lba * 512, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  write_cmds++;
+  sectors_written += n;
+  memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+// ---------- FAT32, the smallest one has 512 byte clusters ----------
+#define F32_RSV       32
+#define F32_FATSZ     1024
+#define F32_DATA      (F32_RSV + 2 * F32_FATSZ)
+#define F32_CLUSTERS  (DISK_SECTORS - F32_DATA)
+
+static void format_fat32(uint32_t frag) {
+  uint8_t *b = disk, *fat = disk + F32_RSV * 512;
+  uint32_t c;
+
+  memset(disk, 0, F32_DATA * 512 + 512);
+  b[0] = 0xeb; b[1] = 0x58; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = 1;                   // sectors per cluster
+  put16(b + 14, F32_RSV);
+  b[16] = 2;                   // FATs
+  b[21] = 0xf8;
+  put32(b + 32, DISK_SECTORS);
+  put32(b + 36, F32_FATSZ);
+  put32(b + 44, 2);            // root directory cluster
+  b[66] = 0x29;
+  memcpy(b + 82, "FAT32   ", 8);
+  put16(b + 510, 0xaa55);
+  put32(fat, 0x0ffffff8);
+  put32(fat + 4, 0x0fffffff);
+  put32(fat + 8, 0x0fffffff);
+  // used runs in the first clusters, lost chains of one cluster
+  for (c = 3; c < 3 + frag; c++)
+    if (((c - 3) / HOLE) & 1) put32(fat + c * 4, 0x0fffffff);
+  memcpy(disk + (F32_RSV + F32_FATSZ) * 512, fat, F32_FATSZ * 512);
+}
+
+// ---------- exFAT with 4k clusters ----------
+#define EX_FATOFS     128
+#define EX_FATSZ      128
+#define EX_DATA       256
+#define EX_SPC        8
+#define EX_CLUSTERS   ((DISK_SECTORS - EX_DATA) / EX_SPC)
+
+static void format_exfat(uint32_t frag) {
+  uint8_t *b = disk, *fat = disk + EX_FATOFS * 512;
+  uint8_t *bitmap = disk + EX_DATA * 512, *root = bitmap + EX_SPC * 512;
+  uint32_t c;
+
+  memset(disk, 0, (EX_DATA + 2 * EX_SPC) * 512);
+  memcpy(b, "\xeb\x76\x90" "EXFAT   ", 11);
+  put32(b + 72, DISK_SECTORS);
+  put32(b + 80, EX_FATOFS);
+  put32(b + 84, EX_FATSZ);
+  put32(b + 88, EX_DATA);
+  put32(b + 92, EX_CLUSTERS);
+  put32(b + 96, 3);            // root directory cluster
+  put16(b + 104, 0x100);       // version 1.0
+  b[108] = 9;                  // 512 bytes per sector
+  b[109] = 3;                  // 8 sectors per cluster
+  b[110] = 1;                  // FATs
+  b[111] = 0x80;
+  put16(b + 510, 0xaa55);
+  put32(fat, 0xfffffff8);
+  put32(fat + 4, 0xffffffff);
+  put32(fat + 8, 0xffffffff);  // allocation bitmap
+  put32(fat + 12, 0xffffffff); // root directory
+  root[0] = 0x81;
+  put32(root + 20, 2);
+  put32(root + 24, (EX_CLUSTERS + 7) / 8);
+  bitmap[0] = 0x03;
+  for (c = 4; c < 4 + frag; c++)
+    if (((c - 4) / HOLE) & 1) bitmap[(c - 2) / 8] |= 1 << ((c - 2) % 8);
+}
+
+// ---------- helpers ----------
+static DWORD clmt[4096];
+
+static void mount(int exfat, uint32_t frag) {
+  // stale data of deleted files all over the volume
+  memset(disk, 0xaa, (size_t)DISK_SECTORS * 512);
+  if (exfat) format_exfat(frag);
+  else format_fat32(frag);
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+  CHECK(fs.fs_type == (exfat ? FS_EXFAT : FS_FAT32));
+}
+
+// number of fragments of an open file
+static int fragments(FIL *f) {
+  FSIZE_t pos = f_tell(f);
+
+  clmt[0] = sizeof(clmt) / sizeof(DWORD);
+  f->cltbl = clmt;
+  if (f_lseek(f, CREATE_LINKMAP) != FR_OK) return -1;
+  f->cltbl = 0;
+  f_lseek(f, pos);
+  return (clmt[0] - 1) / 2;
+}
+
+static int is_zero(FIL *f, FSIZE_t size) {
+  static uint8_t buf[65536];
+  UINT br;
+
+  f_lseek(f, 0);
+  while (size) {
+    UINT n = size > sizeof(buf) ? sizeof(buf) : size;
+    if (f_read(f, buf, n, &br) != FR_OK || br != n) return 0;
+    while (n--) if (buf[n]) return 0;
+    size -= br;
+  }
+  return 1;
+}
+
+// ---------- checks ----------
+static void test_create(int exfat) {
+  FIL f;
+  UINT bw, n;
+  uint32_t lba, csize = exfat ? EX_SPC : 1;
+  uint8_t data[1000];
+
+  // quick: only the partition table area is cleared
+  mount(exfat, 4096);
+  CHECK(FileCreateContiguous(&f, "QUICK.HDF", IMG_SIZE, PREALLOC_CLEAR) == FR_OK);
+  CHECK(f_size(&f) == IMG_SIZE);
+  CHECK(fragments(&f) == 1);
+  lba = fs.database + csize * (f.obj.sclust - 2);
+  CHECK(lba >= fs.database + 4096 * csize);
+  CHECK(is_zero(&f, PREALLOC_CLEAR_SIZE));
+  CHECK(disk[(size_t)lba * 512 + PREALLOC_CLEAR_SIZE] == 0xaa);
+  CHECK(f_close(&f) == FR_OK);
+  CHECK(f_open(&f, "QUICK.HDF", FA_READ) == FR_OK);
+  CHECK(f_size(&f) == IMG_SIZE && fragments(&f) == 1);
+  f_close(&f);
+
+  // the names of the OSD are not overwritten
+  CHECK(FileCreateContiguous(&f, "QUICK.HDF", IMG_SIZE, 0) == FR_EXIST);
+
+  // zero filled, the yield points trash the sector buffer
+  CHECK(FileCreateContiguous(&f, "ZERO.HDF", IMG_SIZE, PREALLOC_ZERO) == FR_OK);
+  CHECK(fragments(&f) == 1);
+  CHECK(is_zero(&f, IMG_SIZE));
+  f_close(&f);
+
+  // too big for the largest free run
+  CHECK(FileCreateContiguous(&f, "HUGE.HDF", (FSIZE_t)DISK_SECTORS * 512 / 2, 0) == FR_DENIED);
+  CHECK(f_open(&f, "HUGE.HDF", FA_READ) == FR_OK && f_size(&f) == 0);
+  f_close(&f);
+
+  // a save file is written after the preallocation, the way
+  // data_io_file_rx() does it
+  CHECK(f_open(&f, "CORE.RAM", FA_READ | FA_WRITE | FA_OPEN_ALWAYS) == FR_OK);
+  CHECK(FilePreallocate(&f, 128 * 1024 + 100, 0) == FR_OK);
+  memset(data, 0x3c, sizeof(data));
+  for (lba = 128 * 1024 + 100; lba; lba -= n) {
+    n = lba > sizeof(data) ? sizeof(data) : lba;
+    CHECK(f_write(&f, data, n, &bw) == FR_OK && bw == n);
+  }
+  f_close(&f);
+  CHECK(f_open(&f, "CORE.RAM", FA_READ | FA_WRITE | FA_OPEN_ALWAYS) == FR_OK);
+  CHECK(f_size(&f) == 128 * 1024 + 100 && fragments(&f) == 1);
+  // an existing save is not preallocated again
+  CHECK(FilePreallocate(&f, 128 * 1024 + 100, 0) == FR_DENIED);
+  f_close(&f);
+}
+
+// ---------- benchmark ----------
+typedef struct {
+  unsigned int cmds, sectors, fragments;
+  double ms;
+} result_t;
+
+static void grow_write(FIL *f) {
+  UINT bw;
+  uint32_t i;
+
+  memset(sector_buffer, 0, SECTOR_BUFFER_SIZE);
+  for (i = 0; i < IMG_SIZE / SECTOR_BUFFER_SIZE; i++)
+    f_write(f, sector_buffer, SECTOR_BUFFER_SIZE, &bw);
+}
+
+static result_t create(int exfat, int mode) {
+  result_t r;
+  clock_t t;
+  FIL f;
+
+  mount(exfat, 8192);
+  write_cmds = sectors_written = 0;
+  t = clock();
+  switch (mode) {
+    case 0: // f_lseek() allocating cluster by cluster
+      CHECK(f_open(&f, "NEW.HDF", FA_READ | FA_WRITE | FA_CREATE_NEW) == FR_OK);
+      CHECK(f_lseek(&f, IMG_SIZE) == FR_OK);
+      break;
+    case 1: // f_write() of zeros
+      CHECK(f_open(&f, "NEW.HDF", FA_READ | FA_WRITE | FA_CREATE_NEW) == FR_OK);
+      grow_write(&f);
+      break;
+    case 2:
+      CHECK(FileCreateContiguous(&f, "NEW.HDF", IMG_SIZE, PREALLOC_CLEAR) == FR_OK);
+      break;
+    case 3:
+      CHECK(FileCreateContiguous(&f, "NEW.HDF", IMG_SIZE, PREALLOC_ZERO) == FR_OK);
+      break;
+  }
+  CHECK(f_close(&f) == FR_OK);
+  r.ms = (double)(clock() - t) * 1000 / CLOCKS_PER_SEC;
+  r.cmds = write_cmds;
+  r.sectors = sectors_written;
+  CHECK(f_open(&f, "NEW.HDF", FA_READ) == FR_OK);
+  CHECK(f_size(&f) == IMG_SIZE);
+  r.fragments = fragments(&f);
+  f_close(&f);
+  return r;
+}
+
+static void print_result(const char *name, result_t *r) {
+  printf("  %-26s: %6u write commands, %6u sectors, %5u fragments, %6.2f ms CPU\n",
+         name, r->cmds, r->sectors, r->fragments, r->ms);
+}
+
+static void benchmark(int exfat) {
+  result_t seek, write, quick, zero;
+
+  seek = create(exfat, 0);
+  write = create(exfat, 1);
+  quick = create(exfat, 2);
+  zero = create(exfat, 3);
+  printf("%s, %u MB image:\n", exfat ? "exFAT, 4k clusters" : "FAT32, 512 byte clusters", IMG_SIZE >> 20);
+  print_result("grown with f_lseek()", &seek);
+  print_result("grown with f_write()", &write);
+  print_result("preallocated", &quick);
+  print_result("preallocated, zero filled", &zero);
+
+  CHECK(seek.fragments > 100 && write.fragments > 100);
+  CHECK(quick.fragments == 1 && zero.fragments == 1);
+  CHECK(quick.cmds < seek.cmds);
+  CHECK(zero.cmds < write.cmds);
+  CHECK(zero.sectors <= write.sectors);
+}
+
+int main() {
+  disk = malloc((size_t)DISK_SECTORS * 512);
+
+  test_create(0);
+  test_create(1);
+  benchmark(0);
+  benchmark(1);
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
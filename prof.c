@@ -0,0 +1,94 @@
+// prof.c
+// Duration statistics of the profiling probes. A probe only costs two
+// timestamp reads and a few additions, the statistics are printed on
+// demand from the CDC control console.
+
+#include <stdio.h>
+#include <string.h>
+#include "prof.h"
+
+static prof_probe_t probes[PROF_PROBES_MAX];
+static const char *names[PROF_PROBES_MAX] = {
+	"sd read", "sd write", "ata read", "ata write", "pkt read", "acsi", "usb in", "usb out",
+	"joystick", "keyboard", "mouse"
+};
+static char nprobes = PROF_FIXED;
+
+// returns the probe id or -1 if the table is full
+char prof_add(const char *name) {
+	if(nprobes >= PROF_PROBES_MAX) return -1;
+	names[nprobes] = name;
+	return nprobes++;
+}
+
+void prof_sample(char id, unsigned long ticks) {
+	prof_probe_t *p;
+	uint32_t us = ticks / TIMESTAMP_TICKS_PER_US;
+	uint8_t bucket = 0;
+
+	if(id < 0 || id >= nprobes) return;
+	p = &probes[id];
+
+	if(!p->count || us < p->min) p->min = us;
+	if(us > p->max) p->max = us;
+	p->sum += us;
+	p->count++;
+
+	while(bucket < PROF_BUCKETS-1 && (us >> bucket)) bucket++;
+	if(p->hist[bucket] != 0xffff) p->hist[bucket]++;
+}
+
+#ifdef PROFILING
+input_trace_t input_trace;
+
+// a USB report of a device of the probe's type arrived
+void input_trace_begin(char probe) {
+	input_trace.stamp = GetTimestamp() | 1;
+	input_trace.probe = probe;
+}
+
+void input_trace_emit(input_trace_t *t) {
+	if(!t->stamp) return;
+	prof_sample(t->probe, GetTimestamp() - t->stamp);
+	t->stamp = 0;
+}
+#endif
+
+void prof_reset() {
+	memset(probes, 0, sizeof(probes));
+}
+
+const prof_probe_t *prof_get(char id) {
+	if(id < 0 || id >= nprobes) return 0;
+	return &probes[id];
+}
+
+void prof_dump(void (*out)(char *line)) {
+	char line[64];
+	char i, b, n;
+
+	out("probe       count    min    avg    max (us)");
+	for(i = 0; i < nprobes; i++) {
+		prof_probe_t *p = &probes[i];
+		if(!p->count) continue;
+		siprintf(line, "%-10s %6lu %6lu %6lu %6lu", names[i], (unsigned long)p->count,
+		         (unsigned long)p->min, (unsigned long)(p->sum / p->count), (unsigned long)p->max);
+		out(line);
+
+		// non-empty histogram buckets, four per line
+		line[0] = line[1] = ' ';
+		n = 0;
+		for(b = 0; b < PROF_BUCKETS; b++) {
+			if(!p->hist[b]) continue;
+			if(b == PROF_BUCKETS-1)
+				siprintf(line + 2 + 12*n, ">%5lu:%-5u ", (1UL << (b-1)) - 1, p->hist[b]);
+			else
+				siprintf(line + 2 + 12*n, "<%5lu:%-5u ", 1UL << b, p->hist[b]);
+			if(++n == 4) {
+				out(line);
+				n = 0;
+			}
+		}
+		if(n) out(line);
+	}
+}
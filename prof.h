@@ -0,0 +1,99 @@
+/*
+ * prof.h
+ * Run time profiling of the main loop tasks and the sector and USB
+ * transfer paths. Durations are collected as min/avg/max and a log2
+ * histogram, enabled with -DPROFILING.
+ *
+ */
+
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdint.h>
+
+#ifdef PROF_TEST
+unsigned long GetTimestamp(void);
+#ifndef TIMESTAMP_TICKS_PER_US
+#define TIMESTAMP_TICKS_PER_US 1
+#endif
+#else
+#include "hardware.h"
+#endif
+
+#ifndef PROF_PROBES_MAX
+#define PROF_PROBES_MAX 20
+#endif
+
+// bucket n counts durations of 2^(n-1) to 2^n-1 us, the last one all longer ones
+#define PROF_BUCKETS 16
+
+// fixed probes, the scheduler adds one per task behind these
+#define PROF_SD_READ   0  // user_io sd card emulation
+#define PROF_SD_WRITE  1
+#define PROF_ATA_READ  2  // minimig ide
+#define PROF_ATA_WRITE 3
+#define PROF_PKT_READ  4  // minimig ide cdrom
+#define PROF_ACSI      5  // atari st hard disk
+#define PROF_USB_IN    6  // usb host transfers
+#define PROF_USB_OUT   7
+#define PROF_INPUT_JOY 8  // usb report to core latency per device type
+#define PROF_INPUT_KBD 9
+#define PROF_INPUT_MOUSE 10
+#define PROF_FIXED     11
+
+typedef struct {
+	uint32_t count;
+	uint32_t min;   // us
+	uint32_t max;
+	uint64_t sum;
+	uint16_t hist[PROF_BUCKETS];
+} prof_probe_t;
+
+#ifdef PROFILING
+#define PROF_START(v)    unsigned long v = GetTimestamp()
+#define PROF_END(id, v)  prof_sample(id, GetTimestamp() - (v))
+#else
+#define PROF_START(v)
+#define PROF_END(id, v)
+#endif
+
+// An input trace is the arrival time of a USB HID report. It is kept
+// with the device state or queued data derived from the report until
+// the first word of it is sent to the core. Without PROFILING it's an
+// empty struct (GNU C), so the traces kept along don't take any RAM.
+typedef struct {
+#ifdef PROFILING
+	unsigned long stamp;  // 0 = no pending event
+	char probe;
+#endif
+} input_trace_t;
+
+#ifdef PROFILING
+extern input_trace_t input_trace;  // report currently processed
+
+void input_trace_begin(char probe);
+void input_trace_emit(input_trace_t *t);
+static inline void input_trace_end() { input_trace.stamp = 0; }
+// the current report has reached the core
+static inline void input_trace_sent() { input_trace_emit(&input_trace); }
+// keep the current report with queued data, unless an older one is waiting
+static inline void input_trace_keep(input_trace_t *t) { if(!t->stamp) *t = input_trace; }
+static inline void input_trace_move(input_trace_t *dst, input_trace_t *src) { *dst = *src; src->stamp = 0; }
+static inline void input_trace_clear(input_trace_t *t) { t->stamp = 0; }
+#else
+static inline void input_trace_begin(char probe) {}
+static inline void input_trace_emit(input_trace_t *t) {}
+static inline void input_trace_end() {}
+static inline void input_trace_sent() {}
+static inline void input_trace_keep(input_trace_t *t) {}
+static inline void input_trace_move(input_trace_t *dst, input_trace_t *src) {}
+static inline void input_trace_clear(input_trace_t *t) {}
+#endif
+
+char prof_add(const char *name);
+void prof_sample(char id, unsigned long ticks);
+void prof_reset();
+const prof_probe_t *prof_get(char id);
+void prof_dump(void (*out)(char *line));
+
+#endif // PROF_H
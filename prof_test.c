@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prof.h"
+
+// Feeds known durations through the probes using a mock timestamp and
+// checks the statistics, histogram buckets and the console dump
+
+static unsigned long now;
+static int lines;
+
+unsigned long GetTimestamp(void) {
+	return now;
+}
+
+static void out(char *line) {
+	printf("%s\n", line);
+	lines++;
+}
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// a probe around a piece of code taking 'us' microseconds
+static void timed(char id, unsigned long us) {
+	PROF_START(t);
+	now += us * TIMESTAMP_TICKS_PER_US;
+	PROF_END(id, t);
+}
+
+int main() {
+	const prof_probe_t *p;
+	char id, i;
+	int b;
+
+	// min, max, average
+	timed(PROF_SD_READ, 120);
+	timed(PROF_SD_READ, 80);
+	timed(PROF_SD_READ, 400);
+	p = prof_get(PROF_SD_READ);
+	CHECK(p->count == 3);
+	CHECK(p->min == 80);
+	CHECK(p->max == 400);
+	CHECK(p->sum / p->count == 200);
+
+	// log2 buckets: 0us, 1us, 2-3us, 4-7us ... 16384us and above in the last one
+	timed(PROF_USB_IN, 0);
+	timed(PROF_USB_IN, 1);
+	timed(PROF_USB_IN, 3);
+	timed(PROF_USB_IN, 4);
+	timed(PROF_USB_IN, 1023);
+	timed(PROF_USB_IN, 1024);
+	timed(PROF_USB_IN, 16383);
+	timed(PROF_USB_IN, 16384);
+	timed(PROF_USB_IN, 5000000);
+	p = prof_get(PROF_USB_IN);
+	CHECK(p->hist[0] == 1);
+	CHECK(p->hist[1] == 1);
+	CHECK(p->hist[2] == 1);
+	CHECK(p->hist[3] == 1);
+	CHECK(p->hist[10] == 1);
+	CHECK(p->hist[11] == 1);
+	CHECK(p->hist[14] == 1);
+	CHECK(p->hist[15] == 2);
+
+	// timestamp wrapping around
+	now = 0xfffffff0UL;
+	timed(PROF_ACSI, 0x20);
+	CHECK(prof_get(PROF_ACSI)->max == 0x20);
+	now = 0;
+
+	// saturating histogram
+	for(b = 0; b < 70000; b++) timed(PROF_SD_WRITE, 5);
+	CHECK(prof_get(PROF_SD_WRITE)->hist[3] == 0xffff);
+	CHECK(prof_get(PROF_SD_WRITE)->count == 70000);
+
+	// dynamically added probes, unknown ids are ignored
+	id = prof_add("ui");
+	CHECK(id == PROF_FIXED);
+	timed(id, 40000);
+	CHECK(prof_get(id)->max == 40000);
+	for(i = id + 1; i < PROF_PROBES_MAX; i++) CHECK(prof_add("task") == i);
+	CHECK(prof_add("full") == -1);
+	prof_sample(-1, 100);
+	prof_sample(PROF_PROBES_MAX, 100);
+	CHECK(prof_get(PROF_PROBES_MAX) == 0);
+
+	prof_dump(out);
+	CHECK(lines == 12);
+
+	prof_reset();
+	CHECK(prof_get(PROF_SD_READ)->count == 0);
+	lines = 0;
+	prof_dump(out);
+	CHECK(lines == 1);
+
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
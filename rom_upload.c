@@ -0,0 +1,190 @@
+// rom_upload.c
+// Uploads ROM images into the memory of the Minimig core. The file is read
+// several sectors at a time into the sector buffer, Amiga Forever ROMs are
+// decrypted a word at a time, and every chunk is written to the ROM and
+// its mirror straight from the buffer, so the card is read only once.
+//
+// The memory write path of the core takes 16 bit words and needs a pause
+// after each of them, so the data is streamed with SPI() and SPIN() delays
+// like before. The QSPI connection only feeds the IDE sector buffer and
+// can't be used here.
+
+#include <stdint.h>
+#include <string.h>
+#include "rom_upload.h"
+#ifdef ROM_UPLOAD_TEST
+#include "misc_cfg.h"
+#define OSD_CMD_WR 0x1c
+extern unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+unsigned char SPI(unsigned char outByte);
+void spin(void);
+#define SPIN() spin()
+void EnableOsd(void);
+void DisableOsd(void);
+void spi_osd_cmd32le_cont(unsigned char cmd, unsigned long parm);
+FRESULT FileReadBlockEx(FIL *file, unsigned char *pBuffer, unsigned int len);
+int iprintf(const char *fmt, ...);
+#else
+#include <stdio.h>
+#include "hardware.h"
+#include "fat_compat.h"
+#include "osd.h"
+#include "misc_cfg.h"
+
+#define SPIN() asm volatile ( "mov r0, r0\n\t" \
+                              "mov r0, r0\n\t" \
+                              "mov r0, r0\n\t" \
+                              "mov r0, r0")
+#endif
+
+static const char kick1xfoundstr[] = "Kickstart v1.%c found\n";
+static const char applymemdetectionpatchstr[] = "Applying Kickstart 1.x memory detection patch\n";
+
+static char kick1xfound;
+static char patchapplied;
+
+// patch kickstart 1.x to force memory detection every time the AMIGA is reset
+static void PatchKick1xMemoryDetection(uint8_t *rom) {
+  if (!strncmp((char*)rom + 0x18, "exec 33.192 (8 Oct 1986)", 24))
+    kick1xfound = '2';
+  else if (!strncmp((char*)rom + 0x18, "exec 34.2 (28 Oct 1987)", 23))
+    kick1xfound = '3';
+  else
+    return;
+
+  if ((rom[0x154] == 0x66) && (rom[0x155] == 0x78)) {
+    patchapplied = 1;
+    rom[0x154] = 0x60;
+  }
+}
+
+// xor a buffer with the repeated key, keyidx is the key position of the
+// first byte and is advanced past the buffer. The key must be word aligned,
+// no word with bytes past its end is read.
+void rom_decrypt(uint8_t *buf, uint32_t len, const uint8_t *key, uint32_t keysize, uint32_t *keyidx) {
+  uint32_t k = *keyidx;
+
+  while (len) {
+    // part of the buffer without a key wrap
+    uint32_t n = (len < keysize - k) ? len : keysize - k;
+    const uint8_t *kp = key + k;
+
+    len -= n;
+    k += n;
+    if (k == keysize) k = 0;
+
+    while (n && ((uintptr_t)buf & 3)) {
+      *buf++ ^= *kp++;
+      n--;
+    }
+
+    if (n >= 4) {
+      uint32_t *d = (uint32_t*)buf;
+      uint32_t words = n >> 2, i;
+      uint32_t shift = ((uintptr_t)kp & 3) << 3;
+      const uint32_t *kw = (const uint32_t*)((uintptr_t)kp & ~3);
+
+      if (!shift) {
+        for (i = words; i; i--) *d++ ^= *kw++;
+      } else {
+        // unaligned key, combine two aligned words (little endian). The
+        // last one may reach past the key, its bytes are done one by one
+        uint32_t lo = *kw++;
+        if ((const uint8_t*)(kw + words) > key + keysize) words--;
+        for (i = words; i; i--) {
+          uint32_t hi = *kw++;
+          *d++ ^= (lo >> shift) | (hi << (32 - shift));
+          lo = hi;
+        }
+      }
+      buf = (uint8_t*)d;
+      kp += words << 2;
+      n -= words << 2;
+    }
+
+    while (n--) *buf++ ^= *kp++;
+  }
+  *keyidx = k;
+}
+
+// write a multiple of 4 bytes to the memory of the core
+static void rom_write(uint32_t adr, const uint8_t *p, uint32_t len) {
+  EnableOsd();
+  SPI(OSD_CMD_WR);
+  SPIN(); SPIN(); SPIN(); SPIN();
+  SPI(adr&0xff); adr = adr>>8;
+  SPI(adr&0xff); adr = adr>>8;
+  SPIN(); SPIN(); SPIN(); SPIN();
+  SPI(adr&0xff); adr = adr>>8;
+  SPI(adr&0xff);
+  SPIN(); SPIN(); SPIN(); SPIN();
+  for (len >>= 2; len; len--) {
+    SPI(p[0]);
+    SPI(p[1]);
+    SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
+    SPI(p[2]);
+    SPI(p[3]);
+    SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN(); SPIN();
+    p += 4;
+  }
+  DisableOsd();
+}
+
+// upload sectors of a ROM file to address and, if mirror is not 0, also
+// to mirror. A key located in the sector buffer limits the chunk size.
+void rom_upload(FIL *file, const uint8_t *key, uint32_t keysize, uint32_t address, uint32_t mirror, uint32_t sectors) {
+  uint32_t maxsectors = SECTOR_BUFFER_SIZE / 512;
+  uint32_t keyidx = 0;
+  uint32_t i, j, n;
+  UINT br;
+
+  kick1xfound = 0;
+  patchapplied = 0;
+
+  if (key >= sector_buffer && key < sector_buffer + SECTOR_BUFFER_SIZE)
+    maxsectors = (key - sector_buffer) / 512;
+
+  iprintf("File size: %dkB\r", (int)(sectors>>1));
+  iprintf("[");
+  if (keysize) {
+    // read header
+    f_read(file, sector_buffer, ROM_KEY_HEADER_SIZE, &br);
+  }
+  for (i=0; i<sectors; i+=n) {
+    n = sectors - i;
+    if (n > maxsectors) n = maxsectors;
+    // the sectors checked for the kickstart 1.x patch start a chunk
+    if (i < 512 && i + n > 512) n = 512 - i;
+
+    for (j=i; j<i+n; j++)
+      if (!(j&31)) iprintf("*");
+
+    FileReadBlockEx(file, sector_buffer, n);
+    if (keysize) rom_decrypt(sector_buffer, n*512, key, keysize, &keyidx);
+
+    if (minimig_cfg.kick1x_memory_detection_patch && (i == 0 || i == 512))
+      PatchKick1xMemoryDetection(sector_buffer);
+
+    rom_write(address + i*512, sector_buffer, n*512);
+    if (mirror) rom_write(mirror + i*512, sector_buffer, n*512);
+  }
+  iprintf("]\r");
+
+  if (kick1xfound) iprintf(kick1xfoundstr, kick1xfound);
+  if (patchapplied) iprintf(applymemdetectionpatchstr);
+}
+
+// clear a multiple of 4 bytes of the memory of the core
+void rom_clear(uint32_t address, uint32_t size) {
+  spi_osd_cmd32le_cont(OSD_CMD_WR, address);
+  for (size >>= 2; size; size--) {
+    SPI(0x00);
+    SPI(0x00);
+    SPIN(); SPIN(); SPIN(); SPIN();
+    SPI(0x00);
+    SPI(0x00);
+    SPIN(); SPIN(); SPIN(); SPIN();
+  }
+  DisableOsd();
+  SPIN(); SPIN(); SPIN(); SPIN();
+}
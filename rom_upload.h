@@ -0,0 +1,21 @@
+/*
+ * rom_upload.h
+ * Block based upload of Kickstart and other ROM images into the memory
+ * of the Minimig core
+ *
+ */
+
+#ifndef ROM_UPLOAD_H
+#define ROM_UPLOAD_H
+
+#include <stdint.h>
+#include "FatFs/ff.h"
+
+// size of the Amiga Forever header in front of encrypted ROMs
+#define ROM_KEY_HEADER_SIZE 0xb
+
+void rom_decrypt(uint8_t *buf, uint32_t len, const uint8_t *key, uint32_t keysize, uint32_t *keyidx);
+void rom_upload(FIL *file, const uint8_t *key, uint32_t keysize, uint32_t address, uint32_t mirror, uint32_t sectors);
+void rom_clear(uint32_t address, uint32_t size);
+
+#endif // ROM_UPLOAD_H
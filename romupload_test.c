@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rom_upload.h"
+#include "misc_cfg.h"
+
+// Uploads Kickstart images like UploadKickstart() does, once with the
+// previous sector by sector code and once with rom_upload(), into a model
+// of the Minimig memory write path. Both memory images must be identical.
+// The SPI bytes, SPIN() delays and card reads of both are compared.
+
+#define MEM_SIZE 0x1000000
+
+// estimated costs for the benchmark
+#define SPI_BYTE_NS   500    // SPI() at 24MHz incl. status polling
+#define SPIN_NS       83     // 4 cycles at 48MHz
+#define CARD_CMD_NS   100000 // card command and data token wait
+#define CARD_SECT_NS  170000 // 512 bytes at 24MHz
+
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE] __attribute__ ((aligned(4)));
+minimig_cfg_t minimig_cfg;
+
+static uint8_t *mem, *mem_legacy, *mem_new;
+static uint8_t *romdata;
+static uint32_t errors;
+
+typedef struct {
+  uint32_t spi_bytes;
+  uint32_t spins;
+  uint32_t card_cmds;
+  uint32_t sectors;
+} counters_t;
+
+static counters_t cnt;
+
+// ---------- mocked OSD SPI and the memory write path of the core ----------
+static int osd_selected, osd_pos;
+static uint8_t osd_cmd;
+static uint32_t osd_adr;
+
+void EnableOsd(void) {
+  osd_selected = 1;
+  osd_pos = 0;
+}
+
+void DisableOsd(void) {
+  osd_selected = 0;
+}
+
+unsigned char SPI(unsigned char outByte) {
+  cnt.spi_bytes++;
+  if (!osd_selected) return 0xff;
+  if (osd_pos == 0) {
+    osd_cmd = outByte;
+    osd_adr = 0;
+  } else if (osd_pos < 5) {
+    osd_adr |= outByte << (8 * (osd_pos - 1));
+  } else if (osd_cmd == 0x1c) {
+    mem[osd_adr++ & (MEM_SIZE - 1)] = outByte;
+  }
+  osd_pos++;
+  return 0xff;
+}
+
+void spin(void) {
+  cnt.spins++;
+}
+
+void spi_osd_cmd32le_cont(unsigned char cmd, unsigned long parm) {
+  EnableOsd();
+  SPI(cmd);
+  SPI(parm >> 0);
+  SPI(parm >> 8);
+  SPI(parm >> 16);
+  SPI(parm >> 24);
+}
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+// ---------- mocked file access ----------
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+  UINT n = btr;
+
+  if (fp->fptr + n > f_size(fp)) n = f_size(fp) - fp->fptr;
+  memcpy(buff, romdata + fp->fptr, n);
+  // multi sector reads from a sector boundary, one command per sector otherwise
+  cnt.card_cmds += (fp->fptr & 511) ? (btr + 511) / 512 : 1;
+  cnt.sectors += (btr + 511) / 512;
+  fp->fptr += n;
+  *br = n;
+  return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs) {
+  fp->fptr = ofs;
+  return FR_OK;
+}
+
+FRESULT FileReadBlockEx(FIL *file, unsigned char *pBuffer, unsigned int len) {
+  UINT br;
+  return f_read(file, pBuffer, 512*len, &br);
+}
+
+static FRESULT FileReadBlock(FIL *file, unsigned char *pBuffer) {
+  UINT br;
+  return f_read(file, pBuffer, 512, &br);
+}
+
+// ---------- previous upload code ----------
+static void legacy_patch(void) {
+  if (strncmp((char*)sector_buffer + 0x18, "exec 33.192 (8 Oct 1986)", 24) &&
+      strncmp((char*)sector_buffer + 0x18, "exec 34.2 (28 Oct 1987)", 23))
+    return;
+  if ((sector_buffer[0x154] == 0x66) && (sector_buffer[0x155] == 0x78))
+    sector_buffer[0x154] = 0x60;
+}
+
+static void SendFileV2(FIL* file, unsigned char* key, int keysize, int address, int size) {
+  UINT br;
+  int i,j;
+  unsigned int keyidx=0;
+
+  if (keysize) {
+    // read header
+    f_read(file, sector_buffer, 0xb, &br);
+  }
+  for (i=0; i<size; i++) {
+    FileReadBlock(file, sector_buffer);
+    if (keysize) {
+      // decrypt ROM
+      for (j=0; j<512; j++) {
+        sector_buffer[j] ^= key[keyidx++];
+        if(keyidx >= keysize) keyidx -= keysize;
+      }
+    }
+
+    if (minimig_cfg.kick1x_memory_detection_patch && (i == 0 || i == 512))
+      legacy_patch();
+
+    EnableOsd();
+    unsigned int adr = address + i*512;
+    SPI(0x1c);
+    spin(); spin(); spin(); spin();
+    SPI(adr&0xff); adr = adr>>8;
+    SPI(adr&0xff); adr = adr>>8;
+    spin(); spin(); spin(); spin();
+    SPI(adr&0xff); adr = adr>>8;
+    SPI(adr&0xff); adr = adr>>8;
+    spin(); spin(); spin(); spin();
+    for (j=0; j<512; j=j+4) {
+      SPI(sector_buffer[j+0]);
+      SPI(sector_buffer[j+1]);
+      spin(); spin(); spin(); spin(); spin(); spin(); spin(); spin();
+      SPI(sector_buffer[j+2]);
+      SPI(sector_buffer[j+3]);
+      spin(); spin(); spin(); spin(); spin(); spin(); spin(); spin();
+    }
+    DisableOsd();
+  }
+}
+
+static void legacy_clear(uint32_t adr, uint32_t size) {
+  spi_osd_cmd32le_cont(0x1c, adr);
+  for (int i = 0; i < size / 4; i++) {
+    SPI(0x00);
+    SPI(0x00);
+    spin(); spin(); spin(); spin();
+    SPI(0x00);
+    SPI(0x00);
+    spin(); spin(); spin(); spin();
+  }
+  DisableOsd();
+  spin(); spin(); spin(); spin();
+}
+
+static void legacy_kickstart(FIL *f, uint8_t *key, uint32_t keysize) {
+  switch (f_size(f)) {
+    case 0x100000:
+      SendFileV2(f, NULL, 0, 0xe00000, f_size(f)>>10);
+      SendFileV2(f, NULL, 0, 0xf80000, f_size(f)>>10);
+      legacy_clear(0, 0x400);
+      break;
+    case 0x80000:
+    case 0x8000b:
+      SendFileV2(f, key, keysize, 0xf80000, f_size(f)>>9);
+      f_rewind(f);
+      SendFileV2(f, key, keysize, 0xe00000, f_size(f)>>9);
+      legacy_clear(0, 0x400);
+      break;
+    case 0x40000:
+    case 0x4000b:
+      SendFileV2(f, key, keysize, 0xf80000, f_size(f)>>9);
+      f_rewind(f);
+      SendFileV2(f, key, keysize, 0xfc0000, f_size(f)>>9);
+      legacy_clear(0, 0x400);
+      legacy_clear(0xe00000, 0x80000);
+      break;
+  }
+}
+
+// ---------- new upload code, as used by UploadKickstart() ----------
+static void new_kickstart(FIL *f, uint8_t *key, uint32_t keysize) {
+  switch (f_size(f)) {
+    case 0x100000:
+      rom_upload(f, NULL, 0, 0xe00000, 0, f_size(f)>>10);
+      rom_upload(f, NULL, 0, 0xf80000, 0, f_size(f)>>10);
+      rom_clear(0, 0x400);
+      break;
+    case 0x80000:
+    case 0x8000b:
+      rom_upload(f, key, keysize, 0xf80000, 0xe00000, f_size(f)>>9);
+      rom_clear(0, 0x400);
+      break;
+    case 0x40000:
+    case 0x4000b:
+      rom_upload(f, key, keysize, 0xf80000, 0xfc0000, f_size(f)>>9);
+      rom_clear(0, 0x400);
+      rom_clear(0xe00000, 0x80000);
+      break;
+  }
+}
+
+static uint64_t est_ns(const counters_t *c) {
+  return (uint64_t)c->spi_bytes * SPI_BYTE_NS + (uint64_t)c->spins * SPIN_NS +
+         (uint64_t)c->card_cmds * CARD_CMD_NS + (uint64_t)c->sectors * CARD_SECT_NS;
+}
+
+static void test_kickstart(const char *name, uint32_t size, uint32_t keysize, int kick1x) {
+  static uint8_t key[SECTOR_BUFFER_SIZE];
+  uint8_t *romkey = NULL;
+  counters_t c_legacy, c_new;
+  FIL f;
+  uint32_t i;
+
+  srand(size + keysize);
+  romdata = malloc(size);
+  for (i = 0; i < size; i++) romdata[i] = rand();
+  for (i = 0; i < keysize; i++) key[i] = rand();
+  if (kick1x) {
+    uint32_t hdr = keysize ? ROM_KEY_HEADER_SIZE : 0;
+    const char *exec = "exec 34.2 (28 Oct 1987)";
+    for (i = 0; i < strlen(exec); i++) romdata[hdr + 0x18 + i] = exec[i] ^ (keysize ? key[0x18 + i] : 0);
+    romdata[hdr + 0x154] = 0x66 ^ (keysize ? key[0x154] : 0);
+    romdata[hdr + 0x155] = 0x78 ^ (keysize ? key[0x155] : 0);
+  }
+  minimig_cfg.kick1x_memory_detection_patch = kick1x;
+
+  memset(&f, 0, sizeof(f));
+  f.obj.objsize = size;
+
+  memset(mem_legacy, 0xa5, MEM_SIZE);
+  mem = mem_legacy;
+  memset(&cnt, 0, sizeof(cnt));
+  legacy_kickstart(&f, key, keysize);
+  c_legacy = cnt;
+
+  // the key is kept at the end of the sector buffer like UploadKickstart() does
+  if (keysize) {
+    romkey = sector_buffer + ((SECTOR_BUFFER_SIZE - keysize) & ~511);
+    memcpy(romkey, key, keysize);
+  }
+  f_rewind(&f);
+  memset(mem_new, 0xa5, MEM_SIZE);
+  mem = mem_new;
+  memset(&cnt, 0, sizeof(cnt));
+  new_kickstart(&f, romkey, keysize);
+  c_new = cnt;
+
+  if (kick1x && mem_new[0xf80154] != 0x60) {
+    printf("%s: kickstart 1.x not patched\n", name);
+    errors++;
+  }
+  if (memcmp(mem_legacy, mem_new, MEM_SIZE)) {
+    for (i = 0; i < MEM_SIZE && mem_legacy[i] == mem_new[i]; i++);
+    printf("%s: memory differs at %06x\n", name, i);
+    errors++;
+  }
+  if (c_new.sectors > c_legacy.sectors || c_new.card_cmds > c_legacy.card_cmds ||
+      c_new.spi_bytes > c_legacy.spi_bytes || c_new.spins > c_legacy.spins) {
+    printf("%s: more work than before\n", name);
+    errors++;
+  }
+
+  printf("%-22s spi %8u/%8u spin %9u/%9u card cmds %5u/%5u sectors %5u/%5u est. %5u/%5u ms\n", name,
+         c_legacy.spi_bytes, c_new.spi_bytes, c_legacy.spins, c_new.spins,
+         c_legacy.card_cmds, c_new.card_cmds, c_legacy.sectors, c_new.sectors,
+         (unsigned)(est_ns(&c_legacy) / 1000000), (unsigned)(est_ns(&c_new) / 1000000));
+  free(romdata);
+}
+
+// word wise decryption against the byte wise one, all alignments
+static void test_decrypt() {
+  static uint8_t key[1100] __attribute__ ((aligned(4)));
+  static uint8_t buf[2100] __attribute__ ((aligned(4)));
+  static uint8_t ref[2100];
+  static const uint32_t keysizes[] = { 1, 2, 3, 4, 5, 7, 64, 511, 1024, 1061 };
+  uint32_t k, off, len, i;
+
+  for (i = 0; i < sizeof(key); i++) key[i] = rand();
+  for (k = 0; k < sizeof(keysizes)/sizeof(keysizes[0]); k++) {
+    uint32_t keysize = keysizes[k];
+    // a copy without room behind it, for reads past the key with -fsanitize=address
+    uint8_t *exact = malloc(keysize);
+
+    memcpy(exact, key, keysize);
+    for (off = 0; off < 4; off++) {
+      for (len = 0; len < 2048; len += 1 + len / 3) {
+        uint32_t keyidx = (len * 7 + off) % keysize, refidx = keyidx;
+        for (i = 0; i < len; i++) buf[off + i] = ref[off + i] = rand();
+        for (i = 0; i < len; i++) {
+          ref[off + i] ^= key[refidx++];
+          if (refidx >= keysize) refidx -= keysize;
+        }
+        rom_decrypt(buf + off, len, exact, keysize, &keyidx);
+        if (memcmp(buf + off, ref + off, len) || keyidx != refidx) {
+          printf("decrypt: keysize %u offset %u len %u differs\n", keysize, off, len);
+          errors++;
+          free(exact);
+          return;
+        }
+      }
+    }
+    free(exact);
+  }
+}
+
+int main() {
+  mem_legacy = malloc(MEM_SIZE);
+  mem_new = malloc(MEM_SIZE);
+
+  test_decrypt();
+
+  printf("legacy/new\n");
+  test_kickstart("1MB", 0x100000, 0, 0);
+  test_kickstart("512KB", 0x80000, 0, 0);
+  test_kickstart("512KB encrypted", 0x8000b, 1061, 0);
+  test_kickstart("256KB", 0x40000, 0, 0);
+  test_kickstart("256KB encrypted", 0x4000b, 1061, 0);
+  test_kickstart("256KB kick 1.3", 0x40000, 0, 1);
+  test_kickstart("256KB kick 1.3 encr.", 0x4000b, 1061, 1);
+  test_kickstart("256KB small key", 0x4000b, 5, 0);
+
+  free(mem_legacy);
+  free(mem_new);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+// savesync.c
+// Incremental writing of save files (battery RAM, flash of cartridges).
+// A CRC of every sector of the last save is kept, a new save received
+// from the core is compared with it while it comes in and only the changed
+// sectors are written. Changed sectors next to each other are collected in
+// the sector buffer and written with one f_write(), the data is received
+// right behind such a pending run. The hashes of a file not seen before,
+// or of another SD card, are read from the file first: reading costs no
+// wear and is faster than writing all of it.
+
+#include <string.h>
+#include "savesync.h"
+#include "fat_compat.h"
+#include "crc32.h"
+
+savesync_stats_t savesync_stats;
+
+static uint32_t hashes[SAVESYNC_MAX_SECTORS];
+
+// the file the hashes belong to
+static struct {
+  WORD     id;       // mount of the file system
+  DWORD    sclust;
+  uint32_t len;
+  uint32_t known;    // sectors with a hash
+} key;
+
+static struct {
+  FIL         *file;
+  uint32_t     len;
+  uint32_t     pos;      // bytes received
+  uint32_t     run_pos;  // file offset of the pending run
+  unsigned int run_ofs;  // and its place in the sector buffer
+  unsigned int run_len;
+  FRESULT      res;
+} save;
+
+void savesync_forget(void) {
+  key.len = 0;
+  key.known = 0;
+}
+
+static uint32_t hash(const unsigned char *p, unsigned int n) {
+  return crc32_update(CRC32_INIT, p, n);
+}
+
+// the hashes of the sectors completely in the file
+static FRESULT read_hashes(FIL *file, uint32_t len) {
+  uint32_t size = (f_size(file) < len) ? f_size(file) : len;
+  uint32_t pos = 0;
+  UINT br;
+
+  savesync_forget();
+  if (f_lseek(file, 0) != FR_OK) return FR_DISK_ERR;
+  while (pos < size && (pos >> 9) < SAVESYNC_MAX_SECTORS) {
+    unsigned int i, n = (size - pos > SECTOR_BUFFER_SIZE) ? SECTOR_BUFFER_SIZE : size - pos;
+    if (f_read(file, sector_buffer, n, &br) != FR_OK || br != n) return FR_DISK_ERR;
+    for (i = 0; i < n && key.known < SAVESYNC_MAX_SECTORS; i += 512) {
+      // a part of the last sector only counts if it is the end of the save
+      if (n - i < 512 && pos + n != len) break;
+      hashes[key.known++] = hash(sector_buffer + i, (n - i < 512) ? n - i : 512);
+    }
+    pos += n;
+  }
+  return FR_OK;
+}
+
+FRESULT savesync_start(FIL *file, uint32_t len) {
+  memset(&save, 0, sizeof(save));
+  save.file = file;
+  save.len = len;
+  if (key.id != file->obj.fs->id || key.sclust != file->obj.sclust || key.len != len || !key.len)
+    save.res = read_hashes(file, len);
+  return save.res;
+}
+
+unsigned char *savesync_buffer(unsigned int *len) {
+  if (*len > SECTOR_BUFFER_SIZE - save.run_len) *len = SECTOR_BUFFER_SIZE - save.run_len;
+  return sector_buffer + save.run_len;
+}
+
+FRESULT savesync_flush(void) {
+  UINT bw;
+
+  if (!save.run_len) return save.res;
+  if (f_lseek(save.file, save.run_pos) != FR_OK ||
+      f_write(save.file, sector_buffer + save.run_ofs, save.run_len, &bw) != FR_OK || bw != save.run_len) {
+    save.res = FR_DISK_ERR;
+  }
+  savesync_stats.written += (save.run_len + 511) >> 9;
+  savesync_stats.writes++;
+  save.run_len = save.run_ofs = 0;
+  return save.res;
+}
+
+FRESULT savesync_data(unsigned int len) {
+  unsigned int o = save.run_len, end = save.run_len + len;
+
+  while (o < end) {
+    unsigned int n = (end - o > 512) ? 512 : end - o;
+    uint32_t s = save.pos >> 9;
+    uint32_t h = hash(sector_buffer + o, n);
+
+    if (s >= key.known || hashes[s] != h) {
+      if (s < SAVESYNC_MAX_SECTORS) hashes[s] = h;
+      if (!save.run_len) {
+        save.run_ofs = o;
+        save.run_pos = save.pos;
+      }
+      save.run_len += n;
+    } else {
+      savesync_flush();
+    }
+    savesync_stats.sectors++;
+    save.pos += n;
+    o += n;
+  }
+  // the next data is received behind the run
+  if (save.run_ofs) {
+    memmove(sector_buffer, sector_buffer + save.run_ofs, save.run_len);
+    save.run_ofs = 0;
+  }
+  if (save.run_len == SECTOR_BUFFER_SIZE) savesync_flush();
+  return save.res;
+}
+
+FRESULT savesync_done(void) {
+  uint32_t sectors = (save.len + 511) >> 9;
+
+  savesync_flush();
+  if (save.res == FR_OK && save.pos == save.len) {
+    key.id = save.file->obj.fs->id;
+    key.sclust = save.file->obj.sclust;
+    key.len = save.len;
+    key.known = (sectors < SAVESYNC_MAX_SECTORS) ? sectors : SAVESYNC_MAX_SECTORS;
+  } else {
+    savesync_forget();
+  }
+  return save.res;
+}
@@ -0,0 +1,40 @@
+/*
+ * savesync.h
+ * Save files written back sector by sector, only where they changed
+ *
+ */
+
+#ifndef SAVESYNC_H
+#define SAVESYNC_H
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+// sectors of a save with a hash, the ones behind are always written
+#ifndef SAVESYNC_MAX_SECTORS
+#define SAVESYNC_MAX_SECTORS  256
+#endif
+
+typedef struct {
+  uint32_t sectors;   // received
+  uint32_t written;   // sectors written to the file
+  uint32_t writes;    // f_write() calls for them
+} savesync_stats_t;
+
+extern savesync_stats_t savesync_stats;
+
+// starts a save of len bytes to file. The hashes of the file are read
+// first unless they are known from the last save of the same file
+FRESULT savesync_start(FIL *file, uint32_t len);
+// where to receive the next data, *len is reduced to the space left there
+unsigned char *savesync_buffer(unsigned int *len);
+// len bytes were received, the changed sectors are collected and written
+// in runs. The sector buffer holds a pending run between the calls
+FRESULT savesync_data(unsigned int len);
+// writes the pending run, the sector buffer can be used again
+FRESULT savesync_flush(void);
+FRESULT savesync_done(void);
+// the next save reads the hashes from the file again
+void savesync_forget(void);
+
+#endif // SAVESYNC_H
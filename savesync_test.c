@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "savesync.h"
+#include "fat_compat.h"
+
+// Saves a synthetic battery RAM to a FAT16 RAM disk with the real FatFs
+// the way data_io_file_rx() does: received in 2k pieces, diffed against
+// the hashes of the last save and written in runs. Every cycle changes a
+// few bytes, like a game updating its save slot and checksum. The file is
+// compared with the RAM after each save and the sector writes of the card
+// are counted against rewriting the whole file.
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+
+static uint8_t *disk;
+static unsigned long sectors_written, write_cmds, sectors_read;
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  memcpy(buf, disk + lba * 512, n * 512);
+  sectors_read += n;
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  memcpy(disk + lba * 512, buf, n * 512);
+  sectors_written += n;
+  write_cmds++;
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void format() {
+  uint8_t *b = disk;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(disk + 512, 0xfff8);
+  put16(disk + 514, 0xffff);
+  memcpy(disk + (1 + FAT_SECTORS) * 512, disk + 512, FAT_SECTORS * 512);
+}
+
+// ---------- saves ----------
+// the receive loop of data_io_file_rx(), the core sends ram
+static void save(const char *name, const uint8_t *ram, uint32_t len) {
+  uint32_t left = len;
+  FIL f;
+
+  CHECK(f_open(&f, name, FA_READ | FA_WRITE | FA_OPEN_ALWAYS) == FR_OK);
+  CHECK(savesync_start(&f, len) == FR_OK);
+  while (left) {
+    unsigned int chunk = (left > 2048) ? 2048 : left;
+    unsigned char *p = savesync_buffer(&chunk);
+    memcpy(p, ram + len - left, chunk);
+    left -= chunk;
+    CHECK(savesync_data(chunk) == FR_OK);
+  }
+  CHECK(savesync_done() == FR_OK);
+  CHECK(f_close(&f) == FR_OK);
+}
+
+// the old way
+static void save_full(const char *name, const uint8_t *ram, uint32_t len) {
+  uint32_t left = len;
+  UINT bw;
+  FIL f;
+
+  CHECK(f_open(&f, name, FA_READ | FA_WRITE | FA_OPEN_ALWAYS) == FR_OK);
+  while (left) {
+    unsigned int chunk = (left > 2048) ? 2048 : left;
+    memcpy(sector_buffer, ram + len - left, chunk);
+    CHECK(f_write(&f, sector_buffer, chunk, &bw) == FR_OK && bw == chunk);
+    left -= chunk;
+  }
+  CHECK(f_close(&f) == FR_OK);
+}
+
+static void check_file(const char *name, const uint8_t *ram, uint32_t len) {
+  uint8_t *buf = malloc(len + 1);
+  UINT br;
+  FIL f;
+
+  CHECK(f_open(&f, name, FA_READ) == FR_OK);
+  CHECK(f_size(&f) >= len);
+  CHECK(f_read(&f, buf, len, &br) == FR_OK && br == len);
+  CHECK(!memcmp(buf, ram, len));
+  f_close(&f);
+  free(buf);
+}
+
+// a game changes its slot and the checksum at the end of it
+static void mutate(uint8_t *ram, uint32_t len) {
+  uint32_t slot = (rand() % 3) * (len / 3);
+  unsigned int i, n = 1 + rand() % 4;
+
+  for (i = 0; i < n; i++) ram[slot + rand() % 1024] ^= 1 + rand() % 255;
+  ram[slot + len / 3 - 1]++;
+}
+
+static void test_cycles(const char *label, uint32_t len, unsigned int cycles) {
+  uint8_t *ram = malloc(len);
+  unsigned long w, c, full_w = 0, full_c = 0, inc_w = 0, inc_c = 0;
+  uint32_t i, uncovered = (len / 512 > SAVESYNC_MAX_SECTORS) ? len / 512 - SAVESYNC_MAX_SECTORS : 0;
+
+  for (i = 0; i < len; i++) ram[i] = (i & 0x100) ? 0 : rand();
+
+  // first save of a new file, everything is written
+  savesync_stats.written = 0;
+  save("SAVE.RAM", ram, len);
+  CHECK(savesync_stats.written == (len + 511) / 512);
+  check_file("SAVE.RAM", ram, len);
+  // unchanged, nothing but the directory entry
+  savesync_stats.written = 0;
+  save("SAVE.RAM", ram, len);
+  CHECK(savesync_stats.written == uncovered);
+
+  for (i = 0; i < cycles; i++) {
+    mutate(ram, len);
+
+    w = sectors_written; c = write_cmds;
+    save_full("FULL.RAM", ram, len);
+    full_w += sectors_written - w;
+    full_c += write_cmds - c;
+
+    w = sectors_written; c = write_cmds;
+    savesync_stats.written = 0;
+    save("SAVE.RAM", ram, len);
+    inc_w += sectors_written - w;
+    inc_c += write_cmds - c;
+    // the slot data is in 3 sectors at most, the checksum in one
+    CHECK(savesync_stats.written <= 4 + uncovered);
+    check_file("SAVE.RAM", ram, len);
+  }
+  check_file("FULL.RAM", ram, len);
+  printf("  %-18s %7lu bytes: %7.1f sectors / %5.1f writes per save, full rewrite %7.1f / %5.1f\n",
+         label, (unsigned long)len, (double)inc_w / cycles, (double)inc_c / cycles,
+         (double)full_w / cycles, (double)full_c / cycles);
+  CHECK(inc_w < full_w);
+  free(ram);
+}
+
+// changed areas longer than the sector buffer and across the receive pieces
+static void test_runs() {
+  static uint8_t ram[65536];
+  uint32_t i;
+
+  for (i = 0; i < sizeof(ram); i++) ram[i] = rand();
+  save("RUNS.RAM", ram, sizeof(ram));
+
+  // 10k from the middle of a piece
+  for (i = 1000; i < 11240; i++) ram[i]++;
+  savesync_stats.written = savesync_stats.writes = 0;
+  save("RUNS.RAM", ram, sizeof(ram));
+  check_file("RUNS.RAM", ram, sizeof(ram));
+  CHECK(savesync_stats.written == 11240 / 512 - 1000 / 512 + 1);
+  CHECK(savesync_stats.writes <= savesync_stats.written * 512 / SECTOR_BUFFER_SIZE + 2);
+
+  // every other sector
+  for (i = 0; i < sizeof(ram); i += 1024) ram[i]++;
+  savesync_stats.written = savesync_stats.writes = 0;
+  save("RUNS.RAM", ram, sizeof(ram));
+  check_file("RUNS.RAM", ram, sizeof(ram));
+  CHECK(savesync_stats.written == sizeof(ram) / 1024);
+  CHECK(savesync_stats.writes == sizeof(ram) / 1024);
+
+  // the last sector and the first one of the next piece
+  ram[2047]++;
+  ram[2048]++;
+  savesync_stats.written = savesync_stats.writes = 0;
+  save("RUNS.RAM", ram, sizeof(ram));
+  check_file("RUNS.RAM", ram, sizeof(ram));
+  CHECK(savesync_stats.written == 2 && savesync_stats.writes == 1);
+}
+
+// the hashes are read from the file when they aren't known
+static void test_reread() {
+  static uint8_t ram[32768], other[32768];
+  unsigned long r;
+  uint32_t i;
+
+  for (i = 0; i < sizeof(ram); i++) ram[i] = other[i] = rand();
+  other[5000]++;
+  save("A.RAM", ram, sizeof(ram));
+  save("B.RAM", other, sizeof(other));
+
+  // another file of the same size: read, one sector differs
+  other[5000]--;
+  savesync_stats.written = 0;
+  r = sectors_read;
+  save("A.RAM", other, sizeof(other));
+  CHECK(sectors_read - r >= sizeof(ram) / 512);
+  CHECK(savesync_stats.written == 0);
+
+  ram[20000]++;
+  savesync_forget();
+  savesync_stats.written = 0;
+  save("A.RAM", ram, sizeof(ram));
+  CHECK(savesync_stats.written == 1);
+  check_file("A.RAM", ram, sizeof(ram));
+
+  // the file is shorter than the save, the rest is written
+  save_full("SHORT.RAM", ram, 10000);
+  savesync_stats.written = 0;
+  save("SHORT.RAM", ram, sizeof(ram));
+  CHECK(savesync_stats.written == sizeof(ram) / 512 - 10000 / 512);
+  check_file("SHORT.RAM", ram, sizeof(ram));
+
+  // odd sizes, like the 256 bytes of a CMOS
+  save("CMOS.RAM", ram, 256);
+  ram[10]++;
+  savesync_stats.written = 0;
+  save("CMOS.RAM", ram, 256);
+  CHECK(savesync_stats.written == 1);
+  savesync_forget();
+  savesync_stats.written = 0;
+  save("CMOS.RAM", ram, 256);
+  CHECK(savesync_stats.written == 0);
+  check_file("CMOS.RAM", ram, 256);
+
+  save("ODD.RAM", ram, 1000);
+  ram[900]++;
+  savesync_forget();
+  savesync_stats.written = 0;
+  save("ODD.RAM", ram, 1000);
+  CHECK(savesync_stats.written == 1);
+  check_file("ODD.RAM", ram, 1000);
+
+  // a new mount
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+  savesync_stats.written = 0;
+  r = sectors_read;
+  save("ODD.RAM", ram, 1000);
+  CHECK(sectors_read > r);
+  CHECK(savesync_stats.written == 0);
+}
+
+int main(int argc, char **argv) {
+  disk = calloc(DISK_SECTORS, 512);
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+
+  printf("Save sync, %d sectors with hashes:\n", SAVESYNC_MAX_SECTORS);
+  test_cycles("SRAM 8k", 8192, 100);
+  test_cycles("SRAM 32k", 32768, 100);
+  test_cycles("SRAM 128k", 131072, 100);
+  // more than the hashes cover, the rest is always written
+  test_cycles("flash 512k", 524288, 20);
+  test_runs();
+  test_reread();
+
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,134 @@
+// sched.c
+// Cooperative scheduler for the main loop. Every pass runs the due
+// critical tasks and then the due normal task with the earliest
+// deadline, so a slow menu redraw delays the storage and input servicing
+// by at most one task run. Long loops like the directory scan or the
+// core configuration call sched_yield() to run the critical tasks in
+// between.
+
+#include <string.h>
+#include "sched.h"
+#include "prof.h"
+#include "timer.h"
+#ifdef SCHED_TEST
+int iprintf(const char *fmt, ...);
+#else
+#include <stdio.h>
+#endif
+
+static sched_task_t tasks[SCHED_TASKS_MAX];
+static char ntasks;
+static char in_yield;
+static char in_run;
+
+void sched_init() {
+	memset(tasks, 0, sizeof(tasks));
+	ntasks = 0;
+	in_yield = in_run = 0;
+}
+
+// returns the task id or -1 if the table is full
+char sched_add(const char *name, sched_func_t func, uint8_t prio, uint8_t needs, uint16_t period) {
+	sched_task_t *t;
+
+	if(ntasks >= SCHED_TASKS_MAX) return -1;
+	t = &tasks[ntasks];
+	t->name = name;
+	t->func = func;
+	t->prio = prio;
+	t->needs = needs;
+	t->period = period;
+	t->deadline = timer_get_msec();
+#ifdef PROFILING
+	t->probe = prof_add(name);
+#else
+	t->probe = -1;
+#endif
+	return ntasks++;
+}
+
+static void sched_run_task(sched_task_t *t, msec_t now) {
+	msec_t end;
+
+	if(!timer_check(t->deadline, 0)) return;  // not due yet
+	if(now - t->deadline > t->max_latency) t->max_latency = now - t->deadline;
+
+	PROF_START(prof);
+	t->running = 1;
+	t->func();
+	t->running = 0;
+	PROF_END(t->probe, prof);
+	t->runs++;
+
+	end = timer_get_msec();
+	if(end - now > t->max_runtime) t->max_runtime = end - now;
+	// periodic tasks keep their rate, the others are due again right away
+	if(!t->period) {
+		t->deadline = end;
+	} else {
+		t->deadline += t->period;
+		// more than a period behind, don't try to catch up
+		if((int32_t)(end - t->deadline) >= t->period) t->deadline = end;
+	}
+}
+
+// one pass of the main loop
+void sched_run() {
+	sched_task_t *t, *next = 0;
+	char i;
+
+	in_run = 1;
+	for(i = 0; i < ntasks; i++) {
+		t = &tasks[i];
+		if(t->prio == SCHED_CRITICAL) {
+			sched_run_task(t, timer_get_msec());
+		} else if(timer_check(t->deadline, 0)) {
+			if(!next || (int32_t)(t->deadline - next->deadline) < 0)
+				next = t;
+		}
+	}
+	if(next) sched_run_task(next, timer_get_msec());
+	in_run = 0;
+}
+
+// called from long running loops, runs the due critical tasks which don't
+// need any of the busy resources
+void sched_yield(uint8_t busy) {
+	sched_task_t *t;
+	char i;
+
+	// not from the init code and not recursively
+	if(!in_run || in_yield) return;
+
+	in_yield = 1;
+	for(i = 0; i < ntasks; i++) {
+		t = &tasks[i];
+		if(t->prio != SCHED_CRITICAL || t->running || (t->needs & busy)) continue;
+		if(timer_check(t->deadline, 0)) {
+			sched_run_task(t, timer_get_msec());
+			t->yield_runs++;
+		}
+	}
+	in_yield = 0;
+}
+
+void sched_reset_stats() {
+	char i;
+	for(i = 0; i < ntasks; i++) {
+		tasks[i].runs = tasks[i].yield_runs = 0;
+		tasks[i].max_latency = tasks[i].max_runtime = 0;
+	}
+}
+
+const sched_task_t *sched_get_task(char id) {
+	if(id < 0 || id >= ntasks) return 0;
+	return &tasks[id];
+}
+
+void sched_dump() {
+	char i;
+	iprintf("task       prio  runs  yield  latency  runtime\n");
+	for(i = 0; i < ntasks; i++)
+		iprintf("%-10s %4d %5lu %6lu %6lums %6lums\n", tasks[i].name, tasks[i].prio,
+		        tasks[i].runs, tasks[i].yield_runs, tasks[i].max_latency, tasks[i].max_runtime);
+}
@@ -0,0 +1,51 @@
+/*
+ * sched.h
+ * Cooperative scheduler for the main loop. Tasks have a priority class,
+ * a period and a deadline. Critical tasks (storage and input servicing)
+ * run in every pass and from the yield points of long running tasks, the
+ * normal ones take turns by deadline.
+ *
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#ifndef SCHED_TASKS_MAX
+#define SCHED_TASKS_MAX 10
+#endif
+
+// priority classes
+#define SCHED_CRITICAL 0  // run in every pass and from yield points
+#define SCHED_NORMAL   1  // one per pass, earliest deadline first
+
+// resources a task needs, a yield point passes the ones in use
+#define SCHED_CORE     0x01  // talks to the core over SPI
+
+typedef void (*sched_func_t)(void);
+
+typedef struct {
+	const char *name;
+	sched_func_t func;
+	uint8_t prio;
+	uint8_t needs;
+	uint16_t period;       // ms between runs, 0 = as often as possible
+	uint32_t deadline;     // time the task is due next
+	uint32_t runs;
+	uint32_t yield_runs;   // runs from yield points
+	uint32_t max_latency;  // ms between the deadline and the start
+	uint32_t max_runtime;  // ms
+	char running;
+	char probe;            // profiling probe id
+} sched_task_t;
+
+void sched_init();
+char sched_add(const char *name, sched_func_t func, uint8_t prio, uint8_t needs, uint16_t period);
+void sched_run();
+void sched_yield(uint8_t busy);
+void sched_reset_stats();
+const sched_task_t *sched_get_task(char id);
+void sched_dump();
+
+#endif // SCHED_H
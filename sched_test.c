@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "sched.h"
+#include "timer.h"
+
+// Simulates the main loop tasks on a virtual clock, once with the former
+// fixed round-robin loop and once with the scheduler. Requests of the
+// core (SD card emulation), the USB input and the USB storage host arrive
+// at random times, the report shows how long they waited.
+
+#define SIM_TIME    20000000   // us
+#define UI_PERIOD   700000     // a menu action every 700ms
+#define CORE_LOAD   5000000    // a new core is loaded once after 5s
+
+static uint32_t now_us;
+
+msec_t timer_get_msec() {
+	return now_us / 1000;
+}
+
+bool timer_check(msec_t ref, msec_t delay) {
+	return (timer_get_msec() - ref) >= delay;
+}
+
+int iprintf(const char *fmt, ...) {
+	va_list arg;
+	int r;
+	va_start(arg, fmt);
+	r = vprintf(fmt, arg);
+	va_end(arg);
+	return r;
+}
+
+// a stream of requests arriving at random intervals
+typedef struct {
+	const char *name;
+	uint32_t interval;  // mean time between requests in us
+	uint32_t cost;      // us to serve one
+	uint32_t next;      // arrival of the next request
+	uint32_t count;
+	uint32_t max_wait;
+	uint64_t sum_wait;
+} source_t;
+
+static source_t sd  = { "sd (core)",    3000, 300 };
+static source_t hid = { "usb input",    8000,  50 };
+static source_t msc = { "usb storage",  5000, 400 };
+
+static bool core_loading, core_loaded;
+
+static void source_reset(source_t *s) {
+	s->next = rand() % (2*s->interval);
+	s->count = s->max_wait = 0;
+	s->sum_wait = 0;
+}
+
+// serve all requests which have arrived
+static void source_serve(source_t *s) {
+	while(s->next <= now_us) {
+		uint32_t wait = now_us - s->next;
+		if(wait > s->max_wait) s->max_wait = wait;
+		s->sum_wait += wait;
+		s->count++;
+		now_us += s->cost;
+		s->next += 1 + rand() % (2*s->interval);
+	}
+	now_us += 5;  // polling overhead
+}
+
+static void sd_poll()  { if(!core_loading) source_serve(&sd); else now_us += 5; }
+static void usb_poll() { if(!core_loading) source_serve(&hid); else now_us += 5; }
+static void msc_poll() { source_serve(&msc); }
+static void eth_poll() { now_us += 100; }
+static void cdc_poll() { now_us += 10; }
+
+static uint32_t next_ui = UI_PERIOD;
+static int ui_action;
+
+// every UI_PERIOD the menu either redraws, scans a large directory or loads a core
+static void ui_poll() {
+	int i;
+
+	now_us += 20;
+	if(now_us < next_ui) return;
+	next_ui += UI_PERIOD;
+
+	switch(ui_action++ % 3) {
+		case 0:
+			// OSD redraw, no yield point
+			now_us += 40000;
+			break;
+		case 1:
+			// directory scan of 800 entries, yields every 16 entries
+			for(i = 0; i < 800; i++) {
+				now_us += 300;
+				if(!((i+1) & 15)) sched_yield(0);
+			}
+			break;
+		case 2:
+			if(now_us < CORE_LOAD || core_loaded) break;
+			// core configuration, 3MB in 8kB chunks
+			core_loading = true;
+			for(i = 0; i < 3*1024*1024/8192; i++) {
+				sched_yield(SCHED_CORE);
+				now_us += 1500;
+			}
+			core_loading = false;
+			core_loaded = true;
+			// the new core starts without pending requests
+			sd.next = now_us + rand() % (2*sd.interval);
+			hid.next = now_us + rand() % (2*hid.interval);
+			break;
+	}
+}
+
+static void reset() {
+	srand(1);
+	now_us = 0;
+	next_ui = UI_PERIOD;
+	ui_action = 0;
+	core_loading = core_loaded = false;
+	source_reset(&sd);
+	source_reset(&hid);
+	source_reset(&msc);
+}
+
+static void report(const char *title) {
+	source_t *s[] = { &sd, &hid, &msc };
+	int i;
+
+	printf("%s\n", title);
+	for(i = 0; i < 3; i++)
+		printf("  %-12s %6u requests, wait avg %6.2fms max %7.2fms\n", s[i]->name, s[i]->count,
+		       s[i]->count ? s[i]->sum_wait / 1000.0 / s[i]->count : 0, s[i]->max_wait / 1000.0);
+}
+
+int main() {
+	int errors = 0;
+	uint32_t rr_sd, rr_hid, rr_msc;
+
+	// the former main loop
+	reset();
+	while(now_us < SIM_TIME) {
+		cdc_poll();
+		msc_poll();
+		sd_poll();
+		usb_poll();
+		eth_poll();
+		ui_poll();
+	}
+	report("round-robin");
+	rr_sd = sd.max_wait; rr_hid = hid.max_wait; rr_msc = msc.max_wait;
+
+	reset();
+	sched_init();
+	sched_add("storage", msc_poll, SCHED_CRITICAL, 0, 0);
+	sched_add("user_io", sd_poll, SCHED_CRITICAL, SCHED_CORE, 0);
+	sched_add("usb", usb_poll, SCHED_CRITICAL, SCHED_CORE, 0);
+	sched_add("cdc", cdc_poll, SCHED_NORMAL, SCHED_CORE, 0);
+	sched_add("eth", eth_poll, SCHED_NORMAL, SCHED_CORE, 20);
+	sched_add("ui", ui_poll, SCHED_NORMAL, SCHED_CORE, 0);
+	while(now_us < SIM_TIME)
+		sched_run();
+	report("scheduler");
+	printf("\n");
+	sched_dump();
+	printf("\n");
+
+	// the directory scan doesn't delay the core and input requests anymore
+	if(sd.max_wait >= rr_sd / 4) { printf("sd latency not reduced\n"); errors++; }
+	if(hid.max_wait >= rr_hid / 4) { printf("usb input latency not reduced\n"); errors++; }
+	// the usb storage is also served while a core is loaded
+	if(msc.max_wait >= rr_msc / 4) { printf("usb storage latency not reduced\n"); errors++; }
+	// nothing needing the core ran while it was configured
+	if(sched_get_task(1)->yield_runs == 0) { printf("no yield runs\n"); errors++; }
+	if(sched_get_task(3)->yield_runs || sched_get_task(5)->yield_runs) { printf("normal task run from yield\n"); errors++; }
+
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
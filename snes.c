@@ -36,19 +36,14 @@ enum HeaderField {
 };
 
 // From Main_MiSTer/support/snes/snes.cpp
-static uint32_t score_header(FIL *file, uint32_t offset, uint32_t addr)
+static uint32_t score_header(snes_read_t read, void *ctx, uint32_t offset, uint32_t addr)
 {
 	int score = 0;
-	UINT br;
 	uint8_t *data = sector_buffer;
 
 	snes_debugf("Header address: %08x offset: %d", addr, offset);
 
-	if ((f_lseek(file, offset + addr) != FR_OK) ||
-	    (f_tell(file) != (offset + addr)) ||
-	    (f_read(file, data, 64, &br) != FR_OK)) {
-		return 0;
-	}
+	if (!read(ctx, offset + addr, data, 64)) return 0;
 
 	uint16_t resetvector = data[ResetVector] | (data[ResetVector + 1] << 8);
 	uint16_t checksum = data[Checksum] | (data[Checksum + 1] << 8);
@@ -61,8 +56,7 @@ static uint32_t score_header(FIL *file, uint32_t offset, uint32_t addr)
 	if (resetvector < 0x8000) return 0;
 
 	uint8_t resetop = 0;
-	if (f_lseek(file, ((addr & ~0x7fff) | (resetvector & 0x7fff)) + offset ) != FR_OK) return 0;
-	if (f_read(file, &resetop, 1, &br) != FR_OK) return 0;
+	read(ctx, ((addr & ~0x7fff) | (resetvector & 0x7fff)) + offset, &resetop, 1); // stays 0 past the end
 	//uint8_t resetop = data[(addr & ~0x7fff) | (resetvector & 0x7fff)];  //first opcode executed upon reset
 	uint8_t mapper = data[Mapper] & ~0x10;                      //mask off irrelevent FastROM-capable bit
 
@@ -136,17 +130,36 @@ static uint32_t score_header(FIL *file, uint32_t offset, uint32_t addr)
 	return score;
 }
 
-char snes_getromtype(FIL *file)
+static unsigned int file_read(void *ctx, uint32_t pos, uint8_t *buf, unsigned int len)
 {
-	uint32_t score_lo, score_hi, score_ex;
+	FIL *file = (FIL*)ctx;
 	UINT br;
-	FSIZE_t size = f_size(file);
-	FSIZE_t offset = size & 0x1ff;
 
-	score_lo = score_header(file, offset, (FSIZE_t) 0x007fc0);
-	score_hi = score_header(file, offset, (FSIZE_t) 0x00ffc0);
-	score_ex = score_header(file, offset, (FSIZE_t) 0x40ffc0);
+	if ((f_lseek(file, pos) != FR_OK) ||
+	    (f_tell(file) != pos) ||
+	    (f_read(file, buf, len, &br) != FR_OK)) {
+		return 0;
+	}
+	return br;
+}
+
+char snes_getromtype(FIL *file)
+{
+	char type = snes_romtype(file_read, file, f_size(file));
 	f_rewind(file);
+	return type;
+}
+
+char snes_romtype(snes_read_t read, void *ctx, uint32_t size)
+{
+	uint32_t score_lo, score_hi, score_ex;
+	uint32_t offset = size & 0x1ff;
+
+	// the reset opcode is in the 32k bank of the header, less than the
+	// inflate window back from it for compressed ROMs
+	score_lo = score_header(read, ctx, offset, 0x007fc0);
+	score_hi = score_header(read, ctx, offset, 0x00ffc0);
+	score_ex = score_header(read, ctx, offset, 0x40ffc0);
 
 	if (score_ex) score_ex += 4;  //favor ExHiROM on images > 32mbits
 	if (score_lo >= score_hi && score_lo >= score_ex) {
@@ -18,8 +18,14 @@
 #ifndef SNES_H
 #define SNES_H
 
+#include <stdint.h>
 #include "FatFs/ff.h"
 
+// reads up to len bytes of the ROM at pos, returns 0 if there are none
+typedef unsigned int (*snes_read_t)(void *ctx, uint32_t pos, uint8_t *buf, unsigned int len);
+
 char snes_getromtype(FIL *file);
+// the same for a ROM that is not a plain file
+char snes_romtype(snes_read_t read, void *ctx, uint32_t size);
 
 #endif // SNES_H
@@ -7,14 +7,37 @@
 #include <string.h>
 #include <stdio.h>
 
-#include "swab.h"
 #include "scsi.h"
 #include "utils.h"
 #include "storage_control.h"
 #include "fat_compat.h"
+#ifdef STORAGE_CONTROL_TEST
+#include "FatFs/diskio.h"
+#define swab32 __builtin_bswap32
+int iprintf(const char *fmt, ...);
+#define BULK_OUT_SIZE 512
+#define USB_STORAGE_BUFFER_SIZE 16384
+#undef DISKLED_ON
+#undef DISKLED_OFF
+#define DISKLED_ON
+#define DISKLED_OFF
+#define storage_debugf(...)
+uint8_t  usb_storage_is_configured(void);
+uint16_t usb_storage_write(const char *pData, uint16_t length);
+uint16_t usb_storage_read(char *pData, uint16_t length);
+uint8_t  usb_storage_write_start(const char *pData, uint32_t length);
+uint8_t  usb_storage_read_start(char *pData, uint32_t length);
+uint8_t  usb_storage_busy(void);
+void     usb_storage_abort(void);
+#else
+#include "swab.h"
 #include "usbdev.h"
 #include "FatFs/diskio.h"
 #include "debug.h"
+#endif
+
+// max. time to wait for the host during a data transfer
+#define STORAGE_USB_TIMEOUT 100
 
 typedef struct
 {
@@ -123,6 +146,100 @@ static void scsi_read_format_capacities(uint8_t *cmd) {
 	usb_storage_write((const char*) &dat, MIN(len, sizeof(FORMATCAPACITYDATA_t)));
 }
 
+#ifdef USB_STORAGE_ASYNC
+
+// The USB DMA sends/receives one buffer while the card reads/writes the other one
+#define STORAGE_BUFFER_BLOCKS (USB_STORAGE_BUFFER_SIZE/512)
+
+static uint8_t storage_buffer[2][USB_STORAGE_BUFFER_SIZE] __attribute__ ((aligned(32)));
+
+static uint8_t storage_wait_usb(uint32_t lba, uint16_t len) {
+	long to = GetTimer(STORAGE_USB_TIMEOUT);
+	while (usb_storage_busy()) {
+		if (CheckTimer(to)) {
+			usb_storage_abort();
+			iprintf("STORAGE: Timeout while waiting for USB host (lba=%d, len=%d)\n", lba, len);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static uint8_t storage_disk_read(uint8_t *buf, uint32_t lba, uint16_t count) {
+	uint8_t ret;
+	DISKLED_ON
+	ret = disk_read(fs.pdrv, buf, lba, count);
+	DISKLED_OFF
+	if (ret) iprintf("STORAGE: Error reading from MMC (lba=%d, len=%d)\n", lba, count);
+	return ret;
+}
+
+static uint8_t scsi_read(uint8_t *cmd) {
+	uint32_t lba = cmd[2]<<24 | cmd[3]<<16 | cmd[4]<<8 | cmd[5];
+	uint16_t len = cmd[7]<<8 | cmd[8];
+	uint16_t read, next;
+	uint8_t cur = 0;
+	storage_debugf("Read lba=%d len=%d", lba, len);
+
+	read = MIN(len, STORAGE_BUFFER_BLOCKS);
+	if (read && storage_disk_read(storage_buffer[cur], lba, read)) return 0;
+	while (len) {
+		// send this chunk while the next one is read from the card
+		if (!usb_storage_write_start(storage_buffer[cur], read*512)) {
+			iprintf("STORAGE: Can't send to USB host (lba=%d, len=%d)\n", lba, len);
+			return 0;
+		}
+		lba+=read;
+		len-=read;
+		next = MIN(len, STORAGE_BUFFER_BLOCKS);
+		if (next && storage_disk_read(storage_buffer[cur^1], lba, next)) {
+			storage_wait_usb(lba, len);
+			return 0;
+		}
+		if (!storage_wait_usb(lba, len)) return 0;
+		read = next;
+		cur ^= 1;
+	}
+	return 1;
+}
+
+static uint8_t scsi_write(uint8_t *cmd) {
+	uint32_t lba = cmd[2]<<24 | cmd[3]<<16 | cmd[4]<<8 | cmd[5];
+	uint16_t len = cmd[7]<<8 | cmd[8];
+	uint16_t write, next;
+	uint8_t cur = 0, ret;
+	storage_debugf("Write lba=%d len=%d", lba, len);
+
+	write = MIN(len, STORAGE_BUFFER_BLOCKS);
+	if (write && !usb_storage_read_start(storage_buffer[cur], write*512)) {
+		iprintf("STORAGE: Can't receive from USB host (lba=%d, len=%d)\n", lba, len);
+		return 0;
+	}
+	while (len) {
+		if (!storage_wait_usb(lba, len)) return 0;
+		// receive the next chunk while this one is written to the card
+		next = MIN(len-write, STORAGE_BUFFER_BLOCKS);
+		if (next && !usb_storage_read_start(storage_buffer[cur^1], next*512)) {
+			iprintf("STORAGE: Can't receive from USB host (lba=%d, len=%d)\n", lba, len);
+			return 0;
+		}
+		DISKLED_ON
+		ret = disk_write(fs.pdrv, storage_buffer[cur], lba, write);
+		DISKLED_OFF
+		if (ret) {
+			usb_storage_abort();
+			return 0;
+		}
+		lba+=write;
+		len-=write;
+		write = next;
+		cur ^= 1;
+	}
+	return 1;
+}
+
+#else
+
 static uint8_t scsi_read(uint8_t *cmd) {
 	uint32_t lba = cmd[2]<<24 | cmd[3]<<16 | cmd[4]<<8 | cmd[5];
 	uint16_t len = cmd[7]<<8 | cmd[8];
@@ -153,7 +270,7 @@ static uint8_t scsi_write(uint8_t *cmd) {
 		uint16_t write = MIN(len, SECTOR_BUFFER_SIZE/512);
 		uint16_t read, total_read = write*512;
 		uint8_t *buf = sector_buffer;
-		long to = GetTimer(100);  // wait max 100ms for host
+		long to = GetTimer(STORAGE_USB_TIMEOUT);  // wait for host
 		while (total_read) {
 			if (CheckTimer(to)) {
 				iprintf("STORAGE: Timeout while waiting for USB host during write (lba=%d, len=%d)\n", lba, len);
@@ -174,6 +291,8 @@ static uint8_t scsi_write(uint8_t *cmd) {
 	return 1;
 }
 
+#endif
+
 static void storage_control_send_csw(uint32_t tag, uint8_t status) {
 	CSW_t* csw = (CSW_t*)sector_buffer;
 	csw->dCSWSignature = 0x53425355;
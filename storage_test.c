@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "fat_compat.h"
+#include "FatFs/diskio.h"
+#include "dma_check.h"
+
+// Simulation of the card and both mass storage endpoints with a virtual
+// clock, to compare the blocking and the double buffered transfers. The
+// DMA buffers are mapped like the SAMV71 driver does, and the CPU touching
+// them before the transfer is done is reported.
+
+#define DISK_BLOCKS   (16*1024*1024/512)
+#define CMD_BLOCKS    128       // 64k per SCSI command, like most hosts use
+
+#define CARD_READ_MBS   20.0    // card throughput
+#define CARD_WRITE_MBS  12.0
+#define CARD_LATENCY_US 150.0   // per card command
+#define USB_MBS         40.0    // usable USB high speed bulk throughput
+
+void storage_control_poll(void);
+void storage_control_poll_sync(void);
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+
+static uint8_t *disk;
+static uint8_t *host_data;
+static uint32_t host_pos, host_len;
+static uint8_t cbw[31];
+static char cbw_pending;
+static int csw_status;
+static double now; // us
+
+// pending DMA transfer
+static uint8_t *dma_buf;
+static uint32_t dma_len;
+static char dma_in;
+static char dma_fail;  // the transfers can't be started, like without a configured host
+static double dma_end;
+
+int iprintf(const char *fmt, ...) {
+	va_list arg;
+	va_start(arg, fmt);
+	vprintf(fmt, arg);
+	va_end(arg);
+	return 0;
+}
+
+unsigned long GetTimer(unsigned long offset) { return (unsigned long)(now / 1000) + offset; }
+unsigned long CheckTimer(unsigned long t) { return (unsigned long)(now / 1000) > t; }
+int8_t fat_uses_mmc(void) { return 1; }
+char mmc_write_protected(void) { return 0; }
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff) {
+	*(DWORD*)buff = DISK_BLOCKS;
+	return RES_OK;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count) {
+	if (sector + count > DISK_BLOCKS) return RES_PARERR;
+	memcpy(buff, disk + sector*512, count*512);
+	now += CARD_LATENCY_US + count*512/CARD_READ_MBS;
+	return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count) {
+	if (sector + count > DISK_BLOCKS) return RES_PARERR;
+	memcpy(disk + sector*512, buff, count*512);
+	now += CARD_LATENCY_US + count*512/CARD_WRITE_MBS;
+	return RES_OK;
+}
+
+uint8_t usb_storage_is_configured(void) { return 1; }
+
+// blocking endpoint access, one packet at a time
+uint16_t usb_storage_read(char *pData, uint16_t length) {
+	if (cbw_pending) {
+		cbw_pending = 0;
+		memcpy(pData, cbw, sizeof(cbw));
+		return sizeof(cbw);
+	}
+	if (host_pos == host_len) return 0;
+	length = 512;
+	memcpy(pData, host_data + host_pos, length);
+	host_pos += length;
+	now += length/USB_MBS;
+	return length;
+}
+
+uint16_t usb_storage_write(const char *pData, uint16_t length) {
+	if (length == 13 && !memcmp(pData, "USBS", 4)) {
+		csw_status = pData[12];
+		return 0;
+	}
+	memcpy(host_data + host_pos, pData, length);
+	host_pos += length;
+	now += length/USB_MBS;
+	return 0;
+}
+
+// DMA transfers, the data is moved when the transfer is complete, so
+// a buffer reused too early shows up as corrupted data
+uint8_t usb_storage_write_start(const char *pData, uint32_t length) {
+	if (dma_fail) return 0;
+	dma_buf = (uint8_t*)pData;
+	dma_len = length;
+	dma_in = 1;
+	dma_end = now + length/USB_MBS;
+	dma_map(dma_buf, dma_len, DMA_TO_DEVICE);
+	return 1;
+}
+
+uint8_t usb_storage_read_start(char *pData, uint32_t length) {
+	if (dma_fail) return 0;
+	dma_buf = (uint8_t*)pData;
+	dma_len = length;
+	dma_in = 0;
+	dma_end = now + length/USB_MBS;
+	dma_map(dma_buf, dma_len, DMA_FROM_DEVICE);
+	return 1;
+}
+
+static void dma_release() {
+	dma_unmap(dma_buf, dma_len, dma_in ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	dma_buf = 0;
+}
+
+static void dma_complete() {
+	if (!dma_buf) return;
+	if (dma_in) memcpy(host_data + host_pos, dma_buf, dma_len);
+	else dma_device_write(dma_buf, host_data + host_pos, dma_len);
+	host_pos += dma_len;
+	dma_release();
+}
+
+uint8_t usb_storage_busy(void) {
+	if (!dma_buf) return 0;
+	if (now < dma_end) {
+		now = (now + 1.0 < dma_end) ? now + 1.0 : dma_end;
+		return 1;
+	}
+	dma_complete();
+	return 0;
+}
+
+void usb_storage_abort(void) {
+	if (dma_buf) dma_release();
+}
+
+static void scsi_cmd(void (*poll)(void), uint8_t op, uint32_t lba, uint16_t len) {
+	memset(cbw, 0, sizeof(cbw));
+	memcpy(cbw, "USBC", 4);
+	cbw[15] = op;
+	cbw[17] = lba >> 24; cbw[18] = lba >> 16; cbw[19] = lba >> 8; cbw[20] = lba;
+	cbw[22] = len >> 8; cbw[23] = len;
+	cbw_pending = 1;
+	csw_status = -1;
+	poll();
+}
+
+static int run(const char *name, void (*poll)(void)) {
+	uint32_t size = DISK_BLOCKS*512;
+	uint8_t *ref = malloc(size);
+	double t;
+	int errors = 0;
+
+	for (uint32_t i = 0; i < size; i++) ref[i] = rand();
+	memset(disk, 0, size);
+
+	// host -> card
+	memcpy(host_data, ref, size);
+	host_pos = 0; host_len = size;
+	t = now;
+	for (uint32_t lba = 0; lba < DISK_BLOCKS; lba += CMD_BLOCKS) {
+		scsi_cmd(poll, 0x2A, lba, CMD_BLOCKS);
+		if (csw_status) errors++;
+	}
+	printf("%-8s write: %5.1f MB/s\n", name, size / (now - t));
+	if (memcmp(disk, ref, size)) {
+		printf("%s: card data corrupted\n", name);
+		errors++;
+	}
+
+	// card -> host
+	memset(host_data, 0, size);
+	host_pos = 0; host_len = 0;
+	t = now;
+	for (uint32_t lba = 0; lba < DISK_BLOCKS; lba += CMD_BLOCKS) {
+		scsi_cmd(poll, 0x28, lba, CMD_BLOCKS);
+		if (csw_status) errors++;
+	}
+	printf("%-8s read:  %5.1f MB/s\n", name, size / (now - t));
+	if (memcmp(host_data, ref, size)) {
+		printf("%s: host data corrupted\n", name);
+		errors++;
+	}
+
+	// a transfer beyond the end of the card fails
+	host_pos = 0; host_len = 0;
+	scsi_cmd(poll, 0x28, DISK_BLOCKS - 8, CMD_BLOCKS);
+	if (csw_status != 1) {
+		printf("%s: read error not reported\n", name);
+		errors++;
+	}
+
+	if (dma_violations) {
+		printf("%s: %lu DMA buffer violations\n", name, dma_violations);
+		errors++;
+	}
+
+	free(ref);
+	return errors;
+}
+
+// the check itself: a buffer written while the DMA still receives into it
+static int early_reuse() {
+	static volatile uint8_t buf[4*4096] __attribute__ ((aligned(4096)));
+	unsigned long violations = dma_violations;
+
+	host_pos = 0;
+	usb_storage_read_start((char*)buf, sizeof(buf));
+	buf[5000] = 1;
+	while (usb_storage_busy());
+	if (dma_violations != violations + 1) {
+		printf("early reuse of a DMA buffer not detected\n");
+		return 1;
+	}
+	dma_violations = violations;
+	return 0;
+}
+
+// a transfer which can't be started fails the command
+static int dma_start_fails() {
+	int errors = 0;
+
+	dma_fail = 1;
+	host_pos = 0; host_len = 0;
+	scsi_cmd(storage_control_poll, 0x28, 0, CMD_BLOCKS);
+	if (csw_status != 1) {
+		printf("failed start of a read transfer not reported\n");
+		errors++;
+	}
+	host_pos = 0; host_len = DISK_BLOCKS*512;
+	scsi_cmd(storage_control_poll, 0x2A, 0, CMD_BLOCKS);
+	if (csw_status != 1) {
+		printf("failed start of a write transfer not reported\n");
+		errors++;
+	}
+	dma_fail = 0;
+	return errors;
+}
+
+int main() {
+	int errors = 0;
+
+	disk = malloc(DISK_BLOCKS*512);
+	host_data = malloc(DISK_BLOCKS*512);
+	srand(1);
+
+	errors += run("blocking", storage_control_poll_sync);
+	errors += run("double", storage_control_poll);
+	errors += early_reuse();
+	errors += dma_start_fails();
+
+	free(disk);
+	free(host_data);
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
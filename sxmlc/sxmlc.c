@@ -1831,6 +1831,384 @@ int XMLDoc_parse_buffer_SAX_len(const SXML_CHAR* buffer, int buffer_len, const S
 	return _parse_data_SAX((void*)&dsb, DATA_SOURCE_BUFFER, sax, &sd);
 }
 
+/* --- Buffered SAX parsing --- */
+
+/*
+ Reads more data at the end of 'ds->buf', moving what is left to the beginning first.
+ Returns the number of characters read, 0 at the end of the stream or when 'buf' is full.
+ */
+static int _stream_fill(DataSourceStream* ds)
+{
+	int n;
+
+	if (ds->eof)
+		return 0;
+	if (ds->pos > 0) {
+		memmove(ds->buf, ds->buf + ds->pos, (ds->len - ds->pos) * sizeof(SXML_CHAR));
+		ds->len -= ds->pos;
+		ds->pos = 0;
+	}
+	if (ds->len >= ds->buf_size - 1)
+		return 0;
+	n = ds->read(ds->src, ds->buf + ds->len, ds->buf_size - 1 - ds->len);
+	if (n <= 0) {
+		ds->eof = TRUE;
+		ds->error = (n < 0);
+		n = 0;
+	}
+	ds->len += n;
+	ds->buf[ds->len] = NULC;
+
+	return n;
+}
+
+/*
+ Searches for 'str' from offset 'from' of the data not parsed yet, reading more data when needed.
+ Returns the offset of 'str' from 'ds->pos' or -1 if it was not found.
+ */
+static int _stream_search(DataSourceStream* ds, int from, const SXML_CHAR* str, int len_str)
+{
+	int i;
+
+	for (;;) {
+		for (i = ds->pos + from; i + len_str <= ds->len; i++) {
+			if (ds->buf[i] == str[0] && !sx_strncmp(ds->buf + i + 1, str + 1, len_str - 1))
+				return i - ds->pos;
+		}
+		from = i - ds->pos;
+		if (_stream_fill(ds) == 0)
+			return -1;
+	}
+}
+
+/*
+ Searches for the '>' ending the tag at 'ds->pos', skipping quoted attribute values.
+ Returns its offset from 'ds->pos' or -1 if it was not found.
+ */
+static int _stream_tag_end(DataSourceStream* ds)
+{
+	SXML_CHAR quote = NULC;
+	int i, from = 1;
+
+	for (;;) {
+		for (i = ds->pos + from; i < ds->len; i++) {
+			if (quote != NULC) {
+				if (ds->buf[i] == quote)
+					quote = NULC;
+			} else if (isquote(ds->buf[i]))
+				quote = ds->buf[i];
+			else if (ds->buf[i] == C2SX('>'))
+				return i - ds->pos;
+		}
+		from = i - ds->pos;
+		if (_stream_fill(ds) == 0)
+			return -1;
+	}
+}
+
+static int _count_lines(const SXML_CHAR* str, int len)
+{
+	int n = 0;
+
+	while (len--)
+		if (*str++ == C2SX('\n'))
+			n++;
+
+	return n;
+}
+
+/*
+ Tokenizes the tag '<...>' of 'len' characters in place: tag name, attribute names and values are
+ NUL-terminated inside 'str' and 'node' points to them.
+ Returns 'TAG_NONE' on syntax error, 'TAG_ERROR' if there are too many attributes.
+ */
+static TagType _parse_tag_in_place(SXML_CHAR* str, int len, XMLNode* node)
+{
+	int n, n0, n1, v0, v1, end;
+	TagType type;
+
+	end = len - 1; /* '>' */
+	if (str[1] == C2SX('/')) {
+		type = TAG_END;
+		n = 2;
+	} else {
+		type = TAG_FATHER;
+		n = 1;
+		if (str[end-1] == C2SX('/')) {
+			type = TAG_SELF;
+			end--;
+		}
+	}
+
+	node->tag = str + n;
+	for (; n < end && str[n] != C2SX('/') && !sx_isspace(str[n]); n++) ;
+	if (node->tag == str + n)
+		return TAG_NONE;
+	n1 = n; /* End of tag name */
+
+	while (type != TAG_END && n < end) {
+		XMLAttribute* attr;
+
+		while (n < end && sx_isspace(str[n])) n++;
+		if (n >= end)
+			break;
+		if (node->n_attributes >= SXMLC_STREAM_MAX_ATTRIBUTES)
+			return TAG_ERROR;
+
+		/* 'n0' is where the attribute name stops, 'v0' and 'v1' are the value bounds */
+		n0 = n;
+		for (; n < end && str[n] != C2SX('=') && !sx_isspace(str[n]); n++) ;
+		attr = &node->attributes[node->n_attributes];
+		attr->name = str + n0;
+		n0 = n;
+		while (n < end && sx_isspace(str[n])) n++;
+		if (n >= end || str[n] != C2SX('=') || attr->name == str + n0)
+			return TAG_NONE;
+		for (n++; n < end && sx_isspace(str[n]); n++) ;
+		if (n < end && isquote(str[n])) {
+			SXML_CHAR quote = str[n++];
+			for (v0 = n; n < end && str[n] != quote; n++) ;
+			if (n >= end)
+				return TAG_NONE;
+		} else
+			for (v0 = n; n < end && !sx_isspace(str[n]); n++) ;
+		v1 = n;
+		if (n < end)
+			n++; /* Skip the quote or space after the value */
+
+		str[n0] = NULC;
+		str[v1] = NULC;
+		attr->value = str + v0;
+		attr->active = TRUE;
+		(void)html2str(attr->value, NULL);
+		node->n_attributes++;
+	}
+	str[n1] = NULC;
+	node->tag_type = type;
+
+	return type;
+}
+
+/*
+ Finds the end of a special tag ('<!-- -->', '<? ?>', ...) at 'ds->pos'. If 'tag' starts it, its
+ content is NUL-terminated in place and given in 'node->tag'.
+ Returns the offset of its final '>', -1 if 'tag' does not start it or -2 if its end was not found.
+ */
+static int _stream_special_tag(DataSourceStream* ds, const _TAG* tag, XMLNode* node)
+{
+	int n;
+
+	if (sx_strncmp(ds->buf + ds->pos, tag->start, tag->len_start))
+		return -1;
+	n = _stream_search(ds, tag->len_start, tag->end, tag->len_end);
+	if (n < 0)
+		return -2;
+	node->tag = ds->buf + ds->pos + tag->len_start;
+	ds->buf[ds->pos + n] = NULC;
+	node->tag_type = tag->tag_type;
+
+	return n + tag->len_end - 1;
+}
+
+static int _stream_error(ParseError error_num, const SAX_Callbacks* sax, SAX_Data* sd)
+{
+	if (sax->on_error == NULL && sax->all_event == NULL)
+		sx_fprintf(stderr, C2SX("%s:%d: PARSE ERROR %d.\n"), sd->name != NULL ? sd->name : C2SX(""), sd->line_num, error_num);
+	if (sax->on_error != NULL && !sax->on_error(error_num, sd->line_num, sd))
+		return FALSE;
+	if (sax->all_event != NULL)
+		(void)sax->all_event(XML_EVENT_ERROR, NULL, (SXML_CHAR*)sd->name, error_num, sd);
+
+	return FALSE;
+}
+
+/*
+ Gives the text from 'ds->pos' to 'end' to the callbacks. The character at 'end' is restored afterwards.
+ */
+static int _stream_text(DataSourceStream* ds, int end, const SAX_Callbacks* sax, SAX_Data* sd)
+{
+	SXML_CHAR* text = ds->buf + ds->pos;
+	SXML_CHAR c = ds->buf[end];
+	int ret = TRUE;
+
+	sd->line_num += _count_lines(text, end - ds->pos);
+	ds->buf[end] = NULC;
+	(void)html2str(text, NULL);
+	if (sax->new_text != NULL && !sax->new_text(text, sd))
+		ret = FALSE;
+	else if (sax->all_event != NULL && !sax->all_event(XML_EVENT_TEXT, NULL, text, sd->line_num, sd))
+		ret = FALSE;
+	ds->buf[end] = c;
+	ds->pos = end;
+
+	return ret;
+}
+
+int XMLDoc_parse_stream_SAX(SXML_CHAR* buf, int buf_size, int (*read)(void* src, SXML_CHAR* buf, int len), void* src,
+							const SXML_CHAR* name, const SAX_Callbacks* sax, void* user)
+{
+	DataSourceStream ds = { buf, buf_size, 0, 0, FALSE, FALSE, read, src };
+	XMLAttribute attributes[SXMLC_STREAM_MAX_ATTRIBUTES];
+	XMLNode node;
+	SAX_Data sd = { NULL };
+	int ret, n, nn;
+
+	if (sax == NULL || buf == NULL || buf_size < 2 || read == NULL)
+		return FALSE;
+
+	sd.name = name;
+	sd.user = user;
+	sd.type = DATA_SOURCE_STREAM;
+	sd.src  = (void*)&ds;
+	sd.line_num = 1;
+
+	if (sax->start_doc != NULL && !sax->start_doc(&sd))
+		return TRUE;
+	if (sax->all_event != NULL && !sax->all_event(XML_EVENT_START_DOC, NULL, (SXML_CHAR*)sd.name, 0, &sd))
+		return TRUE;
+
+	memset(&node, 0, sizeof(node));
+	node.attributes = attributes;
+	node.active = TRUE;
+	node.init_value = XML_INIT_DONE;
+
+	buf[0] = NULC;
+	while (ds.len < 3 && _stream_fill(&ds)) ;
+#ifndef SXMLC_UNICODE
+	if (!sx_strncmp(buf, C2SX("\xef\xbb\xbf"), 3)) /* Skip UTF-8 BOM */
+		ds.pos = 3;
+#endif
+
+	ret = TRUE;
+	while (ret) {
+		if (ds.pos == ds.len && _stream_fill(&ds) == 0) {
+			ret = !ds.error || _stream_error(PARSE_ERR_EOF, sax, &sd);
+			break;
+		}
+
+		/* Text before the next tag */
+		if (buf[ds.pos] != C2SX('<')) {
+			n = _stream_search(&ds, 0, C2SX("<"), 1);
+			if (n > 0) {
+				ret = _stream_text(&ds, ds.pos + n, sax, &sd);
+			} else if (ds.eof) {
+				/* Only spaces are allowed after the last tag */
+				for (n = ds.pos; n < ds.len && sx_isspace(buf[n]); n++) ;
+				if (n < ds.len || ds.error)
+					ret = _stream_error(PARSE_ERR_EOF, sax, &sd);
+				break;
+			} else {
+				/* Text longer than the buffer: give what we have, except an HTML escape sequence cut at its end */
+				n = ds.len;
+				for (nn = n - 1; nn > n - 6 && nn > ds.pos; nn--) {
+					if (buf[nn] == C2SX(';'))
+						break;
+					if (buf[nn] == C2SX('&')) {
+						n = nn;
+						break;
+					}
+				}
+				ret = _stream_text(&ds, n, sax, &sd);
+			}
+			continue;
+		}
+
+		/* Tag: make sure the longest special tag start is in the buffer */
+		while (ds.len - ds.pos < 9 && _stream_fill(&ds)) ;
+		node.tag = NULL;
+		node.n_attributes = 0;
+		n = -1;
+		for (nn = 0; nn < NB_SPECIAL_TAGS && n == -1; nn++)
+			n = _stream_special_tag(&ds, &_spec[nn], &node);
+		if (n == -1 && !sx_strncmp(buf + ds.pos, C2SX("<!DOCTYPE"), 9)) {
+			/* Ends with "]>" instead of ">" if a '[' is found inside */
+			n = _stream_search(&ds, 9, C2SX(">"), 1);
+			if (n >= 0) {
+				for (nn = 9; nn < n && buf[ds.pos + nn] != C2SX('['); nn++) ;
+				if (nn < n)
+					n = _stream_search(&ds, nn, C2SX("]>"), 2);
+			}
+			if (n >= 0) {
+				node.tag = buf + ds.pos + 9;
+				buf[ds.pos + n] = NULC;
+				node.tag_type = TAG_DOCTYPE;
+				n += (nn < n) ? 1 : 0;
+			} else
+				n = -2;
+		}
+		for (nn = 0; nn < _user_tags.n_tags && n == -1; nn++)
+			n = _stream_special_tag(&ds, &_user_tags.tags[nn], &node);
+		if (n == -1) {
+			n = _stream_tag_end(&ds);
+			if (n < 0)
+				n = -2;
+		}
+		if (n == -2) {
+			ret = _stream_error(ds.eof ? PARSE_ERR_EOF : PARSE_ERR_MEMORY, sax, &sd);
+			break;
+		}
+
+		/* 'buf[ds.pos..ds.pos+n]' is the whole tag */
+		sd.line_num += _count_lines(buf + ds.pos, n + 1);
+		if (node.tag == NULL) {
+			switch (_parse_tag_in_place(buf + ds.pos, n + 1, &node)) {
+				case TAG_ERROR:
+					ret = _stream_error(PARSE_ERR_MEMORY, sax, &sd);
+					break;
+				case TAG_NONE:
+					ret = _stream_error(PARSE_ERR_SYNTAX, sax, &sd);
+					break;
+				default:
+					break;
+			}
+			if (!ret)
+				break;
+		}
+		ds.pos += n + 1;
+
+		if (node.tag_type != TAG_END) {
+			if (sax->start_node != NULL && !sax->start_node(&node, &sd))
+				ret = FALSE;
+			else if (sax->all_event != NULL && !sax->all_event(XML_EVENT_START_NODE, &node, NULL, sd.line_num, &sd))
+				ret = FALSE;
+		}
+		if (ret && node.tag_type != TAG_FATHER) {
+			if (sax->end_node != NULL && !sax->end_node(&node, &sd))
+				ret = FALSE;
+			else if (sax->all_event != NULL && !sax->all_event(XML_EVENT_END_NODE, &node, NULL, sd.line_num, &sd))
+				ret = FALSE;
+		}
+	}
+
+	if (sax->end_doc != NULL && !sax->end_doc(&sd))
+		return ret;
+	if (sax->all_event != NULL)
+		(void)sax->all_event(XML_EVENT_END_DOC, NULL, (SXML_CHAR*)sd.name, sd.line_num, &sd);
+
+	return ret;
+}
+
+static int _fd_read(void* src, SXML_CHAR* buf, int len)
+{
+	UINT br;
+
+	/* Whole sectors keep the file position aligned, so FatFs reads them directly into 'buf' */
+	if (len >= 512)
+		len &= ~511;
+	if (f_read((FIL*)src, buf, len, &br) != FR_OK)
+		return -1;
+
+	return (int)br;
+}
+
+int XMLDoc_parse_fd_SAX_buf(FIL* f, SXML_CHAR* buf, int buf_size, const SAX_Callbacks* sax, void* user)
+{
+	if (f == NULL)
+		return FALSE;
+
+	return XMLDoc_parse_stream_SAX(buf, buf_size, _fd_read, (void*)f, NULL, sax, user);
+}
+
 #ifndef SXMLC_TINY
 int XMLDoc_parse_file_DOM_text_as_nodes(const SXML_CHAR* filename, XMLDoc* doc, int text_as_nodes)
 {
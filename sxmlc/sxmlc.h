@@ -167,6 +167,21 @@ typedef struct _DataSourceBuffer {
 	int cur_pos;
 } DataSourceBuffer;
 
+/**
+ * \brief Stream data source used by `XMLDoc_parse_stream_SAX()`. `buf[pos..len[` holds the
+ * data not parsed yet, `buf[len]` is always `NULC`.
+ */
+typedef struct _DataSourceStream {
+	SXML_CHAR* buf;	/**< Caller given read buffer. */
+	int buf_size;	/**< Size of `buf`, in characters. */
+	int pos;
+	int len;
+	int eof;
+	int error;		/**< `read()` returned an error. */
+	int (*read)(void* src, SXML_CHAR* buf, int len);
+	void* src;
+} DataSourceStream;
+
 typedef FILE* DataSourceFile;
 
 /**
@@ -175,6 +190,7 @@ typedef FILE* DataSourceFile;
 typedef enum _DataSourceType {
 	DATA_SOURCE_FILE = 0,
 	DATA_SOURCE_BUFFER,
+	DATA_SOURCE_STREAM,
 	DATA_SOURCE_MAX
 } DataSourceType;
 
@@ -366,8 +382,8 @@ typedef struct _SAX_Data {
 	const SXML_CHAR* name;	/**< Document name (file name or buffer name). */
 	int line_num;			/**< Current line number being processed. */
 	void* user;				/**< User-given data. */
-	DataSourceType type;	/**< Data source type [DATA_SOURCE_FILE|DATA_SOURCE_BUFFER]. */
-	void* src;				/**< Data source [DataSourceFile|DataSourceBuffer]. Depends on type. */
+	DataSourceType type;	/**< Data source type [DATA_SOURCE_FILE|DATA_SOURCE_BUFFER|DATA_SOURCE_STREAM]. */
+	void* src;				/**< Data source [DataSourceFile|DataSourceBuffer|DataSourceStream]. Depends on type. */
 } SAX_Data;
 
 /**
@@ -948,6 +964,40 @@ int XMLDoc_parse_buffer_SAX_len(const SXML_CHAR* buffer, int buffer_len, const S
  */
 #define XMLDoc_parse_buffer_SAX(buffer, name, sax, user) XMLDoc_parse_buffer_SAX_len(buffer, sx_strlen(buffer), name, sax, user)
 
+/**
+ * \brief Max. number of attributes of a node given to SAX callbacks by `XMLDoc_parse_stream_SAX()`.
+ */
+#ifndef SXMLC_STREAM_MAX_ATTRIBUTES
+#define SXMLC_STREAM_MAX_ATTRIBUTES 16
+#endif
+
+/**
+ * \brief Parse an XML stream through a caller given buffer, calling SAX callbacks.
+ *
+ * Nothing is allocated: the stream is read into `buf` as large blocks and every tag is
+ * tokenized in place. Tag names, attributes and texts given to the callbacks are NUL-terminated
+ * slices of `buf` which are only valid until the callback returns.
+ * A tag (including comments, CDATA, ...) must fit in `buf`, longer texts are given to
+ * `new_text()` in several parts. Nodes can have up to `SXMLC_STREAM_MAX_ATTRIBUTES` attributes.
+ * \param buf The read buffer, preferably several disk sectors.
+ * \param buf_size The buffer size, in *characters*.
+ * \param read Reads up to `len` characters into `buf`, returns the number of characters read,
+ * 		0 at the end of the stream and <0 on error.
+ * \param src The data source given to `read()`.
+ * \param name An optional stream name.
+ * \param sax The SAX callbacks that will be called by the parser on each XML event.
+ * \param user A user-given pointer that will be given back to all callbacks.
+ * \return `false` in case of error (read error, tag too long for `buf`, malformed document) or when
+ * 		requested by a SAX callback. `true` otherwise.
+ */
+int XMLDoc_parse_stream_SAX(SXML_CHAR* buf, int buf_size, int (*read)(void* src, SXML_CHAR* buf, int len), void* src,
+							const SXML_CHAR* name, const SAX_Callbacks* sax, void* user);
+
+/**
+ * \brief Parse an open FatFs file through `buf` with `XMLDoc_parse_stream_SAX()`.
+ */
+int XMLDoc_parse_fd_SAX_buf(FIL* f, SXML_CHAR* buf, int buf_size, const SAX_Callbacks* sax, void* user);
+
 /**
  * \brief Parse an XML file using the DOM implementation.
  */
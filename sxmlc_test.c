@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include "sxmlc/sxmlc.h"
+
+// Parses generated and given XML files with the line reading SAX parser
+// (XMLDoc_parse_fd_SAX) and the buffered one (XMLDoc_parse_fd_SAX_buf),
+// checks that both give the same events and compares their speed, f_read()
+// calls and peak heap use. Buffer boundaries, long texts and errors are
+// checked with small buffers.
+//
+// usage: sxmlctest [file.xml ...]
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- FatFs mock ----------
+static const char *image;
+static unsigned int reads, read_error_at;
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br) {
+	FSIZE_t left = fp->obj.objsize - fp->fptr;
+
+	reads++;
+	if (read_error_at && fp->fptr + btr > read_error_at) {
+		*br = 0;
+		return FR_DISK_ERR;
+	}
+	*br = (btr < left) ? btr : left;
+	memcpy(buff, image + fp->fptr, *br);
+	fp->fptr += *br;
+	return FR_OK;
+}
+
+static void open_image(FIL *fp, const char *data, unsigned int size) {
+	memset(fp, 0, sizeof(FIL));
+	image = data;
+	fp->obj.objsize = size;
+	reads = 0;
+}
+
+// ---------- heap tracking (-Wl,--wrap) ----------
+void *__real_malloc(size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+static size_t heap, heap_peak;
+static unsigned int allocs;
+
+void *__wrap_malloc(size_t size) {
+	size_t *p = __real_malloc(size + 16);
+	if (!p) return NULL;
+	*p = size;
+	heap += size;
+	if (heap > heap_peak) heap_peak = heap;
+	allocs++;
+	return (char*)p + 16;
+}
+
+void __wrap_free(void *p) {
+	if (!p) return;
+	p = (char*)p - 16;
+	heap -= *(size_t*)p;
+	__real_free(p);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+	void *n;
+	if (!p) return __wrap_malloc(size);
+	n = __wrap_malloc(size);
+	if (n) {
+		size_t old = *(size_t*)((char*)p - 16);
+		memcpy(n, p, old < size ? old : size);
+		__wrap_free(p);
+	}
+	return n;
+}
+
+// ---------- event recorder ----------
+typedef struct {
+	unsigned long long hash;
+	unsigned int nodes, texts, error;
+	int in_text;
+} events_t;
+
+static events_t ev;
+
+static void hash(const char *s, int term) {
+	while (*s) ev.hash = (ev.hash ^ (unsigned char)*s++) * 0x100000001b3ULL;
+	if (term) ev.hash = (ev.hash ^ 0xff) * 0x100000001b3ULL;
+}
+
+static int start_doc(SAX_Data *sd) {
+	memset(&ev, 0, sizeof(ev));
+	ev.hash = 0xcbf29ce484222325ULL;
+	return true;
+}
+
+static int start_node(const XMLNode *node, SAX_Data *sd) {
+	char type[2] = { '0' + node->tag_type, 0 };
+	ev.in_text = 0;
+	ev.nodes++;
+	hash("S", 1);
+	hash(type, 1);
+	hash(node->tag, 1);
+	for (int i = 0; i < node->n_attributes; i++) {
+		hash(node->attributes[i].name, 1);
+		hash(node->attributes[i].value, 1);
+	}
+	return true;
+}
+
+static int end_node(const XMLNode *node, SAX_Data *sd) {
+	ev.in_text = 0;
+	hash("E", 1);
+	hash(node->tag, 1);
+	return true;
+}
+
+// the buffered parser may give long texts in several parts
+static int new_text(SXML_CHAR *text, SAX_Data *sd) {
+	if (!ev.in_text) {
+		ev.texts++;
+		hash("T", 1);
+	}
+	ev.in_text = 1;
+	hash(text, 0);
+	return true;
+}
+
+static int on_error(ParseError error_num, int line_number, SAX_Data *sd) {
+	ev.error = -error_num;
+	return true;
+}
+
+static const SAX_Callbacks sax = {
+	.start_doc  = start_doc,
+	.start_node = start_node,
+	.end_node   = end_node,
+	.new_text   = new_text,
+	.on_error   = on_error
+};
+
+// ---------- test data ----------
+static char *xml;
+static unsigned int xml_len, xml_size;
+
+static void out(const char *fmt, ...) {
+	va_list ap;
+	int n;
+
+	if (xml_size - xml_len < 4096) {
+		xml_size = xml_size * 2 + 65536;
+		xml = realloc(xml, xml_size);
+	}
+	va_start(ap, fmt);
+	n = vsnprintf(xml + xml_len, xml_size - xml_len, fmt, ap);
+	va_end(ap);
+	xml_len += n;
+}
+
+// arcade ROM descriptor like document of about 'size' bytes
+static void make_xml(unsigned int size, unsigned int seed) {
+	srand(seed);
+	xml_len = 0;
+	out("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	out("<!DOCTYPE misterromdescription [\n  <!ENTITY copy \"(c)\">\n]>\n");
+	out("<misterromdescription>\n\t<name>Test &amp; Bench</name>\n");
+	out("\t<!-- comment with a > inside -->\n");
+	while (xml_len < size) {
+		int part = rand();
+		out("\t<rom index=\"%d\" zip=\"game.zip|alt.zip\" md5='%08x' type=\"merged\">\n", part & 3, part);
+		for (int i = rand() % 8; i >= 0; i--) {
+			out("\t\t<part crc=\"%08x\" name=\"rom%d.bin\" length = \"0x%x\"/>\n", rand(), i, rand() & 0xffff);
+			if (!(rand() % 5)) {
+				out("\t\t<part>");
+				for (int j = rand() % 600; j >= 0; j--) out("%02X ", rand() & 0xff);
+				out("</part>\n");
+			}
+		}
+		if (!(rand() % 10)) out("\t\t<![CDATA[ raw <data> ]]>\n");
+		out("\t\t<patch offset=0x%x>&lt;%d&gt; &quot;x&quot;</patch>\n", rand() & 0xffff, rand() % 100);
+		out("\t</rom>\n");
+	}
+	out("\t<buttons names=\"Fire,Jump\" default=\"A,B\"></buttons>\n");
+	out("</misterromdescription>\n");
+}
+
+// ---------- parse ----------
+static SXML_CHAR buffer[65536];
+
+typedef struct {
+	events_t ev;
+	int ret;
+	unsigned int reads, allocs;
+	size_t heap_peak;
+	double ms;
+} result_t;
+
+static result_t parse(const char *data, unsigned int len, int buf_size) {
+	result_t r;
+	FIL fil;
+	clock_t t;
+
+	open_image(&fil, data, len);
+	heap = heap_peak = allocs = 0;
+	t = clock();
+	if (buf_size)
+		r.ret = XMLDoc_parse_fd_SAX_buf(&fil, buffer, buf_size, &sax, NULL);
+	else
+		r.ret = XMLDoc_parse_fd_SAX(&fil, &sax, NULL);
+	r.ms = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
+	r.ev = ev;
+	r.reads = reads;
+	r.allocs = allocs;
+	r.heap_peak = heap_peak;
+	return r;
+}
+
+static void print_result(const char *name, result_t *r) {
+	printf("  %-22s: %8.1f ms, %8u f_read, %8u allocs, %6u bytes heap peak\n",
+	       name, r->ms, r->reads, r->allocs, (unsigned int)r->heap_peak);
+}
+
+static void benchmark(const char *name, const char *data, unsigned int len) {
+	result_t old, buf, small;
+
+	printf("%s: %u bytes\n", name, len);
+	old = parse(data, len, 0);
+	buf = parse(data, len, 6144);    // zx_col_load() on the SAMV71
+	small = parse(data, len, 600);   // forces refills and split texts
+	print_result("line reader", &old);
+	print_result("buffered, 6K", &buf);
+	print_result("buffered, 600 bytes", &small);
+	printf("  %u nodes, %u texts\n", old.ev.nodes, old.ev.texts);
+
+	CHECK(old.ret && buf.ret && small.ret);
+	CHECK(old.ev.hash == buf.ev.hash && old.ev.nodes == buf.ev.nodes && old.ev.texts == buf.ev.texts);
+	CHECK(buf.ev.hash == small.ev.hash);
+	CHECK(buf.heap_peak == 0 && small.heap_peak == 0);
+}
+
+static result_t parse_str(const char *s, int buf_size) {
+	return parse(s, strlen(s), buf_size);
+}
+
+static void test_boundaries() {
+	result_t ref, r;
+	int size;
+
+	// buffer sizes from the smallest which holds the longest tag
+	make_xml(20000, 2);
+	ref = parse(xml, xml_len, 0);
+	for (size = 80; size < 1100; size += 7) {
+		r = parse(xml, xml_len, size);
+		if (!r.ret || r.ev.hash != ref.ev.hash) {
+			printf("boundaries: buffer size %d differs\n", size);
+			errors++;
+			break;
+		}
+	}
+
+	// escape sequence cut at the end of a long text
+	for (size = 24; size < 40; size++) {
+		r = parse_str("<a>0123456789012345678901234567&amp;&lt;&gt;</a>", size);
+		CHECK(r.ret && r.ev.texts == 1);
+		CHECK(r.ev.hash == parse_str("<a>0123456789012345678901234567&amp;&lt;&gt;</a>", 0).ev.hash);
+	}
+}
+
+static void test_errors() {
+	result_t r;
+	char many[512];
+	int i, n;
+
+	// unexpected end of file
+	r = parse_str("<a><b x=\"1\"", 256);
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_EOF);
+	r = parse_str("<a><!-- unterminated", 256);
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_EOF);
+	r = parse_str("<a></a> trailing", 256);
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_EOF);
+	r = parse_str("<a></a>\n\t \n", 256);
+	CHECK(r.ret && !r.ev.error);
+
+	// tag longer than the buffer
+	r = parse_str("<a><b name=\"a very long attribute value\"/></a>", 16);
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_MEMORY);
+
+	// syntax errors
+	r = parse_str("<a><b x/></a>", 256);
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_SYNTAX);
+	r = parse_str("<a>< /></a>", 256);
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_SYNTAX);
+
+	// '>' in attribute values
+	r = parse_str("<a x=\"1>0\" y='>'></a>", 256);
+	CHECK(r.ret && r.ev.nodes == 1);
+
+	// too many attributes
+	n = sprintf(many, "<a");
+	for (i = 0; i <= SXMLC_STREAM_MAX_ATTRIBUTES; i++) n += sprintf(many + n, " a%d=\"%d\"", i, i);
+	sprintf(many + n, "/>");
+	r = parse_str(many, 512);
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_MEMORY);
+
+	// read error
+	make_xml(20000, 3);
+	read_error_at = 10000;
+	r = parse(xml, xml_len, 2048);
+	read_error_at = 0;
+	CHECK(!r.ret && r.ev.error == -PARSE_ERR_EOF);
+}
+
+int main(int argc, char **argv) {
+	test_boundaries();
+	test_errors();
+
+	make_xml(4 << 20, 1);
+	benchmark("generated", xml, xml_len);
+
+	for (int i = 1; i < argc; i++) {
+		FILE *f = fopen(argv[i], "rb");
+		char *data;
+		long len;
+
+		if (!f) {
+			printf("Unable to open %s\n", argv[i]);
+			errors++;
+			continue;
+		}
+		fseek(f, 0, SEEK_END);
+		len = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		data = malloc(len + 1);
+		if (fread(data, 1, len, f) == len)
+			benchmark(argv[i], data, len);
+		free(data);
+		fclose(f);
+	}
+	free(xml);
+
+	printf("%s\n", errors ? "FAILED" : "PASSED");
+	return errors ? 1 : 0;
+}
@@ -15,10 +15,14 @@
 #include "data_io.h"
 #include "ikbd.h"
 #include "idxfile.h"
+#ifdef HAVE_MSA
+#include "msa.h"
+#endif
 #include "font.h"
 #include "mmc.h"
 #include "utils.h"
 #include "FatFs/diskio.h"
+#include "prof.h"
 
 #define CONFIG_FILENAME  "MIST    CFG"
 
@@ -49,6 +53,9 @@ static struct {
   char name[64];
   unsigned char sides;
   unsigned char spt;
+#ifdef HAVE_MSA
+  msa_t msa;
+#endif
 } fdd_image[2];
 
 unsigned long hdd_direct = 0;
@@ -260,6 +267,7 @@ static void handle_acsi(unsigned char *buffer) {
   static unsigned char asc[2] = { 0,0 };
   unsigned char target = buffer[10] >> 5;
   unsigned char device = buffer[1] >> 5;
+  PROF_START(prof);
   unsigned char cmd = buffer[0];
   unsigned long lba = 256 * 256 * (buffer[1] & 0x1f) +
     256 * buffer[2] + buffer[3];
@@ -360,7 +368,7 @@ static void handle_acsi(unsigned char *buffer) {
               disk_read(fs.pdrv, 0, lba, length);
             } else {
               IDXSeek(&sd_image[target+2], lba);
-              FileReadBlockEx(&sd_image[target+2].file, 0, length);
+              IDXReadBlocks(&sd_image[target+2], 0, length);
             }
             mist2_spi_set_speed(spi_speed);
           } else {
@@ -373,7 +381,7 @@ static void handle_acsi(unsigned char *buffer) {
                 disk_read(fs.pdrv, sector_buffer, lba, blocksize);
               } else {
                 IDXSeek(&sd_image[target+2], lba);
-                FileReadBlockEx(&sd_image[target+2].file, sector_buffer, blocksize);
+                IDXReadBlocks(&sd_image[target+2], sector_buffer, blocksize);
               }
               // hexdump(sector_buffer, 32, 0);
               mist_memory_write_blocks(sector_buffer, blocksize);
@@ -416,8 +424,6 @@ static void handle_acsi(unsigned char *buffer) {
         if(lba+length <= blocks) {
           DISKLED_ON;
           while(length) {
-            UINT bw;
-
             blocklen = (length > SECTOR_BUFFER_SIZE/512) ? SECTOR_BUFFER_SIZE/512 : length;
             buf = sector_buffer;
             blocks = blocklen;
@@ -431,7 +437,7 @@ static void handle_acsi(unsigned char *buffer) {
               disk_write(fs.pdrv, sector_buffer, lba, blocklen);
             } else {
               IDXSeek(&sd_image[target+2], lba);
-              f_write(&sd_image[target+2].file, sector_buffer, blocklen*512, &bw);
+              IDXWriteBlocks(&sd_image[target+2], sector_buffer, blocklen);
             }
             lba+=blocklen;
             length-=blocklen;
@@ -509,6 +515,7 @@ static void handle_acsi(unsigned char *buffer) {
     // but don't generate a acsi irq
     dma_nak();
   }
+  PROF_END(PROF_ACSI, prof);
 }
 
 static void handle_fdc(unsigned char *buffer) {
@@ -551,18 +558,35 @@ static void handle_fdc(unsigned char *buffer) {
 
           DISKLED_ON;
 
-          f_lseek(&fdd_image[drv_sel-1].file, offset * 512);
-
-          if((fdc_cmd & 0xe0) == 0x80) { 
-            // read from disk ...
-            FileReadBlock(&fdd_image[drv_sel-1].file, sector_buffer);
-            // ... and copy to ram
-            mist_memory_write_block(sector_buffer);
-          } else {
-            // read from ram ...
-            mist_memory_read_block(sector_buffer);
-            // ... and write to disk
-            FileWriteBlock(&(fdd_image[drv_sel-1].file), sector_buffer);
+#ifdef HAVE_MSA
+          if(fdd_image[drv_sel-1].msa.file) {
+            // msa images are accessed in the track buffer
+            unsigned char *sector = msa_sector(&fdd_image[drv_sel-1].msa, offset);
+
+            if(!sector)
+              tos_debugf("MSA track error");
+            else if((fdc_cmd & 0xe0) == 0x80)
+              mist_memory_write_block(sector);
+            else {
+              mist_memory_read_block(sector);
+              msa_written(&fdd_image[drv_sel-1].msa);
+            }
+          } else
+#endif
+          {
+            f_lseek(&fdd_image[drv_sel-1].file, offset * 512);
+
+            if((fdc_cmd & 0xe0) == 0x80) { 
+              // read from disk ...
+              FileReadBlock(&fdd_image[drv_sel-1].file, sector_buffer);
+              // ... and copy to ram
+              mist_memory_write_block(sector_buffer);
+            } else {
+              // read from ram ...
+              mist_memory_read_block(sector_buffer);
+              // ... and write to disk
+              FileWriteBlock(&(fdd_image[drv_sel-1].file), sector_buffer);
+            }
           }
 
           DISKLED_OFF;
@@ -1107,6 +1131,9 @@ void tos_poll() {
   static unsigned long timer = 1;
 
   mist_get_dmastate();
+#ifdef HAVE_MSA
+  msa_poll();
+#endif
 
   // check the user button
   if(!MenuButton() && UserButton()) {
@@ -1181,7 +1208,7 @@ void tos_select_hdd_image(char i, const unsigned char *name) {
     config.acsi_img[i][0] = 0;
   // try to open harddisk image
   if (disk_inserted[i+2]) {
-    f_close(&sd_image[i+2].file);
+    IDXClose(&sd_image[i+2]);
     disk_inserted[i+2] = 0;
   }
   config.system_ctrl &= ~(TOS_ACSI0_ENABLE<<i);
@@ -1215,6 +1242,10 @@ void tos_insert_disk(char i, const unsigned char *name) {
   mist_set_control(config.system_ctrl | wp_bit);
 
   // first "eject" disk
+#ifdef HAVE_MSA
+  if(msa_close(&fdd_image[i].msa) != FR_OK)
+    tos_debugf("%c: MSA write back failed", i+'A');
+#endif
   fdd_image[i].sides = 1;
   fdd_image[i].spt = 0;
   disk_inserted[i] = 0;
@@ -1251,17 +1282,26 @@ void tos_insert_disk(char i, const unsigned char *name) {
 
   // check image size and parameters
 
-  // check if image size suggests it's a two sided disk
-  if(f_size(&fdd_image[i].file) > 85*11*512)
-    fdd_image[i].sides = 2;
-
-  // try common sector/track values
-  int m, s, t;
-  for(m=0;m<=2;m++)  // multiplier for hd/ed disks
-    for(s=9;s<=12;s++)
-      for(t=78;t<=85;t++)
-        if(512*(1<<m)*s*t*fdd_image[i].sides == f_size(&fdd_image[i].file))
-          fdd_image[i].spt = s*(1<<m);
+#ifdef HAVE_MSA
+  // msa images have the geometry in the header
+  if(msa_open(&fdd_image[i].msa, &fdd_image[i].file) == FR_OK) {
+    fdd_image[i].sides = fdd_image[i].msa.sides;
+    fdd_image[i].spt = fdd_image[i].msa.spt;
+  } else
+#endif
+  {
+    // check if image size suggests it's a two sided disk
+    if(f_size(&fdd_image[i].file) > 85*11*512)
+      fdd_image[i].sides = 2;
+
+    // try common sector/track values
+    int m, s, t;
+    for(m=0;m<=2;m++)  // multiplier for hd/ed disks
+      for(s=9;s<=12;s++)
+        for(t=78;t<=85;t++)
+          if(512*(1<<m)*s*t*fdd_image[i].sides == f_size(&fdd_image[i].file))
+            fdd_image[i].spt = s*(1<<m);
+  }
 
 
   if(!fdd_image[i].spt) {
@@ -1285,6 +1325,10 @@ void tos_insert_disk(char i, const unsigned char *name) {
 void tos_eject_all() {
   int i;
   for(i=0;i<2;i++) {
+#ifdef HAVE_MSA
+    // the card is gone, a dirty msa track cannot be written back
+    msa_discard(&fdd_image[i].msa);
+#endif
     tos_insert_disk(i, NULL);
     disk_inserted[i] = 0;
   }
@@ -1694,7 +1738,11 @@ static char tos_getmenuitem(uint8_t idx, char action, menu_item_t *item) {
 					if(tos_disk_is_inserted(idx>=7 ? idx-7 : idx))
 						tos_insert_disk(idx>=7 ? idx-7 : idx, NULL);
 					else
+#ifdef HAVE_MSA
+						SelectFileNG((user_io_core_type() == CORE_TYPE_MIST) ? "ST MSA" : "ST ", SCAN_DIR | SCAN_LFN, tos_file_selected, 0);
+#else
 						SelectFileNG("ST ", SCAN_DIR | SCAN_LFN, tos_file_selected, 0);
+#endif
 					break;
 				case 2:
 				case 3:
@@ -0,0 +1,124 @@
+// upgrade.c
+// Verify and flash steps of a firmware upgrade. The upgrade file is read
+// once in chunks before anything is written: the ROM CRC is checked, every
+// chunk gets a checksum, and chunks already in the flash are marked clean.
+// Flashing then reads and programs only the changed chunks and checks each
+// of them against its checksum first. A read error before the first page is
+// programmed aborts the upgrade; afterwards the chunk is read again until it
+// is correct. An interrupted upgrade only has the remaining chunks to do
+// when it is started again.
+//
+// upg_program() runs while the flash is being overwritten, it must not call
+// anything outside of RAM (no library functions, no division).
+
+#include <string.h>
+#include "upgrade.h"
+#include "crc32.h"
+
+// checksum of a chunk, rotate and add of 32 bit words
+static RAMFUNC uint32_t upg_sum(const uint8_t *data, uint32_t len) {
+  const uint32_t *p = (const uint32_t*)data;
+  uint32_t sum = 0, n;
+
+  for (n = len >> 2; n; n--)
+    sum = ((sum << 1) | (sum >> 31)) + *p++;
+
+  data = (const uint8_t*)p;
+  for (n = len & 3; n; n--)
+    sum = ((sum << 1) | (sum >> 31)) + *data++;
+
+  return sum;
+}
+
+uint8_t upg_check_header(upg_state_t *s, const UPGRADE *hdr, const char *id, uint32_t file_size,
+                         uint32_t chunk_size, uint16_t page_size) {
+  memset(s, 0, sizeof(upg_state_t));
+
+  if (hdr->crc != ~crc32_update(CRC32_INIT, hdr, sizeof(UPGRADE) - 4))
+    return UPG_ERR_HEADER_CRC;
+
+  if (strncmp((const char*)hdr->id, id, 7) || hdr->id[7])
+    return UPG_ERR_ID;
+
+  if (file_size < sizeof(UPGRADE) || !hdr->rom.size || hdr->rom.size != file_size - sizeof(UPGRADE))
+    return UPG_ERR_SIZE;
+
+  if ((hdr->rom.size + chunk_size - 1) / chunk_size > UPG_MAX_CHUNKS)
+    return UPG_ERR_TOO_LARGE;
+
+  s->size = hdr->rom.size;
+  s->rom_crc = hdr->rom.crc;
+  s->chunk_size = chunk_size;
+  s->page_size = page_size;
+  s->chunk_pages = chunk_size / page_size;
+  s->chunks = (s->size + chunk_size - 1) / chunk_size;
+  s->last_pages = (upg_chunk_len(s, s->chunks - 1) + page_size - 1) / page_size;
+  s->crc = CRC32_INIT;
+
+  return UPG_OK;
+}
+
+// next chunk of the ROM, flash points to its current flash content or NULL
+void upg_verify_chunk(upg_state_t *s, const uint8_t *data, const uint8_t *flash) {
+  uint16_t i = s->verified;
+  uint32_t len;
+
+  if (i >= s->chunks) return;
+  len = upg_chunk_len(s, i);
+
+  s->crc = crc32_update(s->crc, data, len);
+  s->sum[i] = upg_sum(data, len);
+  if (!flash || memcmp(data, flash, len)) {
+    s->dirty[i >> 3] |= 1 << (i & 7);
+    s->changed++;
+  }
+  s->verified++;
+}
+
+uint8_t upg_verify_done(upg_state_t *s) {
+  if (s->verified != s->chunks || ~s->crc != s->rom_crc)
+    return UPG_ERR_ROM_CRC;
+  return UPG_OK;
+}
+
+const char *upg_error_str(uint8_t err) {
+  switch (err) {
+    case UPG_OK:             return "OK";
+    case UPG_ERR_HEADER_CRC: return "Header CRC mismatch";
+    case UPG_ERR_ID:         return "Invalid upgrade file header";
+    case UPG_ERR_SIZE:       return "ROM size mismatch";
+    case UPG_ERR_TOO_LARGE:  return "ROM too large";
+    case UPG_ERR_ROM_CRC:    return "ROM CRC mismatch";
+  }
+  return "Unknown error";
+}
+
+// program the changed chunks, returns the number of programmed pages or -1
+// if a chunk couldn't be read before the flash was touched
+RAMFUNC int32_t upg_program(upg_state_t *s, const upg_target_t *t) {
+  uint32_t page, programmed = 0;
+  uint16_t i, j, pages;
+  uint8_t retries;
+
+  for (i = 0, page = 0; i < s->chunks; i++, page += s->chunk_pages) {
+    if (t->progress) t->progress(i, s->chunks);
+    if (!upg_chunk_dirty(s, i)) continue;
+
+    for (retries = 0; ; retries++) {
+      if (t->read(i, t->buffer) && upg_sum(t->buffer, upg_chunk_len(s, i)) == s->sum[i])
+        break;
+      if (!programmed && retries >= UPG_READ_RETRIES)
+        return -1;
+    }
+
+    pages = (i == s->chunks - 1) ? s->last_pages : s->chunk_pages;
+    for (j = 0; j < pages; j++) {
+      if (!t->program(page + j, (const uint32_t*)(t->buffer + j * s->page_size)))
+        return programmed;
+      programmed++;
+    }
+  }
+  if (t->progress) t->progress(s->chunks, s->chunks);
+
+  return programmed;
+}
@@ -0,0 +1,90 @@
+/*
+ * upgrade.h
+ * Firmware upgrade file format and the verify and flash steps shared by
+ * the firmware and the mkupg host tool
+ *
+ */
+
+#ifndef UPGRADE_H
+#define UPGRADE_H
+
+#include <stdint.h>
+#include "attrs.h"
+
+typedef struct
+{
+    uint32_t flags;
+    uint32_t base;
+    uint32_t size;
+    uint32_t crc;
+} __attribute__ ((packed)) romTYPE;
+
+typedef struct
+{
+    unsigned char id[8];
+    unsigned char version[16];
+    romTYPE       rom;
+    uint32_t      padding[117];
+    uint32_t      crc;
+} __attribute__ ((packed)) UPGRADE;
+
+// max. number of chunks of a ROM image, chunks are a multiple of the
+// flash erase unit
+#ifndef UPG_MAX_CHUNKS
+#define UPG_MAX_CHUNKS 256
+#endif
+
+// read attempts of a chunk before the upgrade is given up
+#define UPG_READ_RETRIES 8
+
+// upg_check_header() results
+#define UPG_OK             0
+#define UPG_ERR_HEADER_CRC 1
+#define UPG_ERR_ID         2
+#define UPG_ERR_SIZE       3
+#define UPG_ERR_TOO_LARGE  4
+#define UPG_ERR_ROM_CRC    5
+
+typedef struct {
+  uint32_t size;         // ROM size
+  uint32_t chunk_size;
+  uint16_t page_size;
+  uint16_t chunk_pages;  // flash pages per chunk
+  uint16_t last_pages;   // flash pages of the last chunk
+  uint16_t chunks;
+  uint16_t changed;      // chunks which differ from the flash
+  uint16_t verified;     // chunks passed to upg_verify_chunk()
+  uint32_t rom_crc;      // from the header
+  uint32_t crc;
+  uint32_t sum[UPG_MAX_CHUNKS];
+  uint8_t dirty[(UPG_MAX_CHUNKS + 7) / 8];
+} upg_state_t;
+
+// flash side of upg_program(), all functions must run from RAM
+typedef struct {
+  uint8_t *buffer;       // chunk_size bytes, word aligned
+  // read a chunk of the ROM into buffer, 0 on error
+  uint8_t (*read)(uint16_t chunk, uint8_t *buf);
+  // program one page, 0 stops the upgrade (power loss simulation)
+  uint8_t (*program)(uint32_t page, const uint32_t *data);
+  void (*progress)(uint16_t chunk, uint16_t chunks);
+} upg_target_t;
+
+// bytes of the ROM in a chunk
+static inline __attribute__((always_inline)) uint32_t upg_chunk_len(const upg_state_t *s, uint16_t chunk) {
+  uint32_t start = chunk * s->chunk_size;
+  return (s->size - start < s->chunk_size) ? s->size - start : s->chunk_size;
+}
+
+static inline __attribute__((always_inline)) uint8_t upg_chunk_dirty(const upg_state_t *s, uint16_t chunk) {
+  return s->dirty[chunk >> 3] & (1 << (chunk & 7));
+}
+
+uint8_t upg_check_header(upg_state_t *s, const UPGRADE *hdr, const char *id, uint32_t file_size,
+                         uint32_t chunk_size, uint16_t page_size);
+void upg_verify_chunk(upg_state_t *s, const uint8_t *data, const uint8_t *flash);
+uint8_t upg_verify_done(upg_state_t *s);
+const char *upg_error_str(uint8_t err);
+int32_t upg_program(upg_state_t *s, const upg_target_t *t) RAMFUNC;
+
+#endif // UPGRADE_H
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "upgrade.h"
+
+// Runs the verify and flash steps of upgrade.c against a simulated flash:
+// fresh and incremental upgrades, power loss while programming, read
+// errors and modified files between verify and flashing, broken headers.
+
+#define FW_ID     "MNMGUPG"
+#define FLASHSIZE 0x40000
+#define ROMSIZE   200003
+
+static upg_state_t upg;
+static uint8_t upgfile[sizeof(UPGRADE) + FLASHSIZE * 2];
+static uint8_t flash[FLASHSIZE];
+static uint8_t buffer[8192] __attribute__ ((aligned(4)));
+static uint32_t romsize, pagesize;
+static uint32_t programmed, limit, reads, read_errors, corrupt;
+static uint64_t bytes_read;
+static uint32_t errors;
+
+static void make_upg(uint32_t size, uint32_t seed, uint32_t patch_at) {
+  UPGRADE *hdr = (UPGRADE*)upgfile;
+  uint8_t *rom = upgfile + sizeof(UPGRADE);
+  uint32_t i;
+
+  srand(seed);
+  for (i = 0; i < size; i++) rom[i] = rand();
+  if (patch_at) rom[patch_at] ^= 0x55;
+
+  memset(hdr, 0, sizeof(UPGRADE));
+  strcpy((char*)hdr->id, FW_ID);
+  strcpy((char*)hdr->version, "ATH261019");
+  hdr->rom.size = size;
+  hdr->rom.crc = ~crc32_update(CRC32_INIT, rom, size);
+  hdr->crc = ~crc32_update(CRC32_INIT, hdr, sizeof(UPGRADE) - 4);
+  romsize = size;
+}
+
+// ---------- simulated flash target ----------
+static uint8_t t_read(uint16_t chunk, uint8_t *buf) {
+  uint32_t len = upg_chunk_len(&upg, chunk);
+
+  reads++;
+  bytes_read += len;
+  if (read_errors) {
+    read_errors--;
+    return 0;
+  }
+  memcpy(buf, upgfile + sizeof(UPGRADE) + chunk * upg.chunk_size, len);
+  if (corrupt) buf[corrupt % len] ^= 1;
+  return 1;
+}
+
+static uint8_t t_program(uint32_t page, const uint32_t *data) {
+  if (limit && programmed == limit) return 0;
+  if ((page + 1) * pagesize > FLASHSIZE) {
+    printf("page %u outside of the flash\n", page);
+    errors++;
+    return 0;
+  }
+  memcpy(flash + page * pagesize, data, pagesize);
+  programmed++;
+  return 1;
+}
+
+static uint16_t last_progress;
+static void t_progress(uint16_t chunk, uint16_t chunks) {
+  last_progress = chunk;
+}
+
+static const upg_target_t target = { buffer, t_read, t_program, t_progress };
+
+// CheckFirmware() and WriteFirmware()
+static int32_t upgrade(uint32_t chunksize) {
+  uint16_t i;
+  uint8_t err;
+
+  err = upg_check_header(&upg, (UPGRADE*)upgfile, FW_ID, sizeof(UPGRADE) + romsize, chunksize, pagesize);
+  if (err != UPG_OK) return -10 - err;
+  for (i = 0; i < upg.chunks; i++) {
+    bytes_read += upg_chunk_len(&upg, i);
+    upg_verify_chunk(&upg, upgfile + sizeof(UPGRADE) + i * chunksize, flash + i * chunksize);
+  }
+  err = upg_verify_done(&upg);
+  if (err != UPG_OK) return -10 - err;
+
+  programmed = 0;
+  return upg_program(&upg, &target);
+}
+
+static void check(int cond, const char *msg) {
+  if (!cond) {
+    printf("%s\n", msg);
+    errors++;
+  }
+}
+
+static int flash_ok() {
+  return !memcmp(flash, upgfile + sizeof(UPGRADE), romsize);
+}
+
+static void test_geometry(uint32_t psize, uint32_t chunksize) {
+  uint32_t pages_per_chunk = chunksize / psize;
+  uint32_t chunks = (ROMSIZE + chunksize - 1) / chunksize;
+  int32_t ret;
+
+  printf("page size %u, block size %u\n", psize, chunksize);
+  pagesize = psize;
+  memset(flash, 0xff, sizeof(flash));
+  limit = read_errors = corrupt = 0;
+
+  // erased flash
+  make_upg(ROMSIZE, 1, 0);
+  bytes_read = 0;
+  ret = upgrade(chunksize);
+  check(ret == (ROMSIZE + psize - 1) / psize, "fresh: wrong number of programmed pages");
+  check(flash_ok(), "fresh: flash differs");
+  check(last_progress == upg.chunks, "fresh: progress not completed");
+  printf("  fresh upgrade        : %4d pages, %7llu bytes read (was %u)\n", ret,
+         (unsigned long long)bytes_read, 2 * ROMSIZE);
+
+  // same firmware again
+  reads = 0;
+  ret = upgrade(chunksize);
+  check(ret == 0 && reads == 0 && upg.changed == 0, "same: flash was written");
+
+  // two bytes changed in different chunks
+  make_upg(ROMSIZE, 1, chunksize * 3 + 100);
+  ((uint8_t*)upgfile)[sizeof(UPGRADE) + ROMSIZE - 1] ^= 0xff;
+  ((UPGRADE*)upgfile)->rom.crc = ~crc32_update(CRC32_INIT, upgfile + sizeof(UPGRADE), ROMSIZE);
+  ((UPGRADE*)upgfile)->crc = ~crc32_update(CRC32_INIT, upgfile, sizeof(UPGRADE) - 4);
+  bytes_read = 0;
+  ret = upgrade(chunksize);
+  check(upg.changed == 2, "incremental: wrong number of changed chunks");
+  check(ret == pages_per_chunk + (ROMSIZE - (chunks - 1) * chunksize + psize - 1) / psize,
+        "incremental: wrong number of programmed pages");
+  check(flash_ok(), "incremental: flash differs");
+  printf("  incremental upgrade  : %4d pages, %7llu bytes read\n", ret, (unsigned long long)bytes_read);
+
+  // power loss in the middle of a chunk, then the upgrade is started again
+  make_upg(ROMSIZE, 2, 0);
+  limit = pages_per_chunk * 5 + pages_per_chunk / 2;
+  ret = upgrade(chunksize);
+  check(ret == limit && !flash_ok(), "power loss: upgrade not interrupted");
+  limit = 0;
+  ret = upgrade(chunksize);
+  check(upg.changed == chunks - 5, "resume: wrong number of changed chunks");
+  check(flash_ok(), "resume: flash differs");
+  printf("  resumed upgrade      : %4d pages\n", ret);
+
+  // read errors before anything is programmed give up, the flash is untouched
+  make_upg(ROMSIZE, 3, 0);
+  memcpy(buffer, flash, 16);
+  read_errors = 100;
+  ret = upgrade(chunksize);
+  check(ret == -1 && programmed == 0, "read errors: flash was written");
+  check(read_errors == 100 - UPG_READ_RETRIES - 1, "read errors: wrong number of retries");
+
+  // a few read errors are retried
+  read_errors = 3;
+  ret = upgrade(chunksize);
+  check(ret > 0 && flash_ok(), "read retries: flash differs");
+
+  // the file changed after it was verified
+  make_upg(ROMSIZE, 4, 0);
+  upg_check_header(&upg, (UPGRADE*)upgfile, FW_ID, sizeof(UPGRADE) + romsize, chunksize, pagesize);
+  corrupt = 777;
+  ret = upgrade(chunksize);
+  corrupt = 0;
+  check(ret == -1 && programmed == 0, "modified file: flash was written");
+}
+
+static void test_headers() {
+  UPGRADE *hdr = (UPGRADE*)upgfile;
+
+  make_upg(1000, 5, 0);
+  check(upg_check_header(&upg, hdr, FW_ID, sizeof(UPGRADE) + 1000, 4096, 256) == UPG_OK, "header: valid header rejected");
+  check(upg_check_header(&upg, hdr, FW_ID, sizeof(UPGRADE) + 999, 4096, 256) == UPG_ERR_SIZE, "header: size mismatch not detected");
+  check(upg_check_header(&upg, hdr, "SIDIUPG", sizeof(UPGRADE) + 1000, 4096, 256) == UPG_ERR_ID, "header: wrong id not detected");
+  hdr->version[0] ^= 1;
+  check(upg_check_header(&upg, hdr, FW_ID, sizeof(UPGRADE) + 1000, 4096, 256) == UPG_ERR_HEADER_CRC, "header: crc error not detected");
+
+  make_upg(UPG_MAX_CHUNKS * 256 + 1, 6, 0);
+  check(upg_check_header(&upg, hdr, FW_ID, sizeof(UPGRADE) + romsize, 256, 256) == UPG_ERR_TOO_LARGE, "header: too large image accepted");
+
+  // rom crc
+  make_upg(1000, 7, 0);
+  upgfile[sizeof(UPGRADE) + 10] ^= 1;
+  pagesize = 256;
+  check(upgrade(4096) == -10 - UPG_ERR_ROM_CRC, "rom crc error not detected");
+}
+
+int main() {
+  test_headers();
+  test_geometry(256, 4096);  // AT91SAM7S256
+  test_geometry(512, 8192);  // ATSAMV71
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
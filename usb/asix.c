@@ -8,6 +8,7 @@
 
 #include "debug.h"
 #include "usb.h"
+#include "usbsched.h"
 #include "asix.h"
 #include "timer.h"
 #include "mii.h"
@@ -16,9 +17,13 @@
 #include "hardware.h"
 #include "tos.h"
 #include "user_io.h"
+#include "eth_bridge.h"
 
 #define MAX_FRAMELEN 1536
 
+// max. number of usb packets moved per bulk endpoint and poll
+#define ASIX_BULK_BURST 32
+
 static unsigned char rx_buf[MAX_FRAMELEN+64];
 static uint16_t rx_cnt;
 
@@ -335,6 +340,9 @@ static uint8_t asix_parse_conf(usb_device_t *dev, uint8_t conf, uint16_t len) {
   return 0;
 }
 
+static uint8_t usb_asix_poll_irq(usb_device_t *dev, uint8_t idx);
+static uint8_t usb_asix_poll_bulk(usb_device_t *dev, uint8_t idx);
+
 static uint8_t usb_asix_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc) {
   usb_asix_info_t *info = &(dev->asix_info);
   uint8_t i, rcode = 0;
@@ -360,7 +368,7 @@ static uint8_t usb_asix_init(usb_device_t *dev, usb_device_descriptor_t *dev_des
   }
 
   // reset status
-  info->qLastIrqPollTime = info->qLastBulkPollTime = info->qLastMACSendTime = 0;
+  info->qLastMACSendTime = 0;
   info->bPollEnable = false;
   info->linkDetected = false;
 
@@ -508,8 +516,11 @@ static uint8_t usb_asix_init(usb_device_t *dev, usb_device_descriptor_t *dev_des
   asix_debugf("Medium Status is 0x%04x after all initializations", rx_ctl);
 
   info->bPollEnable = true;
+  usb_sched_add(dev, usb_asix_poll_irq, 0, EP_TYPE_INTR, info->int_poll_ms);
+  usb_sched_add(dev, usb_asix_poll_bulk, 0, EP_TYPE_BULK, 2);
 
   rx_cnt = tx_cnt = 0;  // reset buffers
+  eth_bridge_init();
 
   // finally inform core about ethernet support
   tos_update_sysctrl(tos_system_ctrl() | TOS_CONTROL_ETHERNET);
@@ -558,170 +569,171 @@ static uint8_t usb_asix_poll(usb_device_t *dev) {
     info->qLastMACSendTime = timer_get_msec();
   }
 
-  // poll interrupt endpoint
-  if (timer_check(info->qLastIrqPollTime, info->int_poll_ms)) {
-    uint16_t read = info->ep[info->ep_int_idx].maxPktSize;
-    uint8_t buf[info->ep[info->ep_int_idx].maxPktSize];
-    uint8_t rcode = usb_in_transfer(dev, &(info->ep[info->ep_int_idx]), &read, buf);
-    
-    if (rcode) {
-      if (rcode != hrNAK)
-	iprintf("%s() error: %x\n", __FUNCTION__, rcode);
-    } else {
-      //            iprintf("ASIX: int %d bytes\n", read);
-      //            hexdump(buf, read, 0);
+  return rcode;
+}
 
-      // primary or secondary link detected?
-      bool link_detected = ((buf[2] & 3) != 0); 
+// interrupt endpoint, link state
+static uint8_t usb_asix_poll_irq(usb_device_t *dev, uint8_t idx) {
+  usb_asix_info_t *info = &(dev->asix_info);
 
-      if(link_detected != info->linkDetected) {
-	if(link_detected) {
-	  iprintf("ASIX: Link detected\n");	  
-	} else
-	  iprintf("ASIX: Link lost\n");
-	
-	info->linkDetected = link_detected;
-      }
+  if (!info->bPollEnable)
+    return 0;
+
+  uint16_t read = info->ep[info->ep_int_idx].maxPktSize;
+  uint8_t buf[info->ep[info->ep_int_idx].maxPktSize];
+  uint8_t rcode = usb_in_transfer(dev, &(info->ep[info->ep_int_idx]), &read, buf);
+
+  if (rcode) {
+    if (rcode != hrNAK)
+      iprintf("%s() error: %x\n", __FUNCTION__, rcode);
+  } else {
+    //            iprintf("ASIX: int %d bytes\n", read);
+    //            hexdump(buf, read, 0);
+
+    // primary or secondary link detected?
+    bool link_detected = ((buf[2] & 3) != 0); 
+
+    if(link_detected != info->linkDetected) {
+      if(link_detected) {
+	iprintf("ASIX: Link detected\n");	  
+      } else
+	iprintf("ASIX: Link lost\n");
+
+      info->linkDetected = link_detected;
     }
-    info->qLastIrqPollTime = timer_get_msec();
   }
+  return 0;
+}
 
-  // bulk ep polling at fixed 500Hz
-  if (timer_check(info->qLastBulkPollTime, 2)) {
-    uint8_t rcode;
-    static uint32_t old_status = 0;
-    uint32_t status = user_io_eth_get_status();
-
-    if(status != old_status) {
-      asix_debugf("status changed to cmd %x, eq=%d, prx=%d, ptx=%d, len=%d",
-		  status >> 24, (status & 0x40000)?1:0, (status & 0x20000)?1:0,
-		  (status & 0x10000)?1:0, status & 0xffff);
-      old_status = status;
-    }
-    
-    // --------- poll FPGA for data to be transmitted ------------
-    
-    // no transmission in progress?
-    if(!tx_cnt) {
-      if((status >> 24) == 0xa5) {
-	uint16_t len = status & 0xffff;
-	
-	if(len <= MAX_FRAMELEN) {
-	  // iprintf("TX %d\n", len);
-	  
-	  // read frame into local tx buffer, leave 4 bytes space for
-	  // axis packet header marker
-	  user_io_eth_receive_tx_frame(tx_buf+4, len);
-	  
-	  // hexdump(tx_buf+4, len, 0);
-	  
-	  // schedule packet for transmissoin
-	  usb_asix_xmit(len);
-	}
-      }
-    }
-    
-    // check if there's something to transmit
-    if(tx_cnt) {
-      uint16_t bytes2send = (tx_cnt-tx_offset > info->ep[2].maxPktSize)?
-	info->ep[2].maxPktSize:(tx_cnt-tx_offset);
-      
-      //  asix_debugf("bulk out %d of %d (ep %d), off %d", 
-      //      bytes2send, tx_cnt, info->ep[2].maxPktSize, tx_offset);  
-      rcode = usb_out_transfer(dev, &(info->ep[2]), bytes2send, tx_buf + tx_offset);
-      //      asix_debugf("%s() error: %x", __FUNCTION__, rcode);  
-
-      tx_offset += bytes2send;
-      
-      // mark buffer as free after last pkt was sent
-      if(bytes2send != info->ep[2].maxPktSize)
-	tx_cnt = 0;
-    }
+// bulk endpoints, polled at 500Hz
+static uint8_t usb_asix_poll_bulk(usb_device_t *dev, uint8_t idx) {
+  usb_asix_info_t *info = &(dev->asix_info);
+  uint8_t rcode = 0, burst;
+  uint8_t *frame;
+  uint16_t len;
 
-    // poll for rx if receive irq has been cleared (PRX==0)
-    if(!(status & 0x20000)) {
-      // Try to read from bulk in endpoint (ep 2). Raw packets are received this way.
-      // The last USB packet being part of an ethernet frame is marked by being shorter
-      // than the USB FIFO size. If the last packet is exaclty if FIFO size, then an
-      // additional 0 byte packet is appended
-      uint16_t read = info->ep[1].maxPktSize;
-
-      // the rx buffer size (1536+64) can hold an additional maxPktSize (64),
-      // so a transfer still fits into the buffer or there's already 
-      // a full frame present. If it's full we drop all data. This will leave 
-      // the buffered packet incomplete which isn't a problem since
-      // the packet was too long, anyway.
-      uint8_t *data = (rx_cnt < MAX_FRAMELEN)?(rx_buf + rx_cnt):NULL;
-      rcode = usb_in_transfer(dev, &(info->ep[1]), &read, data);
-      
-      if (rcode) {
-	if (rcode != hrNAK)
-	  asix_debugf("%s() error: %x", __FUNCTION__, rcode);
-      } else {
-	rx_cnt += read;
-
-	// check if packet has a valid header
-	uint16_t len0 = (*(uint16_t*)rx_buf) & 0x7ff;
-	uint16_t len1 = (~(*(uint16_t*)(rx_buf+2))) & 0x7ff;
-
-	if(len0 != len1) {
-	  asix_debugf("dropping malformed packet (len %d:%d)", len0, len1);
-	  rx_cnt = 0;
-	} else if(rx_cnt-4 >= len0) {
-	  bool ok2fwd = 0;
+  if (!info->bPollEnable)
+    return 0;
 
-	  // enough room to store the entire packet
+  // exchange frames with the core
+  eth_bridge_poll();
 
-	  // process packet
-	  //	  iprintf("RX %d\n", len0);
-	  //	  hexdump(rx_buf+4, len0, 0);
-	  //	  hexdump(rx_buf+4, 32, 0);
+  // --------- take the next frame from the core ------------
 
-	  uint16_t frame_size = len0;
-	  if(frame_size < 64) frame_size = 64;
+  // no transmission in progress?
+  if(!tx_cnt && (len = eth_bridge_tx_get(&frame))) {
+    // iprintf("TX %d\n", len);
+
+    // copy frame into local tx buffer, leave 4 bytes space for
+    // axis packet header marker
+    memcpy(tx_buf+4, frame, len);
+    eth_bridge_tx_done();
+
+    // hexdump(tx_buf+4, len, 0);
+
+    // schedule packet for transmissoin
+    usb_asix_xmit(len);
+  }
 
-	  // do some sanity checks on frame
-	  //	  iprintf("RX mac = %02x:%02x:%02x:%02x:%02x:%02x\n",
-	  //		  rx_buf[4]&0xff,rx_buf[5]&0xff,rx_buf[6]&0xff,
-	  //		  rx_buf[7]&0xff,rx_buf[8]&0xff,rx_buf[9]&0xff);
+  // check if there's something to transmit
+  for(burst = 0; tx_cnt && burst < ASIX_BULK_BURST; burst++) {
+    uint16_t bytes2send = (tx_cnt-tx_offset > info->ep[2].maxPktSize)?
+      info->ep[2].maxPktSize:(tx_cnt-tx_offset);
 
-	  /* check for own or braodcast mac */
-	  if(!memcmp(rx_buf+4, info->mac, ETH_ALEN)) {
-	    //	    iprintf("MY MAC!!\n");
+    //  asix_debugf("bulk out %d of %d (ep %d), off %d", 
+    //      bytes2send, tx_cnt, info->ep[2].maxPktSize, tx_offset);  
+    rcode = usb_out_transfer(dev, &(info->ep[2]), bytes2send, tx_buf + tx_offset);
+    //      asix_debugf("%s() error: %x", __FUNCTION__, rcode);  
+
+    tx_offset += bytes2send;
+
+    // mark buffer as free after last pkt was sent
+    if(bytes2send != info->ep[2].maxPktSize)
+      tx_cnt = 0;
+  }
+
+  // poll for rx as long as the rx queue can take a frame
+  for(burst = 0; eth_bridge_rx_get_buffer() && burst < ASIX_BULK_BURST; burst++) {
+    // Try to read from bulk in endpoint (ep 2). Raw packets are received this way.
+    // The last USB packet being part of an ethernet frame is marked by being shorter
+    // than the USB FIFO size. If the last packet is exaclty if FIFO size, then an
+    // additional 0 byte packet is appended
+    uint16_t read = info->ep[1].maxPktSize;
+
+    // the rx buffer size (1536+64) can hold an additional maxPktSize (64),
+    // so a transfer still fits into the buffer or there's already 
+    // a full frame present. If it's full we drop all data. This will leave 
+    // the buffered packet incomplete which isn't a problem since
+    // the packet was too long, anyway.
+    uint8_t *data = (rx_cnt < MAX_FRAMELEN)?(rx_buf + rx_cnt):NULL;
+    rcode = usb_in_transfer(dev, &(info->ep[1]), &read, data);
+
+    if (rcode) {
+      if (rcode != hrNAK)
+	asix_debugf("%s() error: %x", __FUNCTION__, rcode);
+      break;
+    } else {
+      rx_cnt += read;
+
+      // check if packet has a valid header
+      uint16_t len0 = (*(uint16_t*)rx_buf) & 0x7ff;
+      uint16_t len1 = (~(*(uint16_t*)(rx_buf+2))) & 0x7ff;
+
+      if(len0 != len1) {
+	asix_debugf("dropping malformed packet (len %d:%d)", len0, len1);
+	eth_bridge_rx_drop(1);
+	rx_cnt = 0;
+      } else if(rx_cnt-4 >= len0) {
+	bool ok2fwd = 0;
+
+	// enough room to store the entire packet
+
+	// process packet
+	//	  iprintf("RX %d\n", len0);
+	//	  hexdump(rx_buf+4, len0, 0);
+	//	  hexdump(rx_buf+4, 32, 0);
+
+	// do some sanity checks on frame
+	//	  iprintf("RX mac = %02x:%02x:%02x:%02x:%02x:%02x\n",
+	//		  rx_buf[4]&0xff,rx_buf[5]&0xff,rx_buf[6]&0xff,
+	//		  rx_buf[7]&0xff,rx_buf[8]&0xff,rx_buf[9]&0xff);
+
+	/* check for own or braodcast mac */
+	if(!memcmp(rx_buf+4, info->mac, ETH_ALEN)) {
+	  //	    iprintf("MY MAC!!\n");
+	  ok2fwd = 1;  // forward packet into core
+	}
+
+	if((rx_buf[4] == 0xff)&&(rx_buf[5] == 0xff)&&(rx_buf[6] == 0xff)&&
+	   (rx_buf[7] == 0xff)&&(rx_buf[8] == 0xff)&&(rx_buf[9] == 0xff)) {
+	  //	    iprintf("BROADCAST MAC %x/%x\n", rx_buf[16], rx_buf[17]);
+
+	  // accept broadcasts only for arp
+	  if((rx_buf[16] == 0x08) && (rx_buf[17] == 0x06))
 	    ok2fwd = 1;  // forward packet into core
-	  }
-	  
-	  if((rx_buf[4] == 0xff)&&(rx_buf[5] == 0xff)&&(rx_buf[6] == 0xff)&&
-	     (rx_buf[7] == 0xff)&&(rx_buf[8] == 0xff)&&(rx_buf[9] == 0xff)) {
-	    //	    iprintf("BROADCAST MAC %x/%x\n", rx_buf[16], rx_buf[17]);
-
-	    // accept broadcasts only for arp
-	    if((rx_buf[16] == 0x08) && (rx_buf[17] == 0x06))
-	      ok2fwd = 1;  // forward packet into core
-	  }
-
-	  // forward frame to FPGA
-	  if(ok2fwd)
-	    user_io_eth_send_rx_frame(rx_buf+4, frame_size);
-	  //	  else
-	  //	    iprintf("ASIX: frame dropped\n");
-
-	  if((rx_cnt-4 > len0) && (rx_cnt < MAX_FRAMELEN+64)) {
-	    // packets are 16 bit padded
-	    if(len0 & 1) len0++;
-	    
-	    // remove len0+4 bytes from buffer
-	    memcpy(rx_buf, rx_buf + len0 + 4, MAX_FRAMELEN + 64 - len0 - 4);
-	    rx_cnt -= len0 + 4;
-	    
-	    // asix_debugf("bytes left in buffer: %d", rx_cnt);
-	  } else
-	    rx_cnt = 0;
 	}
-      }
-    }    
 
-    info->qLastBulkPollTime = timer_get_msec();
+	// queue frame for the FPGA
+	if(ok2fwd && len0 <= ETH_BRIDGE_FRAMELEN) {
+	  memcpy(eth_bridge_rx_get_buffer(), rx_buf+4, len0);
+	  eth_bridge_rx_put(len0);
+	}
+	//	  else
+	//	    iprintf("ASIX: frame dropped\n");
+
+	if((rx_cnt-4 > len0) && (rx_cnt < MAX_FRAMELEN+64)) {
+	  // packets are 16 bit padded
+	  if(len0 & 1) len0++;
+
+	  // remove len0+4 bytes from buffer
+	  memcpy(rx_buf, rx_buf + len0 + 4, MAX_FRAMELEN + 64 - len0 - 4);
+	  rx_cnt -= len0 + 4;
+
+	  // asix_debugf("bytes left in buffer: %d", rx_cnt);
+	} else
+	  rx_cnt = 0;
+      }
+    }
   }
 
   return rcode;
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 
 #include "usb.h"
+#include "usbsched.h"
 #include "max3421e.h"
 #include "timer.h"
 #include "hidparser.h"
@@ -15,6 +16,7 @@
 #include "../mist_cfg.h"
 #include "../osd.h"
 #include "../state.h"
+#include "../prof.h"
 
 
 static unsigned char kbd_led_state = 0;  // default: all leds off
@@ -292,6 +294,8 @@ static uint8_t usb_hid_parse_conf(usb_device_t *dev, uint8_t conf, uint16_t len)
 	return 0;
 }
 
+static uint8_t usb_hid_poll(usb_device_t *dev, uint8_t idx);
+
 static uint8_t usb_hid_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc) {
 	hid_debugf("%s(%x)", __FUNCTION__, dev->bAddress);
 
@@ -308,7 +312,7 @@ static uint8_t usb_hid_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc
 	info->bNumIfaces = 0;
 
 	for(i=0;i<MAX_IFACES;i++) {
-		info->iface[i].qLastPollTime = 0;
+		info->iface[i].last_report_len = 0;
 		info->iface[i].ep.epAddr     = i;
 		info->iface[i].ep.epType     = 0;
 		info->iface[i].ep.maxPktSize = 8;
@@ -421,6 +425,12 @@ static uint8_t usb_hid_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc
 					  info->iface[0].conf.joystick_mouse.button[but].bitmask, but);
 				}
 			}
+
+			// the button description may have been changed
+			hid_report_compile(&info->iface[i].conf);
+
+			if(info->iface[i].device_type == HID_DEVICE_JOYSTICK)
+				virtual_joystick_mapping_init(&info->iface[i].vmap, vid, pid);
 		}
 		rcode = hid_set_idle(dev, info->iface[i].iface_idx, 0, 0);
 		if (rcode && rcode != hrSTALL) {
@@ -456,6 +466,12 @@ static uint8_t usb_hid_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc
 	}
 
 	info->bPollEnable = true;
+
+	// poll the interrupt endpoints at the requested rate
+	for(i=0;i<info->bNumIfaces;i++)
+		if(info->iface[i].device_type != HID_DEVICE_UNKNOWN)
+			usb_sched_add(dev, usb_hid_poll, i, EP_TYPE_INTR, info->iface[i].interval);
+
 	return 0;
 }
 
@@ -568,52 +584,20 @@ static void handle_5200daptor(usb_device_t *dev, usb_hid_iface_info_t *iface, ui
 	}
 }
 
-// collect bits from byte stream and assemble them into a signed word
-static uint16_t collect_bits(uint8_t *p, uint16_t offset, uint8_t size, bool is_signed) {
-	// mask unused bits of first byte
-	uint8_t mask = 0xff << (offset&7);
-	uint8_t byte = offset/8;
-	uint8_t bits = size;
-	uint8_t shift = offset&7;
-
-	//  iprintf("0 m:%x by:%d bi=%d sh=%d ->", mask, byte, bits, shift);
-	uint16_t rval = (p[byte++] & mask) >> shift;
-	//  iprintf("%d\n", (int16_t)rval);
-	mask = 0xff;
-	shift = 8-shift;
-	bits -= shift;
-
-	// first byte already contained more bits than we need
-	if(shift > size) {
-		//    iprintf("  too many bits, masked %x ->", (1<<size)-1);
-		// mask unused bits
-		rval &= (1<<size)-1;
-		//    iprintf("%d\n", (int16_t)rval);
-	} else {
-		// further bytes if required
-		while(bits) {
-			mask = (bits<8)?(0xff>>(8-bits)):0xff;
-			//      iprintf("+ m:%x by:%d bi=%d sh=%d ->", mask, byte, bits, shift);
-			rval += (p[byte++] & mask) << shift;
-			//      iprintf("%d\n", (int16_t)rval);
-			shift += 8;
-			bits -= (bits>8)?8:bits;
-		}
-	}
+// Joysticks repeat the same report as long as nothing changes. Skip these, but
+// still process one every HID_REPORT_REFRESH ms, so changes of the OSD state,
+// remaps or the core take effect
+static bool hid_report_unchanged(usb_hid_iface_info_t *iface, uint8_t *buf, uint16_t len) {
+	if(len > HID_REPORT_CACHE_SIZE) return false;
 
-	if(is_signed) {
-		// do sign expansion
-		uint16_t sign_bit = 1<<(size-1);
-		if(rval & sign_bit) {
-			while(sign_bit) {
-				rval |= sign_bit;
-				sign_bit <<= 1;
-			}
-			// iprintf(" is negative -> sign expand to %d\n", (int16_t)rval);
-		}
-	}
+	if(len == iface->last_report_len && !memcmp(iface->last_report, buf, len) &&
+	   !timer_check(iface->last_report_time, HID_REPORT_REFRESH))
+		return true;
 
-	return rval;
+	memcpy(iface->last_report, buf, len);
+	iface->last_report_len = len;
+	iface->last_report_time = timer_get_msec();
+	return false;
 }
 
 static usb_hid_iface_info_t *virt_joy_kbd_iface = NULL;
@@ -662,6 +646,10 @@ static void usb_process_iface (usb_device_t *dev,
 			int16_t a[MAX_AXES];
 			static int16_t rem[MAX_AXES];
 			uint8_t idx, i;
+			uint16_t buttons;
+
+			if((iface->device_type == HID_DEVICE_JOYSTICK) && hid_report_unchanged(iface, buf, read))
+				return;
 
 			// skip report id if present
 			uint8_t *p = buf+(conf->report_id?1:0);
@@ -669,24 +657,13 @@ static void usb_process_iface (usb_device_t *dev,
 			// hid_debugf("data:"); hexdump(buf, read, 0);
 		
 			// several axes ...
-			for(i=0;i<MAX_AXES;i++) {
-				// if logical minimum is > logical maximum then logical minimum 
-				// is signed. This means that the value itself is also signed
-				bool is_signed = conf->joystick_mouse.axis[i].logical.min > 
-				conf->joystick_mouse.axis[i].logical.max;
-				a[i] = collect_bits(p, conf->joystick_mouse.axis[i].offset, 
-							conf->joystick_mouse.axis[i].size, is_signed);
-			}
-			
-			// ... and four  first buttons
-			for(i=0;i<4;i++)
-				if(p[conf->joystick_mouse.button[i].byte_offset] & 
-				 conf->joystick_mouse.button[i].bitmask) btn |= (1<<i);
-			
-			// ... and the eight extra buttons
-			for(i=4;i<12;i++)
-				if(p[conf->joystick_mouse.button[i].byte_offset] & 
-				 conf->joystick_mouse.button[i].bitmask) btn_extra |= (1<<(i-4));
+			for(i=0;i<MAX_AXES;i++)
+				a[i] = hid_report_field(&conf->prog.axis[i], p);
+
+			// ... four first buttons and the eight extra buttons
+			buttons = hid_report_buttons(conf, p);
+			btn = buttons & 0x0f;
+			btn_extra = buttons >> 4;
 
 			//if (btn_extra != 0)
 			//  iprintf("EXTRA BTNS:%d\n", btn_extra);
@@ -749,8 +726,7 @@ static void usb_process_iface (usb_device_t *dev,
 
 				// handle hat if present and overwrite any axis value
 				if(conf->joystick_mouse.hat.size && !mist_cfg.joystick_ignore_hat) {
-					uint8_t hat = collect_bits(p, conf->joystick_mouse.hat.offset, 
-								 conf->joystick_mouse.hat.size, 0);
+					uint8_t hat = hid_report_field(&conf->prog.hat, p);
 
 					//  iprintf("HAT = %d\n", hat);
 
@@ -820,7 +796,7 @@ static void usb_process_iface (usb_device_t *dev,
 				// map virtual joypad
 				uint32_t vjoy = jmap;
 				vjoy |= btn_extra << 8;
-				vjoy = virtual_joystick_mapping( dev->vid, dev->pid, vjoy );
+				vjoy = virtual_joystick_mapping( &iface->vmap, vjoy );
 
 				//iprintf("VIRTUAL JOY:%d\n", vjoy);
 				//if (jmap != 0) iprintf("JMAP pre map:%d\n", jmap);
@@ -886,37 +862,32 @@ static void usb_process_iface (usb_device_t *dev,
 }
 
 
-static uint8_t usb_hid_poll(usb_device_t *dev) {
+static uint8_t usb_hid_poll(usb_device_t *dev, uint8_t idx) {
 	usb_hid_info_t *info = &(dev->hid_info);
-	int8_t i;
+	usb_hid_iface_info_t *iface = info->iface+idx;
 
 	if (!info->bPollEnable)
 		return 0;
 
-	for(i=0;i<info->bNumIfaces;i++) {
-		usb_hid_iface_info_t *iface = info->iface+i;
-		if(iface->device_type != HID_DEVICE_UNKNOWN) {
-
-			if (timer_check(iface->qLastPollTime, iface->interval)) { // poll at requested rate
-			//      hid_debugf("poll %d...", iface->ep.epAddr);
-				uint16_t read = iface->ep.maxPktSize;
-				// report may not fit into one packet
-				if (iface->conf.report_size > read)
-					read = iface->conf.report_size;
-				uint8_t buf[read];
-				// clear buffer
-				memset(buf, 0, iface->ep.maxPktSize);
-				uint8_t rcode = usb_in_transfer(dev, &(iface->ep), &read, buf);
-				if (rcode) {
-					if (rcode != hrNAK)
-						hid_debugf("%s() error: %d", __FUNCTION__, rcode);
-				} else {
-					usb_process_iface (dev, iface, read, buf);
-				}
-				iface->qLastPollTime = timer_get_msec();
-			}
-		} // end if known device
-	} // end for loop (bNumIfaces)
+	//      hid_debugf("poll %d...", iface->ep.epAddr);
+	uint16_t read = iface->ep.maxPktSize;
+	// report may not fit into one packet
+	if (iface->conf.report_size > read)
+		read = iface->conf.report_size;
+	uint8_t buf[read];
+	// clear buffer
+	memset(buf, 0, iface->ep.maxPktSize);
+	uint8_t rcode = usb_in_transfer(dev, &(iface->ep), &read, buf);
+	if (rcode) {
+		if (rcode != hrNAK)
+			hid_debugf("%s() error: %d", __FUNCTION__, rcode);
+	} else {
+		// arrival time for the input latency statistics
+		input_trace_begin((iface->device_type == HID_DEVICE_KEYBOARD) ? PROF_INPUT_KBD :
+		                  (iface->device_type == HID_DEVICE_MOUSE) ? PROF_INPUT_MOUSE : PROF_INPUT_JOY);
+		usb_process_iface (dev, iface, read, buf);
+		input_trace_end();
+	}
 	return 0;
 }
 
@@ -959,5 +930,5 @@ int8_t hid_keyboard_present(void) {
 }
 
 const usb_device_class_config_t usb_hid_class = {
-  usb_hid_init, usb_hid_release, usb_hid_poll };
+  usb_hid_init, usb_hid_release, NULL };
 
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <inttypes.h>
 #include "hidparser.h"
+#include "joymapping.h"
 
 #define HID_LED_NUM_LOCK    0x01
 #define HID_LED_CAPS_LOCK   0x02
@@ -51,6 +52,11 @@
 #define JOYSTICK_AXIS_TRIGGER_MIN   64
 #define JOYSTICK_AXIS_TRIGGER_MAX   192
 
+// joystick reports up to this size are compared with the previous one
+#define HID_REPORT_CACHE_SIZE       16
+// max. time an unchanged report is ignored
+#define HID_REPORT_REFRESH          100
+
 
 
 typedef struct {
@@ -70,9 +76,14 @@ typedef struct {
   uint32_t jmap;           // last reported joystick state
   uint16_t jindex;         // joystick index
   hid_report_t conf;
+  joymapping_table_t vmap; // virtual joystick mapping
 
   uint8_t interval;
-  uint32_t qLastPollTime;     // last poll time
+
+  // last joystick report, to skip unchanged ones
+  uint8_t last_report[HID_REPORT_CACHE_SIZE];
+  uint8_t last_report_len;
+  uint32_t last_report_time;
 
 } usb_hid_iface_info_t;
 
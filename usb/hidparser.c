@@ -282,8 +282,10 @@ bool parse_report_descriptor(uint8_t *rep, uint16_t rep_size, hid_report_t *conf
 						app_collection--;
 
 						// check if report is usable and stop parsing if it is
-						if(report_is_usable(bit_count, report_complete, conf))
+						if(report_is_usable(bit_count, report_complete, conf)) {
+							hid_report_compile(conf);
 							return true;
+						}
 						else {
 							// retry with next report
 							memset(conf, 0, sizeof(hid_report_t));
@@ -496,3 +498,127 @@ bool parse_report_descriptor(uint8_t *rep, uint16_t rep_size, hid_report_t *conf
 	// if we get here then no usable setup was found
 	return false;
 }
+
+static void compile_field(hid_field_t *field, uint16_t offset, uint8_t size, bool is_signed) {
+	field->byte = offset/8;
+	field->shift = offset&7;
+	field->is_signed = is_signed;
+
+	// only the lower 16 bits of larger fields are used, without sign
+	if(size > 16) {
+		size = 16;
+		field->is_signed = 0;
+	}
+	field->size = size;
+
+	if(!size)
+		field->kind = HID_FIELD_NONE;
+	else if(!field->shift && size == 8)
+		field->kind = HID_FIELD_BYTE;
+	else if(!field->shift && size == 16)
+		field->kind = HID_FIELD_WORD;
+	else
+		field->kind = HID_FIELD_BITS;
+}
+
+// precompute the extraction of the axes, hat and buttons, has to be called
+// again if the joystick_mouse description is changed
+void hid_report_compile(hid_report_t *conf) {
+	hid_report_program_t *prog = &conf->prog;
+	hid_button_run_t *run = NULL;
+	uint16_t run_end = 0;
+	uint8_t i;
+
+	for(i=0;i<MAX_AXES;i++) {
+		// if logical minimum is > logical maximum then logical minimum 
+		// is signed. This means that the value itself is also signed
+		compile_field(&prog->axis[i], conf->joystick_mouse.axis[i].offset, conf->joystick_mouse.axis[i].size,
+		              conf->joystick_mouse.axis[i].logical.min > conf->joystick_mouse.axis[i].logical.max);
+	}
+	compile_field(&prog->hat, conf->joystick_mouse.hat.offset, conf->joystick_mouse.hat.size, 0);
+
+	// merge buttons in consecutive bits into runs
+	prog->button_runs = 0;
+	for(i=0;i<MAX_BUTTONS;i++) {
+		uint8_t mask = conf->joystick_mouse.button[i].bitmask;
+		uint16_t bit = conf->joystick_mouse.button[i].byte_offset*8;
+
+		if(!mask) continue;
+		if(mask & (mask-1)) {
+			prog->button_runs = HID_BUTTON_SCATTERED;
+			break;
+		}
+		while(!(mask & 1)) {
+			mask >>= 1;
+			bit++;
+		}
+
+		if(run && bit == run_end && i == run->dst + run->count) {
+			run->count++;
+			run_end++;
+		} else if(prog->button_runs == HID_BUTTON_RUNS) {
+			prog->button_runs = HID_BUTTON_SCATTERED;
+			break;
+		} else {
+			run = &prog->button[prog->button_runs++];
+			run->byte = bit/8;
+			run->shift = bit&7;
+			run->count = 1;
+			run->dst = i;
+			run_end = bit+1;
+		}
+	}
+	hidp_debugf("compiled report, %d button runs", prog->button_runs);
+}
+
+// extract a field from a report
+uint16_t hid_report_field(const hid_field_t *field, const uint8_t *p) {
+	uint32_t value;
+
+	p += field->byte;
+	switch(field->kind) {
+	case HID_FIELD_NONE:
+		return 0;
+	case HID_FIELD_BYTE:
+		value = p[0];
+		break;
+	case HID_FIELD_WORD:
+		value = p[0] | (p[1] << 8);
+		break;
+	default:
+		value = p[0];
+		if(field->shift + field->size > 8)  value |= p[1] << 8;
+		if(field->shift + field->size > 16) value |= (uint32_t)p[2] << 16;
+		value = (value >> field->shift) & ((1 << field->size) - 1);
+		break;
+	}
+
+	// sign expansion
+	if(field->is_signed && (value & (1 << (field->size - 1))))
+		value |= ~((1 << field->size) - 1);
+
+	return value;
+}
+
+// map of the pressed buttons of a report
+uint16_t hid_report_buttons(const hid_report_t *conf, const uint8_t *p) {
+	const hid_report_program_t *prog = &conf->prog;
+	uint16_t map = 0;
+	uint8_t i;
+
+	if(prog->button_runs == HID_BUTTON_SCATTERED) {
+		for(i=0;i<MAX_BUTTONS;i++)
+			if(p[conf->joystick_mouse.button[i].byte_offset] & conf->joystick_mouse.button[i].bitmask)
+				map |= (1<<i);
+		return map;
+	}
+
+	for(i=0;i<prog->button_runs;i++) {
+		const hid_button_run_t *run = &prog->button[i];
+		uint32_t bits = p[run->byte];
+		if(run->shift + run->count > 8)  bits |= p[run->byte+1] << 8;
+		if(run->shift + run->count > 16) bits |= (uint32_t)p[run->byte+2] << 16;
+		map |= ((bits >> run->shift) & ((1 << run->count) - 1)) << run->dst;
+	}
+	return map;
+}
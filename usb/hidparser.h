@@ -9,6 +9,38 @@
 #define MAX_AXES 4
 #define MAX_BUTTONS 12
 
+// extraction of a report field, precomputed from its bit offset and size
+typedef struct {
+  uint8_t byte;                // first byte of the field
+  uint8_t shift: 3;            // position of the field in this byte
+  uint8_t kind: 2;             // HID_FIELD_...
+  uint8_t is_signed: 1;
+  uint8_t size;                // bits, max. 16 are used
+} hid_field_t;
+
+#define HID_FIELD_NONE 0       // not present, reads as 0
+#define HID_FIELD_BYTE 1       // byte aligned 8 bits
+#define HID_FIELD_WORD 2       // byte aligned 16 bits
+#define HID_FIELD_BITS 3       // any other position/size
+
+// consecutive button bits, copied into the button map at once
+typedef struct {
+  uint8_t byte;
+  uint8_t shift: 3;
+  uint8_t count: 5;
+  uint8_t dst;                 // number of the first button
+} hid_button_run_t;
+
+#define HID_BUTTON_RUNS      4
+#define HID_BUTTON_SCATTERED 0xff   // too many runs, buttons are tested one by one
+
+typedef struct {
+  hid_field_t axis[MAX_AXES];
+  hid_field_t hat;
+  hid_button_run_t button[HID_BUTTON_RUNS];
+  uint8_t button_runs;
+} hid_report_program_t;
+
 // currently only joysticks are supported
 typedef struct {
   uint8_t type: 2;             // REPORT_TYPE_...
@@ -48,8 +80,13 @@ typedef struct {
       
     } joystick_mouse;
   };
+
+  hid_report_program_t prog;   // built from joystick_mouse by hid_report_compile()
 } hid_report_t;
 
 bool parse_report_descriptor(uint8_t *rep, uint16_t rep_size, hid_report_t *conf);
+void hid_report_compile(hid_report_t *conf);
+uint16_t hid_report_field(const hid_field_t *field, const uint8_t *p);
+uint16_t hid_report_buttons(const hid_report_t *conf, const uint8_t *p);
 
 #endif // HIDPARSER_H
@@ -1,6 +1,7 @@
 #include <stdio.h>
 
 #include "usb.h"
+#include "usbsched.h"
 #include "timer.h"
 #include "max3421e.h"
 
@@ -84,6 +85,8 @@ static uint8_t usb_hub_parse_conf(usb_device_t *dev, uint8_t conf, uint16_t len,
   return USB_ERROR_INVALID_MAX_PKT_SIZE;
 }
 
+static uint8_t usb_hub_poll(usb_device_t *dev, uint8_t idx);
+
 static uint8_t usb_hub_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc) {
   iprintf("%s()\n", __FUNCTION__);
 
@@ -99,7 +102,6 @@ static uint8_t usb_hub_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc
 
   // reset status
   info->bNbrPorts = 0; 
-  info->qLastPollTime = 0;
   info->bPollEnable = false;
 
   info->ep.epAddr	= 1;
@@ -156,6 +158,9 @@ static uint8_t usb_hub_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc
 
   info->bPollEnable = true;
 
+  // status change endpoint every 100ms, the schedule rounds it down to 64ms
+  usb_sched_add(dev, usb_hub_poll, 0, EP_TYPE_INTR, 100);
+
   return 0;
 }
 
@@ -341,21 +346,14 @@ static uint8_t usb_hub_check_hub_status(usb_device_t *dev, uint8_t ports) {
   return 0;
 }
 
-static uint8_t usb_hub_poll(usb_device_t *dev) {
+static uint8_t usb_hub_poll(usb_device_t *dev, uint8_t idx) {
   usb_hub_info_t *info = &(dev->hub_info);
 
-  uint8_t rcode = 0;
-
   if (!info->bPollEnable)
     return 0;
-  
-  if (timer_check(info->qLastPollTime, 100)) { // poll 10 times a second
-    rcode = usb_hub_check_hub_status(dev, info->bNbrPorts);
-    info->qLastPollTime = timer_get_msec();
-  }
 
-  return rcode;
+  return usb_hub_check_hub_status(dev, info->bNbrPorts);
 }
 
 const usb_device_class_config_t usb_hub_class = {
-  usb_hub_init, usb_hub_release, usb_hub_poll };  
+  usb_hub_init, usb_hub_release, NULL };  
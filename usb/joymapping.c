@@ -73,11 +73,20 @@ static char dump_mapping() {
 
 static char idx = 0;
 
+// incremented on every change of the remaps, to rebuild the translation tables
+static uint8_t remap_generation = 1;
+
+static void remap_changed() {
+	if(!++remap_generation) remap_generation = 1;
+}
+
 void virtual_joystick_remap_init(char save) {
   if(save)
     idx = 0;
-  else
+  else {
     memset(joystick_mappers, 0, sizeof(joystick_mappers));
+    remap_changed();
+  }
 }
 
 /* Parses an input comma-separated string into a mapping strucutre
@@ -180,6 +189,7 @@ char virtual_joystick_remap(char *s, char action, int tag) {
         token = strtok (NULL, ",");
         count++;
       }
+      remap_changed();
       return 0; // finished processing input string so exit
     }
   }
@@ -193,6 +203,7 @@ void virtual_joystick_remap_update(joymapping_t *map) {
 		    joystick_mappers[i].tag == map->tag) ||
 		    !joystick_mappers[i].vid) {
 			memcpy(&joystick_mappers[i], map, sizeof(joymapping_t));
+			remap_changed();
 			return;
 		}
 	}
@@ -223,6 +234,8 @@ void virtual_joystick_tag_update(uint16_t vid, uint16_t pid, int newtag)
 		}
 	}
 
+	remap_changed();
+
 	if (new == -1) {
 		// no entry with the same tag, simply update
 		joystick_mappers[old].tag = newtag;
@@ -241,219 +254,114 @@ void virtual_joystick_tag_update(uint16_t vid, uint16_t pid, int newtag)
 
 /*****************************************************************************/
 
-char* get_joystick_alias( uint16_t vid, uint16_t pid ) {
-	
-	if(vid==0x0F30 && pid==0x1012)
-		return JOYSTICK_ALIAS_QANBA_Q4RAF;
-	
-	if(vid==0x081F && pid==0xE401)
-		return JOYSTICK_ALIAS_CHEAP_SNES;
-	
-	if(vid==0x0583 && pid==0x2060)
-		return JOYSTICK_ALIAS_IBUFALLO_SNES;
-	
-	if(vid==0x0411 && pid==0x00C6) 
-		return JOYSTICK_ALIAS_IBUFALLO_SNES;
-	
-	if (vid==VID_RETROLINK && pid==0x0006)
-		return JOYSTICK_ALIAS_RETROLINK_GC;
-	
-	if (vid==VID_RETROLINK && pid==0x0011)
-		return JOYSTICK_ALIAS_RETROLINK_NES;
-	
-	if(vid==0x1F4F && pid==0x0003) 
-		return JOYSTICK_ALIAS_ROYDS_EX;
+/* Known joysticks, their names and default mapping for the physical buttons 1-12.
+   Joysticks without button mapping use the default mapping */
+
+typedef struct {
+	uint16_t vid;
+	uint16_t pid;
+	const char *alias;
+	uint16_t button[12];
+} joystick_known_t;
+
+static const joystick_known_t known_joysticks[] = {
+	// Qanba Q4RAF
+	{ 0x0F30, 0x1012, JOYSTICK_ALIAS_QANBA_Q4RAF,
+	  { JOY_A, JOY_B, JOY_B, JOY_A, JOY_X /* for jump */, JOY_SELECT, 0, JOY_SELECT, 0, JOY_START } },
+	// no-brand cheap snes clone pad
+	{ 0x081F, 0xE401, JOYSTICK_ALIAS_CHEAP_SNES,
+	  { JOY_B /* allow two ways to hold the controller */, JOY_A, JOY_B, JOY_UP,
+	    JOY_L | JOY_L2, JOY_R | JOY_R2 /* also bind to buttons for flippers */, 0, 0, JOY_SELECT, JOY_START } },
+	// iBuffalo SNES pad - BSGP801
+	{ 0x0583, 0x2060, JOYSTICK_ALIAS_IBUFALLO_SNES,
+	  { JOY_A, JOY_B, JOY_B /* allow two ways to hold the controller */, JOY_UP,
+	    JOY_L | JOY_L2, JOY_R | JOY_R2 /* also bind to buttons for flippers */, JOY_SELECT, JOY_START } },
+	// Buffalo NES pad - BGCFC801
+	{ 0x0411, 0x00C6, JOYSTICK_ALIAS_IBUFALLO_SNES,
+	  { JOY_A, JOY_B, JOY_B /* allow two ways to hold the controller */, JOY_UP,
+	    JOY_L | JOY_L2, JOY_R | JOY_R2 /* also bind to buttons for flippers */, JOY_SELECT, JOY_START } },
+	// RetroLink N64 and Gamecube pad (same vid/pid)
+	{ VID_RETROLINK, 0x0006, JOYSTICK_ALIAS_RETROLINK_GC,
+	  { 0, 0, JOY_A /* A on GC pad */, JOY_B /* B on GC pad */, JOY_L | JOY_SELECT, JOY_R | JOY_SELECT,
+	    JOY_A /* A on N64 pad */, JOY_L | JOY_SELECT /* Z button on N64 pad */, JOY_B /* B on N64 pad */, JOY_START } },
+	{ VID_RETROLINK, 0x0011, JOYSTICK_ALIAS_RETROLINK_NES },
+	// ROYDS Stick.EX
+	{ 0x1F4F, 0x0003, JOYSTICK_ALIAS_ROYDS_EX,
+	  { JOY_B /* Cross (usually cancel in PSx) */, JOY_X /* Triangle */, JOY_A /* Circle (usually select in PSx) */,
+	    JOY_Y /* Square */, JOY_L, JOY_R, JOY_L2, JOY_R2, JOY_SELECT, JOY_START } },
+	{ VID_DAPTOR, 0xF947, JOYSTICK_ALIAS_ATARI_DAPTOR2 },
+	// NEOGEO-daptor
+	{ VID_DAPTOR, 0xF421, JOYSTICK_ALIAS_NEOGEO_DAPTOR,
+	  { JOY_B /* red button "A" on pad (inverted order with NES/SNES) */,
+	    JOY_A /* yellow button "B" on pad (inverted order with NES/SNES) */,
+	    JOY_Y | JOY_L /* green button, "C" on pad (mapped to Y and L in SNES convention) */,
+	    JOY_X | JOY_R /* blue button "D" */, JOY_START, JOY_SELECT } },
+	{ VID_DAPTOR, 0xF6EC, JOYSTICK_ALIAS_NEOGEO_DAPTOR },
+	{ VID_DAPTOR, 0xF672, JOYSTICK_ALIAS_VISION_DAPTOR },
+	{ 0x1345, 0x1030, JOYSTICK_ALIAS_RETRO_FREAK },
+	// 8bitdo SFC30, physical buttons #3, #6, #9 and #10 not used
+	{ 0x1235, 0xab11, JOYSTICK_ALIAS_8BITDO_SFC30,
+	  { JOY_A, JOY_B, 0, JOY_X, JOY_Y, 0, JOY_L | JOY_L2, JOY_R | JOY_R2 /* also bind to buttons for flippers */,
+	    0, 0, JOY_SELECT, JOY_START } },
+	{ 0x1235, 0xab21, JOYSTICK_ALIAS_8BITDO_SFC30,
+	  { JOY_A, JOY_B, 0, JOY_X, JOY_Y, 0, JOY_L | JOY_L2, JOY_R | JOY_R2 /* also bind to buttons for flippers */,
+	    0, 0, JOY_SELECT, JOY_START } },
+	// 8bitdo FC30, physical buttons #3 and #6 not used
+	{ 0x1002, 0x9000, JOYSTICK_ALIAS_8BITDO_FC30,
+	  { JOY_A, JOY_B, 0, JOY_X, JOY_Y, 0, JOY_L | JOY_L2, JOY_R | JOY_R2,
+	    JOY_L | JOY_L2, JOY_R | JOY_R2 /* also bind to buttons for flippers */, JOY_SELECT, JOY_START } },
+	{ 0x040b, 0x6533, JOYSTICK_ALIAS_SPEEDLINK_COMP },
+	{ 0x0738, 0x2217, JOYSTICK_ALIAS_SPEEDLINK_COMP },
+	{ 0x045E, 0x028E, JOYSTICK_ALIAS_XBOX },
+	{ 0x1C59, 0x0026, JOYSTICK_ALIAS_RETRO_GAMES_THEGAMEPAD },
+};
 
-	if(vid==VID_DAPTOR && pid==0xF947)
-		return JOYSTICK_ALIAS_ATARI_DAPTOR2;
-	
-	if(vid==VID_DAPTOR && pid==0xF421)
-		return JOYSTICK_ALIAS_NEOGEO_DAPTOR;
-	
-	if(vid==VID_DAPTOR && pid==0xF6EC)
-		return JOYSTICK_ALIAS_NEOGEO_DAPTOR;
-	
-	if(vid==VID_DAPTOR && pid==0xF672)
-		return JOYSTICK_ALIAS_VISION_DAPTOR;
-		
-	if(vid==0x1345 && pid==0x1030)
-		return JOYSTICK_ALIAS_RETRO_FREAK;
-	
-	if(vid==0x1235 &&  (pid==0xab11 || pid==0xab21))
-		return JOYSTICK_ALIAS_8BITDO_SFC30;
-	
-	if(vid==0x1002 &&  pid==0x9000)
-		return JOYSTICK_ALIAS_8BITDO_FC30;
-	
-	if(vid==0x040b && pid==0x6533)
-		return JOYSTICK_ALIAS_SPEEDLINK_COMP;
-	
-	if(vid==0x0738 && pid==0x2217)
-		return JOYSTICK_ALIAS_SPEEDLINK_COMP;
+static const joystick_known_t *find_known_joystick(uint16_t vid, uint16_t pid) {
+	uint8_t i;
+	for(i=0; i<sizeof(known_joysticks)/sizeof(known_joysticks[0]); i++)
+		if(known_joysticks[i].vid == vid && known_joysticks[i].pid == pid)
+			return &known_joysticks[i];
+	return NULL;
+}
 
-	if(vid==0x045E && pid==0x028E)
-		return JOYSTICK_ALIAS_XBOX;
+char* get_joystick_alias( uint16_t vid, uint16_t pid ) {
+	const joystick_known_t *known = find_known_joystick(vid, pid);
+	return known ? (char*)known->alias : JOYSTICK_ALIAS_NONE;
+}
 
-	if(vid==0x1C59 && pid==0x0026)
-		return JOYSTICK_ALIAS_RETRO_GAMES_THEGAMEPAD;
+/* Builds the translation table between the USB input and the internal virtual joystick
+   of a device. Done once when the device is attached, and again if the remaps change */
 
-	return JOYSTICK_ALIAS_NONE;
-		
-}
+void virtual_joystick_mapping_init(joymapping_table_t *table, uint16_t vid, uint16_t pid) {
+	const joystick_known_t *known = find_known_joystick(vid, pid);
+	uint8_t i, j;
+	uint8_t use_default = 1;
+	int tag = 0;
 
-/* Translates USB input into internal virtual joystick,
-   with some default handling for common/known gampads */
+	table->vid = vid;
+	table->pid = pid;
+	table->generation = remap_generation;
 
-uint16_t virtual_joystick_mapping (uint16_t vid, uint16_t pid, uint16_t joy_input) {
-	
-	uint8_t i;
-	
-	// defines translations between physical buttons and virtual joysticks
-    uint16_t mapping[16];
-	// keep directions by default
-	for(i=0; i<4; i++) 
-	   mapping[i]=default_joystick_mapping[i]; 
-	// blank the rest
-	for(i=4; i<16; i++) mapping[i]=0;
-
-	uint8_t use_default=1;
-	uint8_t btn_off = 3; // start at three since array is 0 based, so 4 = button 1
-	
-	// mapping for Qanba Q4RAF
-	if( vid==0x0F30 && pid==0x1012) {
-	  mapping[btn_off+1]  = JOY_A;
-	  mapping[btn_off+2]  = JOY_B;
-	  mapping[btn_off+4]  = JOY_A;
-	  mapping[btn_off+3]  = JOY_B;     
-	  mapping[btn_off+5]  = JOY_X; //for jump
-	  mapping[btn_off+6]  = JOY_SELECT;
-	  mapping[btn_off+8]  = JOY_SELECT;
-	  mapping[btn_off+10] = JOY_START;       
-	  use_default=0;
-	}
-	
-	// mapping for no-brand cheap snes clone pad
-	if(vid==0x081F && pid==0xE401) {
-	  mapping[btn_off+2]  = JOY_A;
-	  mapping[btn_off+3]  = JOY_B;
-	  mapping[btn_off+1]  = JOY_B; // allow two ways to hold the controller  
-	  mapping[btn_off+4]  = JOY_UP;
-	  mapping[btn_off+5]  = JOY_L | JOY_L2; // also bind to buttons for flippers
-	  mapping[btn_off+6]  = JOY_R | JOY_R2; 
-	  mapping[btn_off+9]  = JOY_SELECT;
-	  mapping[btn_off+10] = JOY_START;       
-	  use_default=0;
-	}
-	
-	// mapping for iBuffalo SNES pad - BSGP801
-	if(vid==0x0583 && pid==0x2060) {
-	  mapping[btn_off+1] = JOY_A;
-	  mapping[btn_off+2] = JOY_B;
-	  mapping[btn_off+3] = JOY_B;  // allow two ways to hold the controller
-	  mapping[btn_off+4] = JOY_UP; 
-	  mapping[btn_off+5] = JOY_L | JOY_L2; // also bind to buttons for flippers
-	  mapping[btn_off+6] = JOY_R | JOY_R2;                 
-	  mapping[btn_off+7] = JOY_SELECT;
-	  mapping[btn_off+8] = JOY_START;
-	  use_default=0;
-	}
-	
-	//mapping for Buffalo NES pad - BGCFC801
-	if(vid==0x0411 && pid==0x00C6) {
-	  mapping[btn_off+1] = JOY_A;
-	  mapping[btn_off+2] = JOY_B;
-	  mapping[btn_off+3] = JOY_B;  // allow two ways to hold the controller
-	  mapping[btn_off+4] = JOY_UP; 
-	  mapping[btn_off+5] = JOY_L | JOY_L2; // also bind to buttons for flippers
-	  mapping[btn_off+6] = JOY_R | JOY_R2;                     
-	  mapping[btn_off+7] = JOY_SELECT;
-	  mapping[btn_off+8] = JOY_START;
-	  use_default=0;
-	} 
-
-	//mapping for RetroLink N64 and Gamecube pad (same vid/pid)
-	if(vid==VID_RETROLINK && pid==0x0006) {
-	  mapping[btn_off+7] = JOY_A;  // A on N64 pad
-	  mapping[btn_off+9] = JOY_B;  // B on N64 pad
-	  mapping[btn_off+3] = JOY_A;  // A on GC pad
-	  mapping[btn_off+4] = JOY_B;  // B on GC pad
-	  mapping[btn_off+5] = JOY_L | JOY_SELECT;
-	  mapping[btn_off+8] = JOY_L | JOY_SELECT; // Z button on N64 pad
-	  mapping[btn_off+6] = JOY_R | JOY_SELECT;
-	  mapping[btn_off+10] = JOY_START;
-	  use_default=0;
-	}
-	
-	//mapping for ROYDS Stick.EX
-	if(vid==0x1F4F && pid==0x0003) {
-	  mapping[btn_off+3] = JOY_A;  // Circle (usually select in PSx)
-	  mapping[btn_off+1] = JOY_B;  // Cross  (usually cancel in PSx)
-	  mapping[btn_off+2] = JOY_X;  // Triangle
-	  mapping[btn_off+4] = JOY_Y;  // Square
-	  mapping[btn_off+5] = JOY_L;
-	  mapping[btn_off+6] = JOY_R; 
-	  mapping[btn_off+7] = JOY_L2; 
-	  mapping[btn_off+8] = JOY_R2;
-	  mapping[btn_off+9] = JOY_SELECT;
-	  mapping[btn_off+10] = JOY_START;
-	  use_default=0;
-	}
-	
-	//mapping for NEOGEO-daptor
-	if(vid==VID_DAPTOR && pid==0xF421) {
-	  mapping[btn_off+1] = JOY_B;  // red button "A" on pad (inverted order with NES/SNES
-	  mapping[btn_off+2] = JOY_A;  // yellow button "B" on pad (inverted order with NES/SNES
-	  mapping[btn_off+3] = JOY_Y | JOY_L;  // green button, "C" on pad (mapped to Y and L in SNES convention)
-	  mapping[btn_off+4] = JOY_X | JOY_R;  // blue button "D"  
-	  mapping[btn_off+5] = JOY_START;
-	  mapping[btn_off+6] = JOY_SELECT;
-	  use_default=0;
-	}
-	
-	//mapping for 8bitdo SFC30
-	if(vid==0x1235 && (pid==0xab11 || pid==0xab21)) {
-		mapping[btn_off+1] = JOY_A;
-	  mapping[btn_off+2] = JOY_B;
-	  //mapping[btn_off+3] // physical button #3 not used
-		mapping[btn_off+4] = JOY_X;
-		mapping[btn_off+5] = JOY_Y;
-	  //mapping[btn_off+6] // physical button #6 not used
-		mapping[btn_off+7] = JOY_L | JOY_L2; // also bind to buttons for flippers
-	  mapping[btn_off+8] = JOY_R | JOY_R2; // also bind to buttons for flippers
-	  //9 and 10 not used
-		mapping[btn_off+11] = JOY_SELECT;
-		mapping[btn_off+12] = JOY_START;
-		use_default=0;
-	}
-	
-		//mapping for 8bitdo FC30
-	if(vid==0x1002 && pid==0x9000) {
-		mapping[btn_off+1] = JOY_A;
-	  mapping[btn_off+2] = JOY_B;
-	  //mapping[btn_off+3] // physical button #3 not used
-		mapping[btn_off+4] = JOY_X;
-		mapping[btn_off+5] = JOY_Y;
-	  //mapping[btn_off+6] // physical button #6 not used
-		mapping[btn_off+7] = JOY_L | JOY_L2; // also bind to buttons for flippers
-	  mapping[btn_off+8] = JOY_R | JOY_R2; // also bind to buttons for flippers
-		mapping[btn_off+9] = JOY_L | JOY_L2; // also bind to buttons for flippers
-	  mapping[btn_off+10] = JOY_R | JOY_R2; // also bind to buttons for flippers		
-		mapping[btn_off+11] = JOY_SELECT;
-		mapping[btn_off+12] = JOY_START;
-		use_default=0;
+	// keep directions by default, blank the rest
+	memcpy(table->mapping, default_joystick_mapping, 4*sizeof(uint16_t));
+	memset(&table->mapping[4], 0, 12*sizeof(uint16_t));
+
+	// default handling for common/known gamepads
+	if(known) {
+		for(i=0; i<12; i++) {
+			table->mapping[4+i] = known->button[i];
+			if(known->button[i]) use_default = 0;
+		}
 	}
-	
+
 	// Apply remap information from various config sources if present
 	// Priority (low to high):
 	// 0 - mist.ini
 	// 1 - mistcfg.ini
 	// 2 - [corename].cfg
-	uint8_t j;
-	int tag = 0;
 	for(j=0;j<MAX_VIRTUAL_JOYSTICK_REMAP;j++) {
 		if(joystick_mappers[j].vid==vid && joystick_mappers[j].pid==pid && joystick_mappers[j].tag >= tag) {
-			for(i=0; i<16; i++)
-				mapping[i]=joystick_mappers[j].mapping[i];
+			memcpy(table->mapping, joystick_mappers[j].mapping, 16*sizeof(uint16_t));
 			use_default=0;
 			tag = joystick_mappers[j].tag + 1;
 		}
@@ -461,15 +369,25 @@ uint16_t virtual_joystick_mapping (uint16_t vid, uint16_t pid, uint16_t joy_inpu
 
 	// apply default mapping to rest of buttons if requested
 	if (use_default) {
-	  for(i=4; i<16; i++) 
-		if (mapping[i]==0) mapping[i]=default_joystick_mapping[i];
+	  for(i=4; i<16; i++)
+		if (table->mapping[i]==0) table->mapping[i]=default_joystick_mapping[i];
 	}
-	
+}
+
+/* Translates USB input into internal virtual joystick */
+
+uint16_t virtual_joystick_mapping(joymapping_table_t *table, uint16_t joy_input) {
+	const uint16_t *mapping = table->mapping;
 	uint16_t vjoy = 0;
-	for(i=0; i<16; i++) 
-	  if (joy_input & (0x01<<i))  vjoy |= mapping[i];
-  
-  return vjoy;
+
+	// the remaps were changed since the table was built
+	if(table->generation != remap_generation)
+		virtual_joystick_mapping_init(table, table->vid, table->pid);
+
+	for(; joy_input; joy_input >>= 1, mapping++)
+		if(joy_input & 1) vjoy |= *mapping;
+
+	return vjoy;
 }
 
 /*****************************************************************************\
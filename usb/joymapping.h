@@ -57,6 +57,14 @@ typedef struct {
     int      tag;
 } joymapping_t;
 
+// translation table of a device, built when it's attached
+typedef struct {
+    uint16_t vid;
+    uint16_t pid;
+    uint8_t  generation;   // remaps the table was built from
+    uint16_t mapping[16];
+} joymapping_table_t;
+
 /*****************************************************************************/
 
 // INI parsing
@@ -68,7 +76,8 @@ void virtual_joystick_remap_update(joymapping_t*);
 void virtual_joystick_tag_update(uint16_t vid, uint16_t pid, int newtag);
 
 // runtime mapping
-uint16_t virtual_joystick_mapping (uint16_t vid, uint16_t pid, uint16_t joy_input);
+void virtual_joystick_mapping_init(joymapping_table_t *table, uint16_t vid, uint16_t pid);
+uint16_t virtual_joystick_mapping(joymapping_table_t *table, uint16_t joy_input);
 
 // name known joysticks
 char* get_joystick_alias( uint16_t vid, uint16_t pid );
@@ -49,6 +49,7 @@ uint8_t *max3421e_read(uint8_t reg, uint8_t n, uint8_t* data) {
 }
 
 static uint8_t vbusState = MAX3421E_STATE_SE0;
+static uint8_t frameIrq = 0;
 
 uint16_t max3421e_reset() {
   uint16_t i = 0;
@@ -196,10 +197,11 @@ uint8_t max3421e_poll() {
     max3421e_write_u08( MAX3421E_HIRQ, MAX3421E_SNDBAVIRQ);
   }
 
-  //if( hirq & MAX3421E_FRAMEIRQ) {
-    //    iprintf("=> MAX3421E_FRAMEIRQ\n");
-    //max3421e_write_u08( MAX3421E_HIRQ, MAX3421E_FRAMEIRQ);
-  //}
+  // start of frame, picked up by max3421e_frame()
+  if( hirq & MAX3421E_FRAMEIRQ) {
+    max3421e_write_u08( MAX3421E_HIRQ, MAX3421E_FRAMEIRQ);
+    frameIrq = 1;
+  }
 
 #if 0  
   int i;
@@ -214,3 +216,9 @@ uint8_t max3421e_poll() {
   return vbusState; 
 }
 
+// a frame has started since the last call
+uint8_t max3421e_frame() {
+  uint8_t ret = frameIrq;
+  frameIrq = 0;
+  return ret;
+}
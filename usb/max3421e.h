@@ -208,6 +208,7 @@
 // interface used by usb.c
 void max3421e_init();
 uint8_t max3421e_poll();
+uint8_t max3421e_frame();
 void max3421e_write_u08(uint8_t reg, uint8_t data);
 uint8_t max3421e_read_u08(uint8_t reg);
 const uint8_t *max3421e_write(uint8_t reg, uint8_t n, const uint8_t* data);
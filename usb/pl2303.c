@@ -13,6 +13,7 @@
 
 #include "debug.h"
 #include "usb.h"
+#include "usbsched.h"
 #include "pl2303.h"
 #include "max3421e.h"
 #include "utils.h"
@@ -261,6 +262,9 @@ static uint8_t pl2303_parse_conf0(usb_device_t *dev, uint16_t len) {
 uint8_t tx_test = 0;
 #endif
 
+static uint8_t pl2303_poll_irq(usb_device_t *dev, uint8_t idx);
+static uint8_t pl2303_poll_bulk(usb_device_t *dev, uint8_t idx);
+
 static uint8_t pl2303_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc) {
   usb_pl2303_info_t *info = &(dev->pl2303_info);
   uint8_t i, rcode = 0;
@@ -268,8 +272,6 @@ static uint8_t pl2303_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc)
   pl2303_debugf("%s(%d)", __FUNCTION__, dev->bAddress);
 
   // reset status
-  info->qLastIrqPollTime = 0;
-  info->qLastBulkPollTime = 0;
   info->bPollEnable = false;
 
   // buffer should be empty
@@ -359,6 +361,8 @@ static uint8_t pl2303_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc)
   pl2303_settings_dev(dev, 9600, 8, PL2303_PARITY_NONE, PL2303_STOP_BIT_1);
   
   info->bPollEnable = true;
+  usb_sched_add(dev, pl2303_poll_irq, 0, EP_TYPE_INTR, info->int_poll_ms);
+  usb_sched_add(dev, pl2303_poll_bulk, 0, EP_TYPE_BULK, 10);
   
 #ifdef TX_TEST
   tx_test = 0;
@@ -374,118 +378,117 @@ static uint8_t pl2303_release(usb_device_t *dev) {
   return 0;
 }
 
-static uint8_t pl2303_poll(usb_device_t *dev) {
+// interrupt endpoint
+static uint8_t pl2303_poll_irq(usb_device_t *dev, uint8_t idx) {
   usb_pl2303_info_t *info = &(dev->pl2303_info);
-  uint8_t rcode = 0;
-  
+
   if (!info->bPollEnable)
     return 0;
-  
-#if 1 // no need to use the irq channel ...
-  // poll interrupt endpoint
-  if (timer_check(info->qLastIrqPollTime, info->int_poll_ms)) {
-    uint16_t read = info->ep[info->ep_int_idx].maxPktSize;
-    uint8_t buf[info->ep[info->ep_int_idx].maxPktSize];
-    uint8_t rcode = usb_in_transfer(dev, &(info->ep[info->ep_int_idx]), &read, buf);
-    
-    if (rcode) {
-      if (rcode != hrNAK)
-	pl2303_debugf("%s() int error: %x", __FUNCTION__, rcode);
-    } else {
-      pl2303_debugf("int %d bytes", read);
-      hexdump(buf, read, 0);
-    }
-    info->qLastIrqPollTime = timer_get_msec();
+
+  uint16_t read = info->ep[info->ep_int_idx].maxPktSize;
+  uint8_t buf[info->ep[info->ep_int_idx].maxPktSize];
+  uint8_t rcode = usb_in_transfer(dev, &(info->ep[info->ep_int_idx]), &read, buf);
+
+  if (rcode) {
+    if (rcode != hrNAK)
+      pl2303_debugf("%s() int error: %x", __FUNCTION__, rcode);
+  } else {
+    pl2303_debugf("int %d bytes", read);
+    hexdump(buf, read, 0);
   }
-#endif
+  return 0;
+}
 
-  // Do TX/RX handling at 100Hz
-  if(timer_check(info->qLastBulkPollTime, 10)) {
+// TX/RX handling at about 100Hz
+static uint8_t pl2303_poll_bulk(usb_device_t *dev, uint8_t idx) {
+  usb_pl2303_info_t *info = &(dev->pl2303_info);
+  uint8_t rcode = 0;
+
+  if (!info->bPollEnable)
+    return 0;
 
 #ifdef TX_TEST
-    if(tx_test < 26) {
-      // do some tests (needs a loopback connector)
-      uint8_t buffer[30]; 
-      memset(buffer, 'A'+tx_test, sizeof(buffer));
-      
-      // send and retry on failure
-      pl2303_tx_dev(dev, buffer, sizeof(buffer));
-      tx_test++;
-    }
+  if(tx_test < 26) {
+    // do some tests (needs a loopback connector)
+    uint8_t buffer[30]; 
+    memset(buffer, 'A'+tx_test, sizeof(buffer));
+
+    // send and retry on failure
+    pl2303_tx_dev(dev, buffer, sizeof(buffer));
+    tx_test++;
+  }
 #endif
 
-    // transmit anything that's in the local transmit buffer
-    if(tx_buf_fill) {
-      pl2303_tx_dev(dev, tx_buf, tx_buf_fill);
-      tx_buf_fill = 0;
-    }
+  // transmit anything that's in the local transmit buffer
+  if(tx_buf_fill) {
+    pl2303_tx_dev(dev, tx_buf, tx_buf_fill);
+    tx_buf_fill = 0;
+  }
 
-    // only receive if still enough space in rx buffer for a max sized packet
-    if(rx_buf_fill+info->ep[info->ep_bulk_in_idx].maxPktSize < RX_BUF_SIZE) {
-      uint16_t read = info->ep[info->ep_bulk_in_idx].maxPktSize;
-      rcode = usb_in_transfer(dev, &(info->ep[info->ep_bulk_in_idx]), &read, rx_buf+rx_buf_fill);
-      if(rcode) {
-	if (rcode != hrNAK)
-	  pl2303_debugf("%s() rx error: %x", __FUNCTION__, rcode);
-      } else {
+  // only receive if still enough space in rx buffer for a max sized packet
+  if(rx_buf_fill+info->ep[info->ep_bulk_in_idx].maxPktSize < RX_BUF_SIZE) {
+    uint16_t read = info->ep[info->ep_bulk_in_idx].maxPktSize;
+    rcode = usb_in_transfer(dev, &(info->ep[info->ep_bulk_in_idx]), &read, rx_buf+rx_buf_fill);
+    if(rcode) {
+      if (rcode != hrNAK)
+	pl2303_debugf("%s() rx error: %x", __FUNCTION__, rcode);
+    } else {
 #ifdef PL2303_STAT
-	info->rx_cnt += read;
-	pl2303_debugf("rx %d bytes, total = %ld", read, info->rx_cnt);
+      info->rx_cnt += read;
+      pl2303_debugf("rx %d bytes, total = %ld", read, info->rx_cnt);
 #else
-	pl2303_debugf("rx %d bytes", read);
+      pl2303_debugf("rx %d bytes", read);
 #endif
 
-	hexdump(rx_buf+rx_buf_fill, read, 0);
-	rx_buf_fill += read;
-      }
+      hexdump(rx_buf+rx_buf_fill, read, 0);
+      rx_buf_fill += read;
     }
+  }
 
-    // get current serial status
-    serial_status_t stat;
-    if(user_io_serial_status(&stat, 0x90)) {
-      { static serial_status_t old_stat;
-	if(memcmp(&stat, &old_stat, sizeof(stat)) != 0) { 
-	  pl2303_debugf("stat changed:");
-	  hexdump(&stat, sizeof(stat), 0);
-	  memcpy(&old_stat, &stat, sizeof(stat));
-	}
+  // get current serial status
+  serial_status_t stat;
+  if(user_io_serial_status(&stat, 0x90)) {
+    { static serial_status_t old_stat;
+      if(memcmp(&stat, &old_stat, sizeof(stat)) != 0) { 
+	pl2303_debugf("stat changed:");
+	hexdump(&stat, sizeof(stat), 0);
+	memcpy(&old_stat, &stat, sizeof(stat));
       }
+    }
 
-      // is data to be sent?
-      if(rx_buf_fill) {
+    // is data to be sent?
+    if(rx_buf_fill) {
 #define BUFFER_SIZE 8  // max 15
-	// check if fifo is empty (the empty fifo can hold up to 15 entries)
-	if(stat.fifo_stat & 4) {
-	  //	  iprintf("space: %d\n", stat.fifo_stat>>4);
-	  uint8_t buffer_space = stat.fifo_stat>>4; // BUFFER_SIZE
-
-	  // send as many bytes as possible from buffer into core ...
-	  uint8_t bytes2send = (rx_buf_fill < buffer_space)?rx_buf_fill:buffer_space;
-	  pl2303_debugf("forward %d bytes into core", bytes2send);
-	  user_io_serial_tx(rx_buf, bytes2send);
-	  // ... and remove sent data from buffer
-	  memmove(rx_buf, rx_buf+bytes2send, RX_BUF_SIZE-bytes2send);
-	  rx_buf_fill -= bytes2send;
-
-	  //	  if(user_io_serial_status(&stat, 0x90)) {
-	  //	    iprintf("After %d: %d\n", bytes2send, stat.fifo_stat>>4);
-	  //	  }
-	}
-      }
-
-      // set new com paramters (will be ignored if they stay the same)
-      pl2303_settings_dev(dev, stat.bitrate, stat.datasize, stat.parity, stat.stopbits);
-    } else {
-      if(rx_buf_fill) {
-	// just throw all data at the core as we have no insight in its buffer state
-	user_io_serial_tx(rx_buf, rx_buf_fill);
-	rx_buf_fill = 0;
+      // check if fifo is empty (the empty fifo can hold up to 15 entries)
+      if(stat.fifo_stat & 4) {
+	//	  iprintf("space: %d\n", stat.fifo_stat>>4);
+	uint8_t buffer_space = stat.fifo_stat>>4; // BUFFER_SIZE
+
+	// send as many bytes as possible from buffer into core ...
+	uint8_t bytes2send = (rx_buf_fill < buffer_space)?rx_buf_fill:buffer_space;
+	pl2303_debugf("forward %d bytes into core", bytes2send);
+	user_io_serial_tx(rx_buf, bytes2send);
+	// ... and remove sent data from buffer
+	memmove(rx_buf, rx_buf+bytes2send, RX_BUF_SIZE-bytes2send);
+	rx_buf_fill -= bytes2send;
+
+	//	  if(user_io_serial_status(&stat, 0x90)) {
+	//	    iprintf("After %d: %d\n", bytes2send, stat.fifo_stat>>4);
+	//	  }
       }
     }
 
-    info->qLastBulkPollTime = timer_get_msec();
+    // set new com paramters (will be ignored if they stay the same)
+    pl2303_settings_dev(dev, stat.bitrate, stat.datasize, stat.parity, stat.stopbits);
+  } else {
+    if(rx_buf_fill) {
+      // just throw all data at the core as we have no insight in its buffer state
+      user_io_serial_tx(rx_buf, rx_buf_fill);
+      rx_buf_fill = 0;
+    }
   }
+  return 0;
 }
 
 const usb_device_class_config_t usb_pl2303_class = {
-  pl2303_init, pl2303_release, pl2303_poll };  
+  pl2303_init, pl2303_release, NULL };  
@@ -3,13 +3,26 @@
 #include "timer.h"
 #include "max3421e.h"
 #include "usb.h"
+#include "usbsched.h"
+#include "prof.h"
 
 static uint8_t usb_task_state;
 static uint8_t bmHubPre;
+static uint16_t usb_frame;
+static msec_t usb_frame_time;
+static bool usb_sof;
+static bool usb_frame_ended;   // SOF seen while waiting for a transfer
+
+// peripheral address and speed the chip is set up for
+#define NO_ADDR 0xff
+static uint8_t cachedAddr = NO_ADDR;
+static bool cachedLowspeed;
+static uint8_t cachedHubPre;
 
 void usb_reset_state() {
   puts(__FUNCTION__);
   bmHubPre	 = 0;
+  cachedAddr	 = NO_ADDR;
 }
 
 void usb_hw_init() {
@@ -19,6 +32,7 @@ void usb_hw_init() {
 
 	usb_task_state = USB_DETACHED_SUBSTATE_INITIALIZE; 
 
+	usb_sched_init();
 	usb_reset_state();
 }
 
@@ -27,6 +41,11 @@ static uint8_t usb_set_address(usb_device_t *dev, ep_t *ep,
   //  iprintf("  %s(addr=%x, ep=%d)\n", __FUNCTION__, addr, ep);
 	*nak_limit = (1UL << ( ( ep->bmNakPower > USB_NAK_MAX_POWER ) ? 
 	              USB_NAK_MAX_POWER : ep->bmNakPower) ) - 1;
+
+	// the chip is still set up for this device, e.g. for the polls of
+	// several endpoints or packets of one device in a row
+	if(dev->bAddress == cachedAddr && dev->lowspeed == cachedLowspeed && bmHubPre == cachedHubPre)
+		return 0;
   
   /*
     iprintf("\nAddress: %x\n", addr);
@@ -45,6 +64,10 @@ static uint8_t usb_set_address(usb_device_t *dev, ep_t *ep,
 	      (dev->lowspeed) ? mode |   MAX3421E_LOWSPEED | bmHubPre :
 	                        mode & ~(MAX3421E_HUBPRE | MAX3421E_LOWSPEED));
 
+	cachedAddr = dev->bAddress;
+	cachedLowspeed = dev->lowspeed;
+	cachedHubPre = bmHubPre;
+
 	return 0;
 }
 
@@ -70,6 +93,8 @@ static uint8_t usb_dispatchPkt( uint8_t token, uint8_t ep, uint16_t nak_limit )
 		// wait for transfer completion
 		while( !timer_check(timeout, USB_XFER_TIMEOUT) ) {
 			tmpdata = max3421e_read_u08( MAX3421E_HIRQ );
+			if( tmpdata & MAX3421E_FRAMEIRQ )
+				usb_frame_ended = true;
 
 			if( tmpdata & MAX3421E_HXFRDNIRQ ) {
 				//clear the interrupt
@@ -171,11 +196,13 @@ static uint8_t usb_InTransfer(ep_t *pep, uint16_t nak_limit,
 /* fe USB xfer timeout */
 uint8_t usb_in_transfer( usb_device_t *dev, ep_t *ep, uint16_t *nbytesptr, uint8_t* data) {
 	uint16_t nak_limit = 0;
+	PROF_START(prof);
 
 	uint8_t rcode = usb_set_address(dev, ep, &nak_limit);
-	if (rcode) return rcode;
+	if (!rcode) rcode = usb_InTransfer(ep, nak_limit, nbytesptr, data);
 
-	return usb_InTransfer(ep, nak_limit, nbytesptr, data);
+	PROF_END(PROF_USB_IN, prof);
+	return rcode;
 }
 
 static uint8_t usb_OutTransfer(ep_t *pep, uint16_t nak_limit, 
@@ -259,11 +286,13 @@ static uint8_t usb_OutTransfer(ep_t *pep, uint16_t nak_limit,
 /* rcode 0 if no errors. rcode 01-0f is relayed from HRSL                       */
 uint8_t usb_out_transfer(usb_device_t *dev, ep_t *ep, uint16_t nbytes, const uint8_t* data ) {
 	uint16_t nak_limit = 0;
+	PROF_START(prof);
 
 	uint8_t rcode = usb_set_address(dev, ep, &nak_limit);
-	if (rcode) return rcode;
+	if (!rcode) rcode = usb_OutTransfer(ep, nak_limit, nbytes, data);
 
-	return usb_OutTransfer(ep, nak_limit, nbytes, data);
+	PROF_END(PROF_USB_OUT, prof);
+	return rcode;
 }
 
 /* Control transfer. Sets address, endpoint, fills control packet */
@@ -324,6 +353,11 @@ uint8_t usb_ctrl_req(usb_device_t *dev, uint8_t bmReqType,
 	return usb_dispatchPkt( (direction) ? tokOUTHS : tokINHS, 0, nak_limit );
 }
 
+// a new frame has started while the current one was being polled
+static bool usb_frame_over() {
+	return usb_frame_ended;
+}
+
 void usb_poll() {
 	uint8_t rcode;
 	uint8_t tmpdata;
@@ -333,6 +367,10 @@ void usb_poll() {
 	// poll underlaying hardware layer
 	tmpdata = max3421e_poll();
 
+	// the mode register is only written by usb_set_address() while running
+	if(usb_task_state != USB_STATE_RUNNING)
+		cachedAddr = NO_ADDR;
+
 	/* modify USB task state if Vbus changed */
 	switch( tmpdata )  {
 
@@ -362,16 +400,23 @@ void usb_poll() {
 		break;
 	}
 
+	// a new frame has started, run its part of the endpoint poll schedule
+	if(max3421e_frame()) {
+		msec_t now = timer_get_msec();
+		// frames missed while the main loop was busy elsewhere
+		usb_frame += (now - usb_frame_time > 1) ? (now - usb_frame_time) : 1;
+		usb_frame_time = now;
+		usb_sof = true;
+		usb_frame_ended = false;
+		usb_sched_run(usb_frame, usb_frame_over);
+	}
+
 	// max poll 1ms
 	static msec_t poll=0;
 	if(timer_check(poll, 1)) {
-		if (usb_task_state != USB_ATTACHED_SUBSTATE_WAIT_SOF && (max3421e_read_u08( MAX3421E_HIRQ ) & MAX3421E_FRAMEIRQ )) {
-			max3421e_write_u08( MAX3421E_HIRQ, MAX3421E_FRAMEIRQ); // clear SOF irq
-		}
-
 		poll = timer_get_msec();
 
-		// poll all configured devices
+		// housekeeping of all configured devices
 		uint8_t i;
 		usb_device_t *dev = usb_get_devices();
 		for (i=0; i<USB_NUMDEVICES; i++)
@@ -385,6 +430,7 @@ void usb_poll() {
 			// just remove everything ...
 			for (i=0; i<USB_NUMDEVICES; i++) {
 				if(dev[i].bAddress && dev[i].class) {
+					usb_sched_remove(dev+i);
 					rcode = dev[i].class->release(dev+i);
 					dev[i].bAddress = 0;
 				}
@@ -412,14 +458,14 @@ void usb_poll() {
 				tmpdata = max3421e_read_u08( MAX3421E_MODE ) | MAX3421E_SOFKAENAB;   // start SOF generation
 				max3421e_write_u08( MAX3421E_MODE, tmpdata );
 				usb_task_state = USB_ATTACHED_SUBSTATE_WAIT_SOF;
+				usb_sof = false;
 				delay = timer_get_msec();                              //20ms wait after reset per USB spec
 			}
 			break;
 
 		case USB_ATTACHED_SUBSTATE_WAIT_SOF:
 			if( timer_check(delay, 20) ) {//20ms passed
-				if( max3421e_read_u08( MAX3421E_HIRQ ) & MAX3421E_FRAMEIRQ ) { //when first SOF received we can continue
-					max3421e_write_u08( MAX3421E_HIRQ, MAX3421E_FRAMEIRQ);
+				if( usb_sof ) { //when first SOF received we can continue
 					usb_task_state = USB_STATE_CONFIGURING;
 				}
 			}
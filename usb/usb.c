@@ -3,6 +3,7 @@
 
 #include "timer.h"
 #include "usb.h"
+#include "usbsched.h"
 #include "debug.h"
 
 static usb_device_t dev[USB_NUMDEVICES];
@@ -169,6 +170,7 @@ uint8_t usb_release_device(uint8_t parent, uint8_t port) {
 			}
 
 			uint8_t rcode = 0;
+			usb_sched_remove(dev+i);
 			if(dev[i].class)
 				rcode = dev[i].class->release(dev+i);
 
@@ -0,0 +1,157 @@
+// usbsched.c
+// Polls the interrupt and bulk endpoints of all devices from a per frame
+// schedule. Poll periods are rounded down to powers of two and every
+// endpoint gets a fixed phase within its period, chosen so the polls are
+// spread evenly over the frames. The host layer runs the schedule at the
+// start of every frame, interrupt endpoints first.
+
+#include <stdio.h>
+#include <string.h>
+
+#include "usb.h"
+#include "usbsched.h"
+
+static usb_sched_entry_t entries[USB_SCHED_ENTRIES];
+static uint8_t nentries;
+static uint16_t cur_frame;
+static bool changed;
+
+void usb_sched_init() {
+  nentries = 0;
+  cur_frame = 0;
+  changed = true;
+}
+
+// number of polls scheduled in a frame
+static uint8_t usb_sched_load(uint16_t frame) {
+  uint8_t i, load = 0;
+
+  for(i = 0; i < nentries; i++)
+    if(!((uint16_t)(frame - entries[i].next) & (entries[i].period - 1)))
+      load++;
+
+  return load;
+}
+
+// add an endpoint to the schedule, returns its slot or -1 if the schedule is full
+int8_t usb_sched_add(usb_device_t *dev, usb_sched_func_t func, uint8_t idx,
+                     uint8_t type, uint8_t interval) {
+  usb_sched_entry_t *e;
+  uint8_t period, phase, best = 0, best_load = 0xff;
+  uint8_t i, f;
+
+  if(nentries == USB_SCHED_ENTRIES) {
+    iprintf("USB: poll schedule full\n");
+    return -1;
+  }
+
+  for(period = 1; (period < USB_SCHED_MAX_PERIOD) && ((period << 1) <= interval); period <<= 1);
+
+  // phase with the fewest polls in its busiest frame
+  for(phase = 0; phase < period; phase++) {
+    uint8_t load = 0;
+    for(f = phase; f < USB_SCHED_MAX_PERIOD; f += period) {
+      uint8_t l = usb_sched_load(f);
+      if(l > load) load = l;
+    }
+    if(load < best_load) {
+      best_load = load;
+      best = phase;
+    }
+  }
+
+  // interrupt endpoints before bulk ones, shorter periods first
+  for(i = 0; i < nentries; i++) {
+    if(type == EP_TYPE_INTR && entries[i].type != EP_TYPE_INTR) break;
+    if(type == entries[i].type && period < entries[i].period) break;
+  }
+  memmove(entries + i + 1, entries + i, (nentries - i) * sizeof(usb_sched_entry_t));
+  nentries++;
+
+  e = &entries[i];
+  e->dev = dev;
+  e->func = func;
+  e->idx = idx;
+  e->type = type;
+  e->period = period;
+  e->next = cur_frame + 1 + ((uint16_t)(best - cur_frame - 1) & (period - 1));
+  e->polls = 0;
+  e->missed = 0;
+  changed = true;
+
+  return i;
+}
+
+// remove all endpoints of a device
+void usb_sched_remove(usb_device_t *dev) {
+  uint8_t i, j;
+
+  for(i = j = 0; i < nentries; i++)
+    if(entries[i].dev != dev)
+      entries[j++] = entries[i];
+
+  if(j != nentries) changed = true;
+  nentries = j;
+}
+
+// run the polls due in this frame. Bulk endpoints are postponed to the
+// next frame if frame_over() reports that this one has ended, but never
+// for longer than their period
+void usb_sched_run(uint16_t frame, bool (*frame_over)(void)) {
+  uint8_t i;
+
+  cur_frame = frame;
+  changed = false;
+
+  // a poll function may add or remove endpoints (hubs), the remaining
+  // polls are then done in the next frame
+  for(i = 0; i < nentries && !changed; i++) {
+    usb_sched_entry_t *e = &entries[i];
+    int16_t late = frame - e->next;
+
+    if(late < 0) continue;
+
+    if(e->type == EP_TYPE_BULK && late < e->period && frame_over && frame_over())
+      continue;
+
+    if(late >= e->period) {
+      uint16_t n = late / e->period;
+      // the first poll may be late because of the device enumeration
+      if(e->polls) e->missed += n;
+      e->next += n * e->period;
+    }
+    e->next += e->period;
+    e->polls++;
+
+    e->func(e->dev, e->idx);
+  }
+}
+
+uint8_t usb_sched_entries() {
+  return nentries;
+}
+
+const usb_sched_entry_t *usb_sched_get(uint8_t i) {
+  return (i < nentries) ? &entries[i] : 0;
+}
+
+void usb_sched_reset_stats() {
+  uint8_t i;
+
+  for(i = 0; i < nentries; i++)
+    entries[i].missed = 0;
+}
+
+void usb_sched_dump(void (*out)(char *line)) {
+  char line[48];
+  uint8_t i;
+
+  out("addr idx type period    polls   missed");
+  for(i = 0; i < nentries; i++) {
+    usb_sched_entry_t *e = &entries[i];
+    siprintf(line, "%4d %3d %4s %6d %8lu %8lu", e->dev->bAddress, e->idx,
+             (e->type == EP_TYPE_INTR) ? "intr" : "bulk", e->period,
+             (unsigned long)e->polls, (unsigned long)e->missed);
+    out(line);
+  }
+}
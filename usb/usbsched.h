@@ -0,0 +1,47 @@
+/*
+ * usbsched.h
+ * Frame based polling of interrupt and bulk endpoints
+ *
+ */
+
+#ifndef USBSCHED_H
+#define USBSCHED_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+struct usb_device_entry;
+
+// max. number of polled endpoints of all devices
+#ifndef USB_SCHED_ENTRIES
+#define USB_SCHED_ENTRIES 16
+#endif
+
+// longest poll period in frames (ms), periods are powers of two
+#define USB_SCHED_MAX_PERIOD 128
+
+// poll function of an endpoint, idx is the value given to usb_sched_add()
+typedef uint8_t (*usb_sched_func_t)(struct usb_device_entry *dev, uint8_t idx);
+
+typedef struct {
+  struct usb_device_entry *dev;
+  usb_sched_func_t func;
+  uint8_t idx;
+  uint8_t type;       // EP_TYPE_INTR or EP_TYPE_BULK
+  uint8_t period;     // poll period in frames
+  uint16_t next;      // frame of the next poll
+  uint32_t polls;
+  uint32_t missed;    // poll intervals passed without a poll
+} usb_sched_entry_t;
+
+void usb_sched_init();
+int8_t usb_sched_add(struct usb_device_entry *dev, usb_sched_func_t func, uint8_t idx,
+                     uint8_t type, uint8_t interval);
+void usb_sched_remove(struct usb_device_entry *dev);
+void usb_sched_run(uint16_t frame, bool (*frame_over)(void));
+uint8_t usb_sched_entries();
+const usb_sched_entry_t *usb_sched_get(uint8_t i);
+void usb_sched_reset_stats();
+void usb_sched_dump(void (*out)(char *line));
+
+#endif // USBSCHED_H
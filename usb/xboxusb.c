@@ -26,6 +26,7 @@
 #include <string.h>
 #include "max3421e.h"
 #include "usb.h"
+#include "usbsched.h"
 #include "timer.h"
 #include "joystick.h"
 #include "joymapping.h"
@@ -33,6 +34,7 @@
 #include "state.h"
 #include "user_io.h"
 #include "debug.h"
+#include "prof.h"
 
 
 static uint8_t usb_xbox_parse_conf(usb_device_t *dev, uint8_t conf, uint16_t len) {
@@ -112,6 +114,8 @@ static uint8_t usb_xbox_parse_conf(usb_device_t *dev, uint8_t conf, uint16_t len
 	return 0;
 }
 
+static uint8_t usb_xbox_poll(usb_device_t *dev, uint8_t idx);
+
 uint8_t usb_xbox_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc) {
 	uint8_t rcode;
 	uint16_t pid;
@@ -165,7 +169,9 @@ uint8_t usb_xbox_init(usb_device_t *dev, usb_device_descriptor_t *dev_desc) {
 
 	usb_debugf("add xbox joystick #%d", joystick_count());
 	dev->xbox_info.jindex = joystick_add();
+	virtual_joystick_mapping_init(&dev->xbox_info.vmap, dev->vid, dev->pid);
 	dev->xbox_info.bPollEnable = true;
+	usb_sched_add(dev, usb_xbox_poll, 0, EP_TYPE_INTR, dev->xbox_info.interval);
 	return 0;
 }
 
@@ -218,7 +224,7 @@ static void usb_xbox_read_report(usb_device_t *dev, uint16_t len, uint8_t *buf)
 	if(((buf[13]+128) & 0xFF) > JOYSTICK_AXIS_TRIGGER_MAX) jmap |= JOY_UP;
 	buttons |= (jmap << 16);
 
-	uint32_t vjoy = virtual_joystick_mapping(dev->vid, dev->pid, buttons);
+	uint32_t vjoy = virtual_joystick_mapping(&dev->xbox_info.vmap, buttons);
 	// add right stick (no remap)
 	vjoy |= (jmap << 16);
 
@@ -250,26 +256,26 @@ static void usb_xbox_read_report(usb_device_t *dev, uint16_t len, uint8_t *buf)
 	user_io_analog_joystick(idx, buf[7], ~buf[9], buf[11], ~buf[13]);
 }
 
-uint8_t usb_xbox_poll(usb_device_t *dev) {
+static uint8_t usb_xbox_poll(usb_device_t *dev, uint8_t idx) {
 
 	if(!dev->xbox_info.bPollEnable)
 		return 0;
-	if (timer_check(dev->xbox_info.qLastPollTime, dev->xbox_info.interval)) {
-		uint16_t read = dev->xbox_info.inEp.maxPktSize;
-		uint8_t buf[dev->xbox_info.inEp.maxPktSize];
-		// clear buffer
-		memset(buf, 0, dev->xbox_info.inEp.maxPktSize);
-		uint8_t rcode = usb_in_transfer(dev, &(dev->xbox_info.inEp), &read, buf);
-		if (rcode) {
-			if (rcode != hrNAK)
-				usb_debugf("%s() error: %d", __FUNCTION__, rcode);
-		} else {
-			usb_xbox_read_report(dev, read, buf);
-		}
-		dev->xbox_info.qLastPollTime = timer_get_msec();   // poll at requested rate
+
+	uint16_t read = dev->xbox_info.inEp.maxPktSize;
+	uint8_t buf[dev->xbox_info.inEp.maxPktSize];
+	// clear buffer
+	memset(buf, 0, dev->xbox_info.inEp.maxPktSize);
+	uint8_t rcode = usb_in_transfer(dev, &(dev->xbox_info.inEp), &read, buf);
+	if (rcode) {
+		if (rcode != hrNAK)
+			usb_debugf("%s() error: %d", __FUNCTION__, rcode);
+	} else {
+		input_trace_begin(PROF_INPUT_JOY);
+		usb_xbox_read_report(dev, read, buf);
+		input_trace_end();
 	}
 	return 0;
 }
 
 const usb_device_class_config_t usb_xbox_class = {
-  usb_xbox_init, usb_xbox_release, usb_xbox_poll };
+  usb_xbox_init, usb_xbox_release, NULL };
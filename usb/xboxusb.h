@@ -52,10 +52,10 @@ typedef struct {
 	bool     bPollEnable;    // poll enable flag
 	uint8_t  interval;
 	uint32_t oldButtons;
-	uint32_t qLastPollTime;  // next poll time
 	ep_t     inEp;
   ep_t     outEp;
 	uint16_t jindex;
+	joymapping_table_t vmap;
 } usb_xbox_info_t;
 
 // interface to usb core
@@ -0,0 +1,456 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer.h"
+#include "usb.h"
+#include "usbsched.h"
+#include "max3421e.h"
+#include "mist_cfg.h"
+
+// Runs the MAX3421E host layer against a register level model of the
+// chip behind the SPI functions, with a few simulated devices on the bus.
+// The same devices are polled by the frame schedule and by a copy of the
+// former timer based polling, the results are compared.
+
+#define SOF_OFFSET   300     // us, the SOF isn't aligned to the ms timer
+#define LOOP_TIME    150     // us per main loop pass
+#define SPI_BYTE     1       // us per byte on the SPI bus
+#define SIM_TIME     5000    // ms per run
+
+static unsigned long now;        // us
+static unsigned long spi_bytes;
+static unsigned long transfers;
+static unsigned long addr_setups; // PERADDR writes
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+mist_cfg_t mist_cfg;
+int iprintf(const char *fmt, ...) { return 0; }
+
+// ---------------- clock ----------------
+
+static unsigned long sofs;       // SOFs generated
+static char sof_enabled;
+static uint8_t reg[32];
+
+static void sim_advance(unsigned long us) {
+	unsigned long next_sof = (sofs + 1) * 1000 + SOF_OFFSET;
+	now += us;
+	while(sof_enabled && now >= next_sof) {
+		sofs++;
+		next_sof += 1000;
+		reg[MAX3421E_HIRQ >> 3] |= MAX3421E_FRAMEIRQ;
+	}
+	if(!sof_enabled) sofs = (now - SOF_OFFSET) / 1000;
+}
+
+void timer_init() { }
+msec_t timer_get_msec() { return now / 1000; }
+bool timer_check(msec_t ref, msec_t delay) { return (now / 1000 - ref) >= delay; }
+void timer_delay_msec(msec_t t) { sim_advance(t * 1000); }
+
+// ---------------- devices ----------------
+
+typedef struct {
+	const char *name;
+	uint8_t addr;
+	uint8_t epnum;
+	bool lowspeed;
+	uint8_t type;
+	uint8_t interval;            // requested poll interval (ms)
+	uint8_t maxpkt;
+	uint8_t len;                 // report size
+	unsigned long every;         // us between new reports, 0: bulk stream
+
+	// device side
+	unsigned long next_data;     // time the oldest unread report arrived
+	unsigned long reports, lost;
+	unsigned long lat_sum, lat_max;
+
+	// host side
+	ep_t ep;
+	msec_t last;                 // former polling
+	unsigned long polls;
+	unsigned long first_frame, last_frame;
+	unsigned long behind_bulk;   // interrupt polls behind a bulk poll of the same frame
+} sim_ep_t;
+
+static sim_ep_t eps[] = {
+	// an ethernet adapter is the first device, so the former polling
+	// serves it before the joysticks
+	{ "eth irq",  1, 3, false, EP_TYPE_INTR, 8,  8,  8,   0 },
+	{ "eth bulk", 1, 2, false, EP_TYPE_BULK, 2,  64, 64,  0 },
+	// the device clocks are a bit off, so the reports wander through the frames
+	{ "joypad",   2, 1, false, EP_TYPE_INTR, 1,  32, 20,  1001 },
+	{ "joypad 2", 3, 1, false, EP_TYPE_INTR, 4,  32, 20,  4003 },
+	{ "mouse",    4, 1, true,  EP_TYPE_INTR, 8,  8,  4,   7993 },
+	{ "keyboard", 5, 1, true,  EP_TYPE_INTR, 10, 8,  8,   100007 },
+};
+#define NEPS (sizeof(eps)/sizeof(eps[0]))
+#define NDEVS 5
+
+static usb_device_t devs[USB_NUMDEVICES];
+usb_device_t *usb_get_devices() { return devs; }
+
+static sim_ep_t *sim_find(uint8_t addr, uint8_t epnum) {
+	int i;
+	for(i = 0; i < NEPS; i++)
+		if(eps[i].addr == addr && eps[i].epnum == epnum)
+			return &eps[i];
+	return 0;
+}
+
+// ---------------- MAX3421E register model ----------------
+
+static uint8_t rcvfifo[64], rcvlen, rcvptr;
+static uint8_t spi_reg, spi_wr, spi_state;
+static char frame_had_bulk;          // bulk transfer since the SOF irq was cleared
+
+static void sim_transfer(uint8_t token) {
+	sim_ep_t *e = sim_find(reg[MAX3421E_PERADDR >> 3], token & 0x0f);
+	bool ls = e && e->lowspeed;
+	uint8_t result = hrNAK;
+
+	sim_advance(ls ? 60 : 10);   // token and handshake
+	transfers++;
+
+	if(e && (token & 0xf0) == tokIN) {
+		if(e->type == EP_TYPE_BULK) {
+			frame_had_bulk = 1;
+		} else {
+			if(frame_had_bulk) e->behind_bulk++;
+			if(!e->polls) e->first_frame = sofs;
+			e->last_frame = sofs;
+		}
+		e->polls++;
+
+		if(!e->every || now >= e->next_data) {
+			rcvlen = e->len;
+			rcvptr = 0;
+			memset(rcvfifo, 0x55, rcvlen);
+			sim_advance(rcvlen * (ls ? 6 : 1));
+			if(e->every) {
+				unsigned long lat = now - e->next_data;
+				unsigned long n = lat / e->every;
+				e->lost += n;
+				e->reports++;
+				e->lat_sum += lat;
+				if(lat > e->lat_max) e->lat_max = lat;
+				e->next_data += (n + 1) * e->every;
+			}
+			reg[MAX3421E_HIRQ >> 3] |= MAX3421E_RCVDAVIRQ;
+			reg[MAX3421E_RCVBC >> 3] = rcvlen;
+			result = hrSUCCESS;
+		}
+	} else if((token & 0xf0) != tokIN) {
+		result = hrSUCCESS;
+	}
+
+	reg[MAX3421E_HRSL >> 3] = (reg[MAX3421E_HRSL >> 3] & 0xf0) | result;
+	reg[MAX3421E_HIRQ >> 3] |= MAX3421E_HXFRDNIRQ;
+}
+
+static void reg_write(uint8_t r, uint8_t v) {
+	switch(r << 3) {
+	case MAX3421E_HIRQ:
+		// both pollers clear the SOF irq before a poll pass
+		if(v & MAX3421E_FRAMEIRQ) frame_had_bulk = 0;
+		reg[r] &= ~v;
+		break;
+	case MAX3421E_HCTL:
+		// bus reset completes immediately, the toggles are strobes
+		reg[r] = v & ~(MAX3421E_BUSRST | MAX3421E_RCVTOG0 | MAX3421E_RCVTOG1 | MAX3421E_SNDTOG0 | MAX3421E_SNDTOG1);
+		break;
+	case MAX3421E_MODE:
+		reg[r] = v;
+		sof_enabled = (v & MAX3421E_SOFKAENAB) != 0;
+		break;
+	case MAX3421E_HXFR:
+		sim_transfer(v);
+		break;
+	case MAX3421E_PERADDR:
+		addr_setups++;
+		reg[r] = v;
+		break;
+	default:
+		reg[r] = v;
+	}
+}
+
+static uint8_t reg_read(uint8_t r) {
+	switch(r << 3) {
+	case MAX3421E_RCVFIFO:
+		return (rcvptr < rcvlen) ? rcvfifo[rcvptr++] : 0;
+	case MAX3421E_USBIRQ:
+		return MAX3421E_OSCOKIRQ;
+	case MAX3421E_HRSL:
+		return reg[r] | MAX3421E_JSTATUS;
+	}
+	return reg[r];
+}
+
+void spi_max_start() { spi_state = 0; }
+void spi_max_end() { }
+
+void spi8(unsigned char b) {
+	spi_bytes++;
+	sim_advance(SPI_BYTE);
+	if(!spi_state) {
+		spi_reg = b >> 3;
+		spi_wr = b & MAX3421E_WRITE;
+		spi_state = 1;
+	} else if(spi_wr) {
+		reg_write(spi_reg, b);
+	}
+}
+
+unsigned char spi_in() {
+	spi_bytes++;
+	sim_advance(SPI_BYTE);
+	return reg_read(spi_reg);
+}
+
+void spi_read(char *addr, uint16_t len) {
+	while(len--) *addr++ = spi_in();
+}
+
+void spi_write(const char *addr, uint16_t len) {
+	while(len--) spi8(*addr++);
+}
+
+// ---------------- host side ----------------
+
+static uint8_t sim_poll(usb_device_t *dev, uint8_t idx) {
+	sim_ep_t *e = &eps[idx];
+	uint8_t buf[64], burst;
+	uint16_t read;
+
+	if(e->type == EP_TYPE_INTR) {
+		read = e->ep.maxPktSize;
+		return usb_in_transfer(dev, &e->ep, &read, buf);
+	}
+
+	// bulk endpoints read several packets per poll
+	for(burst = 0; burst < 4; burst++) {
+		read = e->ep.maxPktSize;
+		if(usb_in_transfer(dev, &e->ep, &read, buf)) break;
+	}
+	return 0;
+}
+
+static void sim_attach() {
+	int i;
+
+	memset(devs, 0, sizeof(devs));
+	for(i = 0; i < NEPS; i++) {
+		usb_device_t *d = &devs[eps[i].addr - 1];
+		d->bAddress = eps[i].addr;
+		d->lowspeed = eps[i].lowspeed;
+		eps[i].ep.epAddr = eps[i].epnum;
+		eps[i].ep.epType = eps[i].type;
+		eps[i].ep.maxPktSize = eps[i].maxpkt;
+		eps[i].ep.epAttribs = 0;
+		eps[i].ep.bmNakPower = USB_NAK_NOWAIT;
+	}
+}
+
+uint8_t usb_configure(uint8_t parent, uint8_t port, bool lowspeed) {
+	int i;
+
+	sim_attach();
+	for(i = 0; i < NEPS; i++)
+		usb_sched_add(&devs[eps[i].addr - 1], sim_poll, i, eps[i].type, eps[i].interval);
+	return 0;
+}
+
+// the polling before the frame schedule, timer based in device order
+static void legacy_poll() {
+	static msec_t poll = 0;
+	int d, i;
+
+	max3421e_poll();
+	if(timer_check(poll, 1)) {
+		if(max3421e_read_u08(MAX3421E_HIRQ) & MAX3421E_FRAMEIRQ)
+			max3421e_write_u08(MAX3421E_HIRQ, MAX3421E_FRAMEIRQ);
+		poll = timer_get_msec();
+
+		for(d = 0; d < NDEVS; d++)
+			for(i = 0; i < NEPS; i++)
+				if(eps[i].addr == devs[d].bAddress && timer_check(eps[i].last, eps[i].interval)) {
+					sim_poll(&devs[d], i);
+					eps[i].last = timer_get_msec();
+				}
+	}
+}
+
+// ---------------- runs ----------------
+
+typedef struct {
+	unsigned long transfers, addr_setups;
+	unsigned long pad_lat_avg, pad_lat_max, pad_lost;
+	unsigned long behind_bulk;
+	unsigned long bulk_polls;
+} result_t;
+
+static void sim_reset_stats() {
+	int i;
+	for(i = 0; i < NEPS; i++) {
+		eps[i].reports = eps[i].lost = eps[i].lat_sum = eps[i].lat_max = 0;
+		eps[i].polls = eps[i].behind_bulk = 0;
+		if(eps[i].every) eps[i].next_data = now;
+	}
+	usb_sched_reset_stats();
+	spi_bytes = transfers = addr_setups = 0;
+}
+
+// main loop with the usb poll and other tasks, the busy one stalls
+// for 6ms every 40ms (e.g. a floppy track read)
+static void sim_loop(char legacy, char busy, unsigned long ms) {
+	unsigned long end = now + ms * 1000;
+	unsigned long next_stall = now + 40000;
+
+	while(now < end) {
+		if(legacy) legacy_poll();
+		else usb_poll();
+		sim_advance(LOOP_TIME);
+		if(busy && now >= next_stall) {
+			sim_advance(6000);
+			next_stall += 40000;
+		}
+	}
+}
+
+static void sim_result(const char *title, result_t *r, unsigned long ms) {
+	int i;
+	printf("%s:\n", title);
+	printf("  endpoint   polls  reports  lost  latency avg/max (us)  behind bulk\n");
+	for(i = 0; i < NEPS; i++) {
+		sim_ep_t *e = &eps[i];
+		printf("  %-9s %6lu %8lu %5lu  %8lu %8lu  %8lu\n", e->name, e->polls, e->reports, e->lost,
+		       e->reports ? e->lat_sum / e->reports : 0, e->lat_max, e->behind_bulk);
+	}
+	printf("  spi bytes per ms: %lu, transfers %lu, address setups %lu\n", spi_bytes / ms,
+	       transfers, addr_setups);
+
+	r->transfers = transfers;
+	r->addr_setups = addr_setups;
+	r->pad_lat_avg = eps[2].reports ? eps[2].lat_sum / eps[2].reports : 0;
+	r->pad_lat_max = eps[2].lat_max;
+	r->pad_lost = eps[2].lost;
+	r->bulk_polls = 0;
+	for(i = 0, r->behind_bulk = 0; i < NEPS; i++)
+		r->behind_bulk += eps[i].behind_bulk;
+}
+
+static void run_legacy(char busy, result_t *r) {
+	max3421e_init();
+	sim_attach();
+	sim_loop(1, 0, 100);
+	sim_reset_stats();
+	sim_loop(1, busy, SIM_TIME);
+	sim_result(busy ? "timer polling, busy main loop" : "timer polling", r, SIM_TIME);
+}
+
+static void run_sched(char busy, result_t *r) {
+	int i;
+
+	usb_hw_init();
+	// enumeration: settle, reset, first SOF
+	sim_loop(0, 0, 400);
+	CHECK(usb_sched_entries() == NEPS);
+	sim_reset_stats();
+	sim_loop(0, busy, SIM_TIME);
+	sim_result(busy ? "frame schedule, busy main loop" : "frame schedule", r, SIM_TIME);
+
+	usb_sched_dump((void (*)(char *))puts);
+
+	for(i = 0; i < usb_sched_entries(); i++) {
+		const usb_sched_entry_t *e = usb_sched_get(i);
+		sim_ep_t *s = &eps[e->idx];
+		if(e->type == EP_TYPE_BULK) {
+			r->bulk_polls += e->polls;
+			continue;
+		}
+
+		// interrupt endpoints come first, shorter periods first
+		if(i) CHECK(usb_sched_get(i-1)->type == EP_TYPE_INTR && usb_sched_get(i-1)->period <= e->period);
+
+		// every slot of the period was either polled or counted as missed
+		unsigned long slots = (s->last_frame - s->first_frame) / e->period + 1;
+		CHECK(s->polls + e->missed >= slots - 1 && s->polls + e->missed <= slots + 1);
+		if(!busy) CHECK(e->missed == 0);
+	}
+	if(busy) CHECK(usb_sched_get(0)->missed > 0);
+
+	// a device leaving removes its endpoints
+	usb_sched_remove(&devs[0]);
+	CHECK(usb_sched_entries() == NEPS - 2);
+	usb_sched_remove(&devs[1]);
+	usb_sched_remove(&devs[2]);
+	usb_sched_remove(&devs[3]);
+	usb_sched_remove(&devs[4]);
+	CHECK(usb_sched_entries() == 0);
+}
+
+static void test_phases() {
+	static usb_device_t dev;
+	int i, f, load[USB_SCHED_MAX_PERIOD];
+
+	// eight endpoints with a period of 8 frames get one frame each
+	usb_sched_init();
+	for(i = 0; i < 8; i++)
+		CHECK(usb_sched_add(&dev, sim_poll, 0, EP_TYPE_INTR, 10) >= 0);
+
+	memset(load, 0, sizeof(load));
+	for(i = 0; i < 8; i++) {
+		const usb_sched_entry_t *e = usb_sched_get(i);
+		CHECK(e->period == 8);
+		for(f = e->next & 7; f < USB_SCHED_MAX_PERIOD; f += 8)
+			load[f]++;
+	}
+	for(f = 0; f < USB_SCHED_MAX_PERIOD; f++)
+		CHECK(load[f] == 1);
+
+	// bulk endpoints go behind the interrupt ones
+	CHECK(usb_sched_add(&dev, sim_poll, 0, EP_TYPE_BULK, 1) == 8);
+	CHECK(usb_sched_add(&dev, sim_poll, 0, EP_TYPE_INTR, 255) == 8);
+	CHECK(usb_sched_get(8)->period == USB_SCHED_MAX_PERIOD);
+	CHECK(usb_sched_get(9)->type == EP_TYPE_BULK);
+
+	// full schedule
+	for(i = usb_sched_entries(); i < USB_SCHED_ENTRIES; i++)
+		CHECK(usb_sched_add(&dev, sim_poll, 0, EP_TYPE_INTR, 1) >= 0);
+	CHECK(usb_sched_add(&dev, sim_poll, 0, EP_TYPE_INTR, 1) == -1);
+
+	usb_sched_remove(&dev);
+	CHECK(usb_sched_entries() == 0);
+}
+
+int main(int argc, char **argv) {
+	result_t legacy, sched, legacy_busy, sched_busy;
+
+	test_phases();
+
+	run_legacy(0, &legacy);
+	run_sched(0, &sched);
+	run_legacy(1, &legacy_busy);
+	run_sched(1, &sched_busy);
+
+	// interrupt endpoints are never polled behind a bulk transfer
+	CHECK(sched.behind_bulk == 0);
+	CHECK(sched_busy.behind_bulk == 0);
+	CHECK(sched.bulk_polls > 0 && sched_busy.bulk_polls > 0);
+
+	// the 1ms joypad gets its reports at least as fast, and not less of them
+	CHECK(sched.pad_lat_avg <= legacy.pad_lat_avg);
+	CHECK(sched.pad_lost <= legacy.pad_lost);
+	CHECK(sched_busy.pad_lat_avg <= legacy_busy.pad_lat_avg);
+
+	// the chip isn't set up again for transfers to the same device
+	CHECK(sched.addr_setups < sched.transfers * 3 / 4);
+
+	printf("%s (%d errors)\n", errors ? "FAILED" : "PASSED", errors);
+	return errors ? 1 : 0;
+}
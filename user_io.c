@@ -25,6 +25,7 @@
 #include "tos.h"
 #include "errors.h"
 #include "arc_file.h"
+#include "conf_str.h"
 #include "cue_parser.h"
 #include "utils.h"
 #include "settings.h"
@@ -32,6 +33,7 @@
 #include "usb/joystick.h"
 #include "FatFs/diskio.h"
 #include "menu.h"
+#include "prof.h"
 #ifdef HAVE_HDMI
 #include "it6613/HDMI_TX.h"
 #endif
@@ -81,6 +83,7 @@ static uint8_t latest_keyb_priority = 0;  // keyboard=0, joypad with key mapping
 #define MOUSE_FREQ 20   // 20 ms -> 50hz
 static int16_t mouse_pos[2][3] = { {0, 0, 0}, {0, 0, 0} };
 static uint8_t mouse_flags[2] = { 0, 0 };
+static input_trace_t mouse_trace[2];
 static unsigned long mouse_timer;
 
 #define LED_FREQ 100   // 100 ms
@@ -93,6 +96,9 @@ bool scrl_status = 0;
 #define RTC_FREQ 1000   // 1 s
 static unsigned long rtc_timer;
 
+// background save of the battery RAM of 8 bit cores
+static unsigned long autosave_timer;
+
 static unsigned char modifier = 0, pressed[6] = { 0,0,0,0,0,0 };
 
 static unsigned char ps2_typematic_rate = 0x80;
@@ -119,6 +125,9 @@ static uint32_t autofire_map;
 static uint32_t autofire_mask;
 static char autofire_joy;
 
+// virtual joystick mapping of the db9 joysticks
+static joymapping_table_t db9_vmap[2];
+
 // ATA drives
 hardfileTYPE  hardfiles[4];
 
@@ -135,6 +144,8 @@ static uint8_t hdmi_hiclk = 0;
 static uint16_t conf_idx[CONF_TBL_MAX];
 static int conf_items = 0;
 
+static void user_io_8bit_read_config_string();
+
 char user_io_osd_is_visible() {
 	return osd_is_visible;
 }
@@ -165,6 +176,7 @@ void user_io_reset() {
 	autofire_joy = -1;
 	conf_items = 0;
 	conf_idx[0] = 0;
+	conf_str_reset();
 }
 
 void user_io_init() {
@@ -177,6 +189,9 @@ void user_io_init() {
 	// mark remap table as unused
 	memset(key_remap_table, 0, sizeof(key_remap_table));
 
+	virtual_joystick_mapping_init(&db9_vmap[0], 0x00db, 0x0000);
+	virtual_joystick_mapping_init(&db9_vmap[1], 0x00db, 0x0001);
+
 	if(MenuButton()) DEBUG_MODE_VAR = DEBUG_MODE ? 0 : DEBUG_MODE_VALUE;
 	iprintf("debug_mode = %d\n", DEBUG_MODE);
 
@@ -283,6 +298,8 @@ static void user_io_read_core_features() {
 
 void user_io_detect_core_type() {
 	core_name[0] = 0;
+	// the save of the last core is incomplete
+	data_io_rx_abort();
 
 	EnableIO();
 	core_type = SPI(0xff);
@@ -335,7 +352,8 @@ void user_io_detect_core_type() {
 		// SD card implementation
 		user_io_sd_set_config();
 
-		// check if core has a config string
+		// fetch the config string and check if the core has one
+		user_io_8bit_read_config_string();
 		core_type_8bit_with_config_string = (user_io_8bit_get_string(0) != NULL);
 
 		// set core name. This currently only sets a name for the 8 bit cores
@@ -351,8 +369,27 @@ void user_io_detect_core_type() {
 	}
 }
 
+// the core's battery RAM is saved to its .RAM file if there is one already,
+// the 'R' entry of the config string tells the length
+static void user_io_8bit_autosave() {
+	int i, len;
+
+	if (!conf_str_valid()) return;
+	for (i = 0; i < conf_str_items(); i++) {
+		const conf_item_t *item = conf_str_get_item(i);
+		char *p = conf_str_get(i);
+		if (!item || !p || item->type != 'R') continue;
+		if (p[0] == 'P' && p[2] != ',') p += 2;
+		len = strtol(p+1,0,0);
+		if (len && !user_io_create_config_name(s, "RAM", CONFIG_ROOT))
+			data_io_file_rx_background(s, -1, len);
+		return;
+	}
+}
+
 void user_io_init_core() {
 	if(core_type == CORE_TYPE_8BIT) {
+		autosave_timer = GetTimer(mist_cfg.ram_autosave * 60000UL);
 
 		// send a reset
 		user_io_8bit_set_status(UIO_STATUS_RESET, ~0);
@@ -494,6 +531,7 @@ void user_io_analog_joystick(unsigned char joystick, char valueX, char valueY, c
 		spi8(valueXX2);
 		spi8(valueYY2);
 		DisableIO();
+		input_trace_sent();
 	}
 }
 
@@ -518,6 +556,7 @@ void user_io_digital_joystick(unsigned char joystick, unsigned char map) {
 	// every other core else uses this
 	// (even MIST, joystick 3 and 4 were introduced later)
 	spi_uio_cmd8((joystick < 2)?(UIO_JOYSTICK0 + joystick):((UIO_JOYSTICK2 + joystick - 2)), map);
+	input_trace_sent();
 }
 
 void user_io_digital_joystick_ext(unsigned char joystick, uint32_t map) {
@@ -526,6 +565,9 @@ void user_io_digital_joystick_ext(unsigned char joystick, uint32_t map) {
 	if(osd_is_visible && map) return;
 	//iprintf("ext j%d: %x\n", joystick, map);
 	spi_uio_cmd32(UIO_JOYSTICK0_EXT + joystick, 0x000fffff & map);
+	// the atari st gets joystick 0 and 1 through the ikbd
+	if((core_type != CORE_TYPE_MIST) || (joystick >= 2))
+		input_trace_sent();
 	if (autofire && (map & 0x30)) {
 		autofire_mask = map & 0x30;
 		autofire_map = (autofire_map & autofire_mask) | (map & ~autofire_mask);
@@ -694,7 +736,7 @@ uint32_t user_io_eth_get_status(void) {
 // read ethernet frame from FPGAs ethernet tx buffer
 void user_io_eth_receive_tx_frame(uint8_t *d, uint16_t len) {
 	spi_uio_cmd_cont(UIO_ETH_FRM_IN);
-	while(len--) *d++=spi_in();
+	spi_read((char*)d, len);
 	DisableIO();
 }
 
@@ -751,6 +793,7 @@ static void user_io_joystick_emu() {
 // 16 byte fifo for amiga key codes to limit max key rate sent into the core
 #define KBD_FIFO_SIZE  16   // must be power of 2
 static unsigned short kbd_fifo[KBD_FIFO_SIZE];
+static input_trace_t kbd_fifo_trace[KBD_FIFO_SIZE];
 static unsigned char kbd_fifo_r=0, kbd_fifo_w=0;
 static long kbd_timer = 0;
 
@@ -766,6 +809,7 @@ static void kbd_fifo_enqueue(unsigned short code) {
 
 	// store in queue
 	kbd_fifo[kbd_fifo_w] = code;
+	input_trace_keep(&kbd_fifo_trace[kbd_fifo_w]);
 	kbd_fifo_w = (kbd_fifo_w + 1)&(KBD_FIFO_SIZE-1);
 }
 
@@ -781,6 +825,7 @@ static void kbd_fifo_poll() {
 		return;
 
 	kbd_fifo_minimig_send(kbd_fifo[kbd_fifo_r]);
+	input_trace_emit(&kbd_fifo_trace[kbd_fifo_r]);
 	kbd_fifo_r = (kbd_fifo_r + 1)&(KBD_FIFO_SIZE-1);
 }
 
@@ -831,7 +876,7 @@ void user_io_file_mount(const unsigned char *name, unsigned char index) {
 	buffer_lba = 0xffffffff; // invalidate cache
 	if (name) {
 		if (sd_image[sd_index(index)].valid)
-			f_close(&sd_image[sd_index(index)].file);
+			IDXClose(&sd_image[sd_index(index)]);
 
 		res = IDXOpen(&sd_image[sd_index(index)], name, FA_READ | FA_WRITE);
 		if (res != FR_OK) res = IDXOpen(&sd_image[sd_index(index)], name, FA_READ);
@@ -847,7 +892,7 @@ void user_io_file_mount(const unsigned char *name, unsigned char index) {
 		}
 	} else {
 		iprintf("unmounting file in slot %d\n", index);
-		if (sd_image[sd_index(index)].valid) f_close(&sd_image[sd_index(index)].file);
+		if (sd_image[sd_index(index)].valid) IDXClose(&sd_image[sd_index(index)]);
 		sd_image[sd_index(index)].valid = 0;
 		if (!index) umounted = 1;
 	}
@@ -869,7 +914,9 @@ void user_io_file_mount(const unsigned char *name, unsigned char index) {
 // 8 bit cores have a config string telling the firmware how
 // to treat it
 
-char *user_io_8bit_get_string(unsigned char index) {
+// read a single item directly from the core, only used if the config
+// string doesn't fit into the cache
+static char *user_io_8bit_read_string(unsigned char index) {
 	unsigned char i, lidx = 0, j = 0, d = 0, arc = 0;
 	int arc_ptr = 0;
 	char dip[3];
@@ -971,6 +1018,50 @@ char *user_io_8bit_get_string(unsigned char index) {
 	return buffer;
 }
 
+// read the whole config string once into the cache
+static void user_io_8bit_read_config_string() {
+	unsigned char i;
+
+	conf_str_init(arc_get_conf());
+
+	spi_uio_cmd_cont(UIO_GET_STR_EXT);
+	i = SPI(0);
+	if (i == 0xaa) {
+		SPI(0);
+		i = spi_in(); // dummy byte to prepare to apply the offset in the core
+		i = spi_in();
+	} else {
+		DisableIO();
+		spi_uio_cmd_cont(UIO_GET_STRING);
+		i = spi_in();
+		// the first char returned will be 0xff if the core doesn't support
+		// config strings. atari 800 returns 0xa4 which is the status byte
+		if((i == 0xff) || (i == 0xa4)) {
+			DisableIO();
+			conf_str_done();
+			return;
+		}
+	}
+
+	while ((i != 0) && (i != 0xff) && conf_str_putc(i))
+		i = spi_in();
+
+	DisableIO();
+	conf_str_done();
+
+	if (!conf_str_valid())
+		iprintf("Config string doesn't fit into the cache\n");
+	else
+		iprintf("Config string cached, %d items\n", conf_str_items());
+}
+
+char *user_io_8bit_get_string(unsigned char index) {
+	if (conf_str_valid())
+		return conf_str_get(index);
+
+	return user_io_8bit_read_string(index);
+}
+
 unsigned long long user_io_8bit_set_status(unsigned long long new_status, unsigned long long mask) {
 	static unsigned long long status = 0;
 
@@ -1257,6 +1348,7 @@ void user_io_poll() {
 			}
 
 			// reset io controller to cope with new core
+			wb_flush_all();
 			MCUReset(); // restart
 			for(;;);
 		}
@@ -1332,7 +1424,7 @@ void user_io_poll() {
 
 	if(GetDB9(0, &joy_map)) {
 
-		joy_map = virtual_joystick_mapping(0x00db, 0x0000, joy_map);
+		joy_map = virtual_joystick_mapping(&db9_vmap[0], joy_map);
 
 		uint8_t idx = joystick_renumber(0);
 		if (!user_io_osd_is_visible()) user_io_joystick(idx, joy_map);
@@ -1342,7 +1434,7 @@ void user_io_poll() {
 	}
 	if(GetDB9(1, &joy_map)) {
 
-		joy_map = virtual_joystick_mapping(0x00db, 0x0001, joy_map);
+		joy_map = virtual_joystick_mapping(&db9_vmap[1], joy_map);
 
 		uint8_t idx = joystick_renumber(1);
 		if (!user_io_osd_is_visible()) user_io_joystick(idx, joy_map);
@@ -1444,6 +1536,7 @@ void user_io_poll() {
 					spi8(mouse_flags[idx] & 0x07);
 					spi8(z);
 					DisableIO();
+					input_trace_emit(&mouse_trace[idx]);
 
 					// reset flags
 					mouse_flags[idx] = 0;
@@ -1550,6 +1643,7 @@ void user_io_poll() {
 				// only write if the inserted card is not sdhc or
 				// if the core uses sdhc
 				if((!MMC_IsSDHC()) || (c & 0x04)) {
+					PROF_START(prof);
 					if(user_io_dip_switch1())
 						iprintf("SD WR (%d) %d/%d\n", drive_index, lba, 512<<blksz);
 
@@ -1580,11 +1674,13 @@ void user_io_poll() {
 #endif
 
 					DISKLED_OFF;
+					PROF_END(PROF_SD_WRITE, prof);
 				}
 			}
 
 			// Read from file/SD Card
 			if((c & 0x03) == 0x01) {
+				PROF_START(prof);
 
 				if(user_io_dip_switch1())
 					iprintf("SD RD (%d) %d/%d\n", drive_index, lba, 512<<blksz);
@@ -1623,6 +1719,7 @@ void user_io_poll() {
 					spi_uio_cmd_cont(UIO_SECTOR_RD);
 					spi_write(cache_buffer, 512<<blksz);
 					DisableIO();
+					PROF_END(PROF_SD_READ, prof);
 
 					// the end of this transfer acknowledges the FPGA internal
 					// sd card emulation
@@ -1730,6 +1827,7 @@ void user_io_poll() {
 					spi8(ps2_mouse[2]);
 					spi8(ps2_mouse[3]);
 					DisableIO();
+					input_trace_emit(&mouse_trace[idx]);
 
 					// reset counters
 					mouse_flags[idx] = 0;
@@ -1776,6 +1874,12 @@ void user_io_poll() {
 		}
 	}
 
+	if(core_type == CORE_TYPE_8BIT && mist_cfg.ram_autosave && CheckTimer(autosave_timer))
+	{
+		autosave_timer = GetTimer(mist_cfg.ram_autosave * 60000UL);
+		user_io_8bit_autosave();
+	}
+
 	if(CheckTimer(led_timer))
 	{
 		led_timer = GetTimer(LED_FREQ);
@@ -1871,9 +1975,10 @@ static void send_keycode(unsigned short code) {
 		if(code & BREAK) code = (code & 0xff) | 0x80;
 
 		// send immediately if possible
-		if(CheckTimer(kbd_timer) &&(kbd_fifo_w == kbd_fifo_r) )
+		if(CheckTimer(kbd_timer) &&(kbd_fifo_w == kbd_fifo_r) ) {
 			kbd_fifo_minimig_send(code);
-		else
+			input_trace_sent();
+		} else
 			kbd_fifo_enqueue(code);
 	}
 
@@ -1925,6 +2030,7 @@ static void send_keycode(unsigned short code) {
 		}
 
 		DisableIO();
+		input_trace_sent();
 	}
 
 	if(core_type == CORE_TYPE_ARCHIE) 
@@ -1940,6 +2046,7 @@ void user_io_mouse(unsigned char idx, unsigned char b, char x, char y, char z) {
 		mouse_pos[idx][Y] += y;
 		mouse_pos[idx][Z] += z;
 		mouse_flags[idx] |= 0x80 | (b&7);
+		input_trace_keep(&mouse_trace[idx]);
 	}
 
 	// 8 bit core expects ps2 like data
@@ -1949,6 +2056,7 @@ void user_io_mouse(unsigned char idx, unsigned char b, char x, char y, char z) {
 		mouse_pos[idx][Y] -= y;  // ps2 y axis is reversed over usb
 		mouse_pos[idx][Z] += z;
 		mouse_flags[idx] |= 0x08 | (b&7);
+		input_trace_keep(&mouse_trace[idx]);
 	}
 
 	// send mouse data as mist expects it
@@ -2030,6 +2138,7 @@ static void check_reset(unsigned short modifiers, char useKeys)
 		if(modifiers & 2) // with lshift - MiST reset
 		{
 			if(mist_cfg.keep_video_mode) VIDEO_KEEP_VAR = VIDEO_KEEP_VALUE;
+			wb_flush_all();
 			MCUReset(); // HW reset
 			for(;;);
 		}
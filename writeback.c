@@ -0,0 +1,88 @@
+// writeback.c
+// Deferred f_sync() of the hard files and floppy images. Syncing after
+// every block group or track rewrites the directory entry of the image
+// each time, which costs more SD card writes than the data itself for
+// small IDE transfers. Written images are only marked dirty here and
+// synced by wb_poll() according to the policy, or by wb_flush_all()
+// before anything that could lose the open file.
+
+#include "writeback.h"
+
+static struct {
+  wb_state_t *wb;
+  FIL *file;
+} dirty[WB_MAX_FILES];
+static uint8_t ndirty;
+
+static uint8_t policy = WB_IMMEDIATE;
+static uint16_t delay = WB_DEFAULT_DELAY;
+
+void wb_set_policy(uint8_t p, uint16_t d) {
+  wb_flush_all();
+  policy = (p > WB_IDLE) ? WB_IMMEDIATE : p;
+  delay = d;
+}
+
+static void wb_remove(wb_state_t *wb) {
+  uint8_t i;
+
+  for (i = 0; i < ndirty; i++) {
+    if (dirty[i].wb == wb) {
+      dirty[i] = dirty[--ndirty];
+      break;
+    }
+  }
+  wb->dirty = 0;
+}
+
+FRESULT wb_sync(wb_state_t *wb, FIL *file) {
+  if (!wb->dirty) return FR_OK;
+  wb_remove(wb);
+  return f_sync(file);
+}
+
+void wb_written(wb_state_t *wb, FIL *file) {
+  msec_t now = timer_get_msec();
+
+  // wb_set_policy() leaves nothing dirty when switching to WB_IMMEDIATE
+  if (policy == WB_IMMEDIATE || (!wb->dirty && ndirty == WB_MAX_FILES)) {
+    f_sync(file);
+    return;
+  }
+  if (!wb->dirty) {
+    wb->dirty = 1;
+    wb->since = now;
+    dirty[ndirty].wb = wb;
+    dirty[ndirty].file = file;
+    ndirty++;
+  }
+  wb->last = now;
+}
+
+static char wb_due(wb_state_t *wb, msec_t now) {
+  if (policy == WB_PERIODIC)
+    return (now - wb->since) >= delay;
+  return ((now - wb->last) >= delay) || ((now - wb->since) >= (msec_t)delay * WB_IDLE_MAX_AGE);
+}
+
+void wb_poll(void) {
+  msec_t now;
+  uint8_t i;
+
+  if (!ndirty) return;
+  now = timer_get_msec();
+  // wb_sync() moves the last entry into the free slot, go backwards
+  for (i = ndirty; i--; )
+    if (wb_due(dirty[i].wb, now))
+      wb_sync(dirty[i].wb, dirty[i].file);
+}
+
+void wb_flush_all(void) {
+  while (ndirty)
+    wb_sync(dirty[ndirty - 1].wb, dirty[ndirty - 1].file);
+}
+
+void wb_discard_all(void) {
+  while (ndirty)
+    wb_remove(dirty[ndirty - 1].wb);
+}
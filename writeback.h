@@ -0,0 +1,46 @@
+/*
+ * writeback.h
+ * Deferred syncing of the disk images written by the Minimig core
+ *
+ */
+
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+#include "timer.h"
+
+// write-back policies
+#define WB_IMMEDIATE  0  // sync after every write
+#define WB_PERIODIC   1  // sync dirty images every delay ms
+#define WB_IDLE       2  // sync when nothing was written for delay ms
+
+#define WB_DEFAULT_POLICY  WB_IDLE
+#define WB_DEFAULT_DELAY   1000
+// with WB_IDLE an image is synced after delay * WB_IDLE_MAX_AGE at the latest
+#define WB_IDLE_MAX_AGE    8
+
+// 4 hard files and 4 floppies
+#define WB_MAX_FILES  8
+
+// dirty state of an image, part of hdfTYPE and adfTYPE
+typedef struct {
+  uint8_t dirty;
+  msec_t  since;  // first write after the last sync
+  msec_t  last;   // last write
+} wb_state_t;
+
+void wb_set_policy(uint8_t policy, uint16_t delay);
+// called after data was written to the image
+void wb_written(wb_state_t *wb, FIL *file);
+// sync the image now, if it is dirty
+FRESULT wb_sync(wb_state_t *wb, FIL *file);
+// sync the images which are due
+void wb_poll(void);
+// sync all images, before a reset, a core change, ...
+void wb_flush_all(void);
+// the medium is gone, nothing can be synced anymore
+void wb_discard_all(void);
+
+#endif // WRITEBACK_H
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "writeback.h"
+#include "fat_compat.h"
+
+// Replays an IDE write trace of a Minimig hard file on a FAT16 RAM disk
+// with the real FatFs and counts the physical sector writes under each
+// write-back policy. Data writes are the same for all policies, the
+// difference is how often the directory entry of the hard file is
+// rewritten by f_sync(). Also checks that dirty images are synced in
+// time, that wb_flush_all() leaves nothing behind and that nothing is
+// written after wb_discard_all().
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+#define HDF_SIZE      (16 << 20)
+#define ADF_SIZE      901120
+
+static uint8_t *disk;
+static unsigned int write_cmds, sectors_written, dir_writes, reads;
+
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  reads++;
+  memcpy(buf, disk + lba * 512, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  write_cmds++;
+  sectors_written += n;
+  if (lba < DATA_SECTOR) dir_writes++;
+  memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+// ---------- virtual clock ----------
+static msec_t now;
+
+msec_t timer_get_msec() {
+  return now;
+}
+
+char GetRTC(unsigned char *d) {
+  msec_t s = now / 1000;
+  d[0] = 126; d[1] = 10; d[2] = 19;
+  d[3] = (s / 3600) % 24; d[4] = (s / 60) % 60; d[5] = s % 60; d[6] = 1;
+  return 1;
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void dir_entry(uint8_t *e, const char *name, uint16_t clust, uint32_t size) {
+  uint8_t *fat = disk + 512;
+  uint32_t n = (size + SPC * 512 - 1) / (SPC * 512);
+
+  memcpy(e, name, 11);
+  e[11] = 0x20;
+  put16(e + 26, clust);
+  put32(e + 28, size);
+  while (n--) {
+    put16(fat + clust * 2, n ? clust + 1 : 0xffff);
+    clust++;
+  }
+}
+
+static void format() {
+  uint8_t *b = disk;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(disk + 512, 0xfff8);
+  put16(disk + 514, 0xffff);
+  dir_entry(disk + ROOT_SECTOR * 512, "DISK    HDF", 2, HDF_SIZE);
+  dir_entry(disk + ROOT_SECTOR * 512 + 32, "DISK    ADF", 2 + HDF_SIZE / (SPC * 512), ADF_SIZE);
+  memcpy(disk + 65 * 512, disk + 512, FAT_SECTORS * 512);
+}
+
+// ---------- images ----------
+FATFS fs;
+static FIL hdf, adf;
+static DWORD clmt[64];
+static wb_state_t hdf_wb, adf_wb;
+
+static void mount() {
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+  CHECK(f_open(&hdf, "DISK.HDF", FA_READ | FA_WRITE) == FR_OK);
+  CHECK(f_open(&adf, "DISK.ADF", FA_READ | FA_WRITE) == FR_OK);
+  // indexed like IDXIndex() does it
+  clmt[0] = sizeof(clmt) / sizeof(DWORD);
+  hdf.cltbl = clmt;
+  CHECK(f_lseek(&hdf, CREATE_LINKMAP) == FR_OK);
+  memset(&hdf_wb, 0, sizeof(hdf_wb));
+  memset(&adf_wb, 0, sizeof(adf_wb));
+}
+
+// ATA_WriteSectors(): block groups of up to 16 sectors, then wb_written()
+static uint8_t data[16 * 512];
+
+static void ide_write(uint32_t lba, uint32_t count) {
+  UINT bw;
+
+  f_lseek(&hdf, (FSIZE_t)lba * 512);
+  while (count) {
+    uint32_t n = count > 16 ? 16 : count;
+    memset(data, lba + count, sizeof(data));
+    f_write(&hdf, data, n * 512, &bw);
+    count -= n;
+  }
+  wb_written(&hdf_wb, &hdf);
+}
+
+// WriteTrack()
+static void floppy_write(uint8_t track) {
+  UINT bw;
+  int i;
+
+  f_lseek(&adf, track * 11 * 512);
+  for (i = 0; i < 11; i++) f_write(&adf, data, 512, &bw);
+  wb_written(&adf_wb, &adf);
+}
+
+// ---------- trace ----------
+#define POLL_PERIOD  100  // wb_poll() is a scheduler task
+#define SIM_TIME     600000
+
+typedef struct {
+  unsigned int commands, data_sectors, dir_writes, write_cmds, syncs;
+  msec_t max_age;
+} stats_t;
+
+static msec_t next_poll, dirty_since;
+static stats_t st;
+
+// runs the polls up to time t and records how long the image was dirty
+static void advance(msec_t t) {
+  while (next_poll <= t) {
+    now = next_poll;
+    int was_dirty = hdf_wb.dirty;
+    dirty_since = hdf_wb.since;
+    wb_poll();
+    if (was_dirty && !hdf_wb.dirty && now - dirty_since > st.max_age) st.max_age = now - dirty_since;
+    next_poll += POLL_PERIOD;
+  }
+  now = t;
+}
+
+// bursts of file system activity with idle phases in between: single
+// sector metadata updates and sequential file data
+static stats_t replay(uint8_t policy, uint16_t delay, unsigned int seed) {
+  unsigned int start_cmds, start_sectors, start_dir, cursor = 4096;
+  msec_t t = 0;
+
+  mount();
+  now = next_poll = 0;
+  wb_set_policy(policy, delay);
+  memset(&st, 0, sizeof(st));
+  start_cmds = write_cmds;
+  start_sectors = sectors_written;
+  start_dir = dir_writes;
+  srand(seed);
+  while (t < SIM_TIME) {
+    int n = 20 + rand() % 200;
+    while (n--) {
+      uint32_t lba, count;
+      if (rand() % 10 < 3) {
+        lba = rand() % 2048;
+        count = 1;
+      } else {
+        count = 8 + rand() % 120;
+        if (cursor + count > HDF_SIZE / 512) cursor = 4096;
+        lba = cursor;
+        cursor += count;
+      }
+      t += 1 + rand() % 20;
+      advance(t);
+      ide_write(lba, count);
+      st.commands++;
+      st.data_sectors += count;
+    }
+    t += 300 + rand() % 5000;
+    advance(t);
+  }
+  wb_flush_all();
+  CHECK(!hdf_wb.dirty);
+  st.write_cmds = write_cmds - start_cmds;
+  st.dir_writes = dir_writes - start_dir;
+  CHECK(sectors_written - start_sectors == st.data_sectors + st.dir_writes);
+  f_close(&hdf);
+  f_close(&adf);
+  return st;
+}
+
+static void print_stats(const char *name, stats_t *s) {
+  printf("  %-22s: %6u writes, %6u directory writes (%4.1f%%), synced after %5u ms at most\n",
+         name, s->write_cmds, s->dir_writes, 100.0 * s->dir_writes / s->write_cmds, s->max_age);
+}
+
+static void benchmark() {
+  stats_t imm, per, idle;
+
+  imm = replay(WB_IMMEDIATE, 0, 1);
+  per = replay(WB_PERIODIC, 1000, 1);
+  idle = replay(WB_IDLE, 1000, 1);
+  printf("IDE write trace: %u commands, %u sectors\n", imm.commands, imm.data_sectors);
+  print_stats("immediate", &imm);
+  print_stats("periodic, 1s", &per);
+  print_stats("on idle, 1s", &idle);
+
+  CHECK(imm.commands == per.commands && imm.commands == idle.commands);
+  CHECK(imm.dir_writes == imm.commands && imm.max_age == 0);
+  CHECK(per.dir_writes < imm.dir_writes / 10);
+  CHECK(idle.dir_writes < per.dir_writes);
+  CHECK(per.max_age <= 1000 + POLL_PERIOD);
+  CHECK(idle.max_age <= 1000 * WB_IDLE_MAX_AGE + POLL_PERIOD);
+}
+
+static void test_policies() {
+  unsigned int w;
+
+  // idle: synced once the writes stop
+  mount();
+  now = 0;
+  wb_set_policy(WB_IDLE, 500);
+  ide_write(100, 1);
+  CHECK(hdf_wb.dirty);
+  // continuous writes are synced once the max. age is reached
+  for (now = 10, w = 0; now <= 500 * WB_IDLE_MAX_AGE + 500; now += 10) {
+    ide_write(100, 1);
+    wb_poll();
+    if (!hdf_wb.dirty) w++;
+  }
+  CHECK(w == 1);
+  ide_write(100, 1);
+  now += 499;
+  wb_poll();
+  CHECK(hdf_wb.dirty);
+  now++;
+  wb_poll();
+  CHECK(!hdf_wb.dirty);
+
+  // several images
+  floppy_write(5);
+  ide_write(200, 4);
+  CHECK(hdf_wb.dirty && adf_wb.dirty);
+  CHECK(wb_sync(&adf_wb, &adf) == FR_OK && !adf_wb.dirty && hdf_wb.dirty);
+  floppy_write(6);
+  w = dir_writes;
+  wb_flush_all();
+  CHECK(!hdf_wb.dirty && !adf_wb.dirty);
+  CHECK(dir_writes == w + 2);
+  wb_flush_all();
+  CHECK(dir_writes == w + 2);
+
+  // a new policy starts clean
+  ide_write(300, 1);
+  wb_set_policy(WB_IMMEDIATE, 0);
+  CHECK(!hdf_wb.dirty);
+  w = dir_writes;
+  ide_write(300, 1);
+  CHECK(!hdf_wb.dirty && dir_writes == w + 1);
+
+  // card removed
+  wb_set_policy(WB_PERIODIC, 500);
+  ide_write(400, 1);
+  floppy_write(7);
+  w = write_cmds;
+  wb_discard_all();
+  CHECK(!hdf_wb.dirty && !adf_wb.dirty);
+  now += 1000;
+  wb_poll();
+  wb_flush_all();
+  CHECK(write_cmds == w);
+  f_close(&hdf);
+  f_close(&adf);
+}
+
+int main() {
+  disk = calloc(DISK_SECTORS, 512);
+
+  test_policies();
+  benchmark();
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,238 @@
+// zip.c
+// ZIP archives used by the file selector like directories. The central
+// directory is read once when an archive is entered, into a small index
+// of the loadable entries (stored or deflated, not encrypted) and an arena
+// with their names. The archive file stays open until it is left. An
+// entry is decoded on the fly while it is sent: stored data is read
+// straight from the card, deflated data is taken in pieces out of the
+// inflate window. One archive and entry are open at a time.
+
+#include <string.h>
+#include "zip.h"
+#include "inflate.h"
+#include "fat_compat.h"
+
+#define ZIP_LOCAL_SIG    0x04034b50
+#define ZIP_CENTRAL_SIG  0x02014b50
+#define ZIP_END_SIG      0x06054b50
+
+#define ZIP_STORED    0
+#define ZIP_DEFLATED  8
+
+#define ZIP_ENCRYPTED 0x0001
+
+typedef struct {
+  uint32_t offset;   // of the local header
+  uint32_t size;
+  uint32_t crc;
+  uint16_t name;     // in the name arena
+  uint8_t  method;
+} zip_entry_t;
+
+static FIL          file;
+static char         opened;
+static zip_entry_t  entries[ZIP_MAX_ENTRIES];
+static unsigned int count;
+static char         names[ZIP_NAMES_SIZE];
+
+// the entry being read
+static zip_entry_t *cur;
+static uint32_t     data;    // file offset of its data
+
+// the shared decoder, the entry is its context
+#define inf inflate_shared
+
+static uint16_t get16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p) {
+  return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static unsigned int zip_read(void *ctx, uint32_t pos, uint8_t *buf, unsigned int len) {
+  UINT br;
+
+  if (f_tell(&file) != pos && f_lseek(&file, pos) != FR_OK) return 0;
+  if (f_read(&file, buf, len, &br) != FR_OK) return 0;
+  return br;
+}
+
+// the end of central directory record, archives with a comment that
+// doesn't fit into the sector buffer are not found
+static FRESULT find_end(uint32_t *cd_offset, unsigned int *cd_entries) {
+  FSIZE_t size = f_size(&file);
+  unsigned int n = (size > SECTOR_BUFFER_SIZE) ? SECTOR_BUFFER_SIZE : size;
+  int i;
+
+  if (n < 22 || zip_read(0, size - n, sector_buffer, n) != n) return FR_INVALID_OBJECT;
+  for (i = n - 22; i >= 0; i--) {
+    unsigned char *e = sector_buffer + i;
+    if (get32(e) != ZIP_END_SIG) continue;
+    // no multi disk archives
+    if (get16(e + 4) || get16(e + 6) || get16(e + 8) != get16(e + 10)) return FR_INVALID_OBJECT;
+    *cd_entries = get16(e + 10);
+    *cd_offset = get32(e + 16);
+    return (*cd_offset < size) ? FR_OK : FR_INVALID_OBJECT;
+  }
+  return FR_INVALID_OBJECT;
+}
+
+FRESULT zip_open(const char *name) {
+  unsigned char h[46];
+  uint32_t pos;
+  unsigned int total, i, used = 0;
+
+  zip_close();
+  if (f_open(&file, name, FA_READ) != FR_OK) return FR_NO_FILE;
+  if (find_end(&pos, &total) != FR_OK) {
+    f_close(&file);
+    return FR_INVALID_OBJECT;
+  }
+
+  for (i = 0; i < total && count < ZIP_MAX_ENTRIES; i++) {
+    unsigned int nlen, flags, method;
+    zip_entry_t *e = &entries[count];
+
+    if (zip_read(0, pos, h, 46) != 46 || get32(h) != ZIP_CENTRAL_SIG) break;
+    flags = get16(h + 8);
+    method = get16(h + 10);
+    nlen = get16(h + 28);
+    e->crc = get32(h + 16);
+    e->size = get32(h + 24);
+    e->offset = get32(h + 42);
+    e->method = method;
+    e->name = used;
+    pos += 46;
+
+    // directories, unsupported methods and ZIP64 entries are left out
+    if (!(flags & ZIP_ENCRYPTED) && (method == ZIP_STORED || method == ZIP_DEFLATED) &&
+        get32(h + 20) != 0xffffffff && e->size != 0xffffffff && e->offset != 0xffffffff &&
+        nlen && nlen <= FF_LFN_BUF && used + nlen + 1 <= ZIP_NAMES_SIZE) {
+      if (zip_read(0, pos, names + used, nlen) != nlen) break;
+      names[used + nlen] = 0;
+      if (names[used + nlen - 1] != '/' && strncmp(names + used, "__MACOSX/", 9)) {
+        used += nlen + 1;
+        count++;
+      }
+    }
+    pos += nlen + get16(h + 30) + get16(h + 32);
+  }
+
+  if (!count) {
+    f_close(&file);
+    return FR_INVALID_OBJECT;
+  }
+  opened = 1;
+  return FR_OK;
+}
+
+void zip_close(void) {
+  if (opened) f_close(&file);
+  opened = 0;
+  count = 0;
+  cur = 0;
+  // the entries of the next archive are at the same addresses
+  if (inf.read == zip_read) inflate_release();
+}
+
+char zip_is_open(void) {
+  return opened;
+}
+
+DWORD zip_cluster(void) {
+  return opened ? file.obj.sclust : 0;
+}
+
+char zip_readdir(unsigned int i, FILINFO *fno) {
+  if (i >= count) {
+    fno->fname[0] = 0;
+    return 0;
+  }
+  strcpy(fno->fname, names + entries[i].name);
+  fno->altname[0] = 0;
+  fno->fattrib = AM_RDO;
+  fno->fsize = entries[i].size;
+  fno->fclust = 0;
+  fno->fdate = fno->ftime = 0;
+  return 1;
+}
+
+FRESULT zip_entry_open(const char *name) {
+  unsigned char h[30];
+  unsigned int i;
+
+  cur = 0;
+  for (i = 0; i < count; i++)
+    if (!strcmp(names + entries[i].name, name)) break;
+  if (i == count) return FR_NO_FILE;
+
+  // the local header has its own name and extra field lengths
+  if (zip_read(0, entries[i].offset, h, 30) != 30 || get32(h) != ZIP_LOCAL_SIG)
+    return FR_INVALID_OBJECT;
+  data = entries[i].offset + 30 + get16(h + 26) + get16(h + 28);
+  if (entries[i].method == ZIP_STORED && data + entries[i].size > f_size(&file))
+    return FR_INVALID_OBJECT;
+  cur = &entries[i];
+  return FR_OK;
+}
+
+uint32_t zip_entry_size(void) {
+  return cur ? cur->size : 0;
+}
+
+uint32_t zip_entry_crc(void) {
+  return cur ? cur->crc : 0;
+}
+
+FIL *zip_entry_stored(uint32_t *offset) {
+  if (!cur || cur->method != ZIP_STORED) return 0;
+  *offset = data;
+  return &file;
+}
+
+const uint8_t *zip_entry_data(uint32_t pos, unsigned int *len) {
+  unsigned int n = *len;
+  uint32_t ofs;
+
+  if (!cur || pos >= cur->size) return 0;
+  if (n > cur->size - pos) n = cur->size - pos;
+
+  if (cur->method == ZIP_STORED) {
+    if (n > SECTOR_BUFFER_SIZE) n = SECTOR_BUFFER_SIZE;
+    if (zip_read(0, data + pos, sector_buffer, n) != n) return 0;
+    *len = n;
+    return sector_buffer;
+  }
+
+  // the window holds the last INFLATE_WINDOW bytes of output
+  if (!inflate_owned(zip_read, cur) || pos < inf.s.out - ((inf.s.out > INFLATE_WINDOW) ? INFLATE_WINDOW : inf.s.out))
+    inflate_init(&inf, zip_read, cur, data);
+  ofs = pos & (INFLATE_WINDOW - 1);
+  if (n > INFLATE_WINDOW - ofs) n = INFLATE_WINDOW - ofs;
+  if (pos < inf.s.out) {
+    if (n > inf.s.out - pos) n = inf.s.out - pos;
+  } else if (inflate_run(&inf, pos + n) != INFLATE_OK) {
+    inflate_release();
+    return 0;
+  }
+  *len = n;
+  return inf.window + ofs;
+}
+
+unsigned int zip_entry_read(void *ctx, uint32_t pos, uint8_t *buf, unsigned int len) {
+  unsigned int done = 0;
+
+  if (!cur || pos >= cur->size) return 0;
+  if (len > cur->size - pos) len = cur->size - pos;
+  if (cur->method == ZIP_STORED) return zip_read(0, data + pos, buf, len);
+
+  while (done < len) {
+    unsigned int n = len - done;
+    const uint8_t *p = zip_entry_data(pos + done, &n);
+    if (!p) break;
+    memcpy(buf + done, p, n);
+    done += n;
+  }
+  return done;
+}
@@ -0,0 +1,47 @@
+/*
+ * zip.h
+ * ZIP archives browsed like directories, entries decoded on the fly
+ *
+ */
+
+#ifndef ZIP_H
+#define ZIP_H
+
+#include <inttypes.h>
+#include "FatFs/ff.h"
+
+// index of the open archive, a page of the file selector is far less.
+// 16 bytes per entry and names of 32 characters on average, 12K in all
+#ifndef ZIP_MAX_ENTRIES
+#define ZIP_MAX_ENTRIES  256
+#endif
+#ifndef ZIP_NAMES_SIZE
+#define ZIP_NAMES_SIZE   8192
+#endif
+
+// opens an archive and reads its central directory into the index,
+// FR_INVALID_OBJECT if it is not a usable ZIP file
+FRESULT zip_open(const char *name);
+void zip_close(void);
+// an archive is open
+char zip_is_open(void);
+// start cluster of the open archive
+DWORD zip_cluster(void);
+
+// fills in the directory entry of the i-th file of the archive, 0 past the last
+char zip_readdir(unsigned int i, FILINFO *fno);
+
+// selects an entry of the open archive for reading
+FRESULT zip_entry_open(const char *name);
+uint32_t zip_entry_size(void);
+uint32_t zip_entry_crc(void);
+// the archive and the data offset if the entry is stored, 0 if it is deflated
+FIL *zip_entry_stored(uint32_t *offset);
+// up to *len bytes of the entry at pos without copying them, *len is
+// reduced to what is available at once. 0 if the entry is broken
+const uint8_t *zip_entry_data(uint32_t pos, unsigned int *len);
+// copies up to len bytes of the entry at pos to buf, returns the number of
+// bytes read. Going back more than the inflate window restarts decoding
+unsigned int zip_entry_read(void *ctx, uint32_t pos, uint8_t *buf, unsigned int len);
+
+#endif // ZIP_H
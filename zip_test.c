@@ -0,0 +1,380 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "zip.h"
+#include "inflate.h"
+#include "crc32.h"
+#include "fat_compat.h"
+
+// Loads the entries of ZIP archives from a FAT16 RAM disk with the real
+// FatFs the way data_io_zip_tx() sends them to the core and compares the
+// bytes and the CRC with the original files. Without arguments the files
+// are generated (text, code like, empty, random) and archived with the zip
+// tool stored and at several levels, real archives can be given on the
+// command line and are checked against their own CRCs. Reports the inflate
+// throughput and the cost of the random reads of the SNES header check.
+//
+//   ./ziptest [roms.zip ...]
+
+static int errors;
+
+#define CHECK(c) do { if(!(c)) { printf("check failed: %s (line %d)\n", #c, __LINE__); errors++; } } while(0)
+
+// ---------- RAM disk with a FAT16 file system ----------
+#define DISK_SECTORS  131072   // 64MB
+#define SPC           8        // sectors per cluster
+#define FAT_SECTORS   64
+#define ROOT_SECTOR   (1 + 2 * FAT_SECTORS)
+#define DATA_SECTOR   (ROOT_SECTOR + 32)
+
+static uint8_t *disk;
+static unsigned long sectors_read;
+
+FATFS fs;
+unsigned char sector_buffer[SECTOR_BUFFER_SIZE];
+char fat_device = 0;
+
+int iprintf(const char *fmt, ...) {
+  return 0;
+}
+
+void FatalError(unsigned long error) {
+  printf("Fatal error: %lu\n", error);
+  exit(1);
+}
+
+char GetRTC(unsigned char *d) {
+  d[0] = 126; d[1] = 10; d[2] = 19; d[3] = 12; d[4] = 0; d[5] = 0; d[6] = 1;
+  return 1;
+}
+
+unsigned char MMC_CheckCard() {
+  return 1;
+}
+
+unsigned long MMC_GetCapacity() {
+  return DISK_SECTORS;
+}
+
+unsigned char MMC_ReadMultiple(unsigned long lba, unsigned char *buf, unsigned long n) {
+  memcpy(buf, disk + lba * 512, n * 512);
+  sectors_read += n;
+  return 1;
+}
+
+unsigned char MMC_Read(unsigned long lba, unsigned char *buf) {
+  return MMC_ReadMultiple(lba, buf, 1);
+}
+
+unsigned char MMC_WriteMultiple(unsigned long lba, const unsigned char *buf, unsigned long n) {
+  memcpy(disk + lba * 512, buf, n * 512);
+  return 1;
+}
+
+unsigned char MMC_Write(unsigned long lba, const unsigned char *buf) {
+  return MMC_WriteMultiple(lba, buf, 1);
+}
+
+static void put16(uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put32(uint8_t *p, uint32_t v) { put16(p, v); put16(p + 2, v >> 16); }
+
+static void format() {
+  uint8_t *b = disk;
+
+  memset(disk, 0, DATA_SECTOR * 512);
+  b[0] = 0xeb; b[1] = 0x3c; b[2] = 0x90;
+  memcpy(b + 3, "MSWIN4.1", 8);
+  put16(b + 11, 512);
+  b[13] = SPC;
+  put16(b + 14, 1);            // reserved sectors
+  b[16] = 2;                   // FATs
+  put16(b + 17, 512);          // root entries
+  b[21] = 0xf8;
+  put16(b + 22, FAT_SECTORS);
+  put32(b + 32, DISK_SECTORS);
+  b[38] = 0x29;
+  memcpy(b + 54, "FAT16   ", 8);
+  put16(b + 510, 0xaa55);
+  put16(disk + 512, 0xfff8);
+  put16(disk + 514, 0xffff);
+  memcpy(disk + (1 + FAT_SECTORS) * 512, disk + 512, FAT_SECTORS * 512);
+}
+
+// ---------- files ----------
+static double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+static uint8_t *load(const char *name, long *size) {
+  FILE *f = fopen(name, "rb");
+  uint8_t *buf;
+
+  if (!f) return 0;
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  buf = malloc(*size ? *size : 1);
+  if (fread(buf, 1, *size, f) != *size) *size = 0;
+  fclose(f);
+  return buf;
+}
+
+static void put_file(const char *name, const uint8_t *data, long size) {
+  FIL f;
+  UINT bw;
+
+  CHECK(f_open(&f, name, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK);
+  CHECK(f_write(&f, data, size, &bw) == FR_OK && bw == size);
+  CHECK(f_close(&f) == FR_OK);
+}
+
+#define FILES 6
+
+static const struct {
+  const char *name;
+  long size;
+} files[FILES] = {
+  { "game.nes",        40976 },
+  { "big rom.sfc",     4194304 + 65536 + 512 },  // ExHiROM, copier header
+  { "sub/code.bin",    1048576 },
+  { "sub/noise.bin",   262144 },
+  { "empty.rom",       0 },
+  { "one.rom",         1 },
+};
+static uint8_t *data[FILES];
+
+static void make_files() {
+  static const char *words[] = { "LDA ", "STA ", "JSR ", "#$00", "loop", "RTS\n", "the ", "game " };
+  long i;
+  int f;
+
+  for (f = 0; f < FILES; f++) {
+    uint8_t *d = data[f] = malloc(files[f].size + 1);
+    for (i = 0; i < files[f].size; ) {
+      if (f == 3) {
+        d[i++] = rand();
+      } else if ((i >> 12) % 3 == 0) {
+        // code like: few distinct bytes, short repeats
+        d[i++] = (rand() % 16) * ((i >> 8) & 7);
+      } else if ((i >> 12) % 3 == 1) {
+        const char *w = words[rand() % 8];
+        while (*w && i < files[f].size) d[i++] = *w++;
+      } else {
+        // empty space
+        d[i++] = 0xff;
+      }
+    }
+  }
+}
+
+// writes the files to /tmp and archives them there
+static uint8_t *make_zip(const char *opts, long *size) {
+  static char cmd[256];
+  int f;
+
+  CHECK(system("rm -rf /tmp/ziptest && mkdir -p /tmp/ziptest/sub") == 0);
+  for (f = 0; f < FILES; f++) {
+    FILE *o;
+    sprintf(cmd, "/tmp/ziptest/%s", files[f].name);
+    o = fopen(cmd, "wb");
+    fwrite(data[f], 1, files[f].size, o);
+    fclose(o);
+  }
+  sprintf(cmd, "cd /tmp/ziptest && zip -q %s ../ziptest.zip game.nes 'big rom.sfc' sub sub/code.bin sub/noise.bin empty.rom one.rom", opts);
+  remove("/tmp/ziptest.zip");
+  CHECK(system(cmd) == 0);
+  CHECK(system("rm -rf /tmp/ziptest") == 0);
+  return load("/tmp/ziptest.zip", size);
+}
+
+// ---------- entries ----------
+// the send loop of data_io_zip_tx(), returns the CRC of the data
+static uint32_t send(uint8_t *out, uint32_t *sent) {
+  uint32_t size = zip_entry_size(), pos = 0, crc = CRC32_INIT;
+
+  while (pos < size) {
+    unsigned int n = SECTOR_BUFFER_SIZE;
+    const uint8_t *p = zip_entry_data(pos, &n);
+    if (!p) break;
+    crc = crc32_update(crc, p, n);
+    if (out) memcpy(out + pos, p, n);
+    pos += n;
+  }
+  *sent = pos;
+  return ~crc;
+}
+
+static void check_entry(const char *name, const uint8_t *ref, long size, const char *label) {
+  uint8_t *out = malloc(size + 1);
+  uint32_t sent, crc, offset;
+  double t0, t;
+  unsigned long rd;
+
+  CHECK(zip_entry_open(name) == FR_OK);
+  CHECK(zip_entry_size() == size);
+  rd = sectors_read;
+  t0 = now();
+  crc = send(out, &sent);
+  t = now() - t0;
+  rd = sectors_read - rd;
+  CHECK(sent == size);
+  CHECK(crc == zip_entry_crc());
+  CHECK(!memcmp(out, ref, size));
+  if (label && size >= 65536)
+    printf("  %-4s %-14s %8ld bytes %s: %7.1f MB/s, %5lu sectors read\n", label, name, size,
+           zip_entry_stored(&offset) ? "stored  " : "deflated", size / t, rd);
+  free(out);
+}
+
+// the SNES header check reads headers and the reset opcodes before them
+static void test_random_read(const char *label) {
+  static const uint32_t pos[] = { 0x81c0, 0x0123, 0x101c0, 0x8100, 0x4101c0, 0x401000, 0x10 };
+  uint8_t buf[64];
+  const uint8_t *ref = data[1];
+  double t0 = now();
+  unsigned int i;
+
+  CHECK(zip_entry_open("big rom.sfc") == FR_OK);
+  for (i = 0; i < sizeof(pos) / sizeof(pos[0]); i++) {
+    CHECK(zip_entry_read(0, pos[i], buf, 64) == 64);
+    CHECK(!memcmp(buf, ref + pos[i], 64));
+  }
+  // the end of the entry
+  CHECK(zip_entry_read(0, files[1].size - 10, buf, 64) == 10);
+  CHECK(!memcmp(buf, ref + files[1].size - 10, 10));
+  CHECK(zip_entry_read(0, files[1].size, buf, 64) == 0);
+  printf("  %-4s header check reads: %7.1f ms\n", label, (now() - t0) / 1000);
+}
+
+static void test_archive(const char *label, const uint8_t *zip, long size) {
+  FILINFO fno;
+  unsigned int i, found = 0;
+  int f;
+
+  put_file("TEST.ZIP", zip, size);
+  CHECK(zip_open("TEST.ZIP") == FR_OK);
+  CHECK(zip_is_open());
+
+  // directories are left out, the files keep their path
+  for (i = 0; zip_readdir(i, &fno); i++) {
+    for (f = 0; f < FILES; f++)
+      if (!strcmp(fno.fname, files[f].name) && fno.fsize == files[f].size) found++;
+    CHECK(!(fno.fattrib & AM_DIR));
+  }
+  CHECK(i == FILES && found == FILES);
+  CHECK(!fno.fname[0]);
+
+  for (f = 0; f < FILES; f++) check_entry(files[f].name, data[f], files[f].size, label);
+  // again, an entry after another one and the same entry twice
+  check_entry("sub/code.bin", data[2], files[2].size, 0);
+  check_entry("sub/code.bin", data[2], files[2].size, 0);
+  check_entry("game.nes", data[0], files[0].size, 0);
+  test_random_read(label);
+  CHECK(zip_entry_open("sub") == FR_NO_FILE);
+  CHECK(zip_entry_open("missing.rom") == FR_NO_FILE);
+  zip_close();
+  CHECK(!zip_is_open());
+}
+
+static void test_broken(const uint8_t *zip, long size) {
+  uint8_t *buf = malloc(size + 4096);
+  uint32_t sent;
+  long i;
+
+  // not an archive
+  put_file("TEXT.ZIP", data[0], 1000);
+  CHECK(zip_open("TEXT.ZIP") == FR_INVALID_OBJECT);
+  CHECK(!zip_is_open());
+  put_file("TINY.ZIP", zip, 10);
+  CHECK(zip_open("TINY.ZIP") == FR_INVALID_OBJECT);
+  CHECK(zip_open("NONE.ZIP") == FR_NO_FILE);
+
+  // the end record too far from the end of the file
+  memcpy(buf, zip, size);
+  memset(buf + size, 'x', 4096);
+  buf[size - 2] = 4096 & 0xff;
+  buf[size - 1] = 4096 >> 8;
+  put_file("COMMENT.ZIP", buf, size + 4096);
+  CHECK(zip_open("COMMENT.ZIP") == FR_INVALID_OBJECT);
+
+  // damaged data, the CRC shows it
+  memcpy(buf, zip, size);
+  for (i = 2000; i < 2064; i++) buf[i] = rand();
+  put_file("BAD.ZIP", buf, size);
+  if (zip_open("BAD.ZIP") == FR_OK) {
+    if (zip_entry_open("game.nes") == FR_OK)
+      CHECK(send(0, &sent) != zip_entry_crc() || sent != files[0].size);
+    zip_close();
+  }
+
+  // the data cut off, the index is gone as well
+  put_file("CUT.ZIP", zip, size / 2);
+  CHECK(zip_open("CUT.ZIP") == FR_INVALID_OBJECT);
+  free(buf);
+}
+
+// a real archive, the entries are checked against their CRCs
+static void test_real(const char *name) {
+  uint8_t *zip;
+  long size;
+  FILINFO fno;
+  unsigned int i;
+  double t0, t = 0;
+  unsigned long bytes = 0;
+
+  zip = load(name, &size);
+  if (!zip) {
+    printf("cannot read %s\n", name);
+    errors++;
+    return;
+  }
+  put_file("REAL.ZIP", zip, size);
+  free(zip);
+  CHECK(zip_open("REAL.ZIP") == FR_OK);
+  for (i = 0; zip_readdir(i, &fno); i++) {
+    uint32_t sent;
+    CHECK(zip_entry_open(fno.fname) == FR_OK);
+    t0 = now();
+    CHECK(send(0, &sent) == zip_entry_crc());
+    t += now() - t0;
+    CHECK(sent == fno.fsize);
+    bytes += sent;
+  }
+  zip_close();
+  printf("  %s: %u entries, %lu bytes, %.1f MB/s\n", name, i, bytes, t ? bytes / t : 0);
+}
+
+int main(int argc, char **argv) {
+  static const char *levels[] = { "-0", "-1", "-6", "-9" };
+  uint8_t *zip;
+  long size;
+  int i;
+
+  disk = calloc(DISK_SECTORS, 512);
+  format();
+  CHECK(f_mount(&fs, "", 1) == FR_OK);
+  make_files();
+
+  printf("ZIP entries loaded through the inflate window:\n");
+  for (i = 0; i < 4; i++) {
+    zip = make_zip(levels[i], &size);
+    CHECK(zip && size > 0);
+    if (!zip) break;
+    test_archive(levels[i], zip, size);
+    if (i == 3) test_broken(zip, size);
+    free(zip);
+  }
+
+  for (i = 1; i < argc; i++) test_real(argv[i]);
+
+  remove("/tmp/ziptest.zip");
+  for (i = 0; i < FILES; i++) free(data[i]);
+  free(disk);
+
+  printf("%s\n", errors ? "FAILED" : "PASSED");
+  return errors ? 1 : 0;
+}
@@ -21,6 +21,9 @@
 #include "sxmlc/sxmlc.h"
 
 static unsigned char *zx_col_table;
+
+// the table is built at the start of the load buffer, the rest is the XML read buffer
+#define ZX_COL_TABLE_SIZE 2048
 //static char *col_state_s[] = {"None", "Border", "Entry", "Line", "Paper", "Ink"};
 
 typedef enum _zx_col_state {STATE_NONE, STATE_BORDER, STATE_ENTRY, STATE_LINE, STATE_PAPER, STATE_INK} zx_col_state;
@@ -268,12 +271,12 @@ int main() {
 	fclose(f);
 }
 #else
-int zx_col_load(FIL *fil, unsigned char *buf)
+int zx_col_load(FIL *fil, unsigned char *buf, int size)
 {
 	zx_col_table = buf;
 	memset(zx_col_table, 0xf0, 128*8+1);
 #ifdef HAVE_XML
-	return XMLDoc_parse_fd_SAX(fil, &zx_col_sax_callbacks, &zx_col_sax_callbacks);
+	return XMLDoc_parse_fd_SAX_buf(fil, (SXML_CHAR*)buf + ZX_COL_TABLE_SIZE, size - ZX_COL_TABLE_SIZE, &zx_col_sax_callbacks, &zx_col_sax_callbacks);
 #else
 	return 0;
 #endif
@@ -314,14 +317,14 @@ static const unsigned char zx81_charset[512] = {
 	0x00, 0x82, 0x44, 0x28, 0x10, 0x10, 0x10, 0x00, 0x00, 0x7E, 0x04, 0x08, 0x10, 0x20, 0x7E, 0x00
 };
 
-int zx_chr_load(FIL *fil, unsigned char *buf)
+int zx_chr_load(FIL *fil, unsigned char *buf, int size)
 {
 #ifdef HAVE_XML
 	zx_col_table = buf;
 	for (int i=0;i<1024;i++) {
 		zx_col_table[i] = zx81_charset[i&0x1ff];
 	}
-	return XMLDoc_parse_fd_SAX(fil, &zx_chr_sax_callbacks, &zx_chr_sax_callbacks);
+	return XMLDoc_parse_fd_SAX_buf(fil, (SXML_CHAR*)buf + ZX_COL_TABLE_SIZE, size - ZX_COL_TABLE_SIZE, &zx_chr_sax_callbacks, &zx_chr_sax_callbacks);
 #else
 	return 0;
 #endif
@@ -26,7 +26,8 @@
 
 #include "FatFs/ff.h"
 
-int zx_col_load(FIL *fil, unsigned char *buf);
-int zx_chr_load(FIL *fil, unsigned char *buf);
+// buf must hold the 1025 bytes table and the XML read buffer
+int zx_col_load(FIL *fil, unsigned char *buf, int size);
+int zx_chr_load(FIL *fil, unsigned char *buf, int size);
 
 #endif // COL_FILE_H